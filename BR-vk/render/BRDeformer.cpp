@@ -0,0 +1,192 @@
+#include "BRDeformer.h"
+
+#include "BRAppState.h"
+
+using namespace BR;
+
+//threads per workgroup, local_size_x of deform.comp
+const uint32_t DEFORM_GROUP_SIZE = 256;
+
+Deformer::Deformer()
+    : m_descMgr( AppState::instance().getDescMgr() ),
+      m_bufferAlloc( AppState::instance().getMemoryMgr() ),
+      m_vertexCount( 0 ),
+      m_center( 0.0f )
+{
+    m_device = AppState::instance().getLogicalDevice();
+}
+
+void Deformer::init( Scene& scene, vk::DescriptorPool pool )
+{
+    m_vertexCount = scene.m_vertexCount;
+    m_positions = scene.m_positionBuffer;
+
+    //the bounds place the twist axis
+    m_center = glm::vec4( ( scene.m_boundsMin + scene.m_boundsMax ) * 0.5f,
+                          scene.m_boundsMax.y - scene.m_boundsMin.y );
+
+    //the rest pose, straight from the cache
+    m_restPositions = m_bufferAlloc.createDeviceBuffer(
+        "Rest Positions", m_vertexCount * sizeof( glm::vec3 ),
+        scene.m_cache.getPositions(), false,
+        vk::BufferUsageFlagBits::eStorageBuffer );
+
+    m_bufferAlloc.getUploader().flush();
+
+    m_descriptorSetLayout = m_descMgr.createLayout(
+        "Deform Descriptor Set Layout",
+        std::vector<BR::DescMgr::Binding>{
+            { 0, vk::DescriptorType::eStorageBuffer, 1,
+              vk::ShaderStageFlagBits::eCompute },
+            { 1, vk::DescriptorType::eStorageBuffer, 1,
+              vk::ShaderStageFlagBits::eCompute } } );
+
+    m_descriptorSet =
+        m_descMgr.createSet( "Deform Desc Set", m_descriptorSetLayout, pool );
+
+    vk::DescriptorBufferInfo restBufferInfo;
+    restBufferInfo.buffer = m_restPositions;
+    restBufferInfo.offset = 0;
+    restBufferInfo.range = VK_WHOLE_SIZE;
+
+    vk::WriteDescriptorSet restBufferWrite;
+    restBufferWrite.dstSet = m_descriptorSet;
+    restBufferWrite.dstBinding = 0;
+    restBufferWrite.dstArrayElement = 0;
+    restBufferWrite.descriptorType = vk::DescriptorType::eStorageBuffer;
+    restBufferWrite.descriptorCount = 1;
+    restBufferWrite.pBufferInfo = &restBufferInfo;
+    restBufferWrite.pImageInfo = nullptr;        // Optional
+    restBufferWrite.pTexelBufferView = nullptr;  // Optional
+
+    vk::DescriptorBufferInfo positionBufferInfo;
+    positionBufferInfo.buffer = m_positions;
+    positionBufferInfo.offset = 0;
+    positionBufferInfo.range = VK_WHOLE_SIZE;
+
+    vk::WriteDescriptorSet positionBufferWrite;
+    positionBufferWrite.dstSet = m_descriptorSet;
+    positionBufferWrite.dstBinding = 1;
+    positionBufferWrite.dstArrayElement = 0;
+    positionBufferWrite.descriptorType = vk::DescriptorType::eStorageBuffer;
+    positionBufferWrite.descriptorCount = 1;
+    positionBufferWrite.pBufferInfo = &positionBufferInfo;
+    positionBufferWrite.pImageInfo = nullptr;        // Optional
+    positionBufferWrite.pTexelBufferView = nullptr;  // Optional
+
+    std::vector<vk::WriteDescriptorSet> writeDescriptorSets = {
+        restBufferWrite, positionBufferWrite };
+
+    vkUpdateDescriptorSets(
+        m_device, static_cast<uint32_t>( writeDescriptorSets.size() ),
+        (VkWriteDescriptorSet*)writeDescriptorSets.data(), 0, nullptr );
+
+    m_pipeline.addShaderStage( "build/shaders/deform.comp.spv",
+                               vk::ShaderStageFlagBits::eCompute );
+    m_pipeline.build( "Deform Pipeline", m_descriptorSetLayout,
+                      sizeof( PushConstants ) );
+
+    m_editPipeline.addShaderStage( "build/shaders/edit.comp.spv",
+                                   vk::ShaderStageFlagBits::eCompute );
+    m_editPipeline.build( "Edit Pipeline", m_descriptorSetLayout,
+                          sizeof( EditConstants ) );
+}
+
+void Deformer::cmdWaitForReads( vk::CommandBuffer commandBuffer )
+{
+    //the previous frames may still be reading the positions
+    //vertex fetch, BLAS build, RT shader read -> compute write
+    vk::MemoryBarrier readBarrier;
+    readBarrier.srcAccessMask = {};
+    readBarrier.dstAccessMask = vk::AccessFlagBits::eShaderWrite;
+
+    commandBuffer.pipelineBarrier(
+        vk::PipelineStageFlagBits::eVertexInput |
+            vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR |
+            vk::PipelineStageFlagBits::eRayTracingShaderKHR,
+        vk::PipelineStageFlagBits::eComputeShader, {}, readBarrier, nullptr,
+        nullptr );
+}
+
+void Deformer::cmdMakeVisible( vk::CommandBuffer commandBuffer )
+{
+    //compute write -> vertex fetch, BLAS build, RT shader read
+    vk::MemoryBarrier writeBarrier;
+    writeBarrier.srcAccessMask = vk::AccessFlagBits::eShaderWrite;
+    writeBarrier.dstAccessMask = vk::AccessFlagBits::eVertexAttributeRead |
+                                 vk::AccessFlagBits::eShaderRead;
+
+    commandBuffer.pipelineBarrier(
+        vk::PipelineStageFlagBits::eComputeShader,
+        vk::PipelineStageFlagBits::eVertexInput |
+            vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR |
+            vk::PipelineStageFlagBits::eRayTracingShaderKHR,
+        {}, writeBarrier, nullptr, nullptr );
+}
+
+void Deformer::cmdDeform( vk::CommandBuffer commandBuffer, float time,
+                          float amplitude )
+{
+    cmdWaitForReads( commandBuffer );
+
+    PushConstants constants;
+    constants.center = m_center;
+    constants.time = time;
+    constants.amplitude = amplitude;
+    constants.vertexCount = m_vertexCount;
+
+    commandBuffer.bindPipeline( vk::PipelineBindPoint::eCompute,
+                                m_pipeline.get() );
+    commandBuffer.bindDescriptorSets( vk::PipelineBindPoint::eCompute,
+                                      m_pipeline.getLayout(), 0,
+                                      m_descriptorSet, nullptr );
+    commandBuffer.pushConstants( m_pipeline.getLayout(),
+                                 vk::ShaderStageFlagBits::eCompute, 0,
+                                 sizeof( PushConstants ), &constants );
+
+    commandBuffer.dispatch(
+        ( m_vertexCount + DEFORM_GROUP_SIZE - 1 ) / DEFORM_GROUP_SIZE, 1, 1 );
+
+    cmdMakeVisible( commandBuffer );
+}
+
+void Deformer::cmdEdit( vk::CommandBuffer commandBuffer, glm::vec3 center,
+                        float radius, glm::vec3 offset )
+{
+    cmdWaitForReads( commandBuffer );
+
+    EditConstants constants;
+    constants.center = glm::vec4( center, radius );
+    constants.offset = glm::vec4( offset, 0.0f );
+    constants.vertexCount = m_vertexCount;
+
+    commandBuffer.bindPipeline( vk::PipelineBindPoint::eCompute,
+                                m_editPipeline.get() );
+    commandBuffer.bindDescriptorSets( vk::PipelineBindPoint::eCompute,
+                                      m_editPipeline.getLayout(), 0,
+                                      m_descriptorSet, nullptr );
+    commandBuffer.pushConstants( m_editPipeline.getLayout(),
+                                 vk::ShaderStageFlagBits::eCompute, 0,
+                                 sizeof( EditConstants ), &constants );
+
+    commandBuffer.dispatch(
+        ( m_vertexCount + DEFORM_GROUP_SIZE - 1 ) / DEFORM_GROUP_SIZE, 1, 1 );
+
+    //a deform later in the frame reads the edited rest pose
+    vk::MemoryBarrier restBarrier;
+    restBarrier.srcAccessMask = vk::AccessFlagBits::eShaderWrite;
+    restBarrier.dstAccessMask = vk::AccessFlagBits::eShaderRead;
+
+    commandBuffer.pipelineBarrier( vk::PipelineStageFlagBits::eComputeShader,
+                                   vk::PipelineStageFlagBits::eComputeShader,
+                                   {}, restBarrier, nullptr, nullptr );
+
+    cmdMakeVisible( commandBuffer );
+}
+
+void Deformer::destroy()
+{
+    m_bufferAlloc.free( m_restPositions );
+    m_pipeline.destroy();
+    m_editPipeline.destroy();
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <BRComputePipeline.h>
+#include <BRScene.h>
+
+#include "BRDescMgr.h"
+#include "BRMemoryMgr.h"
+
+namespace BR
+{
+/*
+
+GPU deformation of the scene's geometry
+
+* A compute shader ( deform.comp ) rewrites the position stream every frame
+    from a copy of the rest pose, so raster and the BLASes see the same
+    deformed geometry
+* The deformation is procedural, a twist around the model's vertical axis -
+    the models are static OBJs, there are no skins or morph targets to play
+* Edits ( edit.comp ) push a region of the surface along an offset, in the
+    rest pose and the current positions, so they outlast the twist
+* Normals and the other attributes keep their rest pose values
+
+*/
+
+class Deformer
+{
+   public:
+    Deformer();
+
+    void init( Scene& scene, vk::DescriptorPool pool );
+    void destroy();
+
+    //Records the deformation at the given time, amplitude is the twist at
+    //the top and bottom of the model, in radians
+    //Waits for earlier reads of the positions, and makes the new ones
+    //visible to vertex input, BLAS builds and the RT shaders
+    void cmdDeform( vk::CommandBuffer commandBuffer, float time,
+                    float amplitude );
+
+    //Records an edit - the vertices within radius of center move by offset,
+    //less towards the edge. Same barriers as cmdDeform
+    void cmdEdit( vk::CommandBuffer commandBuffer, glm::vec3 center,
+                  float radius, glm::vec3 offset );
+
+   private:
+    DescMgr& m_descMgr;
+    MemoryMgr& m_bufferAlloc;
+
+    vk::Device m_device;
+
+    struct PushConstants
+    {
+        glm::vec4 center;  // xyz = bounds center, w = bounds height
+        float time;
+        float amplitude;
+        uint32_t vertexCount;
+    };
+
+    struct EditConstants
+    {
+        glm::vec4 center;  // xyz = center, w = radius
+        glm::vec4 offset;
+        uint32_t vertexCount;
+    };
+
+    vk::Buffer m_restPositions;
+    vk::Buffer m_positions;
+
+    uint32_t m_vertexCount;
+    glm::vec4 m_center;
+
+    vk::DescriptorSetLayout m_descriptorSetLayout;
+    vk::DescriptorSet m_descriptorSet;
+
+    ComputePipeline m_pipeline;
+    ComputePipeline m_editPipeline;
+
+    //previous position reads -> compute write
+    void cmdWaitForReads( vk::CommandBuffer commandBuffer );
+
+    //compute write -> vertex fetch, BLAS build, RT shader read
+    void cmdMakeVisible( vk::CommandBuffer commandBuffer );
+};
+}  // namespace BR
@@ -0,0 +1,399 @@
+#include "BRDenoiser.h"
+
+#include <algorithm>
+#include <ranges>
+
+#include "BRAppState.h"
+
+using namespace BR;
+
+//pixels per side of a workgroup, local_size of the denoiser passes
+const uint32_t GROUP_SIZE = 8;
+
+//flags of atrous.comp
+const uint32_t FIRST_ITERATION = 1;
+const uint32_t LAST_ITERATION = 2;
+
+//per-pixel sizes of the buffers, see denoise.glsl
+const vk::DeviceSize AOV_SIZE = 3 * sizeof( glm::vec4 );
+const vk::DeviceSize HISTORY_SIZE = 2 * sizeof( glm::vec4 );
+const vk::DeviceSize MOMENT_SIZE = sizeof( glm::vec4 );
+const vk::DeviceSize FILTER_SIZE = 2 * sizeof( glm::vec4 );
+
+Denoiser::Denoiser()
+    : m_descMgr( AppState::instance().getDescMgr() ),
+      m_bufferAlloc( AppState::instance().getMemoryMgr() ),
+      m_framesInFlight( AppState::instance().m_framesInFlight ),
+      m_iterations( MAX_ITERATIONS ),
+      m_historyValid( false ),
+      m_previousModel( 1.0f ),
+      m_previousViewProj( 1.0f ),
+      m_timestamps( nullptr ),
+      m_denoiseMs( 0.0 )
+{
+    m_device = AppState::instance().getLogicalDevice();
+}
+
+void Denoiser::init()
+{
+    std::vector<BR::DescMgr::Binding> bindings;
+
+    for ( uint32_t binding = 0; binding < 6; ++binding )
+    {
+        bindings.push_back( { binding, vk::DescriptorType::eStorageBuffer, 1,
+                              vk::ShaderStageFlagBits::eCompute } );
+    }
+
+    bindings.push_back( { 6, vk::DescriptorType::eStorageImage, 1,
+                          vk::ShaderStageFlagBits::eCompute } );
+    bindings.push_back( { 7, vk::DescriptorType::eUniformBuffer, 1,
+                          vk::ShaderStageFlagBits::eCompute } );
+
+    m_descriptorSetLayout =
+        m_descMgr.createLayout( "Denoise Descriptor Set Layout", bindings );
+
+    m_temporalPipeline.addShaderStage( "build/shaders/temporal.comp.spv",
+                                       vk::ShaderStageFlagBits::eCompute );
+    m_temporalPipeline.build( "Temporal Pipeline", m_descriptorSetLayout );
+
+    m_variancePipeline.addShaderStage( "build/shaders/variance.comp.spv",
+                                       vk::ShaderStageFlagBits::eCompute );
+    m_variancePipeline.build( "Variance Pipeline", m_descriptorSetLayout );
+
+    m_atrousPipeline.addShaderStage( "build/shaders/atrous.comp.spv",
+                                     vk::ShaderStageFlagBits::eCompute );
+    m_atrousPipeline.build( "A-trous Pipeline", m_descriptorSetLayout,
+                            sizeof( PassConstants ) );
+
+    for ( int i : std::views::iota( 0, m_framesInFlight ) )
+    {
+        Params params{};
+
+        m_paramBuffers.push_back( m_bufferAlloc.createDeviceBuffer(
+            "Denoise Params " + std::to_string( i ), sizeof( Params ),
+            &params, true, vk::BufferUsageFlagBits::eUniformBuffer ) );
+    }
+
+    vk::QueryPoolCreateInfo queryInfo;
+    queryInfo.queryType = vk::QueryType::eTimestamp;
+    queryInfo.queryCount = 2 * m_framesInFlight;
+
+    try
+    {
+        m_timestamps = m_device.createQueryPool( queryInfo );
+    }
+    catch ( vk::SystemError err )
+    {
+        throw std::runtime_error( "failed to create query pool!" );
+    }
+
+    DEBUG_NAME( m_timestamps, "Denoise Timestamps" );
+
+    m_timestampsWritten.assign( m_framesInFlight, false );
+
+    createBuffers();
+}
+
+void Denoiser::createBuffers()
+{
+    auto extent = AppState::instance().getSwapchainExtent();
+    vk::DeviceSize pixels = extent.width * extent.height;
+
+    m_aovBuffer = m_bufferAlloc.createDeviceBuffer(
+        "AOV Buffer", pixels * AOV_SIZE, nullptr, false,
+        vk::BufferUsageFlagBits::eStorageBuffer );
+    m_previousAovBuffer = m_bufferAlloc.createDeviceBuffer(
+        "Previous AOV Buffer", pixels * AOV_SIZE, nullptr, false,
+        vk::BufferUsageFlagBits::eStorageBuffer );
+    m_historyBuffer = m_bufferAlloc.createDeviceBuffer(
+        "History Buffer", pixels * HISTORY_SIZE, nullptr, false,
+        vk::BufferUsageFlagBits::eStorageBuffer );
+    m_momentBuffer = m_bufferAlloc.createDeviceBuffer(
+        "Moment Buffer", pixels * MOMENT_SIZE, nullptr, false,
+        vk::BufferUsageFlagBits::eStorageBuffer );
+    m_filterBuffer = m_bufferAlloc.createDeviceBuffer(
+        "Filter Buffer", pixels * FILTER_SIZE, nullptr, false,
+        vk::BufferUsageFlagBits::eStorageBuffer );
+
+    //the new buffers hold nothing to reproject
+    m_historyValid = false;
+}
+
+void Denoiser::resize()
+{
+    m_bufferAlloc.free( m_aovBuffer );
+    m_bufferAlloc.free( m_previousAovBuffer );
+    m_bufferAlloc.free( m_historyBuffer );
+    m_bufferAlloc.free( m_momentBuffer );
+    m_bufferAlloc.free( m_filterBuffer );
+
+    createBuffers();
+    writeBufferDescriptors();
+}
+
+void Denoiser::createDescriptorSets( vk::DescriptorPool pool )
+{
+    for ( int i : std::views::iota( 0, m_framesInFlight ) )
+    {
+        m_descriptorSets.push_back( m_descMgr.createSet(
+            "Denoise Desc Set " + std::to_string( i ), m_descriptorSetLayout,
+            pool ) );
+
+        vk::DescriptorBufferInfo paramBufferInfo;
+        paramBufferInfo.buffer = m_paramBuffers[i];
+        paramBufferInfo.offset = 0;
+        paramBufferInfo.range = sizeof( Params );
+
+        vk::WriteDescriptorSet paramBufferWrite;
+        paramBufferWrite.dstSet = m_descriptorSets[i];
+        paramBufferWrite.dstBinding = 7;
+        paramBufferWrite.dstArrayElement = 0;
+        paramBufferWrite.descriptorType = vk::DescriptorType::eUniformBuffer;
+        paramBufferWrite.descriptorCount = 1;
+        paramBufferWrite.pBufferInfo = &paramBufferInfo;
+        paramBufferWrite.pImageInfo = nullptr;        // Optional
+        paramBufferWrite.pTexelBufferView = nullptr;  // Optional
+
+        vkUpdateDescriptorSets( m_device, 1,
+                                (VkWriteDescriptorSet*)&paramBufferWrite, 0,
+                                nullptr );
+    }
+
+    writeBufferDescriptors();
+}
+
+void Denoiser::writeBufferDescriptors()
+{
+    //bindings 1 - 5, the buffers the denoiser owns
+    std::vector<vk::Buffer> buffers = { m_aovBuffer, m_previousAovBuffer,
+                                        m_historyBuffer, m_momentBuffer,
+                                        m_filterBuffer };
+
+    for ( auto set : m_descriptorSets )
+    {
+        std::vector<vk::DescriptorBufferInfo> bufferInfos( buffers.size() );
+        std::vector<vk::WriteDescriptorSet> writeDescriptorSets(
+            buffers.size() );
+
+        for ( uint32_t b = 0; b < buffers.size(); ++b )
+        {
+            bufferInfos[b].buffer = buffers[b];
+            bufferInfos[b].offset = 0;
+            bufferInfos[b].range = VK_WHOLE_SIZE;
+
+            writeDescriptorSets[b].dstSet = set;
+            writeDescriptorSets[b].dstBinding = b + 1;
+            writeDescriptorSets[b].dstArrayElement = 0;
+            writeDescriptorSets[b].descriptorType =
+                vk::DescriptorType::eStorageBuffer;
+            writeDescriptorSets[b].descriptorCount = 1;
+            writeDescriptorSets[b].pBufferInfo = &bufferInfos[b];
+        }
+
+        vkUpdateDescriptorSets(
+            m_device, static_cast<uint32_t>( writeDescriptorSets.size() ),
+            (VkWriteDescriptorSet*)writeDescriptorSets.data(), 0, nullptr );
+    }
+}
+
+void Denoiser::setAccumulationBuffer( vk::Buffer accBuffer )
+{
+    for ( auto set : m_descriptorSets )
+    {
+        vk::DescriptorBufferInfo accBufferInfo;
+        accBufferInfo.buffer = accBuffer;
+        accBufferInfo.offset = 0;
+        accBufferInfo.range = VK_WHOLE_SIZE;
+
+        vk::WriteDescriptorSet accBufferWrite;
+        accBufferWrite.dstSet = set;
+        accBufferWrite.dstBinding = 0;
+        accBufferWrite.dstArrayElement = 0;
+        accBufferWrite.descriptorType = vk::DescriptorType::eStorageBuffer;
+        accBufferWrite.descriptorCount = 1;
+        accBufferWrite.pBufferInfo = &accBufferInfo;
+        accBufferWrite.pImageInfo = nullptr;        // Optional
+        accBufferWrite.pTexelBufferView = nullptr;  // Optional
+
+        vkUpdateDescriptorSets( m_device, 1,
+                                (VkWriteDescriptorSet*)&accBufferWrite, 0,
+                                nullptr );
+    }
+}
+
+void Denoiser::setRenderTarget( vk::ImageView view, int frame )
+{
+    vk::DescriptorImageInfo imageInfo;
+    imageInfo.imageView = view;
+    imageInfo.imageLayout = vk::ImageLayout::eGeneral;
+
+    vk::WriteDescriptorSet write;
+    write.dstSet = m_descriptorSets[frame];
+    write.dstBinding = 6;
+    write.dstArrayElement = 0;
+    write.descriptorType = vk::DescriptorType::eStorageImage;
+    write.descriptorCount = 1;
+
+    write.pBufferInfo = nullptr;
+    write.pImageInfo = &imageInfo;     // Optional
+    write.pTexelBufferView = nullptr;  // Optional
+
+    vkUpdateDescriptorSets( m_device, 1, (VkWriteDescriptorSet*)&write, 0,
+                            nullptr );
+}
+
+vk::Buffer Denoiser::getAovBuffer()
+{
+    return m_aovBuffer;
+}
+
+void Denoiser::resetHistory()
+{
+    m_historyValid = false;
+}
+
+void Denoiser::setIterations( uint32_t iterations )
+{
+    m_iterations = std::clamp( iterations, 1u, MAX_ITERATIONS );
+}
+
+void Denoiser::cmdPassBarrier( vk::CommandBuffer commandBuffer )
+{
+    vk::MemoryBarrier barrier;
+    barrier.srcAccessMask = vk::AccessFlagBits::eShaderWrite;
+    barrier.dstAccessMask =
+        vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite;
+
+    commandBuffer.pipelineBarrier( vk::PipelineStageFlagBits::eComputeShader,
+                                   vk::PipelineStageFlagBits::eComputeShader,
+                                   {}, barrier, nullptr, nullptr );
+}
+
+void Denoiser::cmdDenoise( vk::CommandBuffer commandBuffer, int frame,
+                           glm::mat4 model, glm::mat4 view, glm::mat4 proj,
+                           uint32_t samples )
+{
+    auto extent = AppState::instance().getSwapchainExtent();
+
+    //the frame's fence was waited on, its last timestamps are ready
+    readTime( frame );
+
+    //this frame's world -> the one the history was rendered in, the model
+    //is the only thing that moves
+    Params params;
+    params.motion = m_previousModel * glm::inverse( model );
+    params.previousViewProj = m_previousViewProj;
+    params.size = glm::uvec2( extent.width, extent.height );
+    params.footprint = 2.0f / ( std::abs( proj[1][1] ) * extent.height );
+    params.historyValid = m_historyValid;
+    params.samples = samples;
+
+    m_bufferAlloc.updateVisibleBuffer( m_paramBuffers[frame], sizeof( Params ),
+                                       &params );
+
+    m_previousModel = model;
+    m_previousViewProj = proj * view;
+    m_historyValid = true;
+
+    uint32_t groupsX = ( extent.width + GROUP_SIZE - 1 ) / GROUP_SIZE;
+    uint32_t groupsY = ( extent.height + GROUP_SIZE - 1 ) / GROUP_SIZE;
+
+    uint32_t query = 2 * frame;
+
+    commandBuffer.resetQueryPool( m_timestamps, query, 2 );
+    commandBuffer.writeTimestamp( vk::PipelineStageFlagBits::eTopOfPipe,
+                                  m_timestamps, query );
+
+    //the last frame's passes wrote the history
+    cmdPassBarrier( commandBuffer );
+
+    commandBuffer.bindDescriptorSets(
+        vk::PipelineBindPoint::eCompute, m_temporalPipeline.getLayout(), 0,
+        m_descriptorSets[frame], nullptr );
+
+    commandBuffer.bindPipeline( vk::PipelineBindPoint::eCompute,
+                                m_temporalPipeline.get() );
+    commandBuffer.dispatch( groupsX, groupsY, 1 );
+    cmdPassBarrier( commandBuffer );
+
+    commandBuffer.bindPipeline( vk::PipelineBindPoint::eCompute,
+                                m_variancePipeline.get() );
+    commandBuffer.dispatch( groupsX, groupsY, 1 );
+    cmdPassBarrier( commandBuffer );
+
+    //the variance pass wrote the second half
+    commandBuffer.bindPipeline( vk::PipelineBindPoint::eCompute,
+                                m_atrousPipeline.get() );
+    commandBuffer.bindDescriptorSets(
+        vk::PipelineBindPoint::eCompute, m_atrousPipeline.getLayout(), 0,
+        m_descriptorSets[frame], nullptr );
+
+    for ( uint32_t i = 0; i < m_iterations; ++i )
+    {
+        PassConstants pass;
+        pass.step = 1u << i;
+        pass.source = ( i + 1 ) % 2;
+        pass.flags = ( i == 0 ? FIRST_ITERATION : 0 ) |
+                     ( i + 1 == m_iterations ? LAST_ITERATION : 0 );
+
+        commandBuffer.pushConstants( m_atrousPipeline.getLayout(),
+                                     vk::ShaderStageFlagBits::eCompute, 0,
+                                     sizeof( PassConstants ), &pass );
+        commandBuffer.dispatch( groupsX, groupsY, 1 );
+        cmdPassBarrier( commandBuffer );
+    }
+
+    commandBuffer.writeTimestamp( vk::PipelineStageFlagBits::eComputeShader,
+                                  m_timestamps, query + 1 );
+
+    m_timestampsWritten[frame] = true;
+}
+
+void Denoiser::readTime( int frame )
+{
+    if ( !m_timestampsWritten[frame] )
+        return;
+
+    uint64_t timestamps[2];
+
+    auto result = m_device.getQueryPoolResults(
+        m_timestamps, 2 * frame, 2, sizeof( timestamps ), timestamps,
+        sizeof( uint64_t ), vk::QueryResultFlagBits::e64 );
+
+    if ( result != vk::Result::eSuccess )
+        return;
+
+    m_timestampsWritten[frame] = false;
+
+    //ticks -> ms
+    const double period = AppState::instance()
+                              .getPhysicalDevice()
+                              .getProperties()
+                              .limits.timestampPeriod /
+                          1e6;
+
+    m_denoiseMs = ( timestamps[1] - timestamps[0] ) * period;
+}
+
+double Denoiser::getDenoiseMs()
+{
+    return m_denoiseMs;
+}
+
+void Denoiser::destroy()
+{
+    m_device.destroyQueryPool( m_timestamps );
+
+    m_temporalPipeline.destroy();
+    m_variancePipeline.destroy();
+    m_atrousPipeline.destroy();
+
+    m_bufferAlloc.free( m_aovBuffer );
+    m_bufferAlloc.free( m_previousAovBuffer );
+    m_bufferAlloc.free( m_historyBuffer );
+    m_bufferAlloc.free( m_momentBuffer );
+    m_bufferAlloc.free( m_filterBuffer );
+
+    for ( auto buffer : m_paramBuffers )
+        m_bufferAlloc.free( buffer );
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <BRComputePipeline.h>
+
+#include <glm/glm.hpp>
+
+#include "BRDescMgr.h"
+#include "BRMemoryMgr.h"
+
+namespace BR
+{
+/*
+
+Spatio-temporal denoiser for the path traced image, SVGF style - see
+Schied et al., Spatiotemporal Variance-Guided Filtering, HPG 2017
+
+* The raygen shader writes AOVs of the primary hit ( position, normal,
+    albedo ) next to the accumulation sums, they guide every pass
+* temporal.comp - integrates the color and luminance moments over time. While
+    accumulating, the sums are the history; after a camera or model move the
+    last frame's history is reprojected and rejected where the surface changed
+* variance.comp - pixels with a short history borrow the moments of their
+    neighbours for a variance estimate
+* atrous.comp - a-trous wavelet iterations, edge stopping on depth, normal,
+    albedo and luminance, scaled by the variance. The first iteration is the
+    next frame's color history, the last writes the image
+* The models have no textures, colors are filtered as they are, the albedo
+    is one more edge stop rather than demodulated
+
+*/
+
+class Denoiser
+{
+   public:
+    Denoiser();
+
+    void init();
+    void destroy();
+
+    //the buffers are sized by the swapchain, and start without a history
+    void createBuffers();
+    void resize();
+
+    //one set per frame in flight, the accumulation buffer comes from the
+    //ray tracer, and is set again after a resize
+    void createDescriptorSets( vk::DescriptorPool pool );
+    void setAccumulationBuffer( vk::Buffer accBuffer );
+    void setRenderTarget( vk::ImageView view, int frame );
+
+    //written by the raygen shader, see Aov in accumulation.glsl
+    vk::Buffer getAovBuffer();
+
+    //Records the passes, reading the accumulation sums and AOVs of the
+    //trace, writing the render target ( in general layout )
+    //The camera and model of this frame, the last frame's are kept for the
+    //reprojection. samples - per pixel in this frame's trace, more in the
+    //sums means they're still accumulating
+    void cmdDenoise( vk::CommandBuffer commandBuffer, int frame,
+                     glm::mat4 model, glm::mat4 view, glm::mat4 proj,
+                     uint32_t samples );
+
+    //the history is of another image - RT mode or depth changed
+    void resetHistory();
+
+    //a-trous iterations, each one doubles the reach
+    static constexpr uint32_t MAX_ITERATIONS = 5;
+    void setIterations( uint32_t iterations );
+
+    //GPU time of all the passes, from the last frame that finished
+    double getDenoiseMs();
+
+   private:
+    DescMgr& m_descMgr;
+    MemoryMgr& m_bufferAlloc;
+    int m_framesInFlight;
+
+    vk::Device m_device;
+
+    //DenoiseParams of denoise.glsl, std140
+    struct Params
+    {
+        glm::mat4 motion;
+        glm::mat4 previousViewProj;
+        glm::uvec2 size;
+        float footprint;
+        uint32_t historyValid;
+        uint32_t samples;
+    };
+
+    //push constants of atrous.comp
+    struct PassConstants
+    {
+        uint32_t step;
+        uint32_t source;
+        uint32_t flags;
+    };
+
+    vk::Buffer m_aovBuffer;
+    vk::Buffer m_previousAovBuffer;
+    vk::Buffer m_historyBuffer;
+    vk::Buffer m_momentBuffer;
+    vk::Buffer m_filterBuffer;
+
+    //host visible, one per frame
+    std::vector<vk::Buffer> m_paramBuffers;
+
+    vk::DescriptorSetLayout m_descriptorSetLayout;
+    std::vector<vk::DescriptorSet> m_descriptorSets;
+
+    ComputePipeline m_temporalPipeline;
+    ComputePipeline m_variancePipeline;
+    ComputePipeline m_atrousPipeline;
+
+    uint32_t m_iterations;
+
+    //the history buffers hold a denoised frame, and the matrices it was
+    //rendered with
+    bool m_historyValid;
+    glm::mat4 m_previousModel;
+    glm::mat4 m_previousViewProj;
+
+    //2 timestamps per frame, around the passes
+    vk::QueryPool m_timestamps;
+    std::vector<bool> m_timestampsWritten;
+    double m_denoiseMs;
+
+    void writeBufferDescriptors();
+    void readTime( int frame );
+
+    //compute write -> compute read
+    void cmdPassBarrier( vk::CommandBuffer commandBuffer );
+};
+}  // namespace BR
@@ -0,0 +1,138 @@
+#include <BRMappedFile.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace BR;
+
+MappedFile::MappedFile()
+    : m_data( nullptr ),
+      m_size( 0 ),
+#ifdef _WIN32
+      m_file( INVALID_HANDLE_VALUE ),
+      m_mapping( nullptr )
+#else
+      m_fd( -1 )
+#endif
+{
+}
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+bool MappedFile::open( const std::string& path )
+{
+    close();
+
+#ifdef _WIN32
+    m_file = CreateFileA( path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                          OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr );
+
+    if ( m_file == INVALID_HANDLE_VALUE )
+        return false;
+
+    LARGE_INTEGER size;
+    if ( !GetFileSizeEx( m_file, &size ) )
+    {
+        close();
+        return false;
+    }
+
+    m_size = static_cast<size_t>( size.QuadPart );
+
+    //empty files can't be mapped, but they are valid
+    if ( m_size == 0 )
+        return true;
+
+    m_mapping =
+        CreateFileMappingA( m_file, nullptr, PAGE_READONLY, 0, 0, nullptr );
+
+    if ( !m_mapping )
+    {
+        close();
+        return false;
+    }
+
+    m_data = static_cast<const char*>(
+        MapViewOfFile( m_mapping, FILE_MAP_READ, 0, 0, 0 ) );
+#else
+    m_fd = ::open( path.c_str(), O_RDONLY );
+
+    if ( m_fd < 0 )
+        return false;
+
+    struct stat info;
+    if ( fstat( m_fd, &info ) != 0 )
+    {
+        close();
+        return false;
+    }
+
+    m_size = static_cast<size_t>( info.st_size );
+
+    if ( m_size == 0 )
+        return true;
+
+    void* data = mmap( nullptr, m_size, PROT_READ, MAP_PRIVATE, m_fd, 0 );
+    m_data = data == MAP_FAILED ? nullptr : static_cast<const char*>( data );
+
+    if ( m_data )
+        madvise( data, m_size, MADV_SEQUENTIAL );
+#endif
+
+    if ( !m_data )
+    {
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+void MappedFile::close()
+{
+#ifdef _WIN32
+    if ( m_data )
+        UnmapViewOfFile( m_data );
+
+    if ( m_mapping )
+        CloseHandle( m_mapping );
+
+    if ( m_file != INVALID_HANDLE_VALUE )
+        CloseHandle( m_file );
+
+    m_mapping = nullptr;
+    m_file = INVALID_HANDLE_VALUE;
+#else
+    if ( m_data )
+        munmap( const_cast<char*>( m_data ), m_size );
+
+    if ( m_fd >= 0 )
+        ::close( m_fd );
+
+    m_fd = -1;
+#endif
+
+    m_data = nullptr;
+    m_size = 0;
+}
+
+const char* MappedFile::getData()
+{
+    return m_data;
+}
+
+size_t MappedFile::getSize()
+{
+    return m_size;
+}
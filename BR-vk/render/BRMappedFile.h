@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+namespace BR
+{
+/*
+
+Read-only memory mapped file
+
+* The OS pages the file in on demand, no copy into a heap buffer
+* Mapping stays valid until close() or destruction
+
+*/
+
+class MappedFile
+{
+   public:
+    MappedFile();
+    ~MappedFile();
+    MappedFile( const MappedFile& ) = delete;
+
+    //returns false if the file can't be opened or mapped
+    bool open( const std::string& path );
+    void close();
+
+    const char* getData();
+    size_t getSize();
+
+   private:
+    const char* m_data;
+    size_t m_size;
+
+#ifdef _WIN32
+    void* m_file;
+    void* m_mapping;
+#else
+    int m_fd;
+#endif
+};
+}  // namespace BR
@@ -0,0 +1,513 @@
+#include <BRMappedFile.h>
+#include <BRObjParser.h>
+
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <thread>
+
+using namespace BR;
+
+//don't bother splitting files smaller than this
+const size_t MIN_CHUNK_SIZE = 1 << 20;
+
+//chunk local indices - relative ones are stored as an offset from the start
+//of the chunk, shifted down so they can't be confused with absolute indices
+const int64_t RELATIVE_BIAS = 1ll << 40;
+
+namespace
+{
+struct LocalIndex
+{
+    int64_t v;
+    int64_t n;
+    int64_t t;
+};
+
+//shape / material switch, at the triangle it applies from
+struct Event
+{
+    bool shape;
+    size_t triangle;
+    std::string name;
+};
+
+struct Chunk
+{
+    const char* begin;
+    const char* end;
+
+    std::vector<float> positions;
+    std::vector<float> normals;
+    std::vector<float> texcoords;
+
+    //3 per triangle
+    std::vector<LocalIndex> corners;
+    std::vector<ObjParser::Index> resolved;
+
+    std::vector<Event> events;
+    std::vector<std::string> mtllibs;
+
+    //offsets of this chunk's vertex data, in elements ( not floats )
+    size_t positionOffset;
+    size_t normalOffset;
+    size_t texcoordOffset;
+};
+
+inline bool isSpace( char c )
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+inline const char* skipSpace( const char* p, const char* end )
+{
+    while ( p < end && isSpace( *p ) )
+        ++p;
+
+    return p;
+}
+
+inline const char* parseFloat( const char* p, const char* end, float& value )
+{
+    p = skipSpace( p, end );
+
+    if ( p < end && *p == '+' )
+        ++p;
+
+    auto result = std::from_chars( p, end, value );
+
+    if ( result.ec != std::errc() )
+        value = 0;
+
+    return result.ptr;
+}
+
+inline const char* parseInt( const char* p, const char* end, int64_t& value )
+{
+    auto result = std::from_chars( p, end, value );
+
+    if ( result.ec != std::errc() )
+        value = 0;
+
+    return result.ptr;
+}
+
+//OBJ index -> absolute 0-based, or biased chunk relative, or -1 if missing
+inline int64_t localIndex( int64_t raw, size_t localCount )
+{
+    if ( raw > 0 )
+        return raw - 1;
+
+    if ( raw < 0 )
+        return static_cast<int64_t>( localCount ) + raw - RELATIVE_BIAS;
+
+    return -1;
+}
+
+inline int resolveIndex( int64_t index, size_t offset )
+{
+    if ( index < -RELATIVE_BIAS / 2 )
+        return static_cast<int>( index + RELATIVE_BIAS + offset );
+
+    return static_cast<int>( index );
+}
+
+std::string trimmed( const char* p, const char* end )
+{
+    p = skipSpace( p, end );
+
+    while ( end > p && isSpace( end[-1] ) )
+        --end;
+
+    return std::string( p, end );
+}
+
+//line starts with keyword followed by whitespace
+inline bool isKeyword( const char* p, const char* end, const char* keyword,
+                       size_t length )
+{
+    return size_t( end - p ) > length && memcmp( p, keyword, length ) == 0 &&
+           isSpace( p[length] );
+}
+
+void parseFace( Chunk& chunk, const char* p, const char* end )
+{
+    LocalIndex polygon[3];
+    int count = 0;
+
+    size_t positionCount = chunk.positions.size() / 3;
+    size_t normalCount = chunk.normals.size() / 3;
+    size_t texcoordCount = chunk.texcoords.size() / 2;
+
+    while ( true )
+    {
+        p = skipSpace( p, end );
+
+        if ( p >= end )
+            break;
+
+        //v, v/t, v//n, v/t/n
+        int64_t v = 0, t = 0, n = 0;
+
+        p = parseInt( p, end, v );
+
+        if ( p < end && *p == '/' )
+        {
+            ++p;
+
+            if ( p < end && *p != '/' )
+                p = parseInt( p, end, t );
+
+            if ( p < end && *p == '/' )
+                p = parseInt( p + 1, end, n );
+        }
+
+        //garbage, skip the token
+        while ( p < end && !isSpace( *p ) )
+            ++p;
+
+        if ( v == 0 )
+            continue;
+
+        LocalIndex corner{ localIndex( v, positionCount ),
+                           localIndex( n, normalCount ),
+                           localIndex( t, texcoordCount ) };
+
+        //fan triangulation - first, previous, current
+        if ( count < 3 )
+        {
+            polygon[count++] = corner;
+        }
+        else
+        {
+            polygon[1] = polygon[2];
+            polygon[2] = corner;
+        }
+
+        if ( count == 3 )
+        {
+            chunk.corners.push_back( polygon[0] );
+            chunk.corners.push_back( polygon[1] );
+            chunk.corners.push_back( polygon[2] );
+        }
+    }
+}
+
+void parseChunk( Chunk& chunk )
+{
+    const char* p = chunk.begin;
+
+    while ( p < chunk.end )
+    {
+        const char* lineEnd = static_cast<const char*>(
+            memchr( p, '\n', chunk.end - p ) );
+
+        if ( !lineEnd )
+            lineEnd = chunk.end;
+
+        const char* line = skipSpace( p, lineEnd );
+        p = lineEnd + 1;
+
+        if ( lineEnd - line < 2 )
+            continue;
+
+        if ( line[0] == 'v' && isSpace( line[1] ) )
+        {
+            float x, y, z;
+            const char* q = parseFloat( line + 2, lineEnd, x );
+            q = parseFloat( q, lineEnd, y );
+            parseFloat( q, lineEnd, z );
+
+            chunk.positions.insert( chunk.positions.end(), { x, y, z } );
+        }
+        else if ( isKeyword( line, lineEnd, "vn", 2 ) )
+        {
+            float x, y, z;
+            const char* q = parseFloat( line + 3, lineEnd, x );
+            q = parseFloat( q, lineEnd, y );
+            parseFloat( q, lineEnd, z );
+
+            chunk.normals.insert( chunk.normals.end(), { x, y, z } );
+        }
+        else if ( isKeyword( line, lineEnd, "vt", 2 ) )
+        {
+            float u, v;
+            const char* q = parseFloat( line + 3, lineEnd, u );
+            parseFloat( q, lineEnd, v );
+
+            chunk.texcoords.insert( chunk.texcoords.end(), { u, v } );
+        }
+        else if ( line[0] == 'f' && isSpace( line[1] ) )
+        {
+            parseFace( chunk, line + 2, lineEnd );
+        }
+        else if ( ( line[0] == 'o' || line[0] == 'g' ) && isSpace( line[1] ) )
+        {
+            chunk.events.push_back( { true, chunk.corners.size() / 3,
+                                      trimmed( line + 2, lineEnd ) } );
+        }
+        else if ( isKeyword( line, lineEnd, "usemtl", 6 ) )
+        {
+            chunk.events.push_back( { false, chunk.corners.size() / 3,
+                                      trimmed( line + 7, lineEnd ) } );
+        }
+        else if ( isKeyword( line, lineEnd, "mtllib", 6 ) )
+        {
+            chunk.mtllibs.push_back( trimmed( line + 7, lineEnd ) );
+        }
+    }
+}
+
+template <typename Func>
+void parallelFor( size_t count, Func func )
+{
+    std::vector<std::thread> threads;
+
+    for ( size_t i = 1; i < count; ++i )
+        threads.emplace_back( func, i );
+
+    if ( count > 0 )
+        func( 0 );
+
+    for ( auto& thread : threads )
+        thread.join();
+}
+}  // namespace
+
+bool ObjParser::parse( const std::string& path, unsigned threadCount )
+{
+    m_positions.clear();
+    m_normals.clear();
+    m_texcoords.clear();
+    m_shapes.clear();
+    m_materials.clear();
+    m_materialLibs.clear();
+
+    MappedFile file;
+
+    if ( !file.open( path ) )
+        return false;
+
+    const char* data = file.getData();
+    size_t size = file.getSize();
+
+    if ( threadCount == 0 )
+        threadCount = std::max( 1u, std::thread::hardware_concurrency() );
+
+    size_t chunkCount =
+        std::clamp<size_t>( size / MIN_CHUNK_SIZE, 1, threadCount );
+
+    // split into line aligned chunks
+
+    std::vector<Chunk> chunks( chunkCount );
+
+    const char* begin = data;
+    for ( size_t i = 0; i < chunkCount; ++i )
+    {
+        const char* end = data + size * ( i + 1 ) / chunkCount;
+
+        if ( i + 1 == chunkCount )
+        {
+            end = data + size;
+        }
+        else
+        {
+            end = std::max( end, begin );
+
+            const char* newline = static_cast<const char*>(
+                memchr( end, '\n', data + size - end ) );
+
+            end = newline ? newline + 1 : data + size;
+        }
+
+        chunks[i].begin = begin;
+        chunks[i].end = end;
+        begin = end;
+    }
+
+    // parse the chunks
+
+    parallelFor( chunkCount, [&]( size_t i ) { parseChunk( chunks[i] ); } );
+
+    // prefix sums, vertex data offsets of each chunk
+
+    size_t positionCount = 0, normalCount = 0, texcoordCount = 0;
+
+    for ( auto& chunk : chunks )
+    {
+        chunk.positionOffset = positionCount;
+        chunk.normalOffset = normalCount;
+        chunk.texcoordOffset = texcoordCount;
+
+        positionCount += chunk.positions.size() / 3;
+        normalCount += chunk.normals.size() / 3;
+        texcoordCount += chunk.texcoords.size() / 2;
+    }
+
+    m_positions.resize( positionCount * 3 );
+    m_normals.resize( normalCount * 3 );
+    m_texcoords.resize( texcoordCount * 2 );
+
+    // copy vertex data into place, resolve relative indices
+
+    parallelFor( chunkCount,
+                 [&]( size_t i )
+                 {
+                     auto& chunk = chunks[i];
+
+                     std::copy( chunk.positions.begin(), chunk.positions.end(),
+                                m_positions.begin() + chunk.positionOffset * 3 );
+                     std::copy( chunk.normals.begin(), chunk.normals.end(),
+                                m_normals.begin() + chunk.normalOffset * 3 );
+                     std::copy( chunk.texcoords.begin(), chunk.texcoords.end(),
+                                m_texcoords.begin() + chunk.texcoordOffset * 2 );
+
+                     chunk.resolved.resize( chunk.corners.size() );
+
+                     for ( size_t c = 0; c < chunk.corners.size(); ++c )
+                     {
+                         auto& corner = chunk.corners[c];
+                         chunk.resolved[c] = {
+                             resolveIndex( corner.v, chunk.positionOffset ),
+                             resolveIndex( corner.n, chunk.normalOffset ),
+                             resolveIndex( corner.t, chunk.texcoordOffset ) };
+                     }
+
+                     //free as we go, big files are tight on memory
+                     chunk.positions = {};
+                     chunk.normals = {};
+                     chunk.texcoords = {};
+                     chunk.corners = {};
+                 } );
+
+    // materials
+
+    std::string directory;
+    auto slash = path.find_last_of( "/\\" );
+
+    if ( slash != std::string::npos )
+        directory = path.substr( 0, slash + 1 );
+
+    for ( auto& chunk : chunks )
+    {
+        for ( auto& mtllib : chunk.mtllibs )
+        {
+            m_materialLibs.push_back( mtllib );
+            parseMaterials( directory + mtllib );
+        }
+    }
+
+    std::map<std::string, int> materialIds;
+
+    for ( size_t i = 0; i < m_materials.size(); ++i )
+        materialIds.emplace( m_materials[i].name, static_cast<int>( i ) );
+
+    // stitch the shapes together, in file order
+
+    m_shapes.emplace_back();
+    int material = -1;
+
+    for ( auto& chunk : chunks )
+    {
+        size_t triangleCount = chunk.resolved.size() / 3;
+        size_t triangle = 0;
+        size_t event = 0;
+
+        while ( triangle < triangleCount || event < chunk.events.size() )
+        {
+            //apply all the switches that happen before this triangle
+            while ( event < chunk.events.size() &&
+                    chunk.events[event].triangle == triangle )
+            {
+                auto& current = chunk.events[event++];
+
+                if ( current.shape )
+                {
+                    //a shape with no triangles yet is just renamed
+                    if ( !m_shapes.back().indices.empty() )
+                        m_shapes.emplace_back();
+
+                    m_shapes.back().name = current.name;
+                }
+                else
+                {
+                    auto it = materialIds.find( current.name );
+                    material = it == materialIds.end() ? -1 : it->second;
+                }
+            }
+
+            size_t next = event < chunk.events.size()
+                              ? chunk.events[event].triangle
+                              : triangleCount;
+
+            auto& shape = m_shapes.back();
+
+            shape.indices.insert( shape.indices.end(),
+                                  chunk.resolved.begin() + triangle * 3,
+                                  chunk.resolved.begin() + next * 3 );
+            shape.materialIds.insert( shape.materialIds.end(), next - triangle,
+                                      material );
+
+            triangle = next;
+        }
+
+        chunk.resolved = {};
+    }
+
+    if ( m_shapes.back().indices.empty() )
+        m_shapes.pop_back();
+
+    return true;
+}
+
+void ObjParser::parseMaterials( const std::string& path )
+{
+    std::ifstream file( path );
+
+    if ( !file )
+    {
+        printf( "\tfailed to open material library %s\n", path.c_str() );
+        return;
+    }
+
+    std::string line;
+
+    while ( std::getline( file, line ) )
+    {
+        const char* p = skipSpace( line.data(), line.data() + line.size() );
+        const char* end = line.data() + line.size();
+
+        auto readColor = [&]( float* color )
+        {
+            const char* q = p + 3;
+            for ( int i = 0; i < 3; ++i )
+                q = parseFloat( q, end, color[i] );
+        };
+
+        if ( isKeyword( p, end, "newmtl", 6 ) )
+        {
+            Material material{};
+            material.name = trimmed( p + 7, end );
+            m_materials.push_back( material );
+        }
+        else if ( m_materials.empty() )
+        {
+            continue;
+        }
+        else if ( isKeyword( p, end, "Ka", 2 ) )
+        {
+            readColor( m_materials.back().ambient );
+        }
+        else if ( isKeyword( p, end, "Kd", 2 ) )
+        {
+            readColor( m_materials.back().diffuse );
+        }
+        else if ( isKeyword( p, end, "Ks", 2 ) )
+        {
+            readColor( m_materials.back().specular );
+        }
+    }
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace BR
+{
+/*
+
+Multithreaded OBJ/MTL parser
+
+* The OBJ is memory mapped and split into line aligned chunks, one per thread
+* Each thread parses its chunk on its own - vertex data, triangles, and the
+    shape/material switches ( o, g, usemtl ) with the triangle they start at
+* Merge
+    * Vertex data is copied to its final place in parallel, chunk offsets
+        come from a prefix sum of the per-chunk counts
+    * Relative ( negative ) indices are resolved against those offsets
+    * Shapes and material IDs are stitched together in file order
+* Polygons are triangulated as fans
+* The output layout follows tinyobj - flat float arrays, per-shape corner
+    indices ( -1 = missing ), one material ID per triangle ( -1 = none )
+
+*/
+
+class ObjParser
+{
+   public:
+    struct Index
+    {
+        int v;
+        int n;
+        int t;
+    };
+
+    struct Shape
+    {
+        std::string name;
+        std::vector<Index> indices;
+        std::vector<int> materialIds;
+    };
+
+    struct Material
+    {
+        std::string name;
+        float ambient[3];
+        float diffuse[3];
+        float specular[3];
+    };
+
+    //threadCount = 0 -> one thread per core
+    bool parse( const std::string& path, unsigned threadCount = 0 );
+
+    std::vector<float> m_positions;
+    std::vector<float> m_normals;
+    std::vector<float> m_texcoords;
+
+    std::vector<Shape> m_shapes;
+    std::vector<Material> m_materials;
+
+    //mtllib names, as written in the OBJ ( relative to its directory )
+    std::vector<std::string> m_materialLibs;
+
+   private:
+    void parseMaterials( const std::string& path );
+};
+}  // namespace BR
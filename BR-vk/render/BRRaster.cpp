@@ -10,6 +10,13 @@
 
 using namespace BR;
 
+//push constants of shader.frag
+struct DrawParams
+{
+    //gl_PrimitiveID starts at 0 in every draw
+    uint32_t firstTriangle;
+};
+
 Raster::Raster()
     : m_descMgr( AppState::instance().getDescMgr() ),
       m_bufferAlloc( AppState::instance().getMemoryMgr() ),
@@ -23,6 +30,12 @@ void Raster::init()
     m_descriptorSetLayout = m_descMgr.createLayout(
         "UBO layout", std::vector<BR::DescMgr::Binding>{
                           { 0, vk::DescriptorType::eUniformBuffer, 1,
+                            vk::ShaderStageFlagBits::eVertex },
+                          { 1, vk::DescriptorType::eStorageBuffer, 1,
+                            vk::ShaderStageFlagBits::eFragment },
+                          { 2, vk::DescriptorType::eStorageBuffer, 1,
+                            vk::ShaderStageFlagBits::eFragment },
+                          { 3, vk::DescriptorType::eStorageBuffer, 1,
                             vk::ShaderStageFlagBits::eVertex } } );
 
     createDepthBuffer();
@@ -43,10 +56,11 @@ void Raster::createPipeline()
     m_pipeline.addShaderStage( "build/shaders/shader.frag.spv",
                                vk::ShaderStageFlagBits::eFragment );
 
-    auto bindingDescription = Scene::PipelineVertex::getBindingDescription();
-    auto attributeDescriptions = Scene::PipelineVertex::getAttributeDescriptions();
+    auto bindingDescriptions = Scene::VertexLayout::getBindingDescriptions();
+    auto attributeDescriptions =
+        Scene::VertexLayout::getAttributeDescriptions();
 
-    m_pipeline.addVertexInputInfo( bindingDescription, attributeDescriptions );
+    m_pipeline.addVertexInputInfo( bindingDescriptions, attributeDescriptions );
     m_pipeline.addInputAssembly( vk::PrimitiveTopology::eTriangleList,
                                  VK_FALSE );
     m_pipeline.addViewport( swapChainExtent );
@@ -57,6 +71,8 @@ void Raster::createPipeline()
     m_pipeline.addColorBlend();
     m_pipeline.addDynamicStates(
         { vk::DynamicState::eScissor, vk::DynamicState::eViewport } );
+    m_pipeline.addPushConstants( vk::ShaderStageFlagBits::eFragment,
+                                 sizeof( DrawParams ) );
     m_pipeline.build( "Raster Pipeline", m_renderPass, m_descriptorSetLayout );
 }
 
@@ -93,11 +109,10 @@ void Raster::createDepthBuffer()
 {
     auto extent = AppState::instance().getSwapchainExtent();
 
-    m_depthBuffer = m_bufferAlloc.createImage(
+    //cleared on load and dropped on store, by the raster and UI passes
+    m_depthBuffer = m_bufferAlloc.createTransientAttachment(
         "Depth Buffer", extent.width, extent.height, vk::Format::eD32Sfloat,
-        vk::ImageTiling::eOptimal,
-        vk::ImageUsageFlagBits::eDepthStencilAttachment,
-        vk::MemoryPropertyFlagBits::eDeviceLocal );
+        vk::ImageUsageFlagBits::eDepthStencilAttachment );
 
     m_depthBufferView = m_bufferAlloc.createImageView(
         "Depth Buffer Image View", m_depthBuffer, vk::Format::eD32Sfloat,
@@ -105,7 +120,10 @@ void Raster::createDepthBuffer()
 }
 
 void Raster::createDescriptorSets( std::vector<vk::Buffer>& uniforms,
-                                   vk::DescriptorPool pool )
+                                   vk::DescriptorPool pool,
+                                   vk::Buffer materialBuffer,
+                                   vk::Buffer triangleMaterialBuffer,
+                                   vk::Buffer transformBuffer )
 {
     m_descriptorSets.push_back( m_descMgr.createSet(
         "Frame 1 Desc set", m_descriptorSetLayout, pool ) );
@@ -130,15 +148,67 @@ void Raster::createDescriptorSets( std::vector<vk::Buffer>& uniforms,
         descriptorWrite.pImageInfo = nullptr;        // Optional
         descriptorWrite.pTexelBufferView = nullptr;  // Optional
 
+        vk::DescriptorBufferInfo materialBufferInfo;
+        materialBufferInfo.buffer = materialBuffer;
+        materialBufferInfo.offset = 0;
+        materialBufferInfo.range = VK_WHOLE_SIZE;
+
+        vk::WriteDescriptorSet materialBufferWrite;
+        materialBufferWrite.dstSet = m_descriptorSets[i];
+        materialBufferWrite.dstBinding = 1;
+        materialBufferWrite.dstArrayElement = 0;
+        materialBufferWrite.descriptorType =
+            vk::DescriptorType::eStorageBuffer;
+        materialBufferWrite.descriptorCount = 1;
+        materialBufferWrite.pBufferInfo = &materialBufferInfo;
+        materialBufferWrite.pImageInfo = nullptr;        // Optional
+        materialBufferWrite.pTexelBufferView = nullptr;  // Optional
+
+        vk::DescriptorBufferInfo triangleMaterialBufferInfo;
+        triangleMaterialBufferInfo.buffer = triangleMaterialBuffer;
+        triangleMaterialBufferInfo.offset = 0;
+        triangleMaterialBufferInfo.range = VK_WHOLE_SIZE;
+
+        vk::WriteDescriptorSet triangleMaterialBufferWrite;
+        triangleMaterialBufferWrite.dstSet = m_descriptorSets[i];
+        triangleMaterialBufferWrite.dstBinding = 2;
+        triangleMaterialBufferWrite.dstArrayElement = 0;
+        triangleMaterialBufferWrite.descriptorType =
+            vk::DescriptorType::eStorageBuffer;
+        triangleMaterialBufferWrite.descriptorCount = 1;
+        triangleMaterialBufferWrite.pBufferInfo = &triangleMaterialBufferInfo;
+        triangleMaterialBufferWrite.pImageInfo = nullptr;        // Optional
+        triangleMaterialBufferWrite.pTexelBufferView = nullptr;  // Optional
+
+        vk::DescriptorBufferInfo transformBufferInfo;
+        transformBufferInfo.buffer = transformBuffer;
+        transformBufferInfo.offset = 0;
+        transformBufferInfo.range = VK_WHOLE_SIZE;
+
+        vk::WriteDescriptorSet transformBufferWrite;
+        transformBufferWrite.dstSet = m_descriptorSets[i];
+        transformBufferWrite.dstBinding = 3;
+        transformBufferWrite.dstArrayElement = 0;
+        transformBufferWrite.descriptorType =
+            vk::DescriptorType::eStorageBuffer;
+        transformBufferWrite.descriptorCount = 1;
+        transformBufferWrite.pBufferInfo = &transformBufferInfo;
+        transformBufferWrite.pImageInfo = nullptr;        // Optional
+        transformBufferWrite.pTexelBufferView = nullptr;  // Optional
+
+        std::vector<vk::WriteDescriptorSet> writeDescriptorSets = {
+            descriptorWrite, materialBufferWrite, triangleMaterialBufferWrite,
+            transformBufferWrite };
+
         vkUpdateDescriptorSets(
-            m_device, 1, (VkWriteDescriptorSet*)&descriptorWrite, 0, nullptr );
+            m_device, static_cast<uint32_t>( writeDescriptorSets.size() ),
+            (VkWriteDescriptorSet*)writeDescriptorSets.data(), 0, nullptr );
     }
 }
 
 void Raster::recordDrawCommandBuffer( vk::CommandBuffer commandBuffer,
                                       uint32_t imageIndex, int currentFrame,
-                                      vk::Buffer vertexBuffer,
-                                      vk::Buffer indexBuffer, int drawCount )
+                                      Scene& scene )
 {
     /*
     * Do a render pass
@@ -181,17 +251,35 @@ void Raster::recordDrawCommandBuffer( vk::CommandBuffer commandBuffer,
     commandBuffer.setViewport( 0, viewport );
     commandBuffer.setScissor( 0, scissor );
 
-    vk::Buffer vertexBuffers[] = { vertexBuffer };
-    vk::DeviceSize offsets[] = { 0 };
+    //one buffer per binding of Scene::VertexLayout
+    vk::Buffer vertexBuffers[] = { scene.m_positionBuffer,
+                                   scene.m_attributeBuffer };
+    vk::DeviceSize offsets[] = { 0, 0 };
 
-    commandBuffer.bindVertexBuffers( 0, 1, vertexBuffers, offsets );
-    commandBuffer.bindIndexBuffer( indexBuffer, 0, vk::IndexType::eUint32 );
+    commandBuffer.bindVertexBuffers( 0, 2, vertexBuffers, offsets );
+    commandBuffer.bindIndexBuffer( scene.m_indexBuffer, 0,
+                                   vk::IndexType::eUint32 );
 
     vkCmdBindDescriptorSets(
         commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipeline.getLayout(),
         0, 1, (VkDescriptorSet*)&m_descriptorSets[currentFrame], 0, nullptr );
 
-    commandBuffer.drawIndexed( static_cast<uint32_t>( drawCount ), 1, 0, 0, 0 );
+    //gl_InstanceIndex includes firstInstance, it indexes the transforms
+    for ( size_t i = 0; i < scene.m_shapes.size(); ++i )
+    {
+        auto& shape = scene.m_shapes[i];
+        auto& draw = scene.m_draws[i];
+
+        DrawParams params;
+        params.firstTriangle = shape.firstIndex / 3;
+
+        commandBuffer.pushConstants( m_pipeline.getLayout(),
+                                     vk::ShaderStageFlagBits::eFragment, 0,
+                                     sizeof( DrawParams ), &params );
+
+        commandBuffer.drawIndexed( shape.indexCount, draw.instanceCount,
+                                   shape.firstIndex, 0, draw.firstInstance );
+    }
 
     commandBuffer.endRenderPass();
 }
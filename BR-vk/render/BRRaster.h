@@ -3,6 +3,7 @@
 #include <BRFramebuffer.h>
 #include <BRRasterPipeline.h>
 #include <BRRenderPass.h>
+#include <BRScene.h>
 
 #include "BRDescMgr.h"
 #include "BRMemoryMgr.h"
@@ -18,12 +19,15 @@ class Raster
     void init();
 
     void createDescriptorSets( std::vector<vk::Buffer>& uniforms,
-                               vk::DescriptorPool pool );
+                               vk::DescriptorPool pool,
+                               vk::Buffer materialBuffer,
+                               vk::Buffer triangleMaterialBuffer,
+                               vk::Buffer transformBuffer );
 
+    //one instanced draw per shape, see Scene::m_draws
     void recordDrawCommandBuffer( vk::CommandBuffer commandBuffer,
                                   uint32_t imageIndex, int currentFrame,
-                                  vk::Buffer vertexBuffer,
-                                  vk::Buffer indexBuffer, int drawCount );
+                                  Scene& scene );
 
     void destroy();
     void resize();
@@ -2,6 +2,7 @@
 
 #include <BRRender.h>
 
+#include <algorithm>
 #include <ranges>
 
 #include "BRAppState.h"
@@ -11,27 +12,117 @@
 
 using namespace BR;
 
+//build BLASes compactable, and shrink them before the TLAS build
+const bool COMPACT_BLAS = true;
+
+//build BLASes on the CPU cores instead of the GPU, if the driver can
+//the build time is logged either way, flip this to compare
+const bool HOST_AS_BUILD = false;
+
+//keep the built BLASes next to the model ( .bras ), and load them instead of
+//building on the next run, if the geometry, settings and driver still match
+const bool CACHE_BLAS = true;
+
+//Triangles per BLAS chunk of a deformable shape. An edit only rebuilds the
+//chunks it touches, smaller ones rebuild sooner, but every chunk is another
+//TLAS instance with bounds overlapping its neighbours, more traversal for
+//every ray. 0 = one BLAS per shape. Static BLASes are never chunked
+const uint32_t BLAS_CHUNK_TRIANGLES = 64 * 1024;
+
+//threads per workgroup, local_size_x of instances.comp
+const uint32_t INSTANCE_GROUP_SIZE = 256;
+
+//pixels per side of an adaptive sampling tile, TILE_SIZE of
+//accumulation.glsl. Also the workgroup size of the adaptive passes
+const uint32_t TILE_SIZE = 8;
+
+//Accumulation of accumulation.glsl, std430
+struct Accumulation
+{
+    glm::vec4 color;
+    glm::vec2 luminance;
+    glm::vec2 padding;
+};
+
+//written by adaptive.comp, height = active tiles
+struct AdaptiveLaunch
+{
+    VkTraceRaysIndirectCommandKHR command;
+    uint32_t activePixels;
+};
+
+//push constants of raygen.rgen
+struct LaunchConstants
+{
+    uint32_t samples;
+    uint32_t firstSample;
+};
+
+//how fast the cost of a sample follows the measured one, the rest is the
+//last estimate - one slow frame doesn't halve the samples
+const double SAMPLE_COST_SMOOTHING = 0.25;
+
+//push constants of instances.comp
+struct InstanceParams
+{
+    glm::mat4 model;
+    uint32_t instanceCount;
+};
+
 RayTracer::RayTracer()
     : m_bufferAlloc( AppState::instance().getMemoryMgr() ),
       m_descMgr( AppState::instance().getDescMgr() ),
-      m_framesInFlight( AppState::instance().m_framesInFlight )
+      m_framesInFlight( AppState::instance().m_framesInFlight ),
+      m_model( 1.0f ),
+      m_tlasModel( 1.0f ),
+      m_view( 1.0f ),
+      m_proj( 1.0f ),
+      m_deformable( false ),
+      m_refitPending( false ),
+      m_instanceCount( 0 ),
+      m_tlasEmpty( true ),
+      m_traceTimestamps( nullptr ),
+      m_traceMs( 0.0 ),
+      m_rayCount( 0 ),
+      m_activePixels( 0 ),
+      m_denoise( false ),
+      m_autoSamples( true ),
+      m_samplesPerLaunch( 1 ),
+      m_frameBudgetMs( 16.0 ),
+      m_sampleMs( 0.0 ),
+      m_traceSamples( 1 ),
+      m_launchedSamples( 0 )
 {
     m_device = AppState::instance().getLogicalDevice();
 }
 
 void RayTracer::init()
 {
-    m_asBuilder.create();
+    m_asBuilder.create( COMPACT_BLAS, HOST_AS_BUILD );
+
+    //the indirect launch of every frame, read back for the UI
+    for ( int i : std::views::iota( 0, m_framesInFlight ) )
+    {
+        AdaptiveLaunch launch{};
+
+        m_launchBuffers.push_back( m_bufferAlloc.createDeviceBuffer(
+            "Adaptive Launch " + std::to_string( i ), sizeof( AdaptiveLaunch ),
+            &launch, true,
+            vk::BufferUsageFlagBits::eStorageBuffer |
+                vk::BufferUsageFlagBits::eIndirectBuffer |
+                vk::BufferUsageFlagBits::eShaderDeviceAddress |
+                vk::BufferUsageFlagBits::eTransferDst ) );
+    }
 
     createAccumulationBuffer();
 
+    m_denoiser.init();
+
     m_rtDescriptorSetLayout = m_descMgr.createLayout(
         "RT Pipeline Descriptor Set Layout",
         std::vector<BR::DescMgr::Binding>{
             { 0, vk::DescriptorType::eAccelerationStructureKHR, 1,
               vk::ShaderStageFlagBits::eRaygenKHR },
-            { 1, vk::DescriptorType::eStorageImage, 1,
-              vk::ShaderStageFlagBits::eRaygenKHR },
             { 2, vk::DescriptorType::eUniformBuffer, 1,
               vk::ShaderStageFlagBits::eRaygenKHR },
             { 3, vk::DescriptorType::eStorageBuffer, 1,
@@ -41,7 +132,80 @@ void RayTracer::init()
             { 5, vk::DescriptorType::eStorageBuffer, 1,
               vk::ShaderStageFlagBits::eRaygenKHR },
             { 6, vk::DescriptorType::eStorageBuffer, 1,
-              vk::ShaderStageFlagBits::eClosestHitKHR } } );
+              vk::ShaderStageFlagBits::eClosestHitKHR },
+            { 7, vk::DescriptorType::eStorageBuffer, 1,
+              vk::ShaderStageFlagBits::eClosestHitKHR },
+            { 8, vk::DescriptorType::eStorageBuffer, 1,
+              vk::ShaderStageFlagBits::eClosestHitKHR },
+            { 9, vk::DescriptorType::eStorageBuffer, 1,
+              vk::ShaderStageFlagBits::eClosestHitKHR },
+            { 10, vk::DescriptorType::eStorageBuffer, 1,
+              vk::ShaderStageFlagBits::eRaygenKHR },
+            { 11, vk::DescriptorType::eStorageBuffer, 1,
+              vk::ShaderStageFlagBits::eClosestHitKHR },
+            { 12, vk::DescriptorType::eStorageBuffer, 1,
+              vk::ShaderStageFlagBits::eClosestHitKHR },
+            { 13, vk::DescriptorType::eStorageBuffer, 1,
+              vk::ShaderStageFlagBits::eRaygenKHR },
+            { 14, vk::DescriptorType::eStorageBuffer, 1,
+              vk::ShaderStageFlagBits::eRaygenKHR } } );
+
+    m_adaptiveDescriptorSetLayout = m_descMgr.createLayout(
+        "Adaptive Descriptor Set Layout",
+        std::vector<BR::DescMgr::Binding>{
+            { 0, vk::DescriptorType::eUniformBuffer, 1,
+              vk::ShaderStageFlagBits::eCompute },
+            { 1, vk::DescriptorType::eStorageBuffer, 1,
+              vk::ShaderStageFlagBits::eCompute },
+            { 2, vk::DescriptorType::eStorageBuffer, 1,
+              vk::ShaderStageFlagBits::eCompute },
+            { 3, vk::DescriptorType::eStorageBuffer, 1,
+              vk::ShaderStageFlagBits::eCompute },
+            { 4, vk::DescriptorType::eStorageImage, 1,
+              vk::ShaderStageFlagBits::eCompute } } );
+
+    m_instanceDescriptorSetLayout = m_descMgr.createLayout(
+        "Instance Descriptor Set Layout",
+        std::vector<BR::DescMgr::Binding>{
+            { 0, vk::DescriptorType::eStorageBuffer, 1,
+              vk::ShaderStageFlagBits::eCompute },
+            { 1, vk::DescriptorType::eStorageBuffer, 1,
+              vk::ShaderStageFlagBits::eCompute },
+            { 2, vk::DescriptorType::eStorageBuffer, 1,
+              vk::ShaderStageFlagBits::eCompute },
+            { 3, vk::DescriptorType::eStorageBuffer, 1,
+              vk::ShaderStageFlagBits::eCompute } } );
+
+    vk::QueryPoolCreateInfo queryInfo;
+    queryInfo.queryType = vk::QueryType::eTimestamp;
+    queryInfo.queryCount = 4 * m_framesInFlight;
+
+    try
+    {
+        m_traceTimestamps = m_device.createQueryPool( queryInfo );
+    }
+    catch ( vk::SystemError err )
+    {
+        throw std::runtime_error( "failed to create query pool!" );
+    }
+
+    DEBUG_NAME( m_traceTimestamps, "Trace Timestamps" );
+
+    m_traceTimestampsWritten.assign( m_framesInFlight, false );
+    m_frameEdits.assign( m_framesInFlight, EditStats() );
+    m_frameEditStarts.assign( m_framesInFlight, Clock::time_point() );
+    m_frameEditEnds.assign( m_framesInFlight, Clock::time_point() );
+    m_frameSamples.assign( m_framesInFlight, 1 );
+
+    //rays traced by the frame, counted by the raygen shader
+    for ( int i : std::views::iota( 0, m_framesInFlight ) )
+    {
+        uint32_t zero = 0;
+
+        m_rayCountBuffers.push_back( m_bufferAlloc.createDeviceBuffer(
+            "Ray Count " + std::to_string( i ), sizeof( uint32_t ), &zero,
+            true, vk::BufferUsageFlagBits::eStorageBuffer ) );
+    }
 
     createPipeline();
 }
@@ -60,29 +224,315 @@ void RayTracer::createPipeline()
     m_pipeline.addShaderGroup(
         vk::RayTracingShaderGroupTypeKHR::eTrianglesHitGroup, 2 );
 
-    m_pipeline.build( "RT Pipeline", m_rtDescriptorSetLayout );
+    m_pipeline.build( "RT Pipeline", m_rtDescriptorSetLayout,
+                      sizeof( LaunchConstants ) );
+
+    m_instancePipeline.addShaderStage( "build/shaders/instances.comp.spv",
+                                       vk::ShaderStageFlagBits::eCompute );
+    m_instancePipeline.build( "Instance Pipeline",
+                              m_instanceDescriptorSetLayout,
+                              sizeof( InstanceParams ) );
+
+    m_adaptivePipeline.addShaderStage( "build/shaders/adaptive.comp.spv",
+                                       vk::ShaderStageFlagBits::eCompute );
+    m_adaptivePipeline.build( "Adaptive Pipeline",
+                              m_adaptiveDescriptorSetLayout );
+
+    m_resolvePipeline.addShaderStage( "build/shaders/resolve.comp.spv",
+                                      vk::ShaderStageFlagBits::eCompute );
+    m_resolvePipeline.build( "Resolve Pipeline",
+                             m_adaptiveDescriptorSetLayout );
 }
 
-void RayTracer::createAS( std::vector<uint32_t>& indices,
-                          vk::Buffer vertexBuffer, vk::Buffer indexBuffer )
+void RayTracer::createAS( Scene& scene, bool deformable )
 {
-    auto it = std::max_element( indices.begin(), indices.end() );
-    int maxVertex = ( *it ) + 1;
+    m_deformable = deformable;
+
+    std::vector<uint32_t> firstChunks;
+    auto inputs = createChunks( scene, firstChunks );
+
+    //compacted and uncompacted BLASes can't share a cache file
+    uint64_t key = scene.m_cache.getGeometryHash() ^ ( COMPACT_BLAS ? 1 : 0 );
+    std::string cachePath = SceneCache::getCachePath( scene.m_path, ".bras" );
+
+    //dynamic BLASes are refit from the first frame, nothing to cache
+    bool useCache = CACHE_BLAS && !deformable;
+
+    bool cached = useCache &&
+                  m_asBuilder.loadBlas( cachePath, key, inputs, m_blases );
+
+    if ( !cached )
+    {
+        m_blases = m_asBuilder.buildBlas( inputs, deformable );
+
+        if ( COMPACT_BLAS && !deformable )
+            m_asBuilder.compactBlas( m_blases );
+    }
+
+    if ( useCache && !cached )
+        m_asBuilder.saveBlas( cachePath, m_blases, key );
+
+    //the instance shader looks the BLASes up by chunk
+    std::vector<uint64_t> addresses;
+
+    for ( auto blas : m_blases )
+        addresses.push_back( m_asBuilder.getAddress( blas ) );
 
-    m_blas = m_asBuilder.buildBlas( "BLAS", vertexBuffer, indexBuffer,
-                                    maxVertex, indices.size() );
+    m_blasAddressBuffer = m_bufferAlloc.createDeviceBuffer(
+        "BLAS Addresses", addresses.size() * sizeof( uint64_t ),
+        addresses.data(), false, vk::BufferUsageFlagBits::eStorageBuffer );
 
-    m_tlas = m_asBuilder.buildTlas( "TLAS", m_blas );
+    m_chunkBuffer = m_bufferAlloc.createDeviceBuffer(
+        "BLAS Chunks", m_chunks.size() * sizeof( Scene::Shape ),
+        m_chunks.data(), false, vk::BufferUsageFlagBits::eStorageBuffer );
+
+    //every placement of a shape places all of its chunks
+    //the transforms are grouped by shape, see Scene::scatter
+    std::vector<glm::uvec2> instanceChunks;
+
+    for ( uint32_t shape = 0; shape < scene.m_draws.size(); ++shape )
+    {
+        auto& draw = scene.m_draws[shape];
+
+        for ( uint32_t i = 0; i < draw.instanceCount; ++i )
+        {
+            for ( uint32_t chunk = firstChunks[shape];
+                  chunk < firstChunks[shape + 1]; ++chunk )
+                instanceChunks.emplace_back( draw.firstInstance + i, chunk );
+        }
+    }
+
+    m_instanceChunkBuffer = m_bufferAlloc.createDeviceBuffer(
+        "Instance Chunks", instanceChunks.size() * sizeof( glm::uvec2 ),
+        instanceChunks.data(), false,
+        vk::BufferUsageFlagBits::eStorageBuffer );
+
+    m_bufferAlloc.getUploader().flush();
+
+    m_instanceCount = static_cast<uint32_t>( instanceChunks.size() );
+
+    printf( "%zu BLASes for %zu shapes, %u TLAS instances\n", m_blases.size(),
+            scene.m_shapes.size(), m_instanceCount );
+
+    //built with the first trace, once the instances are written
+    m_tlas = m_asBuilder.createGpuTlas( "TLAS", m_instanceCount );
+    m_tlasEmpty = true;
+}
+
+std::vector<ASBuilder::BlasInput> RayTracer::createChunks(
+    Scene& scene, std::vector<uint32_t>& firstChunks )
+{
+    auto& shapes = scene.m_shapes;
+    auto positions = scene.m_cache.getPositions();
+
+    //static BLASes are never rebuilt, splitting them only slows the trace
+    uint32_t chunkTriangles = m_deformable ? BLAS_CHUNK_TRIANGLES : 0;
+
+    std::vector<ASBuilder::BlasInput> inputs;
+
+    m_chunks.clear();
+    m_chunkMin.clear();
+    m_chunkMax.clear();
+    firstChunks.clear();
+
+    for ( size_t i = 0; i < shapes.size(); ++i )
+    {
+        firstChunks.push_back( static_cast<uint32_t>( m_chunks.size() ) );
+
+        //the shapes share the vertex buffer, the highest index is count - 1
+        //split shapes build from their range of the BLAS index buffer
+        bool split = shapes[i].blasIndexCount > 0;
+
+        ASBuilder::BlasInput input;
+
+        if ( split )
+        {
+            input = { "BLAS " + std::to_string( i ),
+                      scene.m_positionBuffer,
+                      scene.m_blasIndexBuffer,
+                      scene.m_vertexCount - 1,
+                      shapes[i].blasFirstIndex,
+                      shapes[i].blasIndexCount,
+                      positions,
+                      scene.m_cache.getBlasIndices() };
+        }
+        else
+        {
+            input = { "BLAS " + std::to_string( i ),
+                      scene.m_positionBuffer,
+                      scene.m_indexBuffer,
+                      scene.m_vertexCount - 1,
+                      shapes[i].firstIndex,
+                      shapes[i].indexCount,
+                      positions,
+                      scene.m_cache.getIndices() };
+        }
+
+        //the cooked triangles are in Morton order, consecutive ones are close
+        for ( auto& chunk : ASBuilder::partition( input, chunkTriangles ) )
+        {
+            Scene::Shape range = shapes[i];
+
+            if ( split )
+            {
+                range.blasFirstIndex = chunk.firstIndex;
+                range.blasIndexCount = chunk.indexCount;
+            }
+            else
+            {
+                range.firstIndex = chunk.firstIndex;
+                range.indexCount = chunk.indexCount;
+            }
+
+            auto indices = static_cast<const uint32_t*>( chunk.hostIndexData );
+
+            glm::vec3 min( std::numeric_limits<float>::max() );
+            glm::vec3 max( std::numeric_limits<float>::lowest() );
+
+            for ( uint32_t j = 0; j < chunk.indexCount; ++j )
+            {
+                auto& position = positions[indices[chunk.firstIndex + j]];
+
+                min = glm::min( min, position );
+                max = glm::max( max, position );
+            }
+
+            m_chunks.push_back( range );
+            m_chunkMin.push_back( min );
+            m_chunkMax.push_back( max );
+            inputs.push_back( chunk );
+        }
+    }
+
+    firstChunks.push_back( static_cast<uint32_t>( m_chunks.size() ) );
+
+    return inputs;
+}
+
+void RayTracer::cmdWriteInstances( vk::CommandBuffer commandBuffer,
+                                   int frame )
+{
+    InstanceParams params;
+    params.model = m_model;
+    params.instanceCount = m_instanceCount;
+
+    commandBuffer.bindPipeline( vk::PipelineBindPoint::eCompute,
+                                m_instancePipeline.get() );
+    commandBuffer.bindDescriptorSets(
+        vk::PipelineBindPoint::eCompute, m_instancePipeline.getLayout(), 0,
+        m_instanceDescriptorSets[frame], nullptr );
+    commandBuffer.pushConstants( m_instancePipeline.getLayout(),
+                                 vk::ShaderStageFlagBits::eCompute, 0,
+                                 sizeof( InstanceParams ), &params );
+
+    commandBuffer.dispatch(
+        ( m_instanceCount + INSTANCE_GROUP_SIZE - 1 ) / INSTANCE_GROUP_SIZE, 1,
+        1 );
+
+    //compute write -> TLAS build read
+    vk::MemoryBarrier writeBarrier;
+    writeBarrier.srcAccessMask = vk::AccessFlagBits::eShaderWrite;
+    writeBarrier.dstAccessMask = vk::AccessFlagBits::eShaderRead;
+
+    commandBuffer.pipelineBarrier(
+        vk::PipelineStageFlagBits::eComputeShader,
+        vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, {},
+        writeBarrier, nullptr, nullptr );
 }
 
 void RayTracer::createAccumulationBuffer()
 {
     auto extent = AppState::instance().getSwapchainExtent();
-    vk::DeviceSize size = extent.width * extent.height * sizeof( glm::vec4 );
+    vk::DeviceSize size =
+        extent.width * extent.height * sizeof( Accumulation );
 
-    m_accBuffer = m_bufferAlloc.createDeviceBuffer(
-        "Accumulation Buffer", size, nullptr, false,
+    //only the traces use it, the BLAS builds at load time can borrow its
+    //memory for scratch. The first iteration clears it
+    m_accBuffer = m_bufferAlloc.createAliasedBuffer(
+        "Accumulation Buffer", ASBuilder::SCRATCH_ALIAS_GROUP, size,
         vk::BufferUsageFlagBits::eStorageBuffer );
+
+    //the tile lists are sized by the image too, up to every tile
+    uint32_t tiles = ( ( extent.width + TILE_SIZE - 1 ) / TILE_SIZE ) *
+                     ( ( extent.height + TILE_SIZE - 1 ) / TILE_SIZE );
+
+    for ( int i : std::views::iota( 0, m_framesInFlight ) )
+    {
+        m_tileBuffers.push_back( m_bufferAlloc.createDeviceBuffer(
+            "Active Tiles " + std::to_string( i ), tiles * sizeof( uint32_t ),
+            nullptr, false, vk::BufferUsageFlagBits::eStorageBuffer ) );
+    }
+}
+
+void RayTracer::writeAccumulationDescriptors()
+{
+    for ( int i : std::views::iota( 0, m_framesInFlight ) )
+    {
+        vk::DescriptorBufferInfo accBufferInfo;
+        accBufferInfo.buffer = m_accBuffer;
+        accBufferInfo.offset = 0;
+        accBufferInfo.range = VK_WHOLE_SIZE;
+
+        vk::DescriptorBufferInfo tileBufferInfo;
+        tileBufferInfo.buffer = m_tileBuffers[i];
+        tileBufferInfo.offset = 0;
+        tileBufferInfo.range = VK_WHOLE_SIZE;
+
+        vk::WriteDescriptorSet accBufferWrite;
+        accBufferWrite.dstSet = m_rtDescriptorSets[i];
+        accBufferWrite.dstBinding = 5;
+        accBufferWrite.dstArrayElement = 0;
+        accBufferWrite.descriptorType = vk::DescriptorType::eStorageBuffer;
+        accBufferWrite.descriptorCount = 1;
+        accBufferWrite.pBufferInfo = &accBufferInfo;
+        accBufferWrite.pImageInfo = nullptr;        // Optional
+        accBufferWrite.pTexelBufferView = nullptr;  // Optional
+
+        vk::WriteDescriptorSet tileBufferWrite;
+        tileBufferWrite.dstSet = m_rtDescriptorSets[i];
+        tileBufferWrite.dstBinding = 13;
+        tileBufferWrite.dstArrayElement = 0;
+        tileBufferWrite.descriptorType = vk::DescriptorType::eStorageBuffer;
+        tileBufferWrite.descriptorCount = 1;
+        tileBufferWrite.pBufferInfo = &tileBufferInfo;
+        tileBufferWrite.pImageInfo = nullptr;        // Optional
+        tileBufferWrite.pTexelBufferView = nullptr;  // Optional
+
+        //the same buffers, for the adaptive passes
+        vk::WriteDescriptorSet adaptiveAccBufferWrite = accBufferWrite;
+        adaptiveAccBufferWrite.dstSet = m_adaptiveDescriptorSets[i];
+        adaptiveAccBufferWrite.dstBinding = 1;
+
+        vk::WriteDescriptorSet adaptiveTileBufferWrite = tileBufferWrite;
+        adaptiveTileBufferWrite.dstSet = m_adaptiveDescriptorSets[i];
+        adaptiveTileBufferWrite.dstBinding = 2;
+
+        //the denoiser's guides, written by the raygen shader
+        vk::DescriptorBufferInfo aovBufferInfo;
+        aovBufferInfo.buffer = m_denoiser.getAovBuffer();
+        aovBufferInfo.offset = 0;
+        aovBufferInfo.range = VK_WHOLE_SIZE;
+
+        vk::WriteDescriptorSet aovBufferWrite;
+        aovBufferWrite.dstSet = m_rtDescriptorSets[i];
+        aovBufferWrite.dstBinding = 14;
+        aovBufferWrite.dstArrayElement = 0;
+        aovBufferWrite.descriptorType = vk::DescriptorType::eStorageBuffer;
+        aovBufferWrite.descriptorCount = 1;
+        aovBufferWrite.pBufferInfo = &aovBufferInfo;
+        aovBufferWrite.pImageInfo = nullptr;        // Optional
+        aovBufferWrite.pTexelBufferView = nullptr;  // Optional
+
+        std::vector<vk::WriteDescriptorSet> writeDescriptorSets = {
+            accBufferWrite, tileBufferWrite, adaptiveAccBufferWrite,
+            adaptiveTileBufferWrite, aovBufferWrite };
+
+        vkUpdateDescriptorSets(
+            m_device, static_cast<uint32_t>( writeDescriptorSets.size() ),
+            (VkWriteDescriptorSet*)writeDescriptorSets.data(), 0, nullptr );
+    }
+
+    m_denoiser.setAccumulationBuffer( m_accBuffer );
 }
 
 void RayTracer::createSBT()
@@ -126,9 +576,14 @@ void RayTracer::createSBT()
 
 void RayTracer::createRTDescriptorSets( std::vector<vk::Buffer>& uniforms,
                                         vk::DescriptorPool pool,
-                                        vk::Buffer vertexBuffer,
+                                        vk::Buffer positionBuffer,
                                         vk::Buffer indexBuffer,
-                                        vk::Buffer colorBuffer )
+                                        vk::Buffer attributeBuffer,
+                                        vk::Buffer materialBuffer,
+                                        vk::Buffer triangleMaterialBuffer,
+                                        vk::Buffer transformBuffer,
+                                        vk::Buffer blasIndexBuffer,
+                                        vk::Buffer blasPrimitiveBuffer )
 {
     m_rtDescriptorSets.push_back(
         m_descMgr.createSet( "RT Desc Set 1", m_rtDescriptorSetLayout, pool ) );
@@ -168,7 +623,7 @@ void RayTracer::createRTDescriptorSets( std::vector<vk::Buffer>& uniforms,
         uniformBufferWrite.pTexelBufferView = nullptr;  // Optional
 
         vk::DescriptorBufferInfo vertBufferInfo;
-        vertBufferInfo.buffer = vertexBuffer;
+        vertBufferInfo.buffer = positionBuffer;
         vertBufferInfo.offset = 0;
         vertBufferInfo.range = VK_WHOLE_SIZE;
 
@@ -197,58 +652,268 @@ void RayTracer::createRTDescriptorSets( std::vector<vk::Buffer>& uniforms,
         indexBufferWrite.pImageInfo = nullptr;        // Optional
         indexBufferWrite.pTexelBufferView = nullptr;  // Optional
 
-        vk::DescriptorBufferInfo accelBufferInfo;
-        accelBufferInfo.buffer = m_accBuffer;
-        accelBufferInfo.offset = 0;
-        accelBufferInfo.range = VK_WHOLE_SIZE;
-
-        vk::WriteDescriptorSet accelBufferWrite;
-        accelBufferWrite.dstSet = m_rtDescriptorSets[i];
-        accelBufferWrite.dstBinding = 5;
-        accelBufferWrite.dstArrayElement = 0;
-        accelBufferWrite.descriptorType = vk::DescriptorType::eStorageBuffer;
-        accelBufferWrite.descriptorCount = 1;
-        accelBufferWrite.pBufferInfo = &accelBufferInfo;
-        accelBufferWrite.pImageInfo = nullptr;        // Optional
-        accelBufferWrite.pTexelBufferView = nullptr;  // Optional
-
-        vk::DescriptorBufferInfo colorBufferInfo;
-        colorBufferInfo.buffer = colorBuffer;
-        colorBufferInfo.offset = 0;
-        colorBufferInfo.range = VK_WHOLE_SIZE;
-
-        vk::WriteDescriptorSet colorBufferWrite;
-        colorBufferWrite.dstSet = m_rtDescriptorSets[i];
-        colorBufferWrite.dstBinding = 6;
-        colorBufferWrite.dstArrayElement = 0;
-        colorBufferWrite.descriptorType = vk::DescriptorType::eStorageBuffer;
-        colorBufferWrite.descriptorCount = 1;
-        colorBufferWrite.pBufferInfo = &colorBufferInfo;
-        colorBufferWrite.pImageInfo = nullptr;        // Optional
-        colorBufferWrite.pTexelBufferView = nullptr;  // Optional
+        vk::DescriptorBufferInfo attribBufferInfo;
+        attribBufferInfo.buffer = attributeBuffer;
+        attribBufferInfo.offset = 0;
+        attribBufferInfo.range = VK_WHOLE_SIZE;
+
+        vk::WriteDescriptorSet attribBufferWrite;
+        attribBufferWrite.dstSet = m_rtDescriptorSets[i];
+        attribBufferWrite.dstBinding = 6;
+        attribBufferWrite.dstArrayElement = 0;
+        attribBufferWrite.descriptorType = vk::DescriptorType::eStorageBuffer;
+        attribBufferWrite.descriptorCount = 1;
+        attribBufferWrite.pBufferInfo = &attribBufferInfo;
+        attribBufferWrite.pImageInfo = nullptr;        // Optional
+        attribBufferWrite.pTexelBufferView = nullptr;  // Optional
+
+        vk::DescriptorBufferInfo materialBufferInfo;
+        materialBufferInfo.buffer = materialBuffer;
+        materialBufferInfo.offset = 0;
+        materialBufferInfo.range = VK_WHOLE_SIZE;
+
+        vk::WriteDescriptorSet materialBufferWrite;
+        materialBufferWrite.dstSet = m_rtDescriptorSets[i];
+        materialBufferWrite.dstBinding = 7;
+        materialBufferWrite.dstArrayElement = 0;
+        materialBufferWrite.descriptorType =
+            vk::DescriptorType::eStorageBuffer;
+        materialBufferWrite.descriptorCount = 1;
+        materialBufferWrite.pBufferInfo = &materialBufferInfo;
+        materialBufferWrite.pImageInfo = nullptr;        // Optional
+        materialBufferWrite.pTexelBufferView = nullptr;  // Optional
+
+        vk::DescriptorBufferInfo triangleMaterialBufferInfo;
+        triangleMaterialBufferInfo.buffer = triangleMaterialBuffer;
+        triangleMaterialBufferInfo.offset = 0;
+        triangleMaterialBufferInfo.range = VK_WHOLE_SIZE;
+
+        vk::WriteDescriptorSet triangleMaterialBufferWrite;
+        triangleMaterialBufferWrite.dstSet = m_rtDescriptorSets[i];
+        triangleMaterialBufferWrite.dstBinding = 8;
+        triangleMaterialBufferWrite.dstArrayElement = 0;
+        triangleMaterialBufferWrite.descriptorType =
+            vk::DescriptorType::eStorageBuffer;
+        triangleMaterialBufferWrite.descriptorCount = 1;
+        triangleMaterialBufferWrite.pBufferInfo = &triangleMaterialBufferInfo;
+        triangleMaterialBufferWrite.pImageInfo = nullptr;        // Optional
+        triangleMaterialBufferWrite.pTexelBufferView = nullptr;  // Optional
+
+        vk::DescriptorBufferInfo chunkBufferInfo;
+        chunkBufferInfo.buffer = m_chunkBuffer;
+        chunkBufferInfo.offset = 0;
+        chunkBufferInfo.range = VK_WHOLE_SIZE;
+
+        vk::WriteDescriptorSet chunkBufferWrite;
+        chunkBufferWrite.dstSet = m_rtDescriptorSets[i];
+        chunkBufferWrite.dstBinding = 9;
+        chunkBufferWrite.dstArrayElement = 0;
+        chunkBufferWrite.descriptorType = vk::DescriptorType::eStorageBuffer;
+        chunkBufferWrite.descriptorCount = 1;
+        chunkBufferWrite.pBufferInfo = &chunkBufferInfo;
+        chunkBufferWrite.pImageInfo = nullptr;        // Optional
+        chunkBufferWrite.pTexelBufferView = nullptr;  // Optional
+
+        vk::DescriptorBufferInfo rayCountBufferInfo;
+        rayCountBufferInfo.buffer = m_rayCountBuffers[i];
+        rayCountBufferInfo.offset = 0;
+        rayCountBufferInfo.range = VK_WHOLE_SIZE;
+
+        vk::WriteDescriptorSet rayCountBufferWrite;
+        rayCountBufferWrite.dstSet = m_rtDescriptorSets[i];
+        rayCountBufferWrite.dstBinding = 10;
+        rayCountBufferWrite.dstArrayElement = 0;
+        rayCountBufferWrite.descriptorType = vk::DescriptorType::eStorageBuffer;
+        rayCountBufferWrite.descriptorCount = 1;
+        rayCountBufferWrite.pBufferInfo = &rayCountBufferInfo;
+        rayCountBufferWrite.pImageInfo = nullptr;        // Optional
+        rayCountBufferWrite.pTexelBufferView = nullptr;  // Optional
+
+        vk::DescriptorBufferInfo blasIndexBufferInfo;
+        blasIndexBufferInfo.buffer = blasIndexBuffer;
+        blasIndexBufferInfo.offset = 0;
+        blasIndexBufferInfo.range = VK_WHOLE_SIZE;
+
+        vk::WriteDescriptorSet blasIndexBufferWrite;
+        blasIndexBufferWrite.dstSet = m_rtDescriptorSets[i];
+        blasIndexBufferWrite.dstBinding = 11;
+        blasIndexBufferWrite.dstArrayElement = 0;
+        blasIndexBufferWrite.descriptorType =
+            vk::DescriptorType::eStorageBuffer;
+        blasIndexBufferWrite.descriptorCount = 1;
+        blasIndexBufferWrite.pBufferInfo = &blasIndexBufferInfo;
+        blasIndexBufferWrite.pImageInfo = nullptr;        // Optional
+        blasIndexBufferWrite.pTexelBufferView = nullptr;  // Optional
+
+        vk::DescriptorBufferInfo blasPrimitiveBufferInfo;
+        blasPrimitiveBufferInfo.buffer = blasPrimitiveBuffer;
+        blasPrimitiveBufferInfo.offset = 0;
+        blasPrimitiveBufferInfo.range = VK_WHOLE_SIZE;
+
+        vk::WriteDescriptorSet blasPrimitiveBufferWrite;
+        blasPrimitiveBufferWrite.dstSet = m_rtDescriptorSets[i];
+        blasPrimitiveBufferWrite.dstBinding = 12;
+        blasPrimitiveBufferWrite.dstArrayElement = 0;
+        blasPrimitiveBufferWrite.descriptorType =
+            vk::DescriptorType::eStorageBuffer;
+        blasPrimitiveBufferWrite.descriptorCount = 1;
+        blasPrimitiveBufferWrite.pBufferInfo = &blasPrimitiveBufferInfo;
+        blasPrimitiveBufferWrite.pImageInfo = nullptr;        // Optional
+        blasPrimitiveBufferWrite.pTexelBufferView = nullptr;  // Optional
 
         std::vector<vk::WriteDescriptorSet> writeDescriptorSets = {
-            asWrite, uniformBufferWrite, vertexBufferWrite, indexBufferWrite,
-            accelBufferWrite, colorBufferWrite };
+            asWrite,          uniformBufferWrite, vertexBufferWrite,
+            indexBufferWrite, attribBufferWrite,
+            materialBufferWrite, triangleMaterialBufferWrite, chunkBufferWrite,
+            rayCountBufferWrite, blasIndexBufferWrite,
+            blasPrimitiveBufferWrite };
 
         vkUpdateDescriptorSets(
-            m_device, 6, (VkWriteDescriptorSet*)writeDescriptorSets.data(), 0,
+            m_device, static_cast<uint32_t>( writeDescriptorSets.size() ), (VkWriteDescriptorSet*)writeDescriptorSets.data(), 0,
             nullptr );
     }
+
+    //the instance shader, one set per frame's instance buffer
+    for ( int i : std::views::iota( 0, m_framesInFlight ) )
+    {
+        m_instanceDescriptorSets.push_back( m_descMgr.createSet(
+            "Instance Desc Set " + std::to_string( i ),
+            m_instanceDescriptorSetLayout, pool ) );
+
+        vk::DescriptorBufferInfo transformBufferInfo;
+        transformBufferInfo.buffer = transformBuffer;
+        transformBufferInfo.offset = 0;
+        transformBufferInfo.range = VK_WHOLE_SIZE;
+
+        vk::WriteDescriptorSet transformBufferWrite;
+        transformBufferWrite.dstSet = m_instanceDescriptorSets[i];
+        transformBufferWrite.dstBinding = 0;
+        transformBufferWrite.dstArrayElement = 0;
+        transformBufferWrite.descriptorType =
+            vk::DescriptorType::eStorageBuffer;
+        transformBufferWrite.descriptorCount = 1;
+        transformBufferWrite.pBufferInfo = &transformBufferInfo;
+        transformBufferWrite.pImageInfo = nullptr;        // Optional
+        transformBufferWrite.pTexelBufferView = nullptr;  // Optional
+
+        vk::DescriptorBufferInfo addressBufferInfo;
+        addressBufferInfo.buffer = m_blasAddressBuffer;
+        addressBufferInfo.offset = 0;
+        addressBufferInfo.range = VK_WHOLE_SIZE;
+
+        vk::WriteDescriptorSet addressBufferWrite;
+        addressBufferWrite.dstSet = m_instanceDescriptorSets[i];
+        addressBufferWrite.dstBinding = 1;
+        addressBufferWrite.dstArrayElement = 0;
+        addressBufferWrite.descriptorType = vk::DescriptorType::eStorageBuffer;
+        addressBufferWrite.descriptorCount = 1;
+        addressBufferWrite.pBufferInfo = &addressBufferInfo;
+        addressBufferWrite.pImageInfo = nullptr;        // Optional
+        addressBufferWrite.pTexelBufferView = nullptr;  // Optional
+
+        vk::DescriptorBufferInfo instanceBufferInfo;
+        instanceBufferInfo.buffer = m_asBuilder.getInstanceBuffer( i );
+        instanceBufferInfo.offset = 0;
+        instanceBufferInfo.range = VK_WHOLE_SIZE;
+
+        vk::WriteDescriptorSet instanceBufferWrite;
+        instanceBufferWrite.dstSet = m_instanceDescriptorSets[i];
+        instanceBufferWrite.dstBinding = 2;
+        instanceBufferWrite.dstArrayElement = 0;
+        instanceBufferWrite.descriptorType =
+            vk::DescriptorType::eStorageBuffer;
+        instanceBufferWrite.descriptorCount = 1;
+        instanceBufferWrite.pBufferInfo = &instanceBufferInfo;
+        instanceBufferWrite.pImageInfo = nullptr;        // Optional
+        instanceBufferWrite.pTexelBufferView = nullptr;  // Optional
+
+        vk::DescriptorBufferInfo instanceChunkBufferInfo;
+        instanceChunkBufferInfo.buffer = m_instanceChunkBuffer;
+        instanceChunkBufferInfo.offset = 0;
+        instanceChunkBufferInfo.range = VK_WHOLE_SIZE;
+
+        vk::WriteDescriptorSet instanceChunkBufferWrite;
+        instanceChunkBufferWrite.dstSet = m_instanceDescriptorSets[i];
+        instanceChunkBufferWrite.dstBinding = 3;
+        instanceChunkBufferWrite.dstArrayElement = 0;
+        instanceChunkBufferWrite.descriptorType =
+            vk::DescriptorType::eStorageBuffer;
+        instanceChunkBufferWrite.descriptorCount = 1;
+        instanceChunkBufferWrite.pBufferInfo = &instanceChunkBufferInfo;
+        instanceChunkBufferWrite.pImageInfo = nullptr;        // Optional
+        instanceChunkBufferWrite.pTexelBufferView = nullptr;  // Optional
+
+        std::vector<vk::WriteDescriptorSet> writeDescriptorSets = {
+            transformBufferWrite, addressBufferWrite, instanceBufferWrite,
+            instanceChunkBufferWrite };
+
+        vkUpdateDescriptorSets(
+            m_device, static_cast<uint32_t>( writeDescriptorSets.size() ),
+            (VkWriteDescriptorSet*)writeDescriptorSets.data(), 0, nullptr );
+    }
+
+    //the adaptive passes, the image is set per frame by setRTRenderTarget()
+    for ( int i : std::views::iota( 0, m_framesInFlight ) )
+    {
+        m_adaptiveDescriptorSets.push_back( m_descMgr.createSet(
+            "Adaptive Desc Set " + std::to_string( i ),
+            m_adaptiveDescriptorSetLayout, pool ) );
+
+        vk::DescriptorBufferInfo bufferInfo;
+        bufferInfo.buffer = uniforms[i];
+        bufferInfo.offset = 0;
+        bufferInfo.range = sizeof( BRRender::UniformBufferObject );
+
+        vk::WriteDescriptorSet uniformBufferWrite;
+        uniformBufferWrite.dstSet = m_adaptiveDescriptorSets[i];
+        uniformBufferWrite.dstBinding = 0;
+        uniformBufferWrite.dstArrayElement = 0;
+        uniformBufferWrite.descriptorType = vk::DescriptorType::eUniformBuffer;
+        uniformBufferWrite.descriptorCount = 1;
+        uniformBufferWrite.pBufferInfo = &bufferInfo;
+        uniformBufferWrite.pImageInfo = nullptr;        // Optional
+        uniformBufferWrite.pTexelBufferView = nullptr;  // Optional
+
+        vk::DescriptorBufferInfo launchBufferInfo;
+        launchBufferInfo.buffer = m_launchBuffers[i];
+        launchBufferInfo.offset = 0;
+        launchBufferInfo.range = VK_WHOLE_SIZE;
+
+        vk::WriteDescriptorSet launchBufferWrite;
+        launchBufferWrite.dstSet = m_adaptiveDescriptorSets[i];
+        launchBufferWrite.dstBinding = 3;
+        launchBufferWrite.dstArrayElement = 0;
+        launchBufferWrite.descriptorType = vk::DescriptorType::eStorageBuffer;
+        launchBufferWrite.descriptorCount = 1;
+        launchBufferWrite.pBufferInfo = &launchBufferInfo;
+        launchBufferWrite.pImageInfo = nullptr;        // Optional
+        launchBufferWrite.pTexelBufferView = nullptr;  // Optional
+
+        std::vector<vk::WriteDescriptorSet> writeDescriptorSets = {
+            uniformBufferWrite, launchBufferWrite };
+
+        vkUpdateDescriptorSets(
+            m_device, static_cast<uint32_t>( writeDescriptorSets.size() ),
+            (VkWriteDescriptorSet*)writeDescriptorSets.data(), 0, nullptr );
+    }
+
+    m_denoiser.createDescriptorSets( pool );
+
+    writeAccumulationDescriptors();
 }
 
 void RayTracer::setRTRenderTarget( uint32_t imageIndex, int currentFrame )
 {
     auto views = AppState::instance().getImageViews();
 
-    //the render target
+    //the render target, written by resolve.comp
     vk::DescriptorImageInfo imageInfo;
     imageInfo.imageView = views[imageIndex];
     imageInfo.imageLayout = vk::ImageLayout::eGeneral;
 
     vk::WriteDescriptorSet write;
-    write.dstSet = m_rtDescriptorSets[currentFrame];
-    write.dstBinding = 1;
+    write.dstSet = m_adaptiveDescriptorSets[currentFrame];
+    write.dstBinding = 4;
     write.dstArrayElement = 0;
     write.descriptorType = vk::DescriptorType::eStorageImage;
     write.descriptorCount = 1;
@@ -259,6 +924,8 @@ void RayTracer::setRTRenderTarget( uint32_t imageIndex, int currentFrame )
 
     vkUpdateDescriptorSets( m_device, 1, (VkWriteDescriptorSet*)&write, 0,
                             nullptr );
+
+    m_denoiser.setRenderTarget( views[imageIndex], currentFrame );
 }
 
 void RayTracer::recordRTCommandBuffer( vk::CommandBuffer commandBuffer,
@@ -269,6 +936,31 @@ void RayTracer::recordRTCommandBuffer( vk::CommandBuffer commandBuffer,
 
     vk::Image srcImage = AppState::instance().getSwapchainImage( imageIndex );
 
+    //the frame's fence was waited on, its last timestamps are ready
+    readTraceTime( currentFrame );
+
+    //the TLAS bounds come from the BLASes, it's refit after them
+    bool blasesChanged = m_refitPending || !m_editedChunks.empty();
+
+    if ( !m_editedChunks.empty() )
+        cmdRebuildEdited( commandBuffer, currentFrame );
+
+    else if ( m_refitPending )
+        m_asBuilder.cmdRefitBlas( commandBuffer, currentFrame, m_blases );
+
+    m_refitPending = false;
+
+    //only rewrite the instances when the model moved, the TLAS keeps the
+    //last transform. The first build, then refits
+    if ( m_tlasEmpty || m_model != m_tlasModel || blasesChanged )
+    {
+        cmdWriteInstances( commandBuffer, currentFrame );
+        m_asBuilder.cmdBuildGpuTlas( commandBuffer, currentFrame, m_tlas,
+                                     m_instanceCount );
+        m_tlasModel = m_model;
+        m_tlasEmpty = false;
+    }
+
     vk::ImageSubresourceRange range;
     range.aspectMask = vk::ImageAspectFlagBits::eColor;
     range.baseMipLevel = 0;
@@ -276,12 +968,51 @@ void RayTracer::recordRTCommandBuffer( vk::CommandBuffer commandBuffer,
     range.baseArrayLayer = 0;
     range.layerCount = 1;
 
-    // memory read -> transfer read
-    // undefined -> transfer source
-    imageBarrier( commandBuffer, srcImage, range,
-                  vk::AccessFlagBits::eMemoryRead,
-                  vk::AccessFlagBits::eShaderWrite, vk::ImageLayout::eUndefined,
-                  vk::ImageLayout::eGeneral );
+    uint32_t tilesX = ( extent.width + TILE_SIZE - 1 ) / TILE_SIZE;
+    uint32_t tilesY = ( extent.height + TILE_SIZE - 1 ) / TILE_SIZE;
+
+    //the launch is a row of TILE_SIZE^2 rays per active tile, counted by
+    //adaptive.comp
+    AdaptiveLaunch launch{};
+    launch.command.width = TILE_SIZE * TILE_SIZE;
+    launch.command.height = 0;
+    launch.command.depth = 1;
+
+    commandBuffer.updateBuffer( m_launchBuffers[currentFrame], 0,
+                                sizeof( AdaptiveLaunch ), &launch );
+
+    //the last trace's sums, and the reset launch -> the tile list pass
+    vk::MemoryBarrier sumsBarrier;
+    sumsBarrier.srcAccessMask =
+        vk::AccessFlagBits::eShaderWrite | vk::AccessFlagBits::eTransferWrite;
+    sumsBarrier.dstAccessMask =
+        vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite;
+
+    commandBuffer.pipelineBarrier(
+        vk::PipelineStageFlagBits::eRayTracingShaderKHR |
+            vk::PipelineStageFlagBits::eTransfer,
+        vk::PipelineStageFlagBits::eComputeShader, {}, sumsBarrier, nullptr,
+        nullptr );
+
+    commandBuffer.bindPipeline( vk::PipelineBindPoint::eCompute,
+                                m_adaptivePipeline.get() );
+    commandBuffer.bindDescriptorSets(
+        vk::PipelineBindPoint::eCompute, m_adaptivePipeline.getLayout(), 0,
+        m_adaptiveDescriptorSets[currentFrame], nullptr );
+
+    commandBuffer.dispatch( tilesX, tilesY, 1 );
+
+    //tile list -> the indirect launch, and the raygen shader
+    vk::MemoryBarrier tileBarrier;
+    tileBarrier.srcAccessMask = vk::AccessFlagBits::eShaderWrite;
+    tileBarrier.dstAccessMask = vk::AccessFlagBits::eIndirectCommandRead |
+                                vk::AccessFlagBits::eShaderRead;
+
+    commandBuffer.pipelineBarrier(
+        vk::PipelineStageFlagBits::eComputeShader,
+        vk::PipelineStageFlagBits::eDrawIndirect |
+            vk::PipelineStageFlagBits::eRayTracingShaderKHR,
+        {}, tileBarrier, nullptr, nullptr );
 
     commandBuffer.bindPipeline( vk::PipelineBindPoint::eRayTracingKHR,
                                 m_pipeline.get() );
@@ -291,6 +1022,18 @@ void RayTracer::recordRTCommandBuffer( vk::CommandBuffer commandBuffer,
         m_pipeline.getLayout(), 0, 1,
         (VkDescriptorSet*)&m_rtDescriptorSets[currentFrame], 0, nullptr );
 
+    LaunchConstants constants;
+    constants.samples = m_samplesPerLaunch;
+    constants.firstSample = m_launchedSamples;
+
+    commandBuffer.pushConstants( m_pipeline.getLayout(),
+                                 vk::ShaderStageFlagBits::eRaygenKHR, 0,
+                                 sizeof( LaunchConstants ), &constants );
+
+    //the controller needs the samples the measured frame traced
+    m_frameSamples[currentFrame] = m_samplesPerLaunch;
+    m_launchedSamples += m_samplesPerLaunch;
+
     const uint32_t handleSize =
         AppState::instance().rayTracingPipelineProperties.shaderGroupHandleSize;
     const uint32_t handleSizeAlignment =
@@ -319,13 +1062,58 @@ void RayTracer::recordRTCommandBuffer( vk::CommandBuffer commandBuffer,
 
     VkStridedDeviceAddressRegionKHR callableShaderSbtEntry{};
 
-    //Ray Trace
-    AppState::instance().vkCmdTraceRaysKHR(
+    uint32_t query = 4 * currentFrame;
+
+    commandBuffer.resetQueryPool( m_traceTimestamps, query, 2 );
+    commandBuffer.writeTimestamp( vk::PipelineStageFlagBits::eTopOfPipe,
+                                  m_traceTimestamps, query );
+
+    //Ray Trace, only the active tiles, samplesPerLaunch samples per pixel
+    AppState::instance().vkCmdTraceRaysIndirectKHR(
         commandBuffer, &raygenShaderSbtEntry, &missShaderSbtEntry,
-        &hitShaderSbtEntry, &callableShaderSbtEntry, extent.width,
-        ( extent.height / 2 ) * 2, 1 );
-    //Height needs to be multiple of 2, not sure why, otherwise accumulation breaks
-    //TODO: Figure out why this is happening
+        &hitShaderSbtEntry, &callableShaderSbtEntry,
+        m_bufferAlloc.getDeviceAddress( m_launchBuffers[currentFrame] ) );
+
+    commandBuffer.writeTimestamp(
+        vk::PipelineStageFlagBits::eRayTracingShaderKHR, m_traceTimestamps,
+        query + 1 );
+
+    m_traceTimestampsWritten[currentFrame] = true;
+
+    //sums -> resolve
+    vk::MemoryBarrier resolveBarrier;
+    resolveBarrier.srcAccessMask = vk::AccessFlagBits::eShaderWrite;
+    resolveBarrier.dstAccessMask = vk::AccessFlagBits::eShaderRead;
+
+    commandBuffer.pipelineBarrier(
+        vk::PipelineStageFlagBits::eRayTracingShaderKHR,
+        vk::PipelineStageFlagBits::eComputeShader, {}, resolveBarrier,
+        nullptr, nullptr );
+
+    // memory read -> shader write
+    // undefined -> general
+    imageBarrier( commandBuffer, srcImage, range,
+                  vk::AccessFlagBits::eMemoryRead,
+                  vk::AccessFlagBits::eShaderWrite, vk::ImageLayout::eUndefined,
+                  vk::ImageLayout::eGeneral );
+
+    if ( m_denoise )
+    {
+        m_denoiser.cmdDenoise( commandBuffer, currentFrame, m_model, m_view,
+                               m_proj, m_samplesPerLaunch );
+    }
+
+    else
+    {
+        //every pixel, the skipped tiles show their converged sums
+        commandBuffer.bindPipeline( vk::PipelineBindPoint::eCompute,
+                                    m_resolvePipeline.get() );
+        commandBuffer.bindDescriptorSets(
+            vk::PipelineBindPoint::eCompute, m_resolvePipeline.getLayout(), 0,
+            m_adaptiveDescriptorSets[currentFrame], nullptr );
+
+        commandBuffer.dispatch( tilesX, tilesY, 1 );
+    }
 
     imageBarrier( commandBuffer, srcImage, range,
                   vk::AccessFlagBits::eShaderWrite,
@@ -336,41 +1124,306 @@ void RayTracer::recordRTCommandBuffer( vk::CommandBuffer commandBuffer,
 void RayTracer::resize()
 {
     m_bufferAlloc.free( m_accBuffer );
+
+    for ( auto buffer : m_tileBuffers )
+        m_bufferAlloc.free( buffer );
+
+    m_tileBuffers.clear();
+
     createAccumulationBuffer();
+    m_denoiser.resize();
+    writeAccumulationDescriptors();
+}
 
-    for ( int i : std::views::iota( 0, m_framesInFlight ) )
+void RayTracer::updateTLAS( glm::mat4 model )
+{
+    m_model = model;
+}
+
+void RayTracer::updateCamera( glm::mat4 view, glm::mat4 proj )
+{
+    m_view = view;
+    m_proj = proj;
+}
+
+void RayTracer::refitBLAS()
+{
+    assert( m_deformable );
+    m_refitPending = true;
+}
+
+void RayTracer::editRegion( glm::vec3 center, float radius, glm::vec3 offset,
+                            Clock::time_point requested )
+{
+    assert( m_deformable );
+
+    if ( m_editedChunks.empty() )
+        m_editStart = requested;
+
+    for ( uint32_t i = 0; i < m_chunks.size(); ++i )
     {
-        vk::DescriptorBufferInfo accelBufferInfo;
-        accelBufferInfo.buffer = m_accBuffer;
-        accelBufferInfo.offset = 0;
-        accelBufferInfo.range = VK_WHOLE_SIZE;
-
-        vk::WriteDescriptorSet accelBufferWrite;
-        accelBufferWrite.dstSet = m_rtDescriptorSets[i];
-        accelBufferWrite.dstBinding = 5;
-        accelBufferWrite.dstArrayElement = 0;
-        accelBufferWrite.descriptorType = vk::DescriptorType::eStorageBuffer;
-        accelBufferWrite.descriptorCount = 1;
-        accelBufferWrite.pBufferInfo = &accelBufferInfo;
-        accelBufferWrite.pImageInfo = nullptr;        // Optional
-        accelBufferWrite.pTexelBufferView = nullptr;  // Optional
+        //closest point of the bounds to the center
+        glm::vec3 closest = glm::clamp( center, m_chunkMin[i], m_chunkMax[i] );
+        glm::vec3 d = closest - center;
 
-        std::vector<vk::WriteDescriptorSet> writeDescriptorSets = {
-            accelBufferWrite };
+        if ( glm::dot( d, d ) > radius * radius )
+            continue;
 
-        vkUpdateDescriptorSets(
-            m_device, 1, (VkWriteDescriptorSet*)writeDescriptorSets.data(), 0,
-            nullptr );
+        m_editedChunks.insert( i );
+
+        //the moved vertices may leave the bounds, later edits must see them
+        m_chunkMin[i] = glm::min( m_chunkMin[i], m_chunkMin[i] + offset );
+        m_chunkMax[i] = glm::max( m_chunkMax[i], m_chunkMax[i] + offset );
     }
 }
 
-void RayTracer::updateTLAS( glm::mat4 model )
+void RayTracer::cmdRebuildEdited( vk::CommandBuffer commandBuffer, int frame )
+{
+    std::set<vk::AccelerationStructureKHR> edited;
+    EditStats stats;
+
+    for ( auto chunk : m_editedChunks )
+    {
+        edited.insert( m_blases[chunk] );
+
+        stats.chunks++;
+        stats.triangles += m_chunks[chunk].blasIndexCount > 0
+                               ? m_chunks[chunk].blasIndexCount / 3
+                               : m_chunks[chunk].indexCount / 3;
+    }
+
+    //deforming refits everything anyway, the edited chunks are rebuilt
+    //in the same pass. Otherwise only they are touched
+    std::vector<vk::AccelerationStructureKHR> blases;
+
+    if ( m_refitPending )
+        blases = m_blases;
+    else
+        blases.assign( edited.begin(), edited.end() );
+
+    uint32_t query = 4 * frame + 2;
+
+    commandBuffer.resetQueryPool( m_traceTimestamps, query, 2 );
+    commandBuffer.writeTimestamp( vk::PipelineStageFlagBits::eTopOfPipe,
+                                  m_traceTimestamps, query );
+
+    m_asBuilder.cmdRefitBlas( commandBuffer, frame, blases, edited );
+
+    commandBuffer.writeTimestamp(
+        vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR,
+        m_traceTimestamps, query + 1 );
+
+    m_frameEdits[frame] = stats;
+    m_frameEditStarts[frame] = m_editStart;
+    m_frameEditEnds[frame] = Clock::time_point();
+    m_editedChunks.clear();
+}
+
+void RayTracer::frameFinished( int frame )
+{
+    //the first sighting only, the fence stays signalled until the slot is
+    //recorded again
+    if ( m_frameEdits[frame].chunks > 0 &&
+         m_frameEditEnds[frame] == Clock::time_point() )
+        m_frameEditEnds[frame] = Clock::now();
+}
+
+const RayTracer::EditStats& RayTracer::getEditStats()
 {
-    m_asBuilder.updateTlas( m_tlas, m_blas, model );
+    return m_editStats;
+}
+
+void RayTracer::setRefitPolicy( const ASBuilder::RefitPolicy& policy )
+{
+    m_asBuilder.setRefitPolicy( policy );
+}
+
+const ASBuilder::RefitStats& RayTracer::getRefitStats()
+{
+    return m_asBuilder.getRefitStats();
+}
+
+void RayTracer::readTraceTime( int frame )
+{
+    if ( !m_traceTimestampsWritten[frame] )
+        return;
+
+    //the edit timestamps are only there if the frame rebuilt chunks
+    bool edited = m_frameEdits[frame].chunks > 0;
+
+    uint64_t timestamps[4];
+
+    auto result = m_device.getQueryPoolResults(
+        m_traceTimestamps, 4 * frame, edited ? 4 : 2,
+        ( edited ? 4 : 2 ) * sizeof( uint64_t ), timestamps,
+        sizeof( uint64_t ), vk::QueryResultFlagBits::e64 );
+
+    if ( result != vk::Result::eSuccess )
+        return;
+
+    m_traceTimestampsWritten[frame] = false;
+
+    //ticks -> ms
+    const double period = AppState::instance()
+                              .getPhysicalDevice()
+                              .getProperties()
+                              .limits.timestampPeriod /
+                          1e6;
+
+    m_traceMs = ( timestamps[1] - timestamps[0] ) * period;
+
+    if ( edited )
+    {
+        m_editStats = m_frameEdits[frame];
+        m_editStats.rebuildMs = ( timestamps[3] - timestamps[2] ) * period;
+        //frameFinished() wasn't called for it, now is the best there is
+        if ( m_frameEditEnds[frame] == Clock::time_point() )
+            m_frameEditEnds[frame] = Clock::now();
+
+        m_editStats.latencyMs =
+            std::chrono::duration<double, std::milli>(
+                m_frameEditEnds[frame] - m_frameEditStarts[frame] )
+                .count();
+
+        m_frameEdits[frame] = EditStats();
+        m_frameEditEnds[frame] = Clock::time_point();
+
+        printf( "Edit: %u chunks, %u triangles, rebuild %.2f ms, latency "
+                "%.1f ms\n",
+                m_editStats.chunks, m_editStats.triangles,
+                m_editStats.rebuildMs, m_editStats.latencyMs );
+    }
+
+    //the count of the same frame, zeroed for the next one
+    auto rays = static_cast<uint32_t*>(
+        m_bufferAlloc.getMapping( m_rayCountBuffers[frame] ) );
+
+    m_rayCount = *rays;
+    *rays = 0;
+
+    auto launch = static_cast<AdaptiveLaunch*>(
+        m_bufferAlloc.getMapping( m_launchBuffers[frame] ) );
+
+    m_activePixels = launch->activePixels;
+    m_traceSamples = m_frameSamples[frame];
+
+    updateSamplesPerLaunch();
+}
+
+void RayTracer::updateSamplesPerLaunch()
+{
+    if ( !m_autoSamples || m_activePixels == 0 || m_traceMs <= 0.0 )
+        return;
+
+    //per sample of a pixel, as the active pixels come and go
+    double sampleMs = m_traceMs / ( double( m_traceSamples ) * m_activePixels );
+
+    m_sampleMs = m_sampleMs > 0.0
+                     ? m_sampleMs + SAMPLE_COST_SMOOTHING *
+                                        ( sampleMs - m_sampleMs )
+                     : sampleMs;
+
+    //Budgeted for every pixel - the next frame may restart the accumulation,
+    //and the GPU decides which tiles it traces. The denoiser's time comes
+    //out of the same budget
+    auto extent = AppState::instance().getSwapchainExtent();
+    double pixelCount = double( extent.width ) * extent.height;
+
+    double budget = m_frameBudgetMs - getDenoiseMs();
+    double samples = std::max( budget / ( m_sampleMs * pixelCount ), 1.0 );
+
+    //at most double or halve per step, the timestamps are frames in flight
+    //behind the launches
+    uint32_t next = static_cast<uint32_t>(
+        std::min( samples, double( MAX_SAMPLES_PER_LAUNCH ) ) );
+
+    next = std::clamp( next, std::max( m_samplesPerLaunch / 2, 1u ),
+                       m_samplesPerLaunch * 2 );
+
+    m_samplesPerLaunch = std::min( next, MAX_SAMPLES_PER_LAUNCH );
+}
+
+double RayTracer::getTraceMs()
+{
+    return m_traceMs;
+}
+
+double RayTracer::getRaysPerSecond()
+{
+    return m_traceMs > 0.0 ? m_rayCount / ( m_traceMs / 1000.0 ) : 0.0;
+}
+
+double RayTracer::getRaysPerPixel()
+{
+    return m_activePixels > 0
+               ? double( m_rayCount ) / ( double( m_activePixels ) *
+                                          m_traceSamples )
+               : 0.0;
+}
+
+uint32_t RayTracer::getActivePixels()
+{
+    return m_activePixels;
+}
+
+void RayTracer::setDenoise( bool enabled, uint32_t iterations )
+{
+    //the history stopped when it was turned off
+    if ( enabled && !m_denoise )
+        m_denoiser.resetHistory();
+
+    m_denoise = enabled;
+    m_denoiser.setIterations( iterations );
+}
+
+void RayTracer::setSampleBudget( bool automatic, uint32_t samples,
+                                 double frameMs )
+{
+    m_autoSamples = automatic;
+    m_frameBudgetMs = frameMs;
+
+    //the controller starts from the last manual count
+    if ( !automatic )
+        m_samplesPerLaunch =
+            std::clamp( samples, 1u, MAX_SAMPLES_PER_LAUNCH );
+}
+
+uint32_t RayTracer::getSamplesPerLaunch()
+{
+    return m_samplesPerLaunch;
+}
+
+void RayTracer::resetDenoiseHistory()
+{
+    m_denoiser.resetHistory();
+}
+
+double RayTracer::getDenoiseMs()
+{
+    return m_denoise ? m_denoiser.getDenoiseMs() : 0.0;
 }
 
 void RayTracer::destroy()
 {
+    m_device.destroyQueryPool( m_traceTimestamps );
+
     m_asBuilder.destroy();
+    m_denoiser.destroy();
     m_pipeline.destroy();
+    m_instancePipeline.destroy();
+    m_bufferAlloc.free( m_blasAddressBuffer );
+    m_bufferAlloc.free( m_chunkBuffer );
+    m_bufferAlloc.free( m_instanceChunkBuffer );
+
+    for ( auto buffer : m_rayCountBuffers )
+        m_bufferAlloc.free( buffer );
+
+    m_adaptivePipeline.destroy();
+    m_resolvePipeline.destroy();
+
+    for ( auto buffer : m_tileBuffers )
+        m_bufferAlloc.free( buffer );
+
+    for ( auto buffer : m_launchBuffers )
+        m_bufferAlloc.free( buffer );
 }
\ No newline at end of file
@@ -1,9 +1,15 @@
 #pragma once
 
+#include <BRComputePipeline.h>
 #include <BRRTPipeline.h>
 #include <BRRaster.h>
+#include <BRScene.h>
+
+#include <chrono>
+#include <set>
 
 #include "BRASBuilder.h"
+#include "BRDenoiser.h"
 #include "BRDescMgr.h"
 
 namespace BR
@@ -16,17 +22,26 @@ class RayTracer
 
     void init();
 
-    void createAS( std::vector<uint32_t>& indices, vk::Buffer vertexBuffer,
-                   vk::Buffer indexBuffer );
+    //one BLAS per chunk of a unique shape, see BLAS_CHUNK_TRIANGLES, one
+    //TLAS instance per chunk of a placed shape
+    //the BLASes come from the model's .bras cache when it's valid
+    //deformable builds dynamic BLASes, see refitBLAS() and editRegion()
+    //the TLAS instances are written on the GPU, from the scene's transforms
+    void createAS( Scene& scene, bool deformable = false );
 
     void destroy();
 
     void createSBT();
     void createRTDescriptorSets( std::vector<vk::Buffer>& uniforms,
                                  vk::DescriptorPool pool,
-                                 vk::Buffer vertexBuffer,
-                                 vk::Buffer indexBuffer, 
-                                 vk::Buffer colorBuffer );
+                                 vk::Buffer positionBuffer,
+                                 vk::Buffer indexBuffer,
+                                 vk::Buffer attributeBuffer,
+                                 vk::Buffer materialBuffer,
+                                 vk::Buffer triangleMaterialBuffer,
+                                 vk::Buffer transformBuffer,
+                                 vk::Buffer blasIndexBuffer,
+                                 vk::Buffer blasPrimitiveBuffer );
 
     void setRTRenderTarget( uint32_t imageIndex, int currentFrame );
 
@@ -36,8 +51,73 @@ class RayTracer
 
     void resize();
 
+    //Sets the model transform, the TLAS refit is recorded with the next trace
     void updateTLAS( glm::mat4 model );
 
+    //The camera of the next trace, the denoiser reprojects with it
+    void updateCamera( glm::mat4 view, glm::mat4 proj );
+
+    //The positions changed, the BLAS refits are recorded with the next trace
+    //Only for deformable ASes
+    void refitBLAS();
+
+    using Clock = std::chrono::high_resolution_clock;
+
+    //The positions within radius of center moved, by up to offset, in the
+    //space of the shapes. The chunks it touches are rebuilt with the next
+    //trace, the rest keep their trees. Only for deformable ASes
+    //requested - when the user asked for it, the edit latency starts there
+    void editRegion( glm::vec3 center, float radius, glm::vec3 offset,
+                     Clock::time_point requested );
+
+    //The frame's fence signalled, an edit it traced is visible now
+    //Call it as soon as it's seen, for any frame in flight
+    void frameFinished( int frame );
+
+    //the last edit whose frame finished
+    struct EditStats
+    {
+        uint32_t chunks = 0;
+        uint32_t triangles = 0;
+
+        //GPU time of the chunk rebuilds
+        double rebuildMs = 0.0;
+
+        //from the request to the CPU seeing the traced frame's fence, see
+        //frameFinished()
+        double latencyMs = 0.0;
+    };
+
+    const EditStats& getEditStats();
+
+    void setRefitPolicy( const ASBuilder::RefitPolicy& policy );
+    const ASBuilder::RefitStats& getRefitStats();
+
+    //GPU time of the trace, from the last frame that finished
+    double getTraceMs();
+
+    //every traceRayEXT of that frame, primary and bounces
+    double getRaysPerSecond();
+
+    //average path length of that frame, primary ray included
+    double getRaysPerPixel();
+
+    //pixels traced by that frame - the tiles adaptive sampling kept
+    uint32_t getActivePixels();
+
+    //Samples of every traced pixel per launch, looped in the raygen shader
+    //automatic - set every frame from the trace time of the frames that
+    //finished, so the trace and denoiser take about frameMs of GPU time
+    //otherwise samples, every launch
+    static constexpr uint32_t MAX_SAMPLES_PER_LAUNCH = 64;
+    void setSampleBudget( bool automatic, uint32_t samples, double frameMs );
+    uint32_t getSamplesPerLaunch();
+
+    //Denoise the image instead of showing the accumulation as it is
+    void setDenoise( bool enabled, uint32_t iterations );
+    void resetDenoiseHistory();
+    double getDenoiseMs();
+
    private:
     DescMgr& m_descMgr;
     MemoryMgr& m_bufferAlloc;
@@ -45,11 +125,102 @@ class RayTracer
 
     ASBuilder m_asBuilder;
 
+    //sums and sample count of every pixel, see accumulation.glsl
     vk::Buffer m_accBuffer;
 
-    vk::AccelerationStructureKHR m_blas;
+    //Adaptive sampling, every frame:
+    //adaptive.comp lists the tiles with noisy pixels, and writes the launch
+    //size, the trace visits only those, resolve.comp writes the image
+    vk::DescriptorSetLayout m_adaptiveDescriptorSetLayout;
+    std::vector<vk::DescriptorSet> m_adaptiveDescriptorSets;
+    ComputePipeline m_adaptivePipeline;
+    ComputePipeline m_resolvePipeline;
+
+    //per frame, the active tiles and the indirect launch ( host visible )
+    std::vector<vk::Buffer> m_tileBuffers;
+    std::vector<vk::Buffer> m_launchBuffers;
+    uint32_t m_activePixels;
+
+    //samples per pixel of the next launch, and of the frames in flight
+    bool m_autoSamples;
+    uint32_t m_samplesPerLaunch;
+    double m_frameBudgetMs;
+    std::vector<uint32_t> m_frameSamples;
+
+    //smoothed GPU time of one sample of one pixel, and the samples of the
+    //frame the trace time is from
+    double m_sampleMs;
+    uint32_t m_traceSamples;
+
+    //every sample launched so far, where the next launch starts the
+    //sequence when not accumulating ( wraps )
+    uint32_t m_launchedSamples;
+
+    //writes the image instead of resolve.comp when on
+    Denoiser m_denoiser;
+    bool m_denoise;
+
+    std::vector<vk::AccelerationStructureKHR> m_blases;
     vk::AccelerationStructureKHR m_tlas;
 
+    //Index ranges of every chunk, laid out like Scene::Shape
+    //the hit shader finds the triangle through gl_InstanceCustomIndexEXT
+    //A chunk of a split shape keeps the whole shape's triangles in x, y, its
+    //BLAS triangles are its own range of the BLAS indices
+    std::vector<Scene::Shape> m_chunks;
+    vk::Buffer m_chunkBuffer;
+
+    //model space bounds of every chunk, for picking the edited ones
+    std::vector<glm::vec3> m_chunkMin;
+    std::vector<glm::vec3> m_chunkMax;
+
+    //transform index and chunk of every TLAS instance
+    vk::Buffer m_instanceChunkBuffer;
+
+    bool m_deformable;
+    bool m_refitPending;
+
+    //the TLAS instances, written by instances.comp
+    //custom index = chunk index, transform = model * instance transform
+    uint32_t m_instanceCount;
+    vk::Buffer m_blasAddressBuffer;
+
+    vk::DescriptorSetLayout m_instanceDescriptorSetLayout;
+    std::vector<vk::DescriptorSet> m_instanceDescriptorSets;
+    ComputePipeline m_instancePipeline;
+
+    //the TLAS has never been built
+    bool m_tlasEmpty;
+
+    //4 timestamps per frame, around the trace and the edit rebuilds
+    vk::QueryPool m_traceTimestamps;
+    std::vector<bool> m_traceTimestampsWritten;
+    double m_traceMs;
+
+    //chunks edited since the last trace, and when the first one was
+    //requested
+    std::set<uint32_t> m_editedChunks;
+    Clock::time_point m_editStart;
+
+    //the edit recorded by each frame in flight, chunks = 0 if none
+    std::vector<EditStats> m_frameEdits;
+    std::vector<Clock::time_point> m_frameEditStarts;
+
+    //when the frame was seen finished, empty until it is
+    std::vector<Clock::time_point> m_frameEditEnds;
+    EditStats m_editStats;
+
+    //host visible, one uint per frame
+    std::vector<vk::Buffer> m_rayCountBuffers;
+    uint32_t m_rayCount;
+
+    //the transform requested by the app, and the one the TLAS was built with
+    glm::mat4 m_model;
+    glm::mat4 m_tlasModel;
+
+    glm::mat4 m_view;
+    glm::mat4 m_proj;
+
     vk::DescriptorSetLayout m_rtDescriptorSetLayout;
     std::vector<vk::DescriptorSet> m_rtDescriptorSets;
 
@@ -61,7 +232,14 @@ class RayTracer
     vk::Buffer m_missSBT;
     vk::Buffer m_hitSBT;
 
+    std::vector<ASBuilder::BlasInput> createChunks(
+        Scene& scene, std::vector<uint32_t>& firstChunks );
+    void cmdRebuildEdited( vk::CommandBuffer commandBuffer, int frame );
+    void cmdWriteInstances( vk::CommandBuffer commandBuffer, int frame );
+    void readTraceTime( int frame );
+    void updateSamplesPerLaunch();
     void createAccumulationBuffer();
+    void writeAccumulationDescriptors();
     void createPipeline();
 };
 }  // namespace BR
@@ -4,6 +4,7 @@
 
 #include <algorithm>
 #include <cassert>
+#include <cstdio>
 #include <ranges>
 
 #define GLM_FORCE_RADIANS
@@ -19,6 +20,23 @@
 
 using namespace BR;
 
+//build the RT geometry so it can be deformed every frame - dynamic BLASes,
+//refit each frame, no compaction and no BLAS cache
+const bool DEFORMABLE_GEOMETRY = false;
+
+//build the RT geometry so regions of it can be edited - dynamic BLASes, in
+//chunks, only the edited chunks are rebuilt. See BLAS_CHUNK_TRIANGLES
+const bool EDITABLE_GEOMETRY = false;
+
+//copies of the model scattered on a grid, each one a TLAS and raster instance
+//per placed shape - try a few thousand for a forest of one tree
+const uint32_t SCATTER_COPIES = 1;
+
+//frames averaged by "Log rays/s", the rays/s of one frame are noisy
+const int RAY_LOG_FRAMES = 120;
+
+const char* RT_MODES[] = { "Mirror", "Glossy", "Sharp", "AO" };
+
 BRRender::BRRender()
     : m_window( AppState::instance().getWindow() ),
       m_descMgr( AppState::instance().getDescMgr() ),
@@ -276,6 +294,8 @@ void BRRender::initVulkan()
     // m_scene.loadModel( "CasualEffects/sponza/sponza.obj" );
     // m_scene.loadModel( "CasualEffects/white_oak/white_oak.obj" );
 
+    m_scene.scatter( SCATTER_COPIES );
+
     //Descriptor set stuff (pool and UBO for transformations)
     m_descriptorPool = m_descMgr.createPool(
         "Descriptor pool", 1000,
@@ -294,7 +314,10 @@ void BRRender::initVulkan()
     }
 
     m_raster.init();
-    m_raster.createDescriptorSets( m_uniformBuffers, m_descriptorPool );
+    m_raster.createDescriptorSets( m_uniformBuffers, m_descriptorPool,
+                                   m_scene.m_materialBuffer,
+                                   m_scene.m_triangleMaterialBuffer,
+                                   m_scene.m_transformBuffer );
 
     m_commandPool.create( "Drawing pool",
                           vk::CommandPoolCreateFlagBits::eResetCommandBuffer );
@@ -312,13 +335,20 @@ void BRRender::initVulkan()
     }
 
     m_raytracer.init();
-    m_raytracer.createAS( m_scene.m_indices, m_scene.m_rtVertexBuffer,
-                          m_scene.m_indexBuffer );
+    m_raytracer.createAS( m_scene,
+                          DEFORMABLE_GEOMETRY || EDITABLE_GEOMETRY );
     m_raytracer.createSBT();
-    m_raytracer.createRTDescriptorSets( m_uniformBuffers, m_descriptorPool,
-                                        m_scene.m_rtVertexBuffer,
-                                        m_scene.m_indexBuffer, 
-                                        m_scene.m_rtColorBuffer );
+    m_raytracer.createRTDescriptorSets(
+        m_uniformBuffers, m_descriptorPool, m_scene.m_positionBuffer,
+        m_scene.m_indexBuffer, m_scene.m_attributeBuffer,
+        m_scene.m_materialBuffer, m_scene.m_triangleMaterialBuffer,
+        m_scene.m_transformBuffer, m_scene.m_blasIndexBuffer,
+        m_scene.m_blasPrimitiveBuffer );
+
+    if ( DEFORMABLE_GEOMETRY || EDITABLE_GEOMETRY )
+        m_deformer.init( m_scene, m_descriptorPool );
+
+    m_bufferAlloc.printStats();
 
     initUI();
 }
@@ -359,17 +389,31 @@ void BRRender::updateUniformBuffer( uint32_t currentImage )
     ubo.iteration = ++m_iteration;
     ubo.accumulate = m_rtAccumulate;
     ubo.mode = m_rtType;
+    ubo.maxDepth = m_maxDepth[m_rtType];
+
+    //never reached with the roulette off
+    ubo.rouletteDepth = m_roulette ? m_rouletteDepth : ubo.maxDepth;
+
+    ubo.imageSize = glm::uvec2( extent.width, extent.height );
+    ubo.adaptive = m_adaptive;
+    ubo.adaptiveThreshold = m_adaptiveThreshold;
+    ubo.adaptiveMinSamples = m_adaptiveMinSamples;
 
     m_bufferAlloc.updateVisibleBuffer( m_uniformBuffers[currentImage],
                                        sizeof( ubo ), &ubo );
 
     m_raytracer.updateTLAS( ubo.model );
+    m_raytracer.updateCamera( ubo.view, ubo.proj );
 }
 
 void BRRender::drawUI()
 {
     bool oldAcc = m_rtAccumulate;
     int oldType = m_rtType;
+    bool oldRtMode = m_rtMode;
+    int oldMaxDepth = m_maxDepth[m_rtType];
+    bool oldRoulette = m_roulette;
+    int oldRouletteDepth = m_rouletteDepth;
 
     ImGui_ImplGlfw_NewFrame();
     ImGui::NewFrame();
@@ -377,14 +421,135 @@ void BRRender::drawUI()
     ImGui::Text( "Application average %.3f ms/frame (%.1f FPS)",
                  1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate );
     ImGui::Checkbox( "Ray Tracing", &m_rtMode );
+
+    if ( m_rtMode )
+    {
+        ImGui::Text( "Trace %.3f ms, %.1f Mrays/s", m_raytracer.getTraceMs(),
+                     m_raytracer.getRaysPerSecond() / 1e6 );
+        ImGui::Text( "%.2f rays per sample, %u samples per launch",
+                     m_raytracer.getRaysPerPixel(),
+                     m_raytracer.getSamplesPerLaunch() );
+
+        //prints the average with the RT mode and depth settings, to compare
+        //them - the settings must not change while it runs
+        if ( m_rayLogFrames == 0 && ImGui::Button( "Log rays/s" ) )
+        {
+            m_rayLogFrames = RAY_LOG_FRAMES;
+            m_rayLogSum = 0.0;
+        }
+
+        if ( m_rayLogFrames > 0 )
+        {
+            m_rayLogSum += m_raytracer.getRaysPerSecond();
+
+            if ( --m_rayLogFrames == 0 )
+            {
+                printf( "RT mode %s, max depth %d, roulette %s: %.1f Mrays/s, "
+                        "%.2f rays per sample, %d frames\n",
+                        RT_MODES[m_rtType], m_maxDepth[m_rtType],
+                        m_roulette ? "on" : "off",
+                        m_rayLogSum / RAY_LOG_FRAMES / 1e6,
+                        m_raytracer.getRaysPerPixel(), RAY_LOG_FRAMES );
+            }
+        }
+
+        auto extent = AppState::instance().getSwapchainExtent();
+        uint32_t active = m_raytracer.getActivePixels();
+
+        ImGui::Text( "Active pixels %u (%.1f%%)", active,
+                     100.0 * active / ( extent.width * extent.height ) );
+
+        if ( m_denoise )
+            ImGui::Text( "Denoise %.3f ms", m_raytracer.getDenoiseMs() );
+    }
     ImGui::Checkbox( "Accumulation", &m_rtAccumulate );
 
+    //the sums count every sample, the count can change any frame
+    ImGui::Checkbox( "Auto samples", &m_autoSamples );
+
+    if ( m_autoSamples )
+        ImGui::SliderFloat( "Frame budget (ms)", &m_frameBudgetMs, 1.0f,
+                            100.0f, "%.1f" );
+    else
+        ImGui::SliderInt( "Samples per launch", &m_samplesPerLaunch, 1,
+                          RayTracer::MAX_SAMPLES_PER_LAUNCH );
+
+    m_raytracer.setSampleBudget( m_autoSamples, m_samplesPerLaunch,
+                                 m_frameBudgetMs );
+
+    //changing these needs no restart, the sums are still valid
+    ImGui::Checkbox( "Adaptive sampling", &m_adaptive );
+    ImGui::SliderFloat( "Noise threshold", &m_adaptiveThreshold, 0.001f,
+                        0.1f, "%.3f", ImGuiSliderFlags_Logarithmic );
+    ImGui::SliderInt( "Min samples", &m_adaptiveMinSamples, 2, 256 );
+
+    ImGui::Checkbox( "Denoise", &m_denoise );
+    ImGui::SliderInt( "Filter iterations", &m_denoiseIterations, 1,
+                      Denoiser::MAX_ITERATIONS );
+    m_raytracer.setDenoise( m_denoise, m_denoiseIterations );
+
     const char* items[] = { "Rotate", "Translate", "Scale" };
     ImGui::Combo( "Model Manip", &m_transformMode, items,
                   IM_ARRAYSIZE( items ) );
 
-    const char* rtItems[] = { "Mirror", "Glossy", "Sharp", "AO" };
-    ImGui::Combo( "RT mode", &m_rtType, rtItems, IM_ARRAYSIZE( rtItems ) );
+    ImGui::Combo( "RT mode", &m_rtType, RT_MODES, IM_ARRAYSIZE( RT_MODES ) );
+
+    //depth 100 with the roulette off is the old fixed loop, for comparison
+    ImGui::SliderInt( "Max depth", &m_maxDepth[m_rtType], 1, 100 );
+    ImGui::Checkbox( "Russian roulette", &m_roulette );
+    ImGui::SliderInt( "Roulette after", &m_rouletteDepth, 0, 16 );
+
+    if ( DEFORMABLE_GEOMETRY )
+    {
+        ImGui::Checkbox( "Deform", &m_deform );
+        ImGui::SliderFloat( "Twist", &m_deformAmplitude, 0.0f, 3.0f );
+
+        int maxRefits = static_cast<int>( m_refitPolicy.maxRefits );
+        ImGui::SliderInt( "Refits before rebuild", &maxRefits, 1, 1000 );
+        m_refitPolicy.maxRefits = static_cast<uint32_t>( maxRefits );
+
+        int budget = static_cast<int>( m_refitPolicy.rebuildBudget / 1000 );
+        ImGui::SliderInt( "Rebuild budget (K tris)", &budget, 1, 10000 );
+        m_refitPolicy.rebuildBudget = static_cast<uint64_t>( budget ) * 1000;
+
+        auto& stats = m_raytracer.getRefitStats();
+        ImGui::Text( "Refit %u BLASes, %.2f ms", stats.refits,
+                     stats.refitMs );
+        ImGui::Text( "Rebuilt %u BLASes, %.2f ms", stats.rebuilds,
+                     stats.rebuildMs );
+
+        if ( m_deform )
+            m_deformTime += ImGui::GetIO().DeltaTime;
+    }
+
+    if ( EDITABLE_GEOMETRY )
+    {
+        //a bump somewhere on the surface, edit to visible is timed by the
+        //ray tracer
+        if ( ImGui::Button( "Edit" ) )
+        {
+            std::uniform_int_distribution<uint32_t> vertex(
+                0, m_scene.m_vertexCount - 1 );
+
+            float size =
+                glm::length( m_scene.m_boundsMax - m_scene.m_boundsMin );
+
+            m_edit.center =
+                m_scene.m_cache.getPositions()[vertex( m_editRandom )];
+            m_edit.radius = size * m_editRadius;
+            m_edit.offset = glm::vec3( 0.0f, m_edit.radius * 0.5f, 0.0f );
+            m_edit.requested = RayTracer::Clock::now();
+            m_editPending = true;
+        }
+
+        ImGui::SliderFloat( "Edit radius", &m_editRadius, 0.001f, 0.1f );
+
+        auto& stats = m_raytracer.getEditStats();
+        ImGui::Text( "Edit %u chunks, %u tris", stats.chunks,
+                     stats.triangles );
+        ImGui::Text( "Rebuild %.2f ms, visible after %.1f ms",
+                     stats.rebuildMs, stats.latencyMs );
+    }
 
     if ( ImGui::Button( "Reset Transforms" ) )
     {
@@ -398,8 +563,19 @@ void BRRender::drawUI()
     }
     ImGui::End();
 
-    if ( oldAcc != m_rtAccumulate || oldType != m_rtType )
+    //the geometry moved, nothing to accumulate
+    //back from raster, the accumulation buffer holds stale data, or the
+    //BLAS build scratch it shares memory with
+    if ( oldAcc != m_rtAccumulate || oldType != m_rtType || m_deform ||
+         m_editPending || oldRtMode != m_rtMode ||
+         oldMaxDepth != m_maxDepth[m_rtType] || oldRoulette != m_roulette ||
+         oldRouletteDepth != m_rouletteDepth )
         m_iteration = 0;
+
+    //the image itself changed, the denoiser's history has nothing to give
+    if ( oldType != m_rtType || oldMaxDepth != m_maxDepth[m_rtType] ||
+         oldRoulette != m_roulette || oldRouletteDepth != m_rouletteDepth )
+        m_raytracer.resetDenoiseHistory();
 }
 
 void BRRender::drawFrame()
@@ -419,6 +595,16 @@ void BRRender::drawFrame()
         m_device.waitForFences( 1, &m_inFlightFences[m_currentFrame], VK_TRUE,
                                 std::numeric_limits<uint64_t>::max() );
 
+    //edits are timed to when their frame finished - every frame in flight is
+    //checked, not only the one waited on, before its fence is reset
+    for ( int i = 0; i < m_framesInFlight; ++i )
+    {
+        if ( i == m_currentFrame ||
+             m_device.getFenceStatus( m_inFlightFences[i] ) ==
+                 vk::Result::eSuccess )
+            m_raytracer.frameFinished( i );
+    }
+
     uint32_t imageIndex;
 
     try
@@ -463,12 +649,32 @@ void BRRender::drawFrame()
         throw std::runtime_error( "failed to begin recording command buffer!" );
     }
 
+    m_scene.cmdUpdateMaterials( commandBuffer );
+
+    //edit and deform first, raster and the BLAS builds read the new positions
+    //the edit moves the rest pose, the deform starts from it
+    if ( m_editPending )
+    {
+        m_deformer.cmdEdit( commandBuffer, m_edit.center, m_edit.radius,
+                            m_edit.offset );
+        m_raytracer.editRegion( m_edit.center, m_edit.radius,
+                                m_edit.offset, m_edit.requested );
+        m_editPending = false;
+    }
+
+    if ( m_deform )
+    {
+        m_deformer.cmdDeform( commandBuffer, m_deformTime, m_deformAmplitude );
+        m_raytracer.refitBLAS();
+    }
+
+    m_raytracer.setRefitPolicy( m_refitPolicy );
+
     if ( !m_rtMode )
     {
-        m_raster.recordDrawCommandBuffer(
-            m_commandBuffers[m_currentFrame], imageIndex, m_currentFrame,
-            m_scene.m_vertexBuffer, m_scene.m_indexBuffer,
-            m_scene.m_indices.size() );
+        m_raster.recordDrawCommandBuffer( m_commandBuffers[m_currentFrame],
+                                          imageIndex, m_currentFrame,
+                                          m_scene );
     }
 
     else
@@ -599,6 +805,9 @@ void BRRender::cleanup()
     m_commandPool.destroy();
     m_raster.destroy();
     m_raytracer.destroy();
+
+    if ( DEFORMABLE_GEOMETRY || EDITABLE_GEOMETRY )
+        m_deformer.destroy();
     m_renderPass.destroy();
 
     ImGui_ImplVulkan_Shutdown();
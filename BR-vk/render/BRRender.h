@@ -6,6 +6,7 @@
 #include <BRAppState.h>
 #include <BRCameraManip.h>
 #include <BRCommandPool.h>
+#include <BRDeformer.h>
 #include <BRDescMgr.h>
 #include <BRDevice.h>
 #include <BRFramebuffer.h>
@@ -28,6 +29,7 @@
 #include <fstream>
 #include <glm/glm.hpp>
 #include <iostream>
+#include <random>
 #include <stdexcept>
 #include <vector>
 
@@ -51,6 +53,12 @@ class BRRender
         int iteration;
         bool accumulate;
         int mode;
+        int maxDepth;
+        int rouletteDepth;
+        glm::uvec2 imageSize;
+        bool adaptive;
+        float adaptiveThreshold;
+        int adaptiveMinSamples;
     };
 
    private:
@@ -58,6 +66,7 @@ class BRRender
 
     Raster m_raster;
     RayTracer m_raytracer;
+    Deformer m_deformer;
 
     CommandPool m_commandPool;
 
@@ -95,6 +104,51 @@ class BRRender
     bool m_rtAccumulate = true;
     int m_rtType = 0;
 
+    //bounces after the primary ray, per RT mode
+    std::array<int, 4> m_maxDepth = { 32, 16, 8, 4 };
+    bool m_roulette = true;
+    int m_rouletteDepth = 2;  // bounces before the roulette starts
+
+    //frames left of a "Log rays/s", and the sum of their rays/s
+    int m_rayLogFrames = 0;
+    double m_rayLogSum = 0.0;
+
+    //adaptive sampling - pixels stop once the standard error of their mean
+    //is below the threshold, relative to their brightness
+    bool m_adaptive = true;
+    float m_adaptiveThreshold = 0.02f;
+    int m_adaptiveMinSamples = 16;
+
+    //SVGF style denoising of the RT image, for usable images while moving
+    bool m_denoise = false;
+    int m_denoiseIterations = 5;
+
+    //samples per pixel of every trace, see RayTracer::setSampleBudget()
+    bool m_autoSamples = true;
+    int m_samplesPerLaunch = 1;
+    float m_frameBudgetMs = 16.0f;
+
+    bool m_deform = false;
+    float m_deformTime = 0.0f;
+    float m_deformAmplitude = 0.5f;
+    ASBuilder::RefitPolicy m_refitPolicy;
+
+    //the next edit, recorded with the next frame
+    struct Edit
+    {
+        glm::vec3 center;
+        float radius;
+        glm::vec3 offset;
+
+        //when the button was clicked, the edit latency starts there
+        RayTracer::Clock::time_point requested;
+    };
+
+    Edit m_edit;
+    bool m_editPending = false;
+    float m_editRadius = 0.02f;  // of the bounds diagonal
+    std::mt19937 m_editRandom;
+
     void initWindow();
     void initVulkan();
     void loadModel( std::string name );
@@ -1,186 +1,307 @@
 #include <BRScene.h>
+#include <BRSceneCache.h>
 
-#define TINYOBJLOADER_IMPLEMENTATION
-#include <tiny_obj_loader.h>
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <glm/gtc/matrix_transform.hpp>
+#include <limits>
+#include <random>
 
 using namespace BR;
 
-Scene::Scene() : m_bufferAlloc( AppState::instance().getMemoryMgr() )
+namespace
+{
+//row major 3x4 -> glm, column major
+glm::mat4 toMat4( const SceneCache::Instance& instance )
+{
+    glm::mat4 transform( 1.0f );
+
+    for ( int row = 0; row < 3; ++row )
+    {
+        for ( int column = 0; column < 4; ++column )
+            transform[column][row] = instance.transform[row][column];
+    }
+
+    return transform;
+}
+}  // namespace
+
+Scene::Scene()
+    : m_bufferAlloc( AppState::instance().getMemoryMgr() ),
+      m_boundsMin( 0.0f ),
+      m_boundsMax( 0.0f ),
+      m_instanceCount( 0 ),
+      m_copyCount( 0 ),
+      m_vertexCount( 0 ),
+      m_indexCount( 0 ),
+      m_materialCount( 0 )
 {
 }
 
 void Scene::loadModel( std::string name )
 {
-    tinyobj::ObjReader reader;  // Used to read an OBJ file
-    reader.ParseFromFile( "models/" + name );
+    auto start = std::chrono::high_resolution_clock::now();
+
+    //the arrays are copied straight from the mapped file into staging memory
+    m_path = "models/" + name;
+
+    if ( !m_cache.open( m_path ) )
+        throw std::runtime_error( "failed to load model!" );
+
+    m_vertexCount = static_cast<uint32_t>( m_cache.getVertexCount() );
+    m_indexCount = static_cast<uint32_t>( m_cache.getIndexCount() );
+    m_materialCount = static_cast<uint32_t>( m_cache.getMaterialCount() );
+    m_materialEdits.clear();
+
+    auto bufferSize = m_vertexCount * sizeof( glm::vec3 );
+    m_positionBuffer = m_bufferAlloc.createDeviceBuffer(
+        "Positions", bufferSize, m_cache.getPositions(), false,
+        vk::BufferUsageFlagBits::eVertexBuffer |
+            vk::BufferUsageFlagBits::eStorageBuffer |
+            vk::BufferUsageFlagBits::eShaderDeviceAddress |
+            vk::BufferUsageFlagBits::
+                eAccelerationStructureBuildInputReadOnlyKHR );
+
+    bufferSize = m_vertexCount * sizeof( SceneCache::VertexAttributes );
+    m_attributeBuffer = m_bufferAlloc.createDeviceBuffer(
+        "Attributes", bufferSize, m_cache.getAttributes(), false,
+        vk::BufferUsageFlagBits::eVertexBuffer |
+            vk::BufferUsageFlagBits::eStorageBuffer );
+
+    uint64_t vertexSize =
+        sizeof( glm::vec3 ) + sizeof( SceneCache::VertexAttributes );
+    uint64_t geometrySize = m_vertexCount * vertexSize +
+                            m_indexCount * sizeof( uint32_t );
+
+    bufferSize = m_indexCount * sizeof( uint32_t );
+    m_indexBuffer = m_bufferAlloc.createDeviceBuffer(
+        "Index", bufferSize, m_cache.getIndices(), false,
+        vk::BufferUsageFlagBits::eIndexBuffer |
+            vk::BufferUsageFlagBits::eStorageBuffer |
+            vk::BufferUsageFlagBits::eShaderDeviceAddress |
+            vk::BufferUsageFlagBits::
+                eAccelerationStructureBuildInputReadOnlyKHR );
+
+    //an empty buffer can't be bound, keep a dummy element
+    static const uint32_t none[3] = {};
+
+    uint64_t blasIndexCount = m_cache.getBlasIndexCount();
+
+    bufferSize = std::max<uint64_t>( blasIndexCount, 3 ) * sizeof( uint32_t );
+    m_blasIndexBuffer = m_bufferAlloc.createDeviceBuffer(
+        "BLAS Index", bufferSize,
+        blasIndexCount ? m_cache.getBlasIndices() : none, false,
+        vk::BufferUsageFlagBits::eStorageBuffer |
+            vk::BufferUsageFlagBits::eShaderDeviceAddress |
+            vk::BufferUsageFlagBits::
+                eAccelerationStructureBuildInputReadOnlyKHR );
+
+    geometrySize += blasIndexCount * sizeof( uint32_t );
+
+    bufferSize =
+        std::max<uint64_t>( blasIndexCount / 3, 1 ) * sizeof( uint32_t );
+    m_blasPrimitiveBuffer = m_bufferAlloc.createDeviceBuffer(
+        "BLAS Primitives", bufferSize,
+        blasIndexCount ? m_cache.getBlasPrimitives() : none, false,
+        vk::BufferUsageFlagBits::eStorageBuffer );
+
+    geometrySize += blasIndexCount / 3 * sizeof( uint32_t );
+
+    bufferSize = m_cache.getTriangleMaterialCount() * sizeof( uint16_t );
+    m_triangleMaterialBuffer = m_bufferAlloc.createDeviceBuffer(
+        "Triangle Materials", bufferSize, m_cache.getTriangleMaterials(), false,
+        vk::BufferUsageFlagBits::eStorageBuffer );
 
-    assert( reader.Valid() );  // Make sure tinyobj was able to parse this file
-    const std::vector<tinyobj::real_t> objVertices =
-        reader.GetAttrib().GetVertices();
-    const std::vector<tinyobj::real_t> objNormals = reader.GetAttrib().normals;
-    const std::vector<tinyobj::real_t> objCoords = reader.GetAttrib().texcoords;
-    const std::vector<tinyobj::shape_t>& objShapes =
-        reader.GetShapes();  // All shapes in the file
-    const std::vector<tinyobj::material_t>& objMaterials = reader.GetMaterials();
+    geometrySize += bufferSize;
 
-    m_shapes.resize( objShapes.size() );
+    bufferSize = m_materialCount * sizeof( Material );
+    m_materialBuffer = m_bufferAlloc.createDeviceBuffer(
+        "Materials", bufferSize, m_cache.getMaterials(), false,
+        vk::BufferUsageFlagBits::eStorageBuffer );
 
+    m_shapes.assign( m_cache.getShapes(),
+                     m_cache.getShapes() + m_cache.getShapeCount() );
 
-    // Read obj file
-    for ( int s = 0; s < objShapes.size(); ++s )
+    //bounds of every shape, then of their corners where they are placed
+    auto positions = m_cache.getPositions();
+    auto indices = m_cache.getIndices();
+
+    std::vector<glm::vec3> shapeMin(
+        m_shapes.size(), glm::vec3( std::numeric_limits<float>::max() ) );
+    std::vector<glm::vec3> shapeMax(
+        m_shapes.size(), glm::vec3( std::numeric_limits<float>::lowest() ) );
+
+    for ( size_t i = 0; i < m_shapes.size(); ++i )
     {
-        auto& indices = objShapes[s].mesh.indices;
+        for ( uint32_t j = 0; j < m_shapes[i].indexCount; ++j )
+        {
+            auto& position = positions[indices[m_shapes[i].firstIndex + j]];
+
+            shapeMin[i] = glm::min( shapeMin[i], position );
+            shapeMax[i] = glm::max( shapeMax[i], position );
+        }
+    }
 
-        assert( indices.size() % 3 == 0 );
+    m_boundsMin = glm::vec3( std::numeric_limits<float>::max() );
+    m_boundsMax = glm::vec3( std::numeric_limits<float>::lowest() );
 
-        m_shapes[s].m_name = objShapes[s].name;
+    auto instances = m_cache.getInstances();
 
-        for ( int i = 0; i < indices.size(); i += 3 )
+    for ( uint64_t i = 0; i < m_cache.getInstanceCount(); ++i )
+    {
+        glm::mat4 transform = toMat4( instances[i] );
+        uint32_t shape = instances[i].shape;
+
+        for ( int corner = 0; corner < 8; ++corner )
         {
-            Vertex tverts[3];
-
-            for ( int j = 0; j < 3; ++j )
-            {
-                auto vertIndex = indices[i + j].vertex_index;
-                auto normIndex = indices[i + j].normal_index;
-                auto coordIndex = indices[i + j].texcoord_index;
-
-                assert( vertIndex >= 0 );
-                tverts[j].v.x = objVertices[vertIndex * 3];
-                tverts[j].v.y = objVertices[vertIndex * 3 + 1];
-                tverts[j].v.z = objVertices[vertIndex * 3 + 2];
-
-                if ( normIndex >= 0 )
-                {
-                    tverts[j].n.x = objNormals[normIndex * 3];
-                    tverts[j].n.y = objNormals[normIndex * 3 + 1];
-                    tverts[j].n.z = objNormals[normIndex * 3 + 2];
-                }
-
-                if ( coordIndex >= 0 )
-                {
-                    tverts[j].t.x = objCoords[coordIndex * 2];
-                    tverts[j].t.y = objCoords[coordIndex * 2 + 1];
-                }
-                else
-                {
-                    tverts[j].t.x = -1;
-                    tverts[j].t.y = -1;
-                }
-            }
-
-            int material = objShapes[s].mesh.material_ids[i / 3];
-
-            m_shapes[s].m_triangles.emplace_back(
-                Triangle( tverts[0], tverts[1], tverts[2], material ) );
+            glm::vec3 point( corner & 1 ? shapeMax[shape].x : shapeMin[shape].x,
+                             corner & 2 ? shapeMax[shape].y : shapeMin[shape].y,
+                             corner & 4 ? shapeMax[shape].z
+                                        : shapeMin[shape].z );
+
+            point = glm::vec3( transform * glm::vec4( point, 1.0f ) );
+
+            m_boundsMin = glm::min( m_boundsMin, point );
+            m_boundsMax = glm::max( m_boundsMax, point );
         }
     }
 
-    for( auto& mat : objMaterials )
+    //all the device local buffers go to the GPU in one submission
+    m_bufferAlloc.getUploader().flush();
+
+    auto end = std::chrono::high_resolution_clock::now();
+
+    printf( "Loaded %s ( %u vertices, %u triangles, %zu shapes, %llu "
+            "instances ) in %.1f ms\n",
+            name.c_str(), m_vertexCount, m_indexCount / 3, m_shapes.size(),
+            static_cast<unsigned long long>( m_cache.getInstanceCount() ),
+            std::chrono::duration<double, std::milli>( end - start ).count() );
+
+    printf( "\tgeometry %.1f MB, %.1f bytes per triangle\n",
+            geometrySize / ( 1024.0 * 1024.0 ),
+            m_indexCount ? geometrySize / ( m_indexCount / 3.0 ) : 0.0 );
+}
+
+void Scene::setMaterial( uint32_t index, const Material& material )
+{
+    assert( index < m_materialCount );
+
+    m_materialEdits[index] = material;
+}
+
+void Scene::cmdUpdateMaterials( vk::CommandBuffer commandBuffer )
+{
+    if ( m_materialEdits.empty() )
+        return;
+
+    //the previous frames may still be shading with the old table
+    //shader read -> transfer write
+    commandBuffer.pipelineBarrier(
+        vk::PipelineStageFlagBits::eFragmentShader |
+            vk::PipelineStageFlagBits::eRayTracingShaderKHR,
+        vk::PipelineStageFlagBits::eTransfer, {}, nullptr, nullptr, nullptr );
+
+    for ( auto& [index, material] : m_materialEdits )
+    {
+        commandBuffer.updateBuffer( m_materialBuffer,
+                                    index * sizeof( Material ),
+                                    sizeof( Material ), &material );
+    }
+
+    m_materialEdits.clear();
+
+    //transfer write -> shader read
+    vk::MemoryBarrier barrier;
+    barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+    barrier.dstAccessMask = vk::AccessFlagBits::eShaderRead;
+
+    commandBuffer.pipelineBarrier(
+        vk::PipelineStageFlagBits::eTransfer,
+        vk::PipelineStageFlagBits::eFragmentShader |
+            vk::PipelineStageFlagBits::eRayTracingShaderKHR,
+        {}, barrier, nullptr, nullptr );
+}
+
+void Scene::scatter( uint32_t copies )
+{
+    assert( copies > 0 );
+
+    m_copyCount = copies;
+
+    //square grid, the cells leave some room around the model
+    uint32_t columns =
+        static_cast<uint32_t>( std::ceil( std::sqrt( float( copies ) ) ) );
+
+    glm::vec3 extent = m_boundsMax - m_boundsMin;
+    glm::vec3 center = ( m_boundsMin + m_boundsMax ) * 0.5f;
+    float spacing = std::max( extent.x, extent.z ) * 1.25f;
+
+    //same layout every run
+    std::mt19937 random( 1 );
+    std::uniform_real_distribution<float> turn( 0.0f, glm::radians( 360.0f ) );
+    std::uniform_real_distribution<float> size( 0.8f, 1.2f );
+
+    std::vector<glm::mat4> copyTransforms( copies, glm::mat4( 1.0f ) );
+
+    for ( uint32_t i = 1; i < copies; ++i )
     {
-        m_materials.emplace_back(
-            Material( mat.ambient[0], mat.ambient[1], mat.ambient[2],
-                      mat.diffuse[0], mat.diffuse[1], mat.diffuse[2],
-                      mat.specular[0], mat.specular[1], mat.specular[2] ) );
+        glm::vec3 offset( ( i % columns ) * spacing, 0.0f,
+                          ( i / columns ) * spacing );
+
+        //turn and scale around the model's center, then move to the cell
+        glm::mat4 transform =
+            glm::translate( glm::mat4( 1.0f ), center + offset );
+        transform = glm::rotate( transform, turn( random ),
+                                 glm::vec3( 0.0f, 1.0f, 0.0f ) );
+        transform = glm::scale( transform, glm::vec3( size( random ) ) );
+        transform = glm::translate( transform, -center );
+
+        copyTransforms[i] = transform;
     }
-    
 
-    // prepare vertex buffersM
+    //every copy places every cooked instance, grouped by shape so raster
+    //draws each shape once
+    auto instances = m_cache.getInstances();
+
+    std::vector<std::vector<uint32_t>> placements( m_shapes.size() );
 
-    std::vector<glm::vec4> rtVertices;
-    std::vector<glm::vec4> rtColors;
-    int index = 0;
+    for ( uint32_t i = 0; i < m_cache.getInstanceCount(); ++i )
+        placements[instances[i].shape].push_back( i );
 
-    for ( auto& shape : m_shapes )
+    std::vector<glm::mat4> transforms;
+    uint64_t triangleCount = 0;
+
+    m_draws.clear();
+
+    for ( uint32_t shape = 0; shape < m_shapes.size(); ++shape )
     {
-        for ( auto& triangle : shape.m_triangles )
+        Draw draw;
+        draw.firstInstance = static_cast<uint32_t>( transforms.size() );
+        draw.instanceCount =
+            static_cast<uint32_t>( placements[shape].size() ) * copies;
+
+        for ( auto& copy : copyTransforms )
         {
-            for ( int i = 0; i < 3; ++i )
-            {
-                Material mat( 0.8, 0.8, 0.8, 0.8, 0.8, 0.8, 0.8, 0.8, 0.8 );
-
-                if ( !m_materials.empty() )
-                    mat = m_materials[triangle.mat];
-
-                PipelineVertex vert{
-                    { triangle.verts[i].v.x, triangle.verts[i].v.y,
-                      triangle.verts[i].v.z },
-                    { triangle.verts[i].n.x, triangle.verts[i].n.y,
-                      triangle.verts[i].n.z },
-                    { mat.d.r, mat.d.g, mat.d.b } };
-
-                glm::vec4 rawVert = { triangle.verts[i].v.x,
-                                      triangle.verts[i].v.y,
-                                      triangle.verts[i].v.z, 1 };
-
-                glm::vec4 rtCol = { mat.d.r, mat.d.g, mat.d.b, 1 };
-
-                m_vertices.push_back( vert );
-                rtVertices.push_back( rawVert );
-                rtColors.push_back( rtCol );
-                m_indices.push_back( index );
-                index++;
-            }
+            for ( auto placement : placements[shape] )
+                transforms.push_back( copy * toMat4( instances[placement] ) );
         }
+
+        triangleCount +=
+            uint64_t( draw.instanceCount ) * ( m_shapes[shape].indexCount / 3 );
+
+        m_draws.push_back( draw );
     }
 
-    // std::map<std::string, int> indexMap;      
-
-    // std::vector<glm::vec4> rawVerts;
-
-    // //every combination of vertex/normal pairs must be uniquely defined
-    // //data duplication cannot be avoided
-    // for ( auto shape : objShapes )
-    // {
-    //     for ( auto vert : shape.mesh.indices )
-    //     {
-    //         auto vertIndex = vert.vertex_index;
-    //         auto normIndex = vert.normal_index;
-
-    //         PipelineVertex vert{
-    //             { objVertices[vertIndex * 3], objVertices[vertIndex * 3 + 1],
-    //               objVertices[vertIndex * 3 + 2] },
-    //             { objNormals[normIndex * 3], objNormals[normIndex * 3 + 1],
-    //               objNormals[normIndex * 3 + 2] } };
-
-    //         glm::vec4 rawVert = { objVertices[vertIndex * 3],
-    //                               objVertices[vertIndex * 3 + 1],
-    //                               objVertices[vertIndex * 3 + 2], 1 };
-
-    //         m_vertices.push_back( vert );
-    //         rawVerts.push_back( rawVert );
-    //         m_indices.push_back( index );
-    //         index++; 
-    //     }
-    // }
-
-    auto bufferSize = m_vertices.size() * sizeof( m_vertices[0] );
-    m_vertexBuffer = m_bufferAlloc.createDeviceBuffer(
-        "Vertex", bufferSize, m_vertices.data(), false,
-        vk::BufferUsageFlagBits::eVertexBuffer );
-
-    bufferSize = rtVertices.size() * sizeof( rtVertices[0] );
-    m_rtVertexBuffer = m_bufferAlloc.createDeviceBuffer(
-        "RTVertex", bufferSize, rtVertices.data(), false,
-        vk::BufferUsageFlagBits::eStorageBuffer |
-            vk::BufferUsageFlagBits::eShaderDeviceAddress |
-            vk::BufferUsageFlagBits::
-                eAccelerationStructureBuildInputReadOnlyKHR );
+    m_instanceCount = static_cast<uint32_t>( transforms.size() );
 
-    bufferSize = rtColors.size() * sizeof( rtColors[0] );
-    m_rtColorBuffer = m_bufferAlloc.createDeviceBuffer(
-        "RTColors", bufferSize, rtColors.data(), false,
-        vk::BufferUsageFlagBits::eStorageBuffer |
-            vk::BufferUsageFlagBits::eShaderDeviceAddress |
-            vk::BufferUsageFlagBits::
-                eAccelerationStructureBuildInputReadOnlyKHR );
+    m_transformBuffer = m_bufferAlloc.createDeviceBuffer(
+        "Transforms", transforms.size() * sizeof( glm::mat4 ),
+        transforms.data(), false, vk::BufferUsageFlagBits::eStorageBuffer );
 
-    bufferSize = m_indices.size() * sizeof( m_indices[0] );
-    m_indexBuffer = m_bufferAlloc.createDeviceBuffer(
-        "Index", bufferSize, m_indices.data(), false,
-        vk::BufferUsageFlagBits::eIndexBuffer |
-            vk::BufferUsageFlagBits::eStorageBuffer |
-            vk::BufferUsageFlagBits::eShaderDeviceAddress |
-            vk::BufferUsageFlagBits::
-                eAccelerationStructureBuildInputReadOnlyKHR );
+    m_bufferAlloc.getUploader().flush();
+
+    printf( "Scattered %u copies, %u instances, %.1f M triangles\n", copies,
+            m_instanceCount, triangleCount / 1e6 );
 }
@@ -2,8 +2,11 @@
 
 #include <BRAppState.h>
 #include <BRMemoryMgr.h>
+#include <BRSceneCache.h>
 
 #include <glm/glm.hpp>
+#include <map>
+#include <vector>
 
 namespace BR
 {
@@ -13,107 +16,128 @@ class Scene
    public:
     Scene();
 
+    using Material = SceneCache::Material;
+    using Shape = SceneCache::Shape;
+
+    //the instances of one shape, a range of the transform buffer
+    struct Draw
+    {
+        uint32_t firstInstance;
+        uint32_t instanceCount;
+    };
+
+    //loads the cooked .brscene of the model, cooks it first if needed
     void loadModel( std::string name );
 
-    //This is how we define a vertex in the graphics pipeline - for now, just a position and normal
-    struct PipelineVertex
+    //Queues a material change, the frames in flight still read the material
+    //table. cmdUpdateMaterials() writes it at the start of the next frame
+    void setMaterial( uint32_t index, const Material& material );
+
+    //Records the queued material changes, before anything reads the table
+    //Waits for earlier reads of it, and makes the new values visible to the
+    //fragment and RT shaders
+    void cmdUpdateMaterials( vk::CommandBuffer commandBuffer );
+
+    //Places copies of the model on a grid, with a random turn and scale each
+    //Copy 0 is the model as loaded. Every copy places every cooked instance
+    //The transforms stay on the GPU, raster draws each shape instanced, RT
+    //writes the TLAS instances from them
+    void scatter( uint32_t copies );
+
+    //This is how we define a vertex in the graphics pipeline
+    //Two streams, as cooked by SceneCache:
+    // binding 0 - positions, also read by the BLAS build and the hit shader
+    // binding 1 - packed attributes, unpacked by the vertex fetch
+    struct VertexLayout
     {
-        glm::vec3 pos;
-        glm::vec3 norm;
-        glm::vec3 col;
+        struct Attribute
+        {
+            uint32_t binding;
+            uint32_t location;
+            vk::Format format;
+            uint32_t offset;
+        };
 
-        // This defines how to read the data
-        static vk::VertexInputBindingDescription getBindingDescription()
+        // location matches the location inside the shader
+        static std::vector<Attribute> getAttributes()
         {
-            vk::VertexInputBindingDescription bindingDescription = {};
-            bindingDescription.binding = 0;
-            bindingDescription.stride = sizeof( PipelineVertex );
-            bindingDescription.inputRate = vk::VertexInputRate::eVertex;
+            using Attributes = SceneCache::VertexAttributes;
+
+            return {
+                { 0, 0, vk::Format::eR32G32B32Sfloat, 0 },
+                { 1, 1, vk::Format::eR16G16Snorm,
+                  offsetof( Attributes, normal ) },
+                { 1, 2, vk::Format::eR16G16Sfloat,
+                  offsetof( Attributes, uv ) } };
+        }
 
-            return bindingDescription;
+        // This defines how to read the data
+        static std::vector<vk::VertexInputBindingDescription>
+        getBindingDescriptions()
+        {
+            return { { 0, sizeof( glm::vec3 ), vk::VertexInputRate::eVertex },
+                     { 1, sizeof( SceneCache::VertexAttributes ),
+                       vk::VertexInputRate::eVertex } };
         }
 
-        // This describes where the vertex is and where the color is
-        // type of color, type of vertex
-        // location matches the location inside the shader
+        // This describes where each attribute is, and its type
         static std::vector<vk::VertexInputAttributeDescription>
         getAttributeDescriptions()
         {
             std::vector<vk::VertexInputAttributeDescription>
-                attributeDescriptions( 3,
-                                       vk::VertexInputAttributeDescription() );
-            attributeDescriptions[0].binding = 0;
-            attributeDescriptions[0].location = 0;
-            attributeDescriptions[0].format = vk::Format::eR32G32B32Sfloat;
-            attributeDescriptions[0].offset = offsetof( PipelineVertex, pos );
-            attributeDescriptions[1].binding = 0;
-            attributeDescriptions[1].location = 1;
-            attributeDescriptions[1].format = vk::Format::eR32G32B32Sfloat;
-            attributeDescriptions[1].offset = offsetof( PipelineVertex, norm );
-            attributeDescriptions[2].binding = 0;
-            attributeDescriptions[2].location = 2;
-            attributeDescriptions[2].format = vk::Format::eR32G32B32Sfloat;
-            attributeDescriptions[2].offset = offsetof( PipelineVertex, col );
+                attributeDescriptions;
+
+            for ( auto& attribute : getAttributes() )
+            {
+                attributeDescriptions.emplace_back(
+                    attribute.location, attribute.binding, attribute.format,
+                    attribute.offset );
+            }
 
             return attributeDescriptions;
         }
     };
 
-    //N shapes (Meshes)
-    //Each shape has M triangles
-    //Each triangle has:
-    // 3 vertices
-    // 3 normals
-    // 3 texture coordinates
-    // 1 material ID
+    MemoryMgr& m_bufferAlloc;
 
-    struct Vertex
-    {
-        glm::vec3 v;
-        glm::vec3 n;
-        glm::vec2 t;
-    };
+    //stays mapped after the load, host AS builds read the geometry from it
+    SceneCache m_cache;
 
-    struct Triangle
-    {
-        Triangle( Vertex& v1, Vertex& v2, Vertex& v3, int mat )
-            : verts{ std::move( v1 ), std::move( v2 ), std::move( v3 ) },
-              mat( mat )
-        {
-        }
-        Vertex verts[3];
-        int mat;
-    };
+    //path of the OBJ, other caches of the model are named after it
+    std::string m_path;
 
-    struct Material
-    {
-        Material( float ar, float ag, float ab, float dr, float dg, float db,
-                  float sr, float sg, float sb )
-            : a( ar, ag, ab ), d( dr, dg, db ), s( sr, sg, sb )
-        {
-        }
-        glm::vec3 a;
-        glm::vec3 d;
-        glm::vec3 s;
-    };
+    vk::Buffer m_positionBuffer;
+    vk::Buffer m_attributeBuffer;
+    vk::Buffer m_indexBuffer;
 
-    struct Shape
-    {
-        std::string m_name;
-        std::vector<Triangle> m_triangles;
-    };
+    //16 bit material index per triangle, indexed with gl_PrimitiveID
+    vk::Buffer m_triangleMaterialBuffer;
+    vk::Buffer m_materialBuffer;
+
+    //setMaterial() changes not recorded yet, by material index
+    std::map<uint32_t, Material> m_materialEdits;
 
+    //BLAS triangles of the split shapes, and the cooked triangle of each one
+    //see SceneCache::Shape. At least one element, even if nothing was split
+    vk::Buffer m_blasIndexBuffer;
+    vk::Buffer m_blasPrimitiveBuffer;
+
+    //index ranges of the unique shapes, one BLAS each, or a few for large
+    //dynamic ones - see RayTracer::createAS
     std::vector<Shape> m_shapes;
-    std::vector<Material> m_materials;
 
-    MemoryMgr& m_bufferAlloc;
+    //model space bounds of the placed shapes
+    glm::vec3 m_boundsMin;
+    glm::vec3 m_boundsMax;
 
-    vk::Buffer m_vertexBuffer;
-    vk::Buffer m_rtVertexBuffer;
-    vk::Buffer m_indexBuffer;
-    vk::Buffer m_rtColorBuffer;
+    //mat4 per instance, grouped by shape, see scatter()
+    vk::Buffer m_transformBuffer;
+    std::vector<Draw> m_draws;
+    uint32_t m_instanceCount;
+    uint32_t m_copyCount;
 
-    std::vector<PipelineVertex> m_vertices;
-    std::vector<uint32_t> m_indices;
+    uint32_t m_vertexCount;
+    uint32_t m_indexCount;
+    uint32_t m_materialCount;
 };
 }  // namespace BR
\ No newline at end of file
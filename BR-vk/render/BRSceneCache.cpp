@@ -0,0 +1,1716 @@
+#include <BRObjParser.h>
+#include <BRSceneCache.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <glm/gtc/packing.hpp>
+#include <limits>
+#include <map>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+using namespace BR;
+
+const char MAGIC[4] = { 'B', 'R', 'S', 'C' };
+
+//arrays start at this alignment in the file
+const uint64_t ALIGNMENT = 16;
+
+//size stamp of a file that didn't exist at cook time
+const uint64_t MISSING = ~0ull;
+
+//default material, for triangles without one
+const SceneCache::Material DEFAULT_MATERIAL = {
+    glm::vec4( 0.0f, 0.0f, 0.0f, 1.0f ), glm::vec4( 0.8f, 0.8f, 0.8f, 1.0f ),
+    glm::vec4( 0.0f, 0.0f, 0.0f, 1.0f ) };
+
+namespace
+{
+//Vertex welding key - corners equal in all of these share a vertex
+//No padding, the key is compared and hashed as raw bytes
+struct WeldKey
+{
+    glm::vec3 v;
+    glm::vec3 n;
+    glm::vec2 t;
+
+    bool operator==( const WeldKey& other ) const
+    {
+        //bitwise, so hashing and comparing agree ( -0 vs 0, NaNs )
+        return memcmp( this, &other, sizeof( WeldKey ) ) == 0;
+    }
+};
+
+static_assert( sizeof( WeldKey ) == 8 * sizeof( uint32_t ),
+               "WeldKey must not have padding" );
+
+struct WeldKeyHash
+{
+    size_t operator()( const WeldKey& key ) const
+    {
+        //FNV-1a over the raw 32 bit words of the key
+        const uint32_t* words = reinterpret_cast<const uint32_t*>( &key );
+        uint64_t hash = 14695981039346656037ull;
+
+        for ( size_t i = 0; i < sizeof( WeldKey ) / sizeof( uint32_t ); ++i )
+        {
+            hash ^= words[i];
+            hash *= 1099511628211ull;
+        }
+
+        return static_cast<size_t>( hash ^ ( hash >> 32 ) );
+    }
+};
+
+//GPU ready arrays, before they are written out
+struct Cooked
+{
+    std::vector<glm::vec3> positions;
+    std::vector<SceneCache::VertexAttributes> attributes;
+    std::vector<uint32_t> indices;
+    std::vector<uint16_t> triangleMaterials;
+    std::vector<SceneCache::Material> materials;
+    std::vector<SceneCache::Shape> shapes;
+    std::vector<SceneCache::Instance> instances;
+
+    //BLAS triangles of the split shapes, and the triangle of each one
+    std::vector<uint32_t> blasIndices;
+    std::vector<uint32_t> blasPrimitives;
+};
+
+//unit vector -> octahedron folded onto the [-1, 1] square, 2x snorm16
+uint32_t packNormal( glm::vec3 n )
+{
+    n /= std::abs( n.x ) + std::abs( n.y ) + std::abs( n.z );
+
+    glm::vec2 oct( n.x, n.y );
+
+    if ( n.z < 0 )
+    {
+        oct.x = ( 1.0f - std::abs( n.y ) ) * ( n.x >= 0 ? 1.0f : -1.0f );
+        oct.y = ( 1.0f - std::abs( n.x ) ) * ( n.y >= 0 ? 1.0f : -1.0f );
+    }
+
+    return glm::packSnorm2x16( oct );
+}
+
+//64 bit words at a time, the tail byte by byte
+uint64_t hashBytes( const char* data, size_t size )
+{
+    uint64_t hash = 14695981039346656037ull;
+    size_t words = size / 8;
+
+    for ( size_t i = 0; i < words; ++i )
+    {
+        uint64_t word;
+        memcpy( &word, data + i * 8, 8 );
+
+        hash ^= word;
+        hash *= 1099511628211ull;
+        hash ^= hash >> 29;
+    }
+
+    for ( size_t i = words * 8; i < size; ++i )
+    {
+        hash ^= static_cast<unsigned char>( data[i] );
+        hash *= 1099511628211ull;
+    }
+
+    return hash;
+}
+
+void stamp( const std::string& path, uint64_t& size, int64_t& time )
+{
+    std::error_code error;
+
+    size = std::filesystem::file_size( path, error );
+    auto writeTime = std::filesystem::last_write_time( path, error );
+
+    if ( error )
+    {
+        size = MISSING;
+        time = 0;
+        return;
+    }
+
+    time = writeTime.time_since_epoch().count();
+}
+
+std::string directoryOf( const std::string& path )
+{
+    auto slash = path.find_last_of( "/\\" );
+    return slash == std::string::npos ? "" : path.substr( 0, slash + 1 );
+}
+
+uint64_t alignUp( uint64_t value )
+{
+    return ( value + ALIGNMENT - 1 ) & ~( ALIGNMENT - 1 );
+}
+
+//inverse of packNormal
+glm::vec3 unpackNormal( uint32_t packed )
+{
+    glm::vec2 oct = glm::unpackSnorm2x16( packed );
+    glm::vec3 n( oct.x, oct.y, 1.0f - std::abs( oct.x ) - std::abs( oct.y ) );
+
+    if ( n.z < 0 )
+    {
+        n.x = ( 1.0f - std::abs( oct.y ) ) * ( oct.x >= 0 ? 1.0f : -1.0f );
+        n.y = ( 1.0f - std::abs( oct.x ) ) * ( oct.y >= 0 ? 1.0f : -1.0f );
+    }
+
+    return glm::normalize( n );
+}
+
+//A shape with its own vertex numbering - vertices in the order the indices
+//first reference them. Copies of a mesh keep that order in the OBJ, so the
+//local vertices of two copies line up one to one
+struct LocalShape
+{
+    std::vector<uint32_t> vertices;  // welded vertex of every local one
+    std::vector<uint32_t> indices;   // into vertices
+
+    //canonical space -> model space, a similarity transform
+    glm::mat4 frame;
+    bool hasFrame;
+
+    //topology, uvs and materials, everything that has to match exactly
+    uint64_t hash;
+};
+
+//frame axes come from vertices at least this far from the center,
+//relative to the RMS radius of the shape
+const float FRAME_EPSILON = 0.1f;
+
+//a copy may be off by this much, relative to the RMS radius
+const float MATCH_TOLERANCE = 1e-4f;
+
+//copies with rotated normals, ~2.5 degrees
+const float NORMAL_TOLERANCE = 0.999f;
+
+//unique shapes with the same hash that a shape is checked against, keeps
+//models with lots of same-topology meshes ( boxes ) from going quadratic
+const size_t MAX_CANDIDATES = 64;
+
+//Canonical frame of a shape: translation = centroid, scale = RMS distance
+//from it, rotation from the first vertex far enough from the center and the
+//first one after it off that axis. Planar shapes get a frame from those two
+//in-plane axes, only collinear or zero extent shapes have none
+bool canonicalFrame( const Cooked& cooked, LocalShape& local )
+{
+    glm::dvec3 sum( 0.0 );
+    for ( auto vertex : local.vertices )
+        sum += glm::dvec3( cooked.positions[vertex] );
+
+    glm::vec3 center = glm::vec3( sum / double( local.vertices.size() ) );
+
+    double squared = 0.0;
+    for ( auto vertex : local.vertices )
+    {
+        glm::vec3 d = cooked.positions[vertex] - center;
+        squared += glm::dot( d, d );
+    }
+
+    float scale = float( std::sqrt( squared / local.vertices.size() ) );
+
+    //also catches NaNs
+    if ( !( scale > 0.0f ) )
+        return false;
+
+    glm::vec3 u( 0.0f );
+    glm::vec3 w( 0.0f );
+
+    for ( auto vertex : local.vertices )
+    {
+        glm::vec3 d = ( cooked.positions[vertex] - center ) / scale;
+
+        if ( u == glm::vec3( 0.0f ) )
+        {
+            if ( glm::length( d ) > FRAME_EPSILON )
+                u = glm::normalize( d );
+
+            continue;
+        }
+
+        glm::vec3 n = glm::cross( u, d );
+
+        if ( glm::length( n ) > FRAME_EPSILON )
+        {
+            w = glm::normalize( n );
+            break;
+        }
+    }
+
+    if ( w == glm::vec3( 0.0f ) )
+        return false;
+
+    glm::vec3 v = glm::cross( w, u );
+
+    local.frame = glm::mat4( glm::vec4( u * scale, 0.0f ),
+                             glm::vec4( v * scale, 0.0f ),
+                             glm::vec4( w * scale, 0.0f ),
+                             glm::vec4( center, 1.0f ) );
+    return true;
+}
+
+LocalShape localize( const Cooked& cooked, const SceneCache::Shape& shape,
+                     std::unordered_map<uint32_t, uint32_t>& numbering )
+{
+    LocalShape local;
+
+    numbering.clear();
+    local.indices.reserve( shape.indexCount );
+
+    for ( uint32_t i = 0; i < shape.indexCount; ++i )
+    {
+        uint32_t vertex = cooked.indices[shape.firstIndex + i];
+
+        auto [it, inserted] = numbering.try_emplace(
+            vertex, static_cast<uint32_t>( local.vertices.size() ) );
+
+        if ( inserted )
+            local.vertices.push_back( vertex );
+
+        local.indices.push_back( it->second );
+    }
+
+    local.hasFrame = canonicalFrame( cooked, local );
+
+    std::vector<uint32_t> uvs;
+    uvs.reserve( local.vertices.size() );
+    for ( auto vertex : local.vertices )
+        uvs.push_back( cooked.attributes[vertex].uv );
+
+    local.hash = 14695981039346656037ull;
+
+    for ( auto& [data, size] :
+          { std::pair<const void*, size_t>(
+                local.indices.data(),
+                local.indices.size() * sizeof( uint32_t ) ),
+            std::pair<const void*, size_t>(
+                uvs.data(), uvs.size() * sizeof( uint32_t ) ),
+            std::pair<const void*, size_t>(
+                cooked.triangleMaterials.data() + shape.firstIndex / 3,
+                shape.indexCount / 3 * sizeof( uint16_t ) ) } )
+    {
+        local.hash = ( local.hash ^
+                       hashBytes( static_cast<const char*>( data ), size ) ) *
+                     1099511628211ull;
+    }
+
+    return local;
+}
+
+//is b the prototype a, placed with transform?
+bool matches( const Cooked& cooked, const SceneCache::Shape& shapeA,
+              const LocalShape& a, const SceneCache::Shape& shapeB,
+              const LocalShape& b, const glm::mat4& transform )
+{
+    if ( a.vertices.size() != b.vertices.size() || a.indices != b.indices ||
+         memcmp( cooked.triangleMaterials.data() + shapeA.firstIndex / 3,
+                 cooked.triangleMaterials.data() + shapeB.firstIndex / 3,
+                 shapeA.indexCount / 3 * sizeof( uint16_t ) ) != 0 )
+        return false;
+
+    float tolerance = MATCH_TOLERANCE * glm::length( glm::vec3( b.frame[0] ) );
+    glm::mat3 rotation = glm::mat3( transform );
+
+    for ( size_t i = 0; i < a.vertices.size(); ++i )
+    {
+        auto& attributesA = cooked.attributes[a.vertices[i]];
+        auto& attributesB = cooked.attributes[b.vertices[i]];
+
+        if ( attributesA.uv != attributesB.uv )
+            return false;
+
+        glm::vec3 placed = glm::vec3(
+            transform * glm::vec4( cooked.positions[a.vertices[i]], 1.0f ) );
+
+        if ( glm::length( placed - cooked.positions[b.vertices[i]] ) >
+             tolerance )
+            return false;
+
+        glm::vec3 normal =
+            glm::normalize( rotation * unpackNormal( attributesA.normal ) );
+
+        if ( glm::dot( normal, unpackNormal( attributesB.normal ) ) <
+             NORMAL_TOLERANCE )
+            return false;
+    }
+
+    return true;
+}
+
+// repeated shapes -> one mesh each, plus an instance per OBJ shape
+// a shape is compared against the earlier unique shapes with the same hash,
+// in canonical space, then its geometry is dropped if one of them matches
+void instanceShapes( Cooked& cooked )
+{
+    const glm::mat4 identity( 1.0f );
+
+    std::vector<LocalShape> locals;
+    locals.reserve( cooked.shapes.size() );
+
+    std::unordered_map<uint32_t, uint32_t> numbering;
+
+    for ( auto& shape : cooked.shapes )
+        locals.push_back( localize( cooked, shape, numbering ) );
+
+    //unique shapes by hash
+    std::unordered_map<uint64_t, std::vector<uint32_t>> candidates;
+
+    //the prototype of every shape, itself if it's unique
+    std::vector<uint32_t> prototypes( cooked.shapes.size() );
+    std::vector<glm::mat4> transforms( cooked.shapes.size(), identity );
+
+    for ( uint32_t i = 0; i < cooked.shapes.size(); ++i )
+    {
+        prototypes[i] = i;
+
+        if ( !locals[i].hasFrame )
+            continue;
+
+        auto& list = candidates[locals[i].hash];
+
+        for ( auto candidate : list )
+        {
+            //prototype model space -> canonical -> this shape's model space
+            glm::mat4 transform =
+                locals[i].frame * glm::inverse( locals[candidate].frame );
+
+            if ( matches( cooked, cooked.shapes[candidate], locals[candidate],
+                          cooked.shapes[i], locals[i], transform ) )
+            {
+                prototypes[i] = candidate;
+                transforms[i] = transform;
+                break;
+            }
+        }
+
+        if ( prototypes[i] == i && list.size() < MAX_CANDIDATES )
+            list.push_back( i );
+    }
+
+    // keep the unique shapes only, drop the vertices nothing references
+
+    Cooked unique;
+    unique.materials = std::move( cooked.materials );
+
+    std::vector<uint32_t> vertexMap( cooked.positions.size(), ~0u );
+    std::vector<uint32_t> shapeMap( cooked.shapes.size(), ~0u );
+
+    for ( uint32_t i = 0; i < cooked.shapes.size(); ++i )
+    {
+        if ( prototypes[i] != i )
+            continue;
+
+        auto& shape = cooked.shapes[i];
+
+        shapeMap[i] = static_cast<uint32_t>( unique.shapes.size() );
+        unique.shapes.push_back(
+            { static_cast<uint32_t>( unique.indices.size() ),
+              shape.indexCount } );
+
+        unique.triangleMaterials.insert(
+            unique.triangleMaterials.end(),
+            cooked.triangleMaterials.begin() + shape.firstIndex / 3,
+            cooked.triangleMaterials.begin() +
+                ( shape.firstIndex + shape.indexCount ) / 3 );
+
+        for ( uint32_t j = 0; j < shape.indexCount; ++j )
+        {
+            uint32_t& vertex = vertexMap[cooked.indices[shape.firstIndex + j]];
+
+            if ( vertex == ~0u )
+            {
+                uint32_t source = cooked.indices[shape.firstIndex + j];
+
+                vertex = static_cast<uint32_t>( unique.positions.size() );
+                unique.positions.push_back( cooked.positions[source] );
+                unique.attributes.push_back( cooked.attributes[source] );
+            }
+
+            unique.indices.push_back( vertex );
+        }
+    }
+
+    for ( uint32_t i = 0; i < cooked.shapes.size(); ++i )
+    {
+        SceneCache::Instance instance;
+        instance.shape = shapeMap[prototypes[i]];
+
+        //glm is column major
+        for ( int row = 0; row < 3; ++row )
+        {
+            instance.transform[row] =
+                glm::vec4( transforms[i][0][row], transforms[i][1][row],
+                           transforms[i][2][row], transforms[i][3][row] );
+        }
+
+        unique.instances.push_back( instance );
+    }
+
+    if ( unique.shapes.size() != cooked.shapes.size() )
+    {
+        printf( "Instanced %zu shapes as %zu meshes, %zu triangles -> %zu "
+                "( %.2fx )\n",
+                cooked.shapes.size(), unique.shapes.size(),
+                cooked.indices.size() / 3, unique.indices.size() / 3,
+                double( cooked.indices.size() ) / unique.indices.size() );
+    }
+
+    cooked = std::move( unique );
+}
+
+//runs func( i ) for every i in [0, count), spread over the threads
+template <typename Func>
+void parallelFor( size_t count, unsigned threadCount, Func func )
+{
+    std::atomic<size_t> next = 0;
+
+    auto worker = [&]()
+    {
+        for ( size_t i = next++; i < count; i = next++ )
+            func( i );
+    };
+
+    std::vector<std::thread> threads;
+
+    for ( unsigned i = 1; i < threadCount; ++i )
+        threads.emplace_back( worker );
+
+    worker();
+
+    for ( auto& thread : threads )
+        thread.join();
+}
+
+//spreads the low 10 bits out to every third bit
+uint32_t expandBits( uint32_t x )
+{
+    x &= 0x3FF;
+    x = ( x | ( x << 16 ) ) & 0x030000FF;
+    x = ( x | ( x << 8 ) ) & 0x0300F00F;
+    x = ( x | ( x << 4 ) ) & 0x030C30C3;
+    x = ( x | ( x << 2 ) ) & 0x09249249;
+    return x;
+}
+
+//30 bit Morton code of a point in the unit cube
+uint32_t morton( glm::vec3 p )
+{
+    glm::uvec3 cell = glm::uvec3( glm::clamp( p * 1024.0f, 0.0f, 1023.0f ) );
+
+    return ( expandBits( cell.x ) << 2 ) | ( expandBits( cell.y ) << 1 ) |
+           expandBits( cell.z );
+}
+
+//Average cache miss ratio - vertex shader runs per triangle, for a FIFO
+//post-transform cache. 3 is no reuse at all, ~0.5 is the best a regular
+//mesh can do
+double acmr( const std::vector<uint32_t>& indices, size_t cacheSize )
+{
+    if ( indices.empty() )
+        return 0.0;
+
+    std::vector<uint32_t> fifo( cacheSize, ~0u );
+    size_t head = 0;
+    size_t misses = 0;
+
+    for ( auto index : indices )
+    {
+        if ( std::find( fifo.begin(), fifo.end(), index ) != fifo.end() )
+            continue;
+
+        fifo[head] = index;
+        head = ( head + 1 ) % cacheSize;
+        ++misses;
+    }
+
+    return double( misses ) / ( indices.size() / 3 );
+}
+
+//entries of a typical post-transform cache
+const size_t VERTEX_CACHE_SIZE = 32;
+
+// triangles of every shape sorted along a Morton curve of their centroids,
+// in the shape's bounds, then the vertices renumbered in first use order
+// neighbours in space end up neighbours in the index and vertex buffers
+void reorder( Cooked& cooked, unsigned threadCount )
+{
+    if ( threadCount == 0 )
+        threadCount = std::max( 1u, std::thread::hardware_concurrency() );
+
+    const size_t triangleCount = cooked.indices.size() / 3;
+
+    double acmrBefore = acmr( cooked.indices, VERTEX_CACHE_SIZE );
+
+    auto centroid = [&]( size_t triangle )
+    {
+        const uint32_t* corners = &cooked.indices[triangle * 3];
+
+        return ( cooked.positions[corners[0]] + cooked.positions[corners[1]] +
+                 cooked.positions[corners[2]] ) /
+               3.0f;
+    };
+
+    //shape in the high bits, so triangles stay inside their shape
+    struct SortKey
+    {
+        uint64_t key;
+        uint32_t triangle;
+
+        bool operator<( const SortKey& other ) const
+        {
+            return key < other.key ||
+                   ( key == other.key && triangle < other.triangle );
+        }
+    };
+
+    std::vector<SortKey> keys( triangleCount );
+
+    parallelFor(
+        cooked.shapes.size(), threadCount,
+        [&]( size_t i )
+        {
+            auto& shape = cooked.shapes[i];
+            size_t first = shape.firstIndex / 3;
+            size_t count = shape.indexCount / 3;
+
+            glm::vec3 boundsMin( std::numeric_limits<float>::max() );
+            glm::vec3 boundsMax( std::numeric_limits<float>::lowest() );
+
+            for ( size_t t = first; t < first + count; ++t )
+            {
+                glm::vec3 c = centroid( t );
+                boundsMin = glm::min( boundsMin, c );
+                boundsMax = glm::max( boundsMax, c );
+            }
+
+            glm::vec3 scale =
+                1.0f / glm::max( boundsMax - boundsMin, glm::vec3( 1e-20f ) );
+
+            for ( size_t t = first; t < first + count; ++t )
+            {
+                keys[t].key = ( uint64_t( i ) << 32 ) |
+                              morton( ( centroid( t ) - boundsMin ) * scale );
+                keys[t].triangle = static_cast<uint32_t>( t );
+            }
+        } );
+
+    // merge sort - the runs are sorted in parallel, then merged in pairs
+    // every round, so a model that is one big shape sorts in parallel too
+
+    size_t runCount = threadCount;
+    size_t runSize = ( triangleCount + runCount - 1 ) / runCount;
+
+    auto runBegin = [&]( size_t run )
+    { return keys.begin() + std::min( run * runSize, triangleCount ); };
+
+    parallelFor( runCount, threadCount,
+                 [&]( size_t run )
+                 { std::sort( runBegin( run ), runBegin( run + 1 ) ); } );
+
+    for ( size_t width = 1; width < runCount; width *= 2 )
+    {
+        size_t pairCount = ( runCount + 2 * width - 1 ) / ( 2 * width );
+
+        parallelFor( pairCount, threadCount,
+                     [&]( size_t pair )
+                     {
+                         size_t run = pair * 2 * width;
+                         std::inplace_merge( runBegin( run ),
+                                             runBegin( run + width ),
+                                             runBegin( run + 2 * width ) );
+                     } );
+    }
+
+    // move the triangles
+
+    std::vector<uint32_t> indices( cooked.indices.size() );
+    std::vector<uint16_t> triangleMaterials( cooked.triangleMaterials.size() );
+
+    const size_t CHUNK = 64 * 1024;
+
+    parallelFor(
+        ( triangleCount + CHUNK - 1 ) / CHUNK, threadCount,
+        [&]( size_t chunk )
+        {
+            size_t end = std::min( ( chunk + 1 ) * CHUNK, triangleCount );
+
+            for ( size_t t = chunk * CHUNK; t < end; ++t )
+            {
+                uint32_t source = keys[t].triangle;
+
+                indices[t * 3 + 0] = cooked.indices[source * 3 + 0];
+                indices[t * 3 + 1] = cooked.indices[source * 3 + 1];
+                indices[t * 3 + 2] = cooked.indices[source * 3 + 2];
+                triangleMaterials[t] = cooked.triangleMaterials[source];
+            }
+        } );
+
+    // renumber the vertices in first use order, a serial scan
+    // every vertex is used, the cooked shapes reference all of them
+
+    std::vector<uint32_t> vertexMap( cooked.positions.size(), ~0u );
+    std::vector<uint32_t> order;
+    order.reserve( cooked.positions.size() );
+
+    for ( auto& index : indices )
+    {
+        if ( vertexMap[index] == ~0u )
+        {
+            vertexMap[index] = static_cast<uint32_t>( order.size() );
+            order.push_back( index );
+        }
+
+        index = vertexMap[index];
+    }
+
+    assert( order.size() == cooked.positions.size() );
+
+    std::vector<glm::vec3> positions( order.size() );
+    std::vector<SceneCache::VertexAttributes> attributes( order.size() );
+
+    parallelFor(
+        ( order.size() + CHUNK - 1 ) / CHUNK, threadCount,
+        [&]( size_t chunk )
+        {
+            size_t end = std::min( ( chunk + 1 ) * CHUNK, order.size() );
+
+            for ( size_t v = chunk * CHUNK; v < end; ++v )
+            {
+                positions[v] = cooked.positions[order[v]];
+                attributes[v] = cooked.attributes[order[v]];
+            }
+        } );
+
+    cooked.indices = std::move( indices );
+    cooked.triangleMaterials = std::move( triangleMaterials );
+    cooked.positions = std::move( positions );
+    cooked.attributes = std::move( attributes );
+
+    printf( "Reordered %zu triangles, ACMR ( FIFO %zu ) %.3f -> %.3f\n",
+            triangleCount, VERTEX_CACHE_SIZE, acmrBefore,
+            acmr( cooked.indices, VERTEX_CACHE_SIZE ) );
+}
+
+//relative area below which a triangle is degenerate
+const float DEGENERATE_EPSILON = 1e-10f;
+
+// drops triangles with repeated vertices or no area, they can't be hit or
+// seen, but they still cost BLAS nodes. Shapes left empty go too
+void dropDegenerates( Cooked& cooked )
+{
+    size_t triangleCount = cooked.indices.size() / 3;
+
+    std::vector<uint32_t> indices;
+    std::vector<uint16_t> triangleMaterials;
+    std::vector<SceneCache::Shape> shapes;
+
+    indices.reserve( cooked.indices.size() );
+    triangleMaterials.reserve( triangleCount );
+
+    for ( auto& shape : cooked.shapes )
+    {
+        uint32_t firstIndex = static_cast<uint32_t>( indices.size() );
+
+        for ( uint32_t i = shape.firstIndex;
+              i < shape.firstIndex + shape.indexCount; i += 3 )
+        {
+            const uint32_t* corners = &cooked.indices[i];
+
+            glm::vec3 v0 = cooked.positions[corners[0]];
+            glm::vec3 e1 = cooked.positions[corners[1]] - v0;
+            glm::vec3 e2 = cooked.positions[corners[2]] - v0;
+
+            float area = glm::length( glm::cross( e1, e2 ) );
+            float size = std::max( glm::dot( e1, e1 ), glm::dot( e2, e2 ) );
+
+            //not a NaN either
+            bool degenerate = corners[0] == corners[1] ||
+                              corners[1] == corners[2] ||
+                              corners[0] == corners[2] ||
+                              !( area > DEGENERATE_EPSILON * size );
+
+            if ( degenerate )
+                continue;
+
+            indices.insert( indices.end(), corners, corners + 3 );
+            triangleMaterials.push_back( cooked.triangleMaterials[i / 3] );
+        }
+
+        uint32_t indexCount =
+            static_cast<uint32_t>( indices.size() ) - firstIndex;
+
+        if ( indexCount > 0 )
+            shapes.push_back( { firstIndex, indexCount } );
+    }
+
+    if ( indices.size() != cooked.indices.size() )
+    {
+        printf( "Dropped %zu degenerate triangles\n",
+                triangleCount - indices.size() / 3 );
+    }
+
+    cooked.indices = std::move( indices );
+    cooked.triangleMaterials = std::move( triangleMaterials );
+    cooked.shapes = std::move( shapes );
+}
+
+//A piece of a split triangle, see splitTriangles()
+struct Fragment
+{
+    uint32_t v[3];
+    uint32_t triangle;  // the cooked triangle it's a piece of
+
+    float surface;  // of its AABB
+    float ratio;    // AABB surface / triangle area
+};
+
+Fragment makeFragment( const Cooked& cooked, uint32_t v0, uint32_t v1,
+                       uint32_t v2, uint32_t triangle )
+{
+    glm::vec3 p0 = cooked.positions[v0];
+    glm::vec3 p1 = cooked.positions[v1];
+    glm::vec3 p2 = cooked.positions[v2];
+
+    glm::vec3 extent =
+        glm::max( p0, glm::max( p1, p2 ) ) - glm::min( p0, glm::min( p1, p2 ) );
+
+    Fragment fragment;
+    fragment.v[0] = v0;
+    fragment.v[1] = v1;
+    fragment.v[2] = v2;
+    fragment.triangle = triangle;
+
+    fragment.surface = 2.0f * ( extent.x * extent.y + extent.y * extent.z +
+                                extent.z * extent.x );
+
+    float area = 0.5f * glm::length( glm::cross( p1 - p0, p2 - p0 ) );
+    fragment.ratio = area > 0.0f ? fragment.surface / area : 0.0f;
+
+    return fragment;
+}
+
+//an axis aligned right triangle has a ratio of 4, its AABB is flat
+//triangles worse than this are worth splitting
+const float SPLIT_RATIO = 16.0f;
+
+//an edge by the ids of its ends, lowest id in the high bits
+uint64_t edgeKey( uint32_t a, uint32_t b )
+{
+    return ( uint64_t( std::min( a, b ) ) << 32 ) | std::max( a, b );
+}
+
+// Conditions the BLAS geometry - triangles with a poor AABB to area ratio,
+// long thin diagonal ones, are split at the midpoint of their longest edge
+// until they're good, or the budget of extra triangles runs out
+// The biggest boxes go first, they overlap the most BVH nodes
+// An edge is split for every piece on it at once - a neighbour left whole
+// would have a T-junction there, a crack rays slip through. Edges are
+// matched by position, so the seams of the welding ( hard normals, uv cuts )
+// split on both sides, each side with its own midpoint vertex. A split only
+// goes ahead if the budget has room for all of its pieces
+// Raster keeps the original triangles, the split shapes get their own BLAS
+// index range, and a fragment -> triangle table, so the hit shader shades
+// the original triangle
+void splitTriangles( Cooked& cooked, float budget )
+{
+    size_t triangleCount = cooked.indices.size() / 3;
+    size_t splitBudget = static_cast<size_t>( triangleCount * budget );
+
+    if ( splitBudget == 0 )
+        return;
+
+    //every piece so far, the triangles first - split ones are dead
+    std::vector<Fragment> pieces;
+    std::vector<bool> alive;
+
+    pieces.reserve( triangleCount );
+
+    for ( uint32_t t = 0; t < triangleCount; ++t )
+    {
+        const uint32_t* corners = &cooked.indices[t * 3];
+        pieces.push_back(
+            makeFragment( cooked, corners[0], corners[1], corners[2], t ) );
+    }
+
+    alive.assign( triangleCount, true );
+
+    auto worse = [&]( uint32_t a, uint32_t b )
+    { return pieces[a].surface < pieces[b].surface; };
+
+    //the pieces still worth splitting, biggest box on top
+    std::vector<uint32_t> heap;
+
+    for ( uint32_t t = 0; t < triangleCount; ++t )
+    {
+        if ( pieces[t].ratio > SPLIT_RATIO )
+            heap.push_back( t );
+    }
+
+    if ( heap.empty() )
+        return;
+
+    std::make_heap( heap.begin(), heap.end(), worse );
+
+    //vertices at the same place share an id, triangles on either side of a
+    //seam share the edge
+    std::vector<uint32_t> positionIds( cooked.positions.size() );
+    uint32_t positionCount = 0;
+
+    {
+        std::map<std::array<uint32_t, 3>, uint32_t> ids;
+
+        for ( size_t i = 0; i < cooked.positions.size(); ++i )
+        {
+            glm::vec3 p = cooked.positions[i];
+            std::array<uint32_t, 3> bits = { std::bit_cast<uint32_t>( p.x ),
+                                             std::bit_cast<uint32_t>( p.y ),
+                                             std::bit_cast<uint32_t>( p.z ) };
+
+            auto [it, inserted] = ids.try_emplace( bits, positionCount );
+            positionCount += inserted;
+            positionIds[i] = it->second;
+        }
+    }
+
+    auto positionEdge = [&]( uint32_t a, uint32_t b )
+    { return edgeKey( positionIds[a], positionIds[b] ); };
+
+    //the pieces on every edge, dead ones included
+    std::unordered_map<uint64_t, std::vector<uint32_t>> edgePieces;
+
+    auto addPiece = [&]( const Fragment& piece )
+    {
+        uint32_t id = static_cast<uint32_t>( pieces.size() );
+
+        pieces.push_back( piece );
+        alive.push_back( true );
+
+        for ( int i = 0; i < 3; ++i )
+            edgePieces[positionEdge( piece.v[i], piece.v[( i + 1 ) % 3] )]
+                .push_back( id );
+
+        return id;
+    };
+
+    for ( uint32_t t = 0; t < triangleCount; ++t )
+    {
+        for ( int i = 0; i < 3; ++i )
+            edgePieces[positionEdge( pieces[t].v[i],
+                                     pieces[t].v[( i + 1 ) % 3] )]
+                .push_back( t );
+    }
+
+    //the midpoint of every split edge, by vertex
+    std::unordered_map<uint64_t, uint32_t> midpoints;
+
+    auto midpoint = [&]( uint32_t a, uint32_t b, uint32_t positionId )
+    {
+        auto [it, inserted] = midpoints.try_emplace(
+            edgeKey( a, b ), static_cast<uint32_t>( cooked.positions.size() ) );
+
+        if ( !inserted )
+            return it->second;
+
+        //the attributes are interpolated, so the vertex is a valid one for
+        //anything else that reads it
+        glm::vec3 n = unpackNormal( cooked.attributes[a].normal ) +
+                      unpackNormal( cooked.attributes[b].normal );
+
+        if ( glm::dot( n, n ) == 0 )
+            n = unpackNormal( cooked.attributes[a].normal );
+
+        glm::vec2 uv = ( glm::unpackHalf2x16( cooked.attributes[a].uv ) +
+                         glm::unpackHalf2x16( cooked.attributes[b].uv ) ) *
+                       0.5f;
+
+        //the same position for either side of a seam, a + b == b + a
+        cooked.positions.push_back(
+            ( cooked.positions[a] + cooked.positions[b] ) * 0.5f );
+        cooked.attributes.push_back(
+            { packNormal( glm::normalize( n ) ), glm::packHalf2x16( uv ) } );
+        positionIds.push_back( positionId );
+
+        return it->second;
+    };
+
+    size_t splits = 0;
+    size_t neighbourSplits = 0;
+
+    while ( !heap.empty() )
+    {
+        std::pop_heap( heap.begin(), heap.end(), worse );
+        uint32_t id = heap.back();
+        heap.pop_back();
+
+        //split already, as the neighbour of another
+        if ( !alive[id] )
+            continue;
+
+        //longest edge is v[edge] -> v[edge + 1]
+        const Fragment& fragment = pieces[id];
+
+        int edge = 0;
+        float longest = 0.0f;
+
+        for ( int i = 0; i < 3; ++i )
+        {
+            glm::vec3 d = cooked.positions[fragment.v[( i + 1 ) % 3]] -
+                          cooked.positions[fragment.v[i]];
+
+            if ( glm::dot( d, d ) > longest )
+            {
+                longest = glm::dot( d, d );
+                edge = i;
+            }
+        }
+
+        uint64_t key =
+            positionEdge( fragment.v[edge], fragment.v[( edge + 1 ) % 3] );
+
+        //this one and its neighbours, every piece on the edge
+        auto edgeIt = edgePieces.find( key );
+        std::vector<uint32_t> onEdge;
+
+        for ( uint32_t other : edgeIt->second )
+        {
+            if ( alive[other] )
+                onEdge.push_back( other );
+        }
+
+        //out of budget, stays as it is - a smaller split may still fit
+        if ( splits + onEdge.size() > splitBudget )
+            continue;
+
+        //no piece has it any more, its halves are new edges
+        edgePieces.erase( edgeIt );
+
+        uint32_t positionId = positionCount++;
+
+        for ( uint32_t other : onEdge )
+        {
+            alive[other] = false;
+
+            //the other's own copy of the edge, keeps the winding
+            Fragment piece = pieces[other];
+
+            int i = 0;
+            while ( positionEdge( piece.v[i], piece.v[( i + 1 ) % 3] ) != key )
+                ++i;
+
+            uint32_t a = piece.v[i];
+            uint32_t b = piece.v[( i + 1 ) % 3];
+            uint32_t c = piece.v[( i + 2 ) % 3];
+            uint32_t m = midpoint( a, b, positionId );
+
+            Fragment halves[2] = {
+                makeFragment( cooked, a, m, c, piece.triangle ),
+                makeFragment( cooked, m, b, c, piece.triangle ) };
+
+            for ( auto& half : halves )
+            {
+                uint32_t halfId = addPiece( half );
+
+                if ( half.ratio > SPLIT_RATIO )
+                {
+                    heap.push_back( halfId );
+                    std::push_heap( heap.begin(), heap.end(), worse );
+                }
+            }
+        }
+
+        splits += onEdge.size();
+        neighbourSplits += onEdge.size() - 1;
+    }
+
+    //the pieces of every split triangle
+    std::unordered_map<uint32_t, std::vector<Fragment>> fragments;
+
+    for ( size_t id = triangleCount; id < pieces.size(); ++id )
+    {
+        if ( alive[id] )
+            fragments[pieces[id].triangle].push_back( pieces[id] );
+    }
+
+    // BLAS ranges of the shapes with split triangles
+    // every triangle of the shape, the split ones as their fragments
+
+    size_t splitShapes = 0;
+
+    for ( auto& shape : cooked.shapes )
+    {
+        uint32_t first = shape.firstIndex / 3;
+        uint32_t last = first + shape.indexCount / 3;
+
+        bool split = false;
+        for ( uint32_t t = first; t < last && !split; ++t )
+            split = fragments.count( t ) > 0;
+
+        if ( !split )
+            continue;
+
+        ++splitShapes;
+
+        shape.blasFirstIndex =
+            static_cast<uint32_t>( cooked.blasIndices.size() );
+
+        for ( uint32_t t = first; t < last; ++t )
+        {
+            auto it = fragments.find( t );
+
+            if ( it == fragments.end() )
+            {
+                cooked.blasIndices.insert( cooked.blasIndices.end(),
+                                           &cooked.indices[t * 3],
+                                           &cooked.indices[t * 3] + 3 );
+                cooked.blasPrimitives.push_back( t );
+                continue;
+            }
+
+            for ( auto& fragment : it->second )
+            {
+                cooked.blasIndices.insert( cooked.blasIndices.end(),
+                                           fragment.v, fragment.v + 3 );
+                cooked.blasPrimitives.push_back( t );
+            }
+        }
+
+        shape.blasIndexCount =
+            static_cast<uint32_t>( cooked.blasIndices.size() ) -
+            shape.blasFirstIndex;
+    }
+
+    printf( "Split %zu triangles into %zu, %zu extra BLAS triangles ( %zu "
+            "for neighbours ) in %zu shapes, %zu new vertices\n",
+            fragments.size(), fragments.size() + splits, splits,
+            neighbourSplits, splitShapes, midpoints.size() );
+}
+
+// OBJ -> welded, packed, GPU ready arrays
+void build( ObjParser& parser, Cooked& cooked, unsigned threadCount )
+{
+    const std::vector<float>& objVertices = parser.m_positions;
+    const std::vector<float>& objNormals = parser.m_normals;
+    const std::vector<float>& objCoords = parser.m_texcoords;
+
+    // materials, the default one goes last
+
+    auto color = []( const float* rgb )
+    { return glm::vec4( rgb[0], rgb[1], rgb[2], 1 ); };
+
+    for ( auto& material : parser.m_materials )
+    {
+        //the index has to fit in 16 bits, with room for the default
+        if ( cooked.materials.size() == SceneCache::MAX_MATERIALS )
+        {
+            printf( "\ttoo many materials, using the default for the rest\n" );
+            break;
+        }
+
+        cooked.materials.push_back( { color( material.ambient ),
+                                      color( material.diffuse ),
+                                      color( material.specular ) } );
+    }
+
+    const int defaultMaterial = static_cast<int>( cooked.materials.size() );
+
+    cooked.materials.push_back( DEFAULT_MATERIAL );
+
+    // weld the vertices - OBJ corners that share position, normal and
+    // texcoord become one vertex, referenced by the index buffer
+    // materials are per triangle, they don't split vertices
+
+    size_t cornerCount = 0;
+    for ( auto& shape : parser.m_shapes )
+        cornerCount += shape.indices.size();
+
+    std::unordered_map<WeldKey, uint32_t, WeldKeyHash> weldMap;
+    weldMap.reserve( cornerCount );
+
+    cooked.indices.reserve( cornerCount );
+    cooked.triangleMaterials.reserve( cornerCount / 3 + 1 );
+
+    auto position = [&]( int index )
+    {
+        return glm::vec3( objVertices[index * 3], objVertices[index * 3 + 1],
+                          objVertices[index * 3 + 2] );
+    };
+
+    for ( auto& shape : parser.m_shapes )
+    {
+        assert( shape.indices.size() % 3 == 0 );
+
+        if ( shape.indices.empty() )
+            continue;
+
+        cooked.shapes.push_back(
+            { static_cast<uint32_t>( cooked.indices.size() ),
+              static_cast<uint32_t>( shape.indices.size() ) } );
+
+        for ( size_t i = 0; i < shape.indices.size(); ++i )
+        {
+            auto& index = shape.indices[i];
+
+            if ( i % 3 == 0 )
+            {
+                int material = shape.materialIds[i / 3];
+
+                if ( material < 0 || material >= defaultMaterial )
+                    material = defaultMaterial;
+
+                cooked.triangleMaterials.push_back(
+                    static_cast<uint16_t>( material ) );
+            }
+
+            assert( index.v >= 0 );
+
+            WeldKey key;
+            key.v = position( index.v );
+
+            if ( index.n >= 0 )
+            {
+                key.n = { objNormals[index.n * 3], objNormals[index.n * 3 + 1],
+                          objNormals[index.n * 3 + 2] };
+            }
+            else
+            {
+                //no normal - use the face normal, corners of different faces
+                //stay separate vertices
+                auto* triangle = &shape.indices[i - i % 3];
+
+                glm::vec3 v0 = position( triangle[0].v );
+                glm::vec3 v1 = position( triangle[1].v );
+                glm::vec3 v2 = position( triangle[2].v );
+
+                key.n = glm::cross( v1 - v0, v2 - v0 );
+            }
+
+            //degenerate - any direction will do
+            if ( glm::dot( key.n, key.n ) == 0 )
+                key.n = glm::vec3( 0, 0, 1 );
+
+            key.n = glm::normalize( key.n );
+
+            key.t = glm::vec2( 0 );
+
+            if ( index.t >= 0 )
+                key.t = { objCoords[index.t * 2], objCoords[index.t * 2 + 1] };
+
+            auto [it, inserted] = weldMap.try_emplace(
+                key, static_cast<uint32_t>( cooked.positions.size() ) );
+
+            cooked.indices.push_back( it->second );
+
+            if ( !inserted )
+                continue;
+
+            cooked.positions.push_back( key.v );
+            cooked.attributes.push_back(
+                { packNormal( key.n ), glm::packHalf2x16( key.t ) } );
+        }
+    }
+
+    printf( "Welded %zu vertices into %zu ( %.2fx )\n", cornerCount,
+            cooked.positions.size(),
+            cooked.positions.empty()
+                ? 0.0
+                : double( cornerCount ) / cooked.positions.size() );
+
+    dropDegenerates( cooked );
+
+    instanceShapes( cooked );
+
+    if ( SceneCache::REORDER )
+        reorder( cooked, threadCount );
+
+    splitTriangles( cooked, SceneCache::SPLIT_BUDGET );
+
+    //the shaders read the indices two at a time
+    if ( cooked.triangleMaterials.size() % 2 )
+        cooked.triangleMaterials.push_back( 0 );
+}
+
+void writeBytes( std::ofstream& file, const void* data, uint64_t size,
+                 uint64_t offset )
+{
+    //pad up to the array offset
+    static const char zeros[ALIGNMENT] = {};
+    uint64_t position = static_cast<uint64_t>( file.tellp() );
+    file.write( zeros, offset - position );
+
+    file.write( static_cast<const char*>( data ), size );
+}
+}  // namespace
+
+SceneCache::SceneCache() : m_header( nullptr )
+{
+}
+
+std::string SceneCache::getCachePath( const std::string& objPath,
+                                      const std::string& extension )
+{
+    auto dot = objPath.find_last_of( '.' );
+    auto slash = objPath.find_last_of( "/\\" );
+
+    if ( dot == std::string::npos ||
+         ( slash != std::string::npos && dot < slash ) )
+        return objPath + extension;
+
+    return objPath.substr( 0, dot ) + extension;
+}
+
+bool SceneCache::cook( const std::string& objPath, unsigned threadCount )
+{
+    auto start = std::chrono::high_resolution_clock::now();
+
+    ObjParser parser;
+
+    if ( !parser.parse( objPath, threadCount ) )
+    {
+        printf( "\tfailed to parse %s\n", objPath.c_str() );
+        return false;
+    }
+
+    Cooked cooked;
+    build( parser, cooked, threadCount );
+
+    //hash of the OBJ contents, checked when only its time stamp changes
+    uint64_t sourceHash = 0;
+    {
+        MappedFile source;
+        if ( source.open( objPath ) )
+            sourceHash = hashBytes( source.getData(), source.getSize() );
+    }
+
+    // dependencies - the OBJ, then its material libraries
+
+    std::string directory = directoryOf( objPath );
+
+    std::vector<std::string> paths;
+    paths.push_back( objPath.substr( directory.size() ) );
+    paths.insert( paths.end(), parser.m_materialLibs.begin(),
+                  parser.m_materialLibs.end() );
+
+    std::vector<Dependency> dependencies( paths.size() );
+
+    // layout
+
+    Header header = {};
+    memcpy( header.magic, MAGIC, sizeof( MAGIC ) );
+    header.version = VERSION;
+    header.reordered = REORDER;
+    header.splitBudget = SPLIT_BUDGET;
+    header.sourceHash = sourceHash;
+
+    //each array hashed on its own, then mixed, so moving bytes between them
+    //changes the hash
+    for ( auto& [data, size] :
+          { std::pair<const void*, size_t>(
+                cooked.positions.data(),
+                cooked.positions.size() * sizeof( glm::vec3 ) ),
+            std::pair<const void*, size_t>(
+                cooked.indices.data(),
+                cooked.indices.size() * sizeof( uint32_t ) ),
+            std::pair<const void*, size_t>(
+                cooked.shapes.data(), cooked.shapes.size() * sizeof( Shape ) ),
+            std::pair<const void*, size_t>(
+                cooked.blasIndices.data(),
+                cooked.blasIndices.size() * sizeof( uint32_t ) ) } )
+    {
+        header.geometryHash =
+            ( header.geometryHash ^
+              hashBytes( static_cast<const char*>( data ), size ) ) *
+            1099511628211ull;
+    }
+
+    header.dependencyCount = dependencies.size();
+    header.dependencyOffset = alignUp( sizeof( Header ) );
+
+    uint64_t offset =
+        header.dependencyOffset + dependencies.size() * sizeof( Dependency );
+
+    for ( size_t i = 0; i < paths.size(); ++i )
+    {
+        stamp( directory + paths[i], dependencies[i].size,
+               dependencies[i].time );
+
+        dependencies[i].pathOffset = offset;
+        dependencies[i].pathLength = paths[i].size();
+        offset += paths[i].size();
+    }
+
+    //data and byte size of every section, in Section order
+    struct
+    {
+        const void* data;
+        uint64_t count;
+        uint64_t stride;
+    } sections[eSectionCount] = {
+        { cooked.positions.data(), cooked.positions.size(),
+          sizeof( glm::vec3 ) },
+        { cooked.attributes.data(), cooked.attributes.size(),
+          sizeof( VertexAttributes ) },
+        { cooked.indices.data(), cooked.indices.size(), sizeof( uint32_t ) },
+        { cooked.triangleMaterials.data(), cooked.triangleMaterials.size(),
+          sizeof( uint16_t ) },
+        { cooked.materials.data(), cooked.materials.size(),
+          sizeof( Material ) },
+        { cooked.shapes.data(), cooked.shapes.size(), sizeof( Shape ) },
+        { cooked.instances.data(), cooked.instances.size(),
+          sizeof( Instance ) },
+        { cooked.blasIndices.data(), cooked.blasIndices.size(),
+          sizeof( uint32_t ) },
+        { cooked.blasPrimitives.data(), cooked.blasPrimitives.size(),
+          sizeof( uint32_t ) } };
+
+    for ( int i = 0; i < eSectionCount; ++i )
+    {
+        offset = alignUp( offset );
+
+        header.sections[i].offset = offset;
+        header.sections[i].count = sections[i].count;
+
+        offset += sections[i].count * sections[i].stride;
+    }
+
+    header.fileSize = offset;
+
+    // write to a temporary, then move it in place
+    // a reader never sees a half written cache
+
+    std::string cachePath = getCachePath( objPath );
+    std::string tempPath = cachePath + ".tmp";
+
+    {
+        std::ofstream file( tempPath, std::ios::binary | std::ios::trunc );
+
+        if ( !file )
+        {
+            printf( "\tfailed to write %s\n", tempPath.c_str() );
+            return false;
+        }
+
+        file.write( reinterpret_cast<const char*>( &header ), sizeof( header ) );
+
+        writeBytes( file, dependencies.data(),
+                    dependencies.size() * sizeof( Dependency ),
+                    header.dependencyOffset );
+
+        for ( auto& path : paths )
+            file.write( path.data(), path.size() );
+
+        for ( int i = 0; i < eSectionCount; ++i )
+        {
+            writeBytes( file, sections[i].data,
+                        sections[i].count * sections[i].stride,
+                        header.sections[i].offset );
+        }
+
+        if ( !file )
+        {
+            printf( "\tfailed to write %s\n", tempPath.c_str() );
+            return false;
+        }
+    }
+
+    std::error_code error;
+    std::filesystem::rename( tempPath, cachePath, error );
+
+    if ( error )
+    {
+        std::filesystem::remove( tempPath, error );
+        return false;
+    }
+
+    auto end = std::chrono::high_resolution_clock::now();
+
+    printf( "Cooked %s in %.1f ms\n", cachePath.c_str(),
+            std::chrono::duration<double, std::milli>( end - start ).count() );
+
+    return true;
+}
+
+template <typename T>
+const T* SceneCache::at( uint64_t offset )
+{
+    return reinterpret_cast<const T*>( m_file.getData() + offset );
+}
+
+bool SceneCache::validate( const std::string& objPath )
+{
+    if ( m_file.getSize() < sizeof( Header ) )
+        return false;
+
+    m_header = at<Header>( 0 );
+
+    if ( memcmp( m_header->magic, MAGIC, sizeof( MAGIC ) ) != 0 ||
+         m_header->version != VERSION ||
+         m_header->reordered != uint32_t( REORDER ) ||
+         m_header->splitBudget != SPLIT_BUDGET ||
+         m_header->fileSize != m_file.getSize() ||
+         m_header->dependencyCount == 0 )
+        return false;
+
+    //don't trust the offsets, the file might be corrupt
+    auto inFile = [&]( uint64_t offset, uint64_t count, uint64_t stride )
+    { return offset <= m_file.getSize() &&
+             count <= ( m_file.getSize() - offset ) / stride; };
+
+    if ( !inFile( m_header->dependencyOffset, m_header->dependencyCount,
+                  sizeof( Dependency ) ) )
+        return false;
+
+    const uint64_t strides[eSectionCount] = {
+        sizeof( glm::vec3 ), sizeof( VertexAttributes ), sizeof( uint32_t ),
+        sizeof( uint16_t ), sizeof( Material ), sizeof( Shape ),
+        sizeof( Instance ), sizeof( uint32_t ), sizeof( uint32_t ) };
+
+    for ( int i = 0; i < eSectionCount; ++i )
+    {
+        if ( !inFile( m_header->sections[i].offset,
+                      m_header->sections[i].count, strides[i] ) )
+            return false;
+    }
+
+    if ( m_header->sections[eAttributes].count !=
+         m_header->sections[ePositions].count )
+        return false;
+
+    uint64_t triangleCount = m_header->sections[eIndices].count / 3;
+
+    if ( m_header->sections[eTriangleMaterials].count !=
+         ( triangleCount + 1 ) / 2 * 2 )
+        return false;
+
+    if ( m_header->sections[eMaterials].count == 0 ||
+         m_header->sections[eMaterials].count > MAX_MATERIALS + 1 )
+        return false;
+
+    //the GPU indexes with these, an index out of range reads past the buffers
+    auto inRange = [&]( auto* values, uint64_t count, uint64_t limit )
+    {
+        for ( uint64_t i = 0; i < count; ++i )
+        {
+            if ( values[i] >= limit )
+                return false;
+        }
+
+        return true;
+    };
+
+    if ( !inRange( getIndices(), getIndexCount(), getVertexCount() ) ||
+         !inRange( getBlasIndices(), getBlasIndexCount(), getVertexCount() ) ||
+         !inRange( getTriangleMaterials(), getTriangleMaterialCount(),
+                   getMaterialCount() ) )
+        return false;
+
+    //the shapes are the BLAS ranges, they must stay inside the index buffer
+    auto shapes = getShapes();
+
+    for ( uint64_t i = 0; i < getShapeCount(); ++i )
+    {
+        if ( shapes[i].indexCount % 3 != 0 ||
+             uint64_t( shapes[i].firstIndex ) + shapes[i].indexCount >
+                 m_header->sections[eIndices].count )
+            return false;
+
+        if ( shapes[i].blasIndexCount % 3 != 0 ||
+             uint64_t( shapes[i].blasFirstIndex ) + shapes[i].blasIndexCount >
+                 m_header->sections[eBlasIndices].count )
+            return false;
+    }
+
+    if ( m_header->sections[eBlasPrimitives].count * 3 !=
+         m_header->sections[eBlasIndices].count )
+        return false;
+
+    auto primitives = getBlasPrimitives();
+
+    for ( uint64_t i = 0; i < getBlasPrimitiveCount(); ++i )
+    {
+        if ( primitives[i] >= triangleCount )
+            return false;
+    }
+
+    auto instances = getInstances();
+
+    for ( uint64_t i = 0; i < getInstanceCount(); ++i )
+    {
+        if ( instances[i].shape >= getShapeCount() )
+            return false;
+    }
+
+    auto dependencies = at<Dependency>( m_header->dependencyOffset );
+
+    std::string directory = directoryOf( objPath );
+
+    for ( uint64_t i = 0; i < m_header->dependencyCount; ++i )
+    {
+        auto& dependency = dependencies[i];
+
+        if ( !inFile( dependency.pathOffset, dependency.pathLength, 1 ) )
+            return false;
+
+        std::string path( at<char>( dependency.pathOffset ),
+                          dependency.pathLength );
+
+        uint64_t size;
+        int64_t time;
+        stamp( directory + path, size, time );
+
+        if ( size != dependency.size )
+            return false;
+
+        if ( time == dependency.time )
+            continue;
+
+        //touched but maybe not changed, compare the OBJ contents
+        if ( i != 0 )
+            return false;
+
+        MappedFile source;
+        if ( !source.open( objPath ) ||
+             hashBytes( source.getData(), source.getSize() ) !=
+                 m_header->sourceHash )
+            return false;
+    }
+
+    return true;
+}
+
+bool SceneCache::isCurrent( const std::string& objPath )
+{
+    if ( m_file.open( getCachePath( objPath ) ) && validate( objPath ) )
+        return true;
+
+    close();
+    return false;
+}
+
+bool SceneCache::open( const std::string& objPath )
+{
+    if ( isCurrent( objPath ) )
+        return true;
+
+    printf( "Cooking %s\n", objPath.c_str() );
+
+    if ( !cook( objPath ) )
+        return false;
+
+    return isCurrent( objPath );
+}
+
+void SceneCache::close()
+{
+    m_file.close();
+    m_header = nullptr;
+}
+
+template <typename T>
+const T* SceneCache::getSection( Section section )
+{
+    return at<T>( m_header->sections[section].offset );
+}
+
+uint64_t SceneCache::getVertexCount()
+{
+    return m_header->sections[ePositions].count;
+}
+
+uint64_t SceneCache::getIndexCount()
+{
+    return m_header->sections[eIndices].count;
+}
+
+uint64_t SceneCache::getMaterialCount()
+{
+    return m_header->sections[eMaterials].count;
+}
+
+const glm::vec3* SceneCache::getPositions()
+{
+    return getSection<glm::vec3>( ePositions );
+}
+
+const SceneCache::VertexAttributes* SceneCache::getAttributes()
+{
+    return getSection<VertexAttributes>( eAttributes );
+}
+
+const uint32_t* SceneCache::getIndices()
+{
+    return getSection<uint32_t>( eIndices );
+}
+
+const uint16_t* SceneCache::getTriangleMaterials()
+{
+    return getSection<uint16_t>( eTriangleMaterials );
+}
+
+uint64_t SceneCache::getTriangleMaterialCount()
+{
+    return m_header->sections[eTriangleMaterials].count;
+}
+
+const SceneCache::Material* SceneCache::getMaterials()
+{
+    return getSection<SceneCache::Material>( eMaterials );
+}
+
+uint64_t SceneCache::getShapeCount()
+{
+    return m_header->sections[eShapes].count;
+}
+
+const SceneCache::Shape* SceneCache::getShapes()
+{
+    return getSection<Shape>( eShapes );
+}
+
+uint64_t SceneCache::getInstanceCount()
+{
+    return m_header->sections[eInstances].count;
+}
+
+const SceneCache::Instance* SceneCache::getInstances()
+{
+    return getSection<Instance>( eInstances );
+}
+
+uint64_t SceneCache::getBlasIndexCount()
+{
+    return m_header->sections[eBlasIndices].count;
+}
+
+const uint32_t* SceneCache::getBlasIndices()
+{
+    return getSection<uint32_t>( eBlasIndices );
+}
+
+uint64_t SceneCache::getBlasPrimitiveCount()
+{
+    return m_header->sections[eBlasPrimitives].count;
+}
+
+const uint32_t* SceneCache::getBlasPrimitives()
+{
+    return getSection<uint32_t>( eBlasPrimitives );
+}
+
+uint64_t SceneCache::getGeometryHash()
+{
+    return m_header->geometryHash;
+}
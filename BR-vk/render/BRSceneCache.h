@@ -0,0 +1,201 @@
+#pragma once
+
+#include <BRMappedFile.h>
+
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <string>
+
+namespace BR
+{
+/*
+
+Cooked scene cache - .brscene files
+
+* Holds the final GPU ready arrays of a model, so loading is a memory map and
+    a copy into staging memory, no parsing or per-vertex work
+* Cooking parses the OBJ, welds the vertices, packs them, and writes the
+    arrays next to the OBJ ( models/foo/bar.obj -> models/foo/bar.brscene )
+* The triangles of every shape are sorted along a Morton curve, and the
+    vertices renumbered in first use order, for cache locality in the hit
+    shader and the post-transform cache
+* Degenerate triangles are dropped, and long thin triangles are split for
+    the BLAS only, up to a budget - see SPLIT_BUDGET
+* Repeated shapes are cooked once - a shape that matches an earlier one up
+    to translation, rotation and uniform scale keeps no geometry of its own,
+    it becomes an instance of the earlier one with a transform
+* The header records a version, and the size/time stamps of the OBJ and its
+    material libraries, plus a hash of the OBJ contents
+    * Stale or old-version caches are cooked again on open
+    * If only the OBJ time stamp changed, the contents hash decides
+
+File layout, every array 16 byte aligned:
+    Header | Dependency[] | dependency paths | sections
+
+*/
+
+class SceneCache
+{
+   public:
+    SceneCache();
+
+    //Vertex streams, shared by raster and RT
+    //Positions are a tightly packed vec3 stream - the BLAS build input
+    //Everything else is packed in the attribute stream
+    struct VertexAttributes
+    {
+        uint32_t normal;  // octahedral, 2x snorm16
+        uint32_t uv;      // 2x half
+    };
+
+    //GPU material table entry, std430 layout
+    struct Material
+    {
+        glm::vec4 ambient;
+        glm::vec4 diffuse;
+        glm::vec4 specular;
+    };
+
+    //A group of triangles from the OBJ ( o / g ), a range of the index buffer
+    //Each shape gets its own BLAS. Shapes with split triangles build it from
+    //their range of the BLAS index buffer instead, blasIndexCount = 0 if not
+    struct Shape
+    {
+        uint32_t firstIndex;
+        uint32_t indexCount;
+        uint32_t blasFirstIndex;
+        uint32_t blasIndexCount;
+    };
+
+    //A placement of a shape in the model, every OBJ shape is one
+    //Repeated shapes are placements of the same mesh
+    struct Instance
+    {
+        glm::vec4 transform[3];  // row major 3x4, like VkTransformMatrixKHR
+        uint32_t shape;
+    };
+
+    //per-triangle material indices are 16 bit, two per 32 bit word
+    static const uint32_t MAX_MATERIALS = 0xFFFF;
+
+    //bump whenever the cooked data changes
+    static const uint32_t VERSION = 9;
+
+    //Morton order the triangles, and the vertices by first use
+    //flip to compare, caches cooked the other way are cooked again
+    static const bool REORDER = true;
+
+    //extra BLAS triangles the splitting may add, a fraction of the triangle
+    //count. 0 turns it off, caches cooked with another budget are cooked again
+    static constexpr float SPLIT_BUDGET = 0.25f;
+
+    //maps the cache of the OBJ, cooks it first if it's missing or stale
+    bool open( const std::string& objPath );
+    void close();
+
+    //maps the cache of the OBJ, if it's there and up to date
+    bool isCurrent( const std::string& objPath );
+
+    //parse the OBJ and write its cache
+    //threadCount is passed on to the OBJ parser
+    static bool cook( const std::string& objPath, unsigned threadCount = 0 );
+
+    //the OBJ path with its extension replaced, other caches of the same model
+    //use their own extension
+    static std::string getCachePath( const std::string& objPath,
+                                     const std::string& extension = ".brscene" );
+
+    //hash of the positions, indices, shapes and BLAS indices - what the
+    //BLASes are built from
+    uint64_t getGeometryHash();
+
+    uint64_t getVertexCount();
+    uint64_t getIndexCount();
+    uint64_t getMaterialCount();
+
+    const glm::vec3* getPositions();
+    const VertexAttributes* getAttributes();
+    const uint32_t* getIndices();
+
+    //material index of every triangle, padded to an even count
+    const uint16_t* getTriangleMaterials();
+    uint64_t getTriangleMaterialCount();
+
+    //the last one is the default material
+    const Material* getMaterials();
+
+    //non-empty unique shapes, in index buffer order
+    uint64_t getShapeCount();
+    const Shape* getShapes();
+
+    //the OBJ shapes, in file order, each one places a unique shape
+    uint64_t getInstanceCount();
+    const Instance* getInstances();
+
+    //triangles of the shapes with split triangles, see Shape
+    uint64_t getBlasIndexCount();
+    const uint32_t* getBlasIndices();
+
+    //the cooked triangle of every BLAS triangle
+    uint64_t getBlasPrimitiveCount();
+    const uint32_t* getBlasPrimitives();
+
+   private:
+    enum Section
+    {
+        ePositions,
+        eAttributes,
+        eIndices,
+        eTriangleMaterials,
+        eMaterials,
+        eShapes,
+        eInstances,
+        eBlasIndices,
+        eBlasPrimitives,
+        eSectionCount
+    };
+
+    struct SectionInfo
+    {
+        uint64_t offset;
+        uint64_t count;
+    };
+
+    struct Header
+    {
+        char magic[4];
+        uint32_t version;
+        uint32_t reordered;
+        float splitBudget;
+        uint64_t fileSize;
+        uint64_t sourceHash;
+        uint64_t geometryHash;
+
+        uint64_t dependencyCount;
+        uint64_t dependencyOffset;
+
+        SectionInfo sections[eSectionCount];
+    };
+
+    //a file the cache was cooked from, path relative to the OBJ directory
+    //the OBJ itself is always the first one
+    struct Dependency
+    {
+        uint64_t size;
+        int64_t time;
+        uint64_t pathOffset;
+        uint64_t pathLength;
+    };
+
+    bool validate( const std::string& objPath );
+
+    template <typename T>
+    const T* at( uint64_t offset );
+
+    template <typename T>
+    const T* getSection( Section section );
+
+    MappedFile m_file;
+    const Header* m_header;
+};
+}  // namespace BR
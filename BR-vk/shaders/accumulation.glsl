@@ -0,0 +1,41 @@
+//Per-pixel outputs of the raygen shader - the sums of the accumulation
+//buffer, read by adaptive.comp, resolve.comp and the denoiser, and the AOVs
+//that guide the denoiser
+
+//pixels are traced in TILE_SIZE x TILE_SIZE tiles, the units of adaptive
+//sampling - see adaptive.comp
+const uint TILE_SIZE = 8;
+
+struct Accumulation
+{
+  vec4 color;      // sum of the samples, w = sample count
+  vec2 luminance;  // sum and sum of squares of the samples' luminance
+};
+
+//the primary hit of the pixel's latest sample
+struct Aov
+{
+  vec4 position;  // world, w = distance from the camera, < 0 for the sky
+  vec4 normal;    // world
+  vec4 albedo;    // of the hit, the sky color for the sky
+};
+
+float luminance(vec3 c)
+{
+  return dot(c, vec3(0.2126, 0.7152, 0.0722));
+}
+
+//standard error of the pixel's mean luminance, relative to the mean
+//the floor keeps dark pixels from needing an error of 0
+float relativeError(Accumulation a)
+{
+  float n = a.color.w;
+
+  if (n < 2.0)
+    return 1e30;
+
+  float mean = a.luminance.x / n;
+  float variance = max(a.luminance.y / n - mean * mean, 0.0) * n / (n - 1.0);
+
+  return sqrt(variance / n) / (mean + 0.1);
+}
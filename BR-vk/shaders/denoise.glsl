@@ -0,0 +1,85 @@
+//Shared by the denoiser passes - temporal.comp, variance.comp, atrous.comp
+//See Denoiser ( render/BRDenoiser.h ) for the order they run in
+
+#include "accumulation.glsl"
+
+//edge stopping - how different a neighbour can be and still be blended in
+const float PHI_DEPTH = 2.0;    // distance off the tangent plane, in pixels
+const float PHI_NORMAL = 64.0;  // power of the normals' cosine
+const float PHI_ALBEDO = 0.1;
+const float PHI_COLOR = 4.0;    // luminance, in standard deviations
+
+//the history of a pixel
+struct History
+{
+  vec4 color;    // the first a-trous iteration's output
+  vec4 moments;  // luminance mean, mean of squares, history length
+};
+
+layout(binding = 0, set = 0) readonly buffer accumulation
+{
+  Accumulation acc[];
+};
+layout(binding = 1, set = 0) readonly buffer aovs
+{
+  Aov aov[];
+};
+layout(binding = 2, set = 0) buffer previousAovs
+{
+  Aov previousAov[];
+};
+layout(binding = 3, set = 0) buffer histories
+{
+  History history[];
+};
+//this frame's moments, the same layout as History.moments
+layout(binding = 4, set = 0) buffer momentBuffer
+{
+  vec4 moments[];
+};
+//two halves of color, w = variance, each pass reads one and writes the other
+layout(binding = 5, set = 0) buffer filterBuffer
+{
+  vec4 filtered[];
+};
+
+layout(binding = 6, set = 0, rgba8) uniform writeonly image2D image;
+
+layout(binding = 7, set = 0) uniform DenoiseParams
+{
+  mat4 motion;            // this frame's world -> the last frame's
+  mat4 previousViewProj;
+  uvec2 size;
+  float footprint;        // size of a pixel at distance 1
+  uint historyValid;
+  uint samples;           // traced per pixel this frame
+} params;
+
+uint pixelIndex(ivec2 p)
+{
+  return p.y * params.size.x + p.x;
+}
+
+bool inside(ivec2 p)
+{
+  return all(greaterThanEqual(p, ivec2(0))) &&
+         all(lessThan(p, ivec2(params.size)));
+}
+
+bool isSky(Aov a)
+{
+  return a.position.w < 0.0;
+}
+
+//how much q is the same surface as p, distance in pixels
+float geometryWeight(Aov p, Aov q, float distance)
+{
+  float plane = abs(dot(p.normal.xyz, q.position.xyz - p.position.xyz));
+  float size = PHI_DEPTH * p.position.w * params.footprint * distance;
+
+  float wz = exp(-plane / max(size, 1e-6));
+  float wn = pow(max(dot(p.normal.xyz, q.normal.xyz), 0.0), PHI_NORMAL);
+  float wa = exp(-length(p.albedo.rgb - q.albedo.rgb) / PHI_ALBEDO);
+
+  return wz * wn * wa;
+}
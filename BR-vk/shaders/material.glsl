@@ -0,0 +1,15 @@
+//Material table and per-triangle material indices, see SceneCache::Material
+
+struct Material
+{
+    vec4 ambient;
+    vec4 diffuse;
+    vec4 specular;
+};
+
+//the per-triangle indices are 16 bit, packed two per uint
+//word is t[primitive / 2] of the triangle material buffer
+uint materialIndex( uint word, int primitive )
+{
+    return ( word >> ( 16 * ( primitive & 1 ) ) ) & 0xFFFF;
+}
@@ -0,0 +1,130 @@
+//Low discrepancy sampling for the path tracer
+//
+//* Owen scrambled Sobol points, scrambled and shuffled with hashes - see
+//    Burley, Practical Hash-based Owen Scrambling, JCGT 2020
+//* A sample is indexed by its pixel, its sample index ( the iteration )
+//    and a dimension - one per random decision along the path, see
+//    bounceDimension()
+//* Every dimension is a 2D Sobol sequence with its own shuffle and
+//    scramble, seeded from the pixel and the dimension, so neither pixels
+//    nor dimensions are correlated
+//* The warps are closed form, no rejection loops
+//
+//tools/BRSampleBench.cpp has a CPU copy, keep them in sync
+
+const float PI = 3.14159265358979;
+
+//dimensions of a path
+//the pixel jitter, then DIMENSIONS_PER_BOUNCE for every bounce
+const uint DIMENSION_PIXEL = 0;
+const uint DIMENSIONS_PER_BOUNCE = 3;
+
+//what the dimensions of a bounce are used for
+const uint BOUNCE_DIRECTION = 0;  // 2D
+const uint BOUNCE_RADIUS = 1;     // 1D
+const uint BOUNCE_ROULETTE = 2;   // 1D
+
+uint bounceDimension(uint depth, uint use)
+{
+  return 1 + depth * DIMENSIONS_PER_BOUNCE + use;
+}
+
+//PCG hash
+uint hash(uint x)
+{
+  uint state = x * 747796405u + 2891336453u;
+  uint word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+  return (word >> 22u) ^ word;
+}
+
+uint hashCombine(uint seed, uint value)
+{
+  return seed ^ (hash(value) + 0x9E3779B9u + (seed << 6) + (seed >> 2));
+}
+
+//the seed of a pixel, every dimension of it derives from this
+uint pixelSeed(uvec2 pixel)
+{
+  return hashCombine(hash(pixel.x), pixel.y);
+}
+
+//Laine-Karras style permutation, flips every bit depending only on the
+//bits below it
+uint laineKarras(uint x, uint seed)
+{
+  x += seed;
+  x ^= x * 0x6C50B47Cu;
+  x ^= x * 0xB82F1E52u;
+  x ^= x * 0xC7AFE638u;
+  x ^= x * 0x8D22F6E6u;
+  return x;
+}
+
+//Owen scrambling of a 32 bit fraction - each bit flipped depending only on
+//the bits above it
+uint nestedUniformScramble(uint x, uint seed)
+{
+  x = bitfieldReverse(x);
+  x = laineKarras(x, seed);
+  return bitfieldReverse(x);
+}
+
+//the first two Sobol dimensions as 32 bit fractions - van der Corput, and
+//the one from the Pascal matrix
+uvec2 sobol2(uint index)
+{
+  uint y = 0;
+
+  for (uint i = index, v = 1u << 31; i != 0; i >>= 1, v ^= v >> 1)
+  {
+    if ((i & 1u) != 0)
+      y ^= v;
+  }
+
+  return uvec2(bitfieldReverse(index), y);
+}
+
+//[0, 1)^2 point of a sample
+vec2 sample2D(uint seed, uint sampleIndex, uint dimension)
+{
+  seed = hashCombine(seed, dimension);
+
+  uvec2 p = sobol2(nestedUniformScramble(sampleIndex, seed));
+
+  p.x = nestedUniformScramble(p.x, hashCombine(seed, 0u));
+  p.y = nestedUniformScramble(p.y, hashCombine(seed, 1u));
+
+  //24 bits, a float can't round them up to 1
+  return vec2(p >> 8) * (1.0 / 16777216.0);
+}
+
+float sample1D(uint seed, uint sampleIndex, uint dimension)
+{
+  return sample2D(seed, sampleIndex, dimension).x;
+}
+
+//uniform on the unit sphere
+vec3 sphereDirection(vec2 u)
+{
+  float z = 1.0 - 2.0 * u.x;
+  float r = sqrt(max(0.0, 1.0 - z * z));
+  float phi = 2.0 * PI * u.y;
+
+  return vec3(r * cos(phi), r * sin(phi), z);
+}
+
+//uniform in the unit ball, v places it along the radius
+vec3 ballPoint(vec2 u, float v)
+{
+  return sphereDirection(u) * pow(v, 1.0 / 3.0);
+}
+
+//cosine weighted around the normal - a point on the unit sphere touching
+//the surface, no tangent frame needed
+vec3 cosineHemisphere(vec2 u, vec3 normal)
+{
+  vec3 d = normal + sphereDirection(u);
+  float length2 = dot(d, d);
+
+  return length2 > 1e-12 ? d * inversesqrt(length2) : normal;
+}
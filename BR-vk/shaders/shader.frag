@@ -1,10 +1,57 @@
 #version 450
+#extension GL_GOOGLE_include_directive : enable
 
-layout(location = 0) in vec3 inColor;
+#include "material.glsl"
+
+layout(binding = 1) readonly buffer materials {
+    Material m[];
+};
+
+layout(binding = 2) readonly buffer triangleMaterials {
+    uint t[];
+};
+
+//index of the draw's first triangle, the shape's offset in the index buffer
+layout(push_constant) uniform Params {
+    uint firstTriangle;
+} params;
+
+layout(location = 0) in vec3 inNormal;
+layout(location = 1) in vec3 inLightVec;
+layout(location = 2) in vec3 inEyeVec;
 
 layout(location = 0) out vec4 outColor;
 
 
 void main() {
-    outColor = vec4(inColor, 1.0);
-}
\ No newline at end of file
+    // the triangle's material, gl_PrimitiveID counts triangles in the draw
+    int triangle = int( params.firstTriangle ) + gl_PrimitiveID;
+    Material material = m[materialIndex( t[triangle / 2], triangle )];
+
+    vec3 ambient = vec3( 0.3, 0.3, 0.3 );
+
+    vec3 normal = normalize( inNormal );
+
+    // normalized light vector
+    vec3 light_vec_n = normalize( inLightVec );
+
+    // dot product between the normal and the light vector
+    // perpendicular - 1
+    // parallel - 0
+    float cosTheta = clamp( dot( normal, light_vec_n ), 0, 1 );
+
+    // normalized eye vector
+    vec3 eye_vec_n = normalize( inEyeVec );
+
+    // reflect the light vector around the normal
+    vec3 refl = reflect( -light_vec_n, normal );
+
+    // dot product between the eye vector and the reflected light vector
+    float cosAlpha = clamp( dot( eye_vec_n, refl ), 0, 1 );
+
+    vec3 color = material.ambient.xyz + ambient * material.diffuse.xyz +
+                 material.diffuse.xyz * cosTheta +
+                 material.specular.xyz * pow( cosAlpha, 5 );
+
+    outColor = vec4( color, 1.0 );
+}
@@ -1,4 +1,7 @@
 #version 450
+#extension GL_GOOGLE_include_directive : enable
+
+#include "vertex.glsl"
 
 layout(binding = 0) uniform UniformBufferObject {
     mat4 model;
@@ -7,50 +10,43 @@ layout(binding = 0) uniform UniformBufferObject {
     vec3 cameraPos;
 } ubo;
 
+//placement of every instance of the shape, see Scene::scatter
+layout(binding = 3) readonly buffer transforms {
+    mat4 t[];
+};
+
 layout(location = 0) in vec3 inPosition; // in model space
-layout(location = 1) in vec3 inNormal; // in model space
-layout(location = 2) in vec3 inColor; // in model space
+layout(location = 1) in vec2 inNormal; // octahedral, in model space
+layout(location = 2) in vec2 inUV;
 
-layout(location = 0) out vec3 outColor;
+// all in view space, the material is applied per fragment
+layout(location = 0) out vec3 outNormal;
+layout(location = 1) out vec3 outLightVec;
+layout(location = 2) out vec3 outEyeVec;
 
 void main() {
 
     vec3 lightPos = vec3( 10, 10, 0 ); //in model space
-    vec3 objColor = inColor; 
-    vec3 ambient = vec3( 0.3, 0.3, 0.3);
 
     // the position of the light, in view space
     vec4 light_pos_view = ubo.view * vec4( lightPos, 1 ); 
 
-    // the vector from light to surface, in view space
-    vec4 light_vec_view = light_pos_view - ( ubo.view * ubo.model * vec4( inPosition, 1.0 ) );
+    mat4 model = ubo.model * t[gl_InstanceIndex];
 
-    // the surface normal, in view space
-    vec4 normal_view = ubo.view * ubo.model * vec4( inNormal, 0 );
+    // the position of the surface, in view space
+    vec4 pos_view = ubo.view * model * vec4( inPosition, 1.0 );
 
-    // normalized light vector
-    vec4 light_vec_view_n = normalize( light_vec_view );
+    // the vector from light to surface, in view space
+    outLightVec = ( light_pos_view - pos_view ).xyz;
 
-    // dot product between the normal and the light vector
-    // perpendicular - 1
-    // parallel - 0
-    float cosTheta = clamp( dot( normal_view, light_vec_view_n ), 0, 1 );
+    // the surface normal, in view space
+    outNormal = ( ubo.view * model * vec4( octDecode( inNormal ), 0 ) ).xyz;
 
     // position of camera, in view space
     vec4 eye_pos_view = ubo.view * vec4( ubo.cameraPos, 1 );
 
     // vector from camera to surface, in view space
-    vec4 eye_vec_view = eye_pos_view - ( ubo.view * ubo.model * vec4( inPosition, 1.0 ) ) ;
-
-    // normalized eye vector
-    vec4 eye_vec_view_n = normalize( eye_vec_view );
-
-    // reflect the light vector around the normal
-    vec4 refl = reflect( -light_vec_view_n, normal_view );
-
-    // dot product between the eye vector and the reflected light vector
-    float cosAlpha = clamp( dot( eye_vec_view_n, refl ), 0, 1 );
+    outEyeVec = ( eye_pos_view - pos_view ).xyz;
 
-    gl_Position = ubo.proj * ubo.view * ubo.model * vec4( inPosition, 1.0 );
-    outColor = ambient*objColor + objColor * cosTheta + objColor * pow( cosAlpha, 5 );
-}
\ No newline at end of file
+    gl_Position = ubo.proj * pos_view;
+}
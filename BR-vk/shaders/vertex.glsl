@@ -0,0 +1,12 @@
+//Unpacking of the vertex attribute stream, see SceneCache::VertexAttributes
+
+//octahedral encoded unit vector -> normal
+vec3 octDecode( vec2 e )
+{
+    vec3 n = vec3( e.xy, 1.0 - abs( e.x ) - abs( e.y ) );
+
+    if ( n.z < 0 )
+        n.xy = ( 1.0 - abs( n.yx ) ) * vec2( n.x >= 0 ? 1.0 : -1.0, n.y >= 0 ? 1.0 : -1.0 );
+
+    return normalize( n );
+}
@@ -0,0 +1,107 @@
+/*
+
+Scene cooker - writes the .brscene cache of every OBJ under a directory
+
+* Usage: br-cook [directory] [--force]
+* Default directory is models/, same as Scene::loadModel
+* Up-to-date caches are skipped, unless --force
+* One file per thread, each parsed single-threaded - many small models
+    scale better this way than one parser fanning out per file
+
+*/
+
+#include <BRSceneCache.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace BR;
+
+int main( int argc, char** argv )
+{
+    std::string directory = "models";
+    bool force = false;
+
+    for ( int i = 1; i < argc; ++i )
+    {
+        std::string arg = argv[i];
+
+        if ( arg == "--force" )
+            force = true;
+        else
+            directory = arg;
+    }
+
+    std::vector<std::string> models;
+
+    std::error_code error;
+    for ( auto& entry :
+          std::filesystem::recursive_directory_iterator( directory, error ) )
+    {
+        auto extension = entry.path().extension().string();
+        std::transform( extension.begin(), extension.end(), extension.begin(),
+                        ::tolower );
+
+        if ( entry.is_regular_file() && extension == ".obj" )
+            models.push_back( entry.path().generic_string() );
+    }
+
+    if ( error )
+    {
+        printf( "failed to read %s\n", directory.c_str() );
+        return 1;
+    }
+
+    printf( "Cooking %zu models from %s\n", models.size(), directory.c_str() );
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    std::atomic<size_t> next = 0;
+    std::atomic<int> cooked = 0, skipped = 0, failed = 0;
+
+    auto worker = [&]()
+    {
+        for ( size_t i = next++; i < models.size(); i = next++ )
+        {
+            if ( !force )
+            {
+                SceneCache existing;
+
+                //open() would cook, only check the cache here
+                if ( existing.isCurrent( models[i] ) )
+                {
+                    skipped++;
+                    continue;
+                }
+            }
+
+            if ( SceneCache::cook( models[i], 1 ) )
+                cooked++;
+            else
+                failed++;
+        }
+    };
+
+    unsigned threadCount = std::max( 1u, std::thread::hardware_concurrency() );
+
+    std::vector<std::thread> threads;
+    for ( unsigned i = 0; i < threadCount; ++i )
+        threads.emplace_back( worker );
+
+    for ( auto& thread : threads )
+        thread.join();
+
+    auto end = std::chrono::high_resolution_clock::now();
+
+    printf( "Cooked %d, up to date %d, failed %d in %.1f s\n", cooked.load(),
+            skipped.load(), failed.load(),
+            std::chrono::duration<double>( end - start ).count() );
+
+    return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,123 @@
+/*
+
+OBJ loading benchmark - tinyobj ObjReader vs ObjParser
+
+* Usage: obj-bench [model.obj ...]
+* Paths are relative to models/, same as Scene::loadModel
+* With no arguments, runs over the models used in BRRender::initVulkan
+* Checks that both parsers agree on the vertex/triangle/material counts
+
+*/
+
+#include <BRObjParser.h>
+
+#define TINYOBJLOADER_IMPLEMENTATION
+#include <tiny_obj_loader.h>
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+using namespace BR;
+
+const int RUNS = 3;
+
+template <typename Func>
+double bestOf( Func func )
+{
+    double best = 1e30;
+
+    for ( int i = 0; i < RUNS; ++i )
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        func();
+        auto end = std::chrono::high_resolution_clock::now();
+
+        best = std::min(
+            best,
+            std::chrono::duration<double, std::milli>( end - start ).count() );
+    }
+
+    return best;
+}
+
+int main( int argc, char** argv )
+{
+    std::vector<std::string> models;
+
+    for ( int i = 1; i < argc; ++i )
+        models.push_back( argv[i] );
+
+    if ( models.empty() )
+    {
+        models = { "new/911-turbo/source/911_scene.obj",
+                   "CasualEffects/sponza/sponza.obj",
+                   "CasualEffects/San_Miguel/san-miguel.obj",
+                   "CasualEffects/bistro/Exterior/exterior.obj",
+                   "CasualEffects/bistro/Interior/interior.obj",
+                   "CasualEffects/hairball/hairball.obj" };
+    }
+
+    printf( "%-48s %12s %12s %8s\n", "model", "tinyobj ms", "BR ms",
+            "speedup" );
+
+    for ( auto& model : models )
+    {
+        std::string path = "models/" + model;
+
+        size_t tinyTriangles = 0, tinyVertices = 0, tinyMaterials = 0;
+        bool tinyValid = false;
+
+        double tinyTime = bestOf(
+            [&]()
+            {
+                tinyobj::ObjReader reader;
+                tinyValid = reader.ParseFromFile( path );
+
+                tinyTriangles = 0;
+                for ( auto& shape : reader.GetShapes() )
+                    tinyTriangles += shape.mesh.indices.size() / 3;
+
+                tinyVertices = reader.GetAttrib().vertices.size() / 3;
+                tinyMaterials = reader.GetMaterials().size();
+            } );
+
+        size_t brTriangles = 0, brVertices = 0, brMaterials = 0;
+        bool brValid = false;
+
+        double brTime = bestOf(
+            [&]()
+            {
+                ObjParser parser;
+                brValid = parser.parse( path );
+
+                brTriangles = 0;
+                for ( auto& shape : parser.m_shapes )
+                    brTriangles += shape.indices.size() / 3;
+
+                brVertices = parser.m_positions.size() / 3;
+                brMaterials = parser.m_materials.size();
+            } );
+
+        if ( !tinyValid || !brValid )
+        {
+            printf( "%-48s failed to load\n", model.c_str() );
+            continue;
+        }
+
+        printf( "%-48s %12.1f %12.1f %7.1fx\n", model.c_str(), tinyTime,
+                brTime, tinyTime / brTime );
+
+        if ( tinyTriangles != brTriangles || tinyVertices != brVertices ||
+             tinyMaterials != brMaterials )
+        {
+            printf( "\tmismatch: triangles %zu/%zu vertices %zu/%zu "
+                    "materials %zu/%zu\n",
+                    tinyTriangles, brTriangles, tinyVertices, brVertices,
+                    tinyMaterials, brMaterials );
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,403 @@
+/*
+
+Sampling convergence benchmark - xorshift with rejection vs scrambled Sobol
+
+* Usage: sample-bench
+* Estimates the first bounce of the Glossy and AO RT modes for a block of
+    pixels, against a sky occluded by a plane, the way the hit shader does
+* "before" is the old sampler - seeded with wang_hash( pixel * iteration ),
+    unit ball points by rejection from xorshift
+* "after" is shaders/sampling.glsl, copied below - keep them in sync
+* Prints the RMSE over the pixels after a fixed number of iterations, each
+    method against its own converged value
+
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+const float PI = 3.14159265358979f;
+
+//the block of pixels, in a 1280 wide image, away from the corner
+const uint32_t WIDTH = 1280;
+const uint32_t BLOCK_X = 640;
+const uint32_t BLOCK_Y = 360;
+const uint32_t BLOCK_SIZE = 16;
+
+//samples of the converged values
+const uint32_t REFERENCE_SAMPLES = 1 << 18;
+
+struct Vec3
+{
+    float x, y, z;
+
+    Vec3 operator+( Vec3 b ) const { return { x + b.x, y + b.y, z + b.z }; }
+    Vec3 operator*( float s ) const { return { x * s, y * s, z * s }; }
+};
+
+float dot( Vec3 a, Vec3 b )
+{
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+Vec3 normalize( Vec3 v )
+{
+    float length2 = dot( v, v );
+    return length2 > 1e-12f ? v * ( 1.0f / std::sqrt( length2 ) ) : v;
+}
+
+// ---- before: rng.glsl and the rejection loop of the hit shader ----
+
+struct Xorshift
+{
+    uint32_t state;
+
+    uint32_t next()
+    {
+        state ^= ( state << 13 );
+        state ^= ( state >> 17 );
+        state ^= ( state << 5 );
+        return state;
+    }
+
+    float uniform() { return next() * ( 1.0f / 4294967296.0f ); }
+};
+
+uint32_t wangHash( uint32_t seed )
+{
+    seed = ( seed ^ 61 ) ^ ( seed >> 16 );
+    seed *= 9;
+    seed = seed ^ ( seed >> 4 );
+    seed *= 0x27d4eb2d;
+    seed = seed ^ ( seed >> 15 );
+    return seed;
+}
+
+uint64_t g_rejectionTries = 0;
+uint64_t g_rejectionSamples = 0;
+
+Vec3 rejectionBallPoint( uint32_t pixel, uint32_t iteration )
+{
+    Xorshift rng{ wangHash( pixel * iteration ) };
+
+    Vec3 dir;
+    int count = 0;
+
+    do
+    {
+        float val1 = rng.uniform();
+        float val2 = rng.uniform();
+        float val3 = rng.uniform();
+
+        dir = Vec3{ val1, val2, val3 } * 2.0f + Vec3{ -1.0f, -1.0f, -1.0f };
+
+        count += 1;
+
+    } while ( dot( dir, dir ) >= 1 && count < 1000 );
+
+    g_rejectionTries += count;
+    g_rejectionSamples++;
+
+    return dir;
+}
+
+// ---- after: sampling.glsl ----
+
+const uint32_t DIMENSIONS_PER_BOUNCE = 3;
+const uint32_t BOUNCE_DIRECTION = 0;
+const uint32_t BOUNCE_RADIUS = 1;
+
+uint32_t bounceDimension( uint32_t depth, uint32_t use )
+{
+    return 1 + depth * DIMENSIONS_PER_BOUNCE + use;
+}
+
+uint32_t hash( uint32_t x )
+{
+    uint32_t state = x * 747796405u + 2891336453u;
+    uint32_t word = ( ( state >> ( ( state >> 28u ) + 4u ) ) ^ state ) *
+                    277803737u;
+    return ( word >> 22u ) ^ word;
+}
+
+uint32_t hashCombine( uint32_t seed, uint32_t value )
+{
+    return seed ^ ( hash( value ) + 0x9E3779B9u + ( seed << 6 ) + ( seed >> 2 ) );
+}
+
+uint32_t pixelSeed( uint32_t x, uint32_t y )
+{
+    return hashCombine( hash( x ), y );
+}
+
+uint32_t bitfieldReverse( uint32_t x )
+{
+    x = ( ( x >> 1 ) & 0x55555555u ) | ( ( x & 0x55555555u ) << 1 );
+    x = ( ( x >> 2 ) & 0x33333333u ) | ( ( x & 0x33333333u ) << 2 );
+    x = ( ( x >> 4 ) & 0x0F0F0F0Fu ) | ( ( x & 0x0F0F0F0Fu ) << 4 );
+    x = ( ( x >> 8 ) & 0x00FF00FFu ) | ( ( x & 0x00FF00FFu ) << 8 );
+    return ( x >> 16 ) | ( x << 16 );
+}
+
+uint32_t laineKarras( uint32_t x, uint32_t seed )
+{
+    x += seed;
+    x ^= x * 0x6C50B47Cu;
+    x ^= x * 0xB82F1E52u;
+    x ^= x * 0xC7AFE638u;
+    x ^= x * 0x8D22F6E6u;
+    return x;
+}
+
+uint32_t nestedUniformScramble( uint32_t x, uint32_t seed )
+{
+    x = bitfieldReverse( x );
+    x = laineKarras( x, seed );
+    return bitfieldReverse( x );
+}
+
+void sobol2( uint32_t index, uint32_t& x, uint32_t& y )
+{
+    y = 0;
+
+    for ( uint32_t i = index, v = 1u << 31; i != 0; i >>= 1, v ^= v >> 1 )
+    {
+        if ( i & 1u )
+            y ^= v;
+    }
+
+    x = bitfieldReverse( index );
+}
+
+void sample2D( uint32_t seed, uint32_t sampleIndex, uint32_t dimension,
+               float& u, float& v )
+{
+    seed = hashCombine( seed, dimension );
+
+    uint32_t x, y;
+    sobol2( nestedUniformScramble( sampleIndex, seed ), x, y );
+
+    x = nestedUniformScramble( x, hashCombine( seed, 0u ) );
+    y = nestedUniformScramble( y, hashCombine( seed, 1u ) );
+
+    u = ( x >> 8 ) * ( 1.0f / 16777216.0f );
+    v = ( y >> 8 ) * ( 1.0f / 16777216.0f );
+}
+
+float sample1D( uint32_t seed, uint32_t sampleIndex, uint32_t dimension )
+{
+    float u, v;
+    sample2D( seed, sampleIndex, dimension, u, v );
+    return u;
+}
+
+Vec3 sphereDirection( float u, float v )
+{
+    float z = 1.0f - 2.0f * u;
+    float r = std::sqrt( std::max( 0.0f, 1.0f - z * z ) );
+    float phi = 2.0f * PI * v;
+
+    return { r * std::cos( phi ), r * std::sin( phi ), z };
+}
+
+Vec3 ballPoint( float u, float v, float w )
+{
+    return sphereDirection( u, v ) * std::cbrt( w );
+}
+
+Vec3 cosineHemisphere( float u, float v, Vec3 normal )
+{
+    Vec3 d = normal + sphereDirection( u, v );
+    float length2 = dot( d, d );
+
+    return length2 > 1e-12f ? d * ( 1.0f / std::sqrt( length2 ) ) : normal;
+}
+
+// ---- the benchmark ----
+
+//what the first bounce of a pixel sees
+struct Pixel
+{
+    uint32_t x, y;
+    Vec3 normal;    // AO
+    Vec3 mirror;    // Glossy, the mirror direction
+    Vec3 occluder;  // directions below this plane are blocked
+};
+
+//the miss shader's sky, as a luminance, and the occluding plane
+float radiance( const Pixel& pixel, Vec3 direction )
+{
+    if ( dot( direction, pixel.occluder ) < 0.0f )
+        return 0.0f;
+
+    float t = 0.5f * ( direction.y + 1.0f );
+    return ( 1.0f - t ) + t * 0.7f;
+}
+
+enum Mode
+{
+    eGlossy,
+    eAO
+};
+
+enum Method
+{
+    eBefore,
+    eAfter
+};
+
+//the bounce direction of one sample
+Vec3 bounce( const Pixel& pixel, Mode mode, Method method,
+             uint32_t iteration, uint32_t seed )
+{
+    if ( method == eBefore )
+    {
+        Vec3 dir = rejectionBallPoint( pixel.y * WIDTH + pixel.x, iteration );
+
+        return normalize( ( mode == eGlossy ? pixel.mirror : pixel.normal ) +
+                          dir );
+    }
+
+    float u, v;
+    sample2D( seed, iteration - 1, bounceDimension( 0, BOUNCE_DIRECTION ), u,
+              v );
+
+    if ( mode == eAO )
+        return cosineHemisphere( u, v, pixel.normal );
+
+    float w = sample1D( seed, iteration - 1,
+                        bounceDimension( 0, BOUNCE_RADIUS ) );
+
+    return normalize( pixel.mirror + ballPoint( u, v, w ) );
+}
+
+//the mean each method converges to, with scrambled Sobol from an unrelated
+//seed - the old AO offsets by a point in the ball, not on the sphere
+float reference( const Pixel& pixel, Mode mode, Method method )
+{
+    uint32_t seed = hashCombine( pixelSeed( pixel.x, pixel.y ), 0xC0FFEEu );
+    double sum = 0.0;
+
+    for ( uint32_t i = 0; i < REFERENCE_SAMPLES; ++i )
+    {
+        float u, v;
+        sample2D( seed, i, 0, u, v );
+        float w = sample1D( seed, i, 1 );
+
+        Vec3 offset = mode == eAO && method == eAfter ? sphereDirection( u, v )
+                                                      : ballPoint( u, v, w );
+        Vec3 base = mode == eGlossy ? pixel.mirror : pixel.normal;
+
+        sum += radiance( pixel, normalize( base + offset ) );
+    }
+
+    return static_cast<float>( sum / REFERENCE_SAMPLES );
+}
+
+Vec3 randomDirection( std::mt19937& random )
+{
+    std::uniform_real_distribution<float> uniform( 0.0f, 1.0f );
+    return sphereDirection( uniform( random ), uniform( random ) );
+}
+
+int main()
+{
+    //same scene every run
+    std::mt19937 random( 1 );
+
+    std::vector<Pixel> pixels;
+
+    for ( uint32_t y = 0; y < BLOCK_SIZE; ++y )
+    {
+        for ( uint32_t x = 0; x < BLOCK_SIZE; ++x )
+        {
+            pixels.push_back( { BLOCK_X + x, BLOCK_Y + y,
+                                randomDirection( random ),
+                                randomDirection( random ),
+                                randomDirection( random ) } );
+        }
+    }
+
+    const uint32_t iterations[] = { 1, 4, 16, 64, 256, 1024 };
+    const char* modeNames[] = { "Glossy", "AO" };
+
+    printf( "%zu pixels, RMSE after N iterations\n\n", pixels.size() );
+    printf( "%-8s %6s %12s %12s %8s\n", "mode", "N", "before", "after",
+            "ratio" );
+
+    for ( Mode mode : { eGlossy, eAO } )
+    {
+        std::vector<float> references[2];
+
+        for ( auto& pixel : pixels )
+        {
+            references[eBefore].push_back( reference( pixel, mode, eBefore ) );
+            references[eAfter].push_back( reference( pixel, mode, eAfter ) );
+        }
+
+        for ( uint32_t count : iterations )
+        {
+            double rmse[2] = {};
+
+            for ( Method method : { eBefore, eAfter } )
+            {
+                double squared = 0.0;
+
+                for ( size_t p = 0; p < pixels.size(); ++p )
+                {
+                    uint32_t seed = pixelSeed( pixels[p].x, pixels[p].y );
+                    double sum = 0.0;
+
+                    //iterations start at 1, as in the UBO
+                    for ( uint32_t i = 1; i <= count; ++i )
+                    {
+                        sum += radiance( pixels[p], bounce( pixels[p], mode,
+                                                            method, i, seed ) );
+                    }
+
+                    double error = sum / count - references[method][p];
+                    squared += error * error;
+                }
+
+                rmse[method] = std::sqrt( squared / pixels.size() );
+            }
+
+            printf( "%-8s %6u %12.5f %12.5f %7.1fx\n", modeNames[mode], count,
+                    rmse[eBefore], rmse[eAfter],
+                    rmse[eAfter] > 0.0 ? rmse[eBefore] / rmse[eAfter] : 0.0 );
+        }
+    }
+
+    printf( "\nrejection: %.2f tries, %.2f xorshifts per ball point\n",
+            double( g_rejectionTries ) / g_rejectionSamples,
+            3.0 * g_rejectionTries / g_rejectionSamples );
+
+    //cost of one ball point each way
+    const uint32_t TIMED = 1 << 22;
+    volatile float sink = 0.0f;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for ( uint32_t i = 1; i <= TIMED; ++i )
+        sink = sink + rejectionBallPoint( i, 7 ).x;
+    auto middle = std::chrono::high_resolution_clock::now();
+    for ( uint32_t i = 1; i <= TIMED; ++i )
+    {
+        float u, v;
+        sample2D( i, 7, 1, u, v );
+        sink = sink + ballPoint( u, v, sample1D( i, 7, 2 ) ).x;
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+
+    printf( "ball point, CPU: before %.1f ns, after %.1f ns\n",
+            std::chrono::duration<double, std::nano>( middle - start ).count() /
+                TIMED,
+            std::chrono::duration<double, std::nano>( end - middle ).count() /
+                TIMED );
+
+    return 0;
+}
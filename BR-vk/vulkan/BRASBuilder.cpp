@@ -1,11 +1,106 @@
 #include <BRASBuilder.h>
 #include <BRAppState.h>
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <thread>
 
 using namespace BR;
 
-ASBuilder::ASBuilder() : m_alloc( AppState::instance().getMemoryMgr() )
+//upper bound for the shared BLAS build scratch buffer
+const vk::DeviceSize MAX_BLAS_SCRATCH = 256ull * 1024 * 1024;
+
+//serialized BLAS cache
+const char SERIAL_MAGIC[4] = { 'B', 'R', 'A', 'S' };
+const uint32_t SERIAL_VERSION = 1;
+
+//serialization copies need 256 byte aligned addresses
+const uint64_t SERIAL_ALIGNMENT = 256;
+
+//sanity limit on the BLAS size of a cache file
+const uint64_t MAX_SERIAL_STRUCTURE_SIZE = 4ull * 1024 * 1024 * 1024;
+
+//a serialized BLAS starts with the driver and compatibility UUIDs, then the
+//serialized size, the deserialized size and the handle count, 64 bit each
+const uint64_t SERIAL_BLAS_HEADER_SIZE =
+    2 * VK_UUID_SIZE + 3 * sizeof( uint64_t );
+
+namespace
+{
+vk::AccelerationStructureInstanceKHR toASInstance(
+    const ASBuilder::Instance& instance, uint64_t blasAddress )
+{
+    auto& mat = instance.transform;
+
+    VkTransformMatrixKHR transformMatrix = {
+        mat[0][0], mat[1][0], mat[2][0], mat[3][0], mat[0][1], mat[1][1],
+        mat[2][1], mat[3][1], mat[0][2], mat[1][2], mat[2][2], mat[3][2] };
+
+    //the BLAS instance that we're putting into the TLAS
+    vk::AccelerationStructureInstanceKHR result;
+    result.transform = transformMatrix;
+    result.instanceCustomIndex = instance.customIndex;
+    result.mask = 0xFF;
+    result.instanceShaderBindingTableRecordOffset = 0;
+    result.flags = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR;
+    result.accelerationStructureReference = blasAddress;
+
+    return result;
+}
+
+//Description of the geometry of a BLAS, where the index and vertex data is
+//no transform, the instance places it
+vk::AccelerationStructureGeometryKHR toGeometry(
+    const ASBuilder::BlasInput& input,
+    vk::DeviceOrHostAddressConstKHR vertexData,
+    vk::DeviceOrHostAddressConstKHR indexData )
+{
+    vk::AccelerationStructureGeometryKHR geometry;
+    geometry.flags = vk::GeometryFlagBitsKHR::eOpaque;
+    geometry.geometryType = vk::GeometryTypeKHR::eTriangles;
+    geometry.geometry.triangles.vertexFormat = vk::Format::eR32G32B32Sfloat;
+    geometry.geometry.triangles.vertexData = vertexData;
+    geometry.geometry.triangles.maxVertex = input.maxVertex;
+    geometry.geometry.triangles.vertexStride = sizeof( glm::vec3 );
+    geometry.geometry.triangles.indexType = vk::IndexType::eUint32;
+    geometry.geometry.triangles.indexData = indexData;
+    geometry.geometry.triangles.transformData.deviceAddress = 0;
+
+    return geometry;
+}
+
+//the shape's part of the index buffer
+vk::AccelerationStructureBuildRangeInfoKHR toRange(
+    const ASBuilder::BlasInput& input )
+{
+    vk::AccelerationStructureBuildRangeInfoKHR range;
+    range.primitiveCount = input.indexCount / 3;
+    range.primitiveOffset = input.firstIndex * sizeof( uint32_t );
+    range.firstVertex = 0;
+    range.transformOffset = 0;
+
+    return range;
+}
+}  // namespace
+
+ASBuilder::ASBuilder()
+    : m_alloc( AppState::instance().getMemoryMgr() ),
+      m_framesInFlight( AppState::instance().m_framesInFlight ),
+      m_allowCompaction( false ),
+      m_hostBuild( false ),
+      m_instanceCount( 0 ),
+      m_maxInstances( 0 ),
+      m_tlasRefits( 0 ),
+      m_blasesRebuilt( false ),
+      m_blasScratchSize( 0 ),
+      m_timestamps( nullptr ),
+      m_refitCost( 0.0 ),
+      m_rebuildCost( 0.0 )
 {
 }
 
@@ -14,201 +109,1347 @@ ASBuilder::~ASBuilder()
     assert( m_structures.empty() );
 }
 
-void ASBuilder::create()
+void ASBuilder::create( bool allowCompaction, bool hostBuild )
 {
+    m_allowCompaction = allowCompaction;
+    m_hostBuild = hostBuild;
+
+    if ( hostBuild && !AppState::instance()
+                           .accelerationStructureFeatures
+                           .accelerationStructureHostCommands )
+    {
+        printf( "Host AS builds not supported, building on the GPU\n" );
+        m_hostBuild = false;
+    }
+
     m_device = AppState::instance().getLogicalDevice();
     m_pool.create( "ASBuilder Command Pool",
                    vk::CommandPoolCreateFlagBits::eTransient );
 }
 
-vk::AccelerationStructureKHR ASBuilder::buildBlas( std::string name,
-                                                   vk::Buffer vertexBuffer,
-                                                   vk::Buffer indexBuffer,
-                                                   int maxVertex, int numIndex )
+vk::BuildAccelerationStructureFlagsKHR ASBuilder::getBlasFlags( bool dynamic )
 {
-    const uint32_t numTriangles = numIndex / 3;
+    //refits and rebuilds must use the flags of the first build
+    if ( dynamic )
+        return vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastBuild |
+               vk::BuildAccelerationStructureFlagBitsKHR::eAllowUpdate;
 
-    //identity transform
-    VkTransformMatrixKHR transformMatrix = { 1.0f, 0.0f, 0.0f, 0.0f,
-                                             0.0f, 1.0f, 0.0f, 0.0f,
-                                             0.0f, 0.0f, 1.0f, 0.0f };
+    vk::BuildAccelerationStructureFlagsKHR flags =
+        vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace;
 
-    std::vector<VkTransformMatrixKHR> mats;
-    mats.push_back( transformMatrix );
+    if ( m_allowCompaction )
+        flags |= vk::BuildAccelerationStructureFlagBitsKHR::eAllowCompaction;
 
-    auto bufferSize = sizeof( mats[0] ) * mats.size();
-    auto transformMatrixBuff = m_alloc.createDeviceBuffer(
-        "BLAS Transform", bufferSize, mats.data(), false,
-        vk::BufferUsageFlagBits::eShaderDeviceAddress |
-            vk::BufferUsageFlagBits::
-                eAccelerationStructureBuildInputReadOnlyKHR );
+    return flags;
+}
 
-    vk::DeviceOrHostAddressConstKHR vertexBufferDeviceAddress{};
-    vk::DeviceOrHostAddressConstKHR indexBufferDeviceAddress{};
-    vk::DeviceOrHostAddressConstKHR transformBufferDeviceAddress{};
+std::vector<ASBuilder::BlasInput> ASBuilder::partition(
+    const BlasInput& input, uint32_t chunkTriangles )
+{
+    uint32_t triangleCount = input.indexCount / 3;
 
-    vertexBufferDeviceAddress.deviceAddress =
-        m_alloc.getDeviceAddress( vertexBuffer );
-    indexBufferDeviceAddress.deviceAddress =
-        m_alloc.getDeviceAddress( indexBuffer );
-    transformBufferDeviceAddress.deviceAddress =
-        m_alloc.getDeviceAddress( transformMatrixBuff );
+    if ( chunkTriangles == 0 || triangleCount <= chunkTriangles )
+        return { input };
 
-    //Description of the geometry, where the index and vertex data is
-    vk::AccelerationStructureGeometryKHR geometry;
-    geometry.flags = vk::GeometryFlagBitsKHR::eOpaque;
-    geometry.geometryType = vk::GeometryTypeKHR::eTriangles;
-    geometry.geometry.triangles.vertexFormat = vk::Format::eR32G32B32Sfloat;
-    geometry.geometry.triangles.vertexData = vertexBufferDeviceAddress;
-    geometry.geometry.triangles.maxVertex = maxVertex;
-    geometry.geometry.triangles.vertexStride = sizeof( glm::vec4 );
-    geometry.geometry.triangles.indexType = vk::IndexType::eUint32;
-    geometry.geometry.triangles.indexData = indexBufferDeviceAddress;
-    geometry.geometry.triangles.transformData.deviceAddress = 0;
-    geometry.geometry.triangles.transformData.hostAddress = nullptr;
-    geometry.geometry.triangles.transformData = transformBufferDeviceAddress;
+    //even chunks, the last one isn't left with a sliver
+    uint32_t chunkCount =
+        ( triangleCount + chunkTriangles - 1 ) / chunkTriangles;
+    uint32_t chunkSize = ( triangleCount + chunkCount - 1 ) / chunkCount;
 
-    //Description of what we're building (BLAS)
-    vk::AccelerationStructureBuildGeometryInfoKHR geometryInfo;
-    geometryInfo.type = vk::AccelerationStructureTypeKHR::eBottomLevel;
-    geometryInfo.flags =
-        vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace;
-    geometryInfo.geometryCount = 1;
-    geometryInfo.pGeometries = &geometry;
+    std::vector<BlasInput> chunks;
 
-    //get the size of everything
-    vk::AccelerationStructureBuildSizesInfoKHR buildSizeInfo;
+    for ( uint32_t first = 0; first < triangleCount; first += chunkSize )
+    {
+        BlasInput chunk = input;
+        chunk.name = input.name + "." + std::to_string( chunks.size() );
+        chunk.firstIndex = input.firstIndex + first * 3;
+        chunk.indexCount = std::min( chunkSize, triangleCount - first ) * 3;
 
-    // clang-format off
-    AppState::instance().vkGetAccelerationStructureBuildSizesKHR(
-        m_device,
-        VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
-        reinterpret_cast<VkAccelerationStructureBuildGeometryInfoKHR*>(&geometryInfo ),
-        &numTriangles,
-        reinterpret_cast<VkAccelerationStructureBuildSizesInfoKHR*>(&buildSizeInfo )
-    );
-    // clang-format on
+        chunks.push_back( chunk );
+    }
 
-    //allocate the blas memory
-    vk::Buffer blas = m_alloc.createDeviceBuffer(
-        name + " Buffer", buildSizeInfo.accelerationStructureSize, nullptr,
-        false,
-        vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR |
+    return chunks;
+}
+
+std::vector<vk::AccelerationStructureKHR> ASBuilder::buildBlas(
+    const std::vector<BlasInput>& inputs, bool dynamic )
+{
+    if ( inputs.empty() )
+        return {};
+
+    const uint32_t count = static_cast<uint32_t>( inputs.size() );
+
+    vk::BuildAccelerationStructureFlagsKHR buildFlags = getBlasFlags( dynamic );
+
+    //dynamic geometry is written on the GPU, so it's built there
+    const bool onHost = m_hostBuild && !dynamic;
+
+    const uint32_t scratchAlignment =
+        AppState::instance()
+            .accelerationStructureProperties
+            .minAccelerationStructureScratchOffsetAlignment;
+
+    //one geometry per BLAS, the pointers into these must stay put
+    std::vector<vk::AccelerationStructureGeometryKHR> geometries( count );
+    std::vector<vk::AccelerationStructureBuildGeometryInfoKHR> asInfos( count );
+    std::vector<vk::AccelerationStructureBuildRangeInfoKHR> asRangeInfos(
+        count );
+    std::vector<vk::DeviceSize> scratchSizes( count );
+    std::vector<vk::DeviceSize> refitScratchSizes( count );
+
+    std::vector<vk::AccelerationStructureKHR> handles( count );
+
+    vk::DeviceSize totalSize = 0;
+
+    for ( uint32_t i = 0; i < count; ++i )
+    {
+        auto& input = inputs[i];
+        const uint32_t numTriangles = input.indexCount / 3;
+
+        vk::DeviceOrHostAddressConstKHR vertexBufferDeviceAddress{};
+        vk::DeviceOrHostAddressConstKHR indexBufferDeviceAddress{};
+
+        //host builds read the geometry from host memory
+        if ( onHost )
+        {
+            assert( input.hostVertexData && input.hostIndexData );
+
+            vertexBufferDeviceAddress.hostAddress = input.hostVertexData;
+            indexBufferDeviceAddress.hostAddress = input.hostIndexData;
+        }
+        else
+        {
+            vertexBufferDeviceAddress.deviceAddress =
+                m_alloc.getDeviceAddress( input.vertexBuffer );
+            indexBufferDeviceAddress.deviceAddress =
+                m_alloc.getDeviceAddress( input.indexBuffer );
+        }
+
+        geometries[i] = toGeometry( input, vertexBufferDeviceAddress,
+                                    indexBufferDeviceAddress );
+
+        //Description of what we're building (BLAS)
+        vk::AccelerationStructureBuildGeometryInfoKHR& asInfo = asInfos[i];
+        asInfo.type = vk::AccelerationStructureTypeKHR::eBottomLevel;
+        asInfo.flags = buildFlags;
+        asInfo.mode = vk::BuildAccelerationStructureModeKHR::eBuild;
+        asInfo.geometryCount = 1;
+        asInfo.pGeometries = &geometries[i];
+
+        //get the size of everything
+        vk::AccelerationStructureBuildSizesInfoKHR buildSizeInfo;
+
+        // clang-format off
+        AppState::instance().vkGetAccelerationStructureBuildSizesKHR(
+            m_device,
+            onHost ? VK_ACCELERATION_STRUCTURE_BUILD_TYPE_HOST_KHR
+                   : VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
+            reinterpret_cast<VkAccelerationStructureBuildGeometryInfoKHR*>(&asInfo ),
+            &numTriangles,
+            reinterpret_cast<VkAccelerationStructureBuildSizesInfoKHR*>(&buildSizeInfo )
+        );
+        // clang-format on
+
+        //allocate the blas memory, host builds write it from the CPU
+        vk::Buffer blas = m_alloc.createDeviceBuffer(
+            input.name + " Buffer", buildSizeInfo.accelerationStructureSize,
+            nullptr, onHost,
+            vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR |
+                vk::BufferUsageFlagBits::eShaderDeviceAddress );
+
+        vk::AccelerationStructureCreateInfoKHR createInfo;
+        createInfo.buffer = blas;
+        createInfo.size = buildSizeInfo.accelerationStructureSize;
+        createInfo.type = vk::AccelerationStructureTypeKHR::eBottomLevel;
+
+        // clang-format off
+        auto result = AppState::instance().vkCreateAccelerationStructureKHR(
+            m_device,
+            reinterpret_cast<VkAccelerationStructureCreateInfoKHR*>( &createInfo ),
+            nullptr,
+            reinterpret_cast<VkAccelerationStructureKHR*>( &handles[i] )
+        );
+        // clang-format on
+
+        checkSuccess( result );
+
+        asInfo.dstAccelerationStructure = handles[i];
+
+        //BLAS range description
+        asRangeInfos[i] = toRange( input );
+
+        //every build's slice starts aligned
+        scratchSizes[i] = ( buildSizeInfo.buildScratchSize +
+                            scratchAlignment - 1 ) &
+                          ~vk::DeviceSize( scratchAlignment - 1 );
+
+        refitScratchSizes[i] =
+            ( std::max( buildSizeInfo.buildScratchSize,
+                        buildSizeInfo.updateScratchSize ) +
+              scratchAlignment - 1 ) &
+            ~vk::DeviceSize( scratchAlignment - 1 );
+
+        totalSize += buildSizeInfo.accelerationStructureSize;
+
+        m_structures.push_back( handles[i] );
+        m_storage[handles[i]] = {
+            blas, buildSizeInfo.accelerationStructureSize, input.name };
+        DEBUG_NAME( handles[i], input.name );
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    std::string how = onHost
+                          ? hostBuild( asInfos, asRangeInfos, scratchSizes )
+                          : deviceBuild( asInfos, asRangeInfos, scratchSizes );
+
+    auto end = std::chrono::high_resolution_clock::now();
+
+    //get the BLAS hardware addresses, needed to build TLAS later
+    for ( auto handle : handles )
+    {
+        vk::AccelerationStructureDeviceAddressInfoKHR adressInfo{};
+        adressInfo.accelerationStructure = handle;
+
+        // clang-format off
+        m_addresses[handle] =
+            AppState::instance().vkGetAccelerationStructureDeviceAddressKHR(
+                m_device,
+                reinterpret_cast<VkAccelerationStructureDeviceAddressInfoKHR*>(&adressInfo )
+        );
+        // clang-format on
+    }
+
+    printf( "Built %u %sBLASes, %.2f MB, on the %s in %.1f ms\n", count,
+            dynamic ? "dynamic " : "", totalSize / ( 1024.0 * 1024.0 ),
+            how.c_str(),
+            std::chrono::duration<double, std::milli>( end - start ).count() );
+
+    //every dynamic BLAS gets its own slice of the refit scratch
+    if ( dynamic )
+    {
+        for ( uint32_t i = 0; i < count; ++i )
+        {
+            m_dynamic[handles[i]] = { inputs[i], m_blasScratchSize, 0 };
+            m_blasScratchSize += refitScratchSizes[i];
+        }
+
+        createRefitResources();
+    }
+
+    return handles;
+}
+
+void ASBuilder::createRefitResources()
+{
+    for ( auto scratch : m_blasScratch )
+        m_alloc.free( scratch );
+
+    m_blasScratch.clear();
+
+    for ( int i = 0; i < m_framesInFlight; ++i )
+    {
+        m_blasScratch.push_back( m_alloc.createDeviceBuffer(
+            "BLAS Refit Scratch " + std::to_string( i ), m_blasScratchSize,
+            nullptr, false,
+            vk::BufferUsageFlagBits::eStorageBuffer |
+                vk::BufferUsageFlagBits::eShaderDeviceAddress ) );
+    }
+
+    printf( "\tBLAS refit scratch %.2f MB per frame\n",
+            m_blasScratchSize / ( 1024.0 * 1024.0 ) );
+
+    if ( m_timestamps )
+        return;
+
+    vk::QueryPoolCreateInfo queryInfo;
+    queryInfo.queryType = vk::QueryType::eTimestamp;
+    queryInfo.queryCount = 3 * m_framesInFlight;
+
+    try
+    {
+        m_timestamps = m_device.createQueryPool( queryInfo );
+    }
+    catch ( vk::SystemError err )
+    {
+        throw std::runtime_error( "failed to create query pool!" );
+    }
+
+    DEBUG_NAME( m_timestamps, "BLAS Refit Timestamps" );
+
+    m_frameStats.resize( m_framesInFlight );
+    m_timestampsWritten.assign( m_framesInFlight, false );
+}
+
+std::string ASBuilder::deviceBuild(
+    std::vector<vk::AccelerationStructureBuildGeometryInfoKHR>& asInfos,
+    std::vector<vk::AccelerationStructureBuildRangeInfoKHR>& asRangeInfos,
+    const std::vector<vk::DeviceSize>& scratchSizes )
+{
+    const uint32_t count = static_cast<uint32_t>( asInfos.size() );
+
+    vk::DeviceSize totalScratch = 0;
+    vk::DeviceSize maxScratch = 0;
+
+    for ( auto size : scratchSizes )
+    {
+        totalScratch += size;
+        maxScratch = std::max( maxScratch, size );
+    }
+
+    //One scratch buffer for all the builds
+    //Builds in one vkCmdBuild call run together, so each gets its own slice
+    //When the slices don't fit, the builds are split into passes that reuse
+    //the buffer, with a barrier in between
+    //If the alias group already has memory that fits the biggest build, the
+    //scratch stays within it - more passes, but no memory of its own
+    vk::DeviceSize maxSize = MAX_BLAS_SCRATCH;
+    vk::DeviceSize aliasCapacity =
+        m_alloc.getAliasCapacity( SCRATCH_ALIAS_GROUP );
+
+    if ( aliasCapacity >= maxScratch )
+        maxSize = std::min( maxSize, aliasCapacity );
+
+    vk::DeviceSize scratchSize =
+        std::max( maxScratch, std::min( totalScratch, maxSize ) );
+
+    vk::Buffer scratch = m_alloc.createAliasedBuffer(
+        "BLAS Scratch", SCRATCH_ALIAS_GROUP, scratchSize,
+        vk::BufferUsageFlagBits::eStorageBuffer |
             vk::BufferUsageFlagBits::eShaderDeviceAddress );
 
-    vk::AccelerationStructureCreateInfoKHR createInfo;
-    createInfo.buffer = blas;
-    createInfo.size = buildSizeInfo.accelerationStructureSize;
-    createInfo.type = vk::AccelerationStructureTypeKHR::eBottomLevel;
+    auto scratchAddress = m_alloc.getDeviceAddress( scratch );
+
+    //Perform the BLAS builds, all in one command buffer
+    auto buffer = m_pool.beginOneTimeSubmit( "BLAS creation" );
+
+    int passes = 0;
+    uint32_t first = 0;
+
+    while ( first < count )
+    {
+        std::vector<VkAccelerationStructureBuildRangeInfoKHR*> rangeInfos;
+        vk::DeviceSize offset = 0;
+        uint32_t last = first;
+
+        while ( last < count && offset + scratchSizes[last] <= scratchSize )
+        {
+            asInfos[last].scratchData.deviceAddress = scratchAddress + offset;
+            rangeInfos.push_back(
+                reinterpret_cast<VkAccelerationStructureBuildRangeInfoKHR*>(
+                    &asRangeInfos[last] ) );
+
+            offset += scratchSizes[last];
+            ++last;
+        }
+
+        //the previous pass must be done with the scratch memory
+        //AS write -> AS write
+        if ( passes > 0 )
+        {
+            vk::MemoryBarrier scratchBarrier;
+            scratchBarrier.srcAccessMask =
+                vk::AccessFlagBits::eAccelerationStructureWriteKHR;
+            scratchBarrier.dstAccessMask =
+                vk::AccessFlagBits::eAccelerationStructureReadKHR |
+                vk::AccessFlagBits::eAccelerationStructureWriteKHR;
+
+            buffer.pipelineBarrier(
+                vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR,
+                vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, {},
+                scratchBarrier, nullptr, nullptr );
+        }
+
+        // clang-format off
+        AppState::instance().vkCmdBuildAccelerationStructuresKHR(
+            buffer,
+            last - first,
+            reinterpret_cast<VkAccelerationStructureBuildGeometryInfoKHR*>( &asInfos[first] ),
+            rangeInfos.data()
+        );
+        // clang-format on
+
+        first = last;
+        ++passes;
+    }
 
-    //The resulting handle
-    vk::AccelerationStructureKHR handle;
+    m_pool.endOneTimeSubmit( buffer );
+
+    m_alloc.free( scratch );
+
+    return "GPU ( " + std::to_string( passes ) + " passes, " +
+           std::to_string( scratchSize / ( 1024 * 1024 ) ) + " MB scratch )";
+}
+
+std::string ASBuilder::hostBuild(
+    std::vector<vk::AccelerationStructureBuildGeometryInfoKHR>& asInfos,
+    std::vector<vk::AccelerationStructureBuildRangeInfoKHR>& asRangeInfos,
+    const std::vector<vk::DeviceSize>& scratchSizes )
+{
+    const uint32_t count = static_cast<uint32_t>( asInfos.size() );
+
+    //every build runs at the same time, each needs its own scratch memory
+    std::vector<std::vector<uint8_t>> scratch( count );
+    std::vector<VkAccelerationStructureBuildRangeInfoKHR*> rangeInfos;
+
+    for ( uint32_t i = 0; i < count; ++i )
+    {
+        scratch[i].resize( scratchSizes[i] );
+        asInfos[i].scratchData.hostAddress = scratch[i].data();
+
+        rangeInfos.push_back(
+            reinterpret_cast<VkAccelerationStructureBuildRangeInfoKHR*>(
+                &asRangeInfos[i] ) );
+    }
+
+    auto& app = AppState::instance();
+
+    VkDeferredOperationKHR operation;
+    checkSuccess(
+        app.vkCreateDeferredOperationKHR( m_device, nullptr, &operation ) );
 
     // clang-format off
-    auto result = AppState::instance().vkCreateAccelerationStructureKHR(
+    auto result = app.vkBuildAccelerationStructuresKHR(
         m_device,
-        reinterpret_cast<VkAccelerationStructureCreateInfoKHR*>( &createInfo ),
-        nullptr,
-        reinterpret_cast<VkAccelerationStructureKHR*>( &handle ) 
+        operation,
+        count,
+        reinterpret_cast<VkAccelerationStructureBuildGeometryInfoKHR*>( asInfos.data() ),
+        rangeInfos.data()
     );
     // clang-format on
 
+    unsigned threadCount = 1;
+
+    //deferred - the work is done by the threads that join the operation
+    //otherwise the driver already did it on this thread
+    if ( result == VK_OPERATION_DEFERRED_KHR )
+    {
+        threadCount = std::min(
+            std::max( 1u, std::thread::hardware_concurrency() ),
+            app.vkGetDeferredOperationMaxConcurrencyKHR( m_device,
+                                                         operation ) );
+        threadCount = std::max( 1u, threadCount );
+
+        auto join = [&]()
+        {
+            while ( true )
+            {
+                auto joinResult =
+                    app.vkDeferredOperationJoinKHR( m_device, operation );
+
+                //done, or no more work for this thread
+                if ( joinResult == VK_SUCCESS ||
+                     joinResult == VK_THREAD_DONE_KHR )
+                    break;
+
+                //the remaining work can't be split further right now
+                if ( joinResult == VK_THREAD_IDLE_KHR )
+                {
+                    std::this_thread::yield();
+                    continue;
+                }
+
+                checkSuccess( joinResult );
+                break;
+            }
+        };
+
+        //this thread joins too
+        std::vector<std::thread> threads;
+
+        for ( unsigned i = 1; i < threadCount; ++i )
+            threads.emplace_back( join );
+
+        join();
+
+        for ( auto& thread : threads )
+            thread.join();
+
+        result = app.vkGetDeferredOperationResultKHR( m_device, operation );
+    }
+
     checkSuccess( result );
 
-    //allocate scratch buffer
-    vk::Buffer blasScratch = m_alloc.createDeviceBuffer(
-        name + " Scratch", buildSizeInfo.buildScratchSize, nullptr, false,
-        vk::BufferUsageFlagBits::eStorageBuffer |
-            vk::BufferUsageFlagBits::eShaderDeviceAddress );
+    app.vkDestroyDeferredOperationKHR( m_device, operation, nullptr );
 
-    auto blasScratchAddress = m_alloc.getDeviceAddress( blasScratch );
+    return "CPU ( " + std::to_string( threadCount ) + " threads )";
+}
 
-    //BLAS description
-    vk::AccelerationStructureBuildGeometryInfoKHR asInfo;
-    asInfo.type = vk::AccelerationStructureTypeKHR::eBottomLevel;
-    asInfo.flags = vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace;
-    asInfo.mode = vk::BuildAccelerationStructureModeKHR::eBuild;
-    asInfo.dstAccelerationStructure = handle;
-    asInfo.geometryCount = 1;
-    asInfo.pGeometries = &geometry;
-    asInfo.scratchData.deviceAddress = blasScratchAddress;
+void ASBuilder::cmdRefitBlas(
+    vk::CommandBuffer commandBuffer, int frame,
+    const std::vector<vk::AccelerationStructureKHR>& blases,
+    const std::set<vk::AccelerationStructureKHR>& forced )
+{
+    assert( frame >= 0 && frame < m_framesInFlight );
+
+    if ( blases.empty() )
+        return;
+
+    //the frame's fence was waited on, its last timestamps are ready
+    readRefitStats( frame );
+
+    const uint32_t count = static_cast<uint32_t>( blases.size() );
+
+    //refits that save nothing over a rebuild aren't worth the worse tree
+    const bool rebuildIsCheap = m_refitCost > 0.0 && m_rebuildCost > 0.0 &&
+                                m_rebuildCost <= m_refitCost;
+
+    //due for a rebuild, worst first
+    std::vector<uint32_t> due;
+
+    for ( uint32_t i = 0; i < count; ++i )
+    {
+        if ( rebuildIsCheap ||
+             m_dynamic.at( blases[i] ).refits >= m_refitPolicy.maxRefits )
+            due.push_back( i );
+    }
+
+    std::stable_sort( due.begin(), due.end(),
+                      [&]( uint32_t a, uint32_t b )
+                      {
+                          return m_dynamic.at( blases[a] ).refits >
+                                 m_dynamic.at( blases[b] ).refits;
+                      } );
+
+    std::vector<bool> rebuild( count, false );
+    uint64_t rebuildTriangles = 0;
+
+    //edited geometry may have moved too far for a refit to be any good
+    //they come out of the budget first
+    for ( uint32_t i = 0; i < count; ++i )
+    {
+        if ( forced.contains( blases[i] ) )
+        {
+            rebuild[i] = true;
+            rebuildTriangles += m_dynamic.at( blases[i] ).input.indexCount / 3;
+        }
+    }
+
+    for ( auto i : due )
+    {
+        if ( rebuild[i] )
+            continue;
+
+        uint64_t triangles = m_dynamic.at( blases[i] ).input.indexCount / 3;
+
+        if ( rebuildTriangles > 0 &&
+             rebuildTriangles + triangles > m_refitPolicy.rebuildBudget )
+            break;
+
+        rebuild[i] = true;
+        rebuildTriangles += triangles;
+    }
+
+    //the pointers into these must stay put
+    std::vector<vk::AccelerationStructureGeometryKHR> geometries( count );
+    std::vector<vk::AccelerationStructureBuildRangeInfoKHR> asRangeInfos(
+        count );
+
+    std::vector<vk::AccelerationStructureBuildGeometryInfoKHR> rebuildInfos;
+    std::vector<VkAccelerationStructureBuildRangeInfoKHR*> rebuildRanges;
+    std::vector<vk::AccelerationStructureBuildGeometryInfoKHR> refitInfos;
+    std::vector<VkAccelerationStructureBuildRangeInfoKHR*> refitRanges;
+
+    RefitStats stats;
+
+    auto scratchAddress = m_alloc.getDeviceAddress( m_blasScratch[frame] );
+
+    for ( uint32_t i = 0; i < count; ++i )
+    {
+        auto& dynamic = m_dynamic.at( blases[i] );
+
+        vk::DeviceOrHostAddressConstKHR vertexBufferDeviceAddress{};
+        vertexBufferDeviceAddress.deviceAddress =
+            m_alloc.getDeviceAddress( dynamic.input.vertexBuffer );
+
+        vk::DeviceOrHostAddressConstKHR indexBufferDeviceAddress{};
+        indexBufferDeviceAddress.deviceAddress =
+            m_alloc.getDeviceAddress( dynamic.input.indexBuffer );
+
+        geometries[i] = toGeometry( dynamic.input, vertexBufferDeviceAddress,
+                                    indexBufferDeviceAddress );
+        asRangeInfos[i] = toRange( dynamic.input );
+
+        //a refit reads the BLAS and writes it back in place
+        vk::AccelerationStructureBuildGeometryInfoKHR asInfo;
+        asInfo.type = vk::AccelerationStructureTypeKHR::eBottomLevel;
+        asInfo.flags = getBlasFlags( true );
+        asInfo.dstAccelerationStructure = blases[i];
+        asInfo.geometryCount = 1;
+        asInfo.pGeometries = &geometries[i];
+        asInfo.scratchData.deviceAddress =
+            scratchAddress + dynamic.scratchOffset;
+
+        auto range = reinterpret_cast<VkAccelerationStructureBuildRangeInfoKHR*>(
+            &asRangeInfos[i] );
+
+        if ( rebuild[i] )
+        {
+            asInfo.mode = vk::BuildAccelerationStructureModeKHR::eBuild;
+
+            rebuildInfos.push_back( asInfo );
+            rebuildRanges.push_back( range );
+
+            stats.rebuilds++;
+            stats.rebuildTriangles += asRangeInfos[i].primitiveCount;
+            dynamic.refits = 0;
+        }
+        else
+        {
+            asInfo.mode = vk::BuildAccelerationStructureModeKHR::eUpdate;
+            asInfo.srcAccelerationStructure = blases[i];
+
+            refitInfos.push_back( asInfo );
+            refitRanges.push_back( range );
+
+            stats.refits++;
+            stats.refitTriangles += asRangeInfos[i].primitiveCount;
+            dynamic.refits++;
+        }
+    }
+
+    //the previous frame may still be tracing against these BLASes
+    //trace read -> AS write
+    vk::MemoryBarrier readBarrier;
+    readBarrier.srcAccessMask = vk::AccessFlagBits::eAccelerationStructureReadKHR;
+    readBarrier.dstAccessMask =
+        vk::AccessFlagBits::eAccelerationStructureWriteKHR;
+
+    commandBuffer.pipelineBarrier(
+        vk::PipelineStageFlagBits::eRayTracingShaderKHR,
+        vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, {},
+        readBarrier, nullptr, nullptr );
+
+    //the rebuilds and refits touch different BLASes and scratch slices, but
+    //they're kept apart so each phase has its own GPU time for the cost model
+    //A timestamp waits for the builds before it, not for the ones after
+    const uint32_t query = 3 * frame;
+
+    commandBuffer.resetQueryPool( m_timestamps, query, 3 );
+    commandBuffer.writeTimestamp(
+        vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR,
+        m_timestamps, query );
 
-    //BLAS range description
-    vk::AccelerationStructureBuildRangeInfoKHR asRangeInfo;
-    asRangeInfo.primitiveCount = numTriangles;
-    asRangeInfo.primitiveOffset = 0;
-    asRangeInfo.firstVertex = 0;
-    asRangeInfo.transformOffset = 0;
+    // clang-format off
+    if ( !rebuildInfos.empty() )
+    {
+        AppState::instance().vkCmdBuildAccelerationStructuresKHR(
+            commandBuffer,
+            static_cast<uint32_t>( rebuildInfos.size() ),
+            reinterpret_cast<VkAccelerationStructureBuildGeometryInfoKHR*>( rebuildInfos.data() ),
+            rebuildRanges.data()
+        );
+    }
+    // clang-format on
 
-    std::vector<VkAccelerationStructureBuildRangeInfoKHR*>
-        accelerationBuildStructureRangeInfos = {
-            reinterpret_cast<VkAccelerationStructureBuildRangeInfoKHR*>(
-                &asRangeInfo ) };
+    commandBuffer.writeTimestamp(
+        vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR,
+        m_timestamps, query + 1 );
+
+    //the refits mustn't start before the rebuilds finish
+    //AS build -> AS build
+    if ( !rebuildInfos.empty() && !refitInfos.empty() )
+    {
+        vk::MemoryBarrier phaseBarrier;
+        phaseBarrier.srcAccessMask =
+            vk::AccessFlagBits::eAccelerationStructureWriteKHR;
+        phaseBarrier.dstAccessMask =
+            vk::AccessFlagBits::eAccelerationStructureReadKHR |
+            vk::AccessFlagBits::eAccelerationStructureWriteKHR;
+
+        commandBuffer.pipelineBarrier(
+            vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR,
+            vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, {},
+            phaseBarrier, nullptr, nullptr );
+    }
 
-    //Perform the BLAS build
-    auto buffer = m_pool.beginOneTimeSubmit( name + " creation" );
+    // clang-format off
+    if ( !refitInfos.empty() )
+    {
+        AppState::instance().vkCmdBuildAccelerationStructuresKHR(
+            commandBuffer,
+            static_cast<uint32_t>( refitInfos.size() ),
+            reinterpret_cast<VkAccelerationStructureBuildGeometryInfoKHR*>( refitInfos.data() ),
+            refitRanges.data()
+        );
+    }
+    // clang-format on
+
+    commandBuffer.writeTimestamp(
+        vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR,
+        m_timestamps, query + 2 );
+
+    //the TLAS refit and the trace must see the new BLASes
+    //AS write -> AS read
+    vk::MemoryBarrier buildBarrier;
+    buildBarrier.srcAccessMask =
+        vk::AccessFlagBits::eAccelerationStructureWriteKHR;
+    buildBarrier.dstAccessMask =
+        vk::AccessFlagBits::eAccelerationStructureReadKHR;
+
+    commandBuffer.pipelineBarrier(
+        vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR,
+        vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR |
+            vk::PipelineStageFlagBits::eRayTracingShaderKHR,
+        {}, buildBarrier, nullptr, nullptr );
+
+    if ( stats.rebuilds > 0 )
+        m_blasesRebuilt = true;
+
+    m_frameStats[frame] = stats;
+    m_timestampsWritten[frame] = true;
+}
+
+void ASBuilder::readRefitStats( int frame )
+{
+    if ( !m_timestampsWritten[frame] )
+        return;
+
+    uint64_t timestamps[3];
+
+    auto result = m_device.getQueryPoolResults(
+        m_timestamps, 3 * frame, 3, sizeof( timestamps ), timestamps,
+        sizeof( uint64_t ), vk::QueryResultFlagBits::e64 );
+
+    if ( result != vk::Result::eSuccess )
+        return;
+
+    m_timestampsWritten[frame] = false;
+
+    //ticks -> ms
+    const double period = AppState::instance()
+                              .getPhysicalDevice()
+                              .getProperties()
+                              .limits.timestampPeriod /
+                          1e6;
+
+    RefitStats& stats = m_frameStats[frame];
+    stats.rebuildMs = ( timestamps[1] - timestamps[0] ) * period;
+    stats.refitMs = ( timestamps[2] - timestamps[1] ) * period;
+
+    //the cost model, smoothed over frames
+    auto average = []( double& cost, double ms, uint64_t triangles )
+    {
+        if ( triangles == 0 )
+            return;
+
+        double sample = ms / ( triangles / 1e6 );
+        cost = cost > 0.0 ? cost * 0.9 + sample * 0.1 : sample;
+    };
+
+    average( m_rebuildCost, stats.rebuildMs, stats.rebuildTriangles );
+    average( m_refitCost, stats.refitMs, stats.refitTriangles );
+
+    m_refitStats = stats;
+}
+
+void ASBuilder::setRefitPolicy( const RefitPolicy& policy )
+{
+    m_refitPolicy = policy;
+}
+
+const ASBuilder::RefitStats& ASBuilder::getRefitStats()
+{
+    return m_refitStats;
+}
+
+void ASBuilder::compactBlas( std::vector<vk::AccelerationStructureKHR>& blases )
+{
+    assert( m_allowCompaction );
+
+    if ( blases.empty() )
+        return;
+
+    //compacted BLASes can't be refit
+    for ( auto blas : blases )
+        assert( !m_dynamic.contains( blas ) );
+
+    const uint32_t count = static_cast<uint32_t>( blases.size() );
+
+    //one compacted size query per BLAS
+    vk::QueryPoolCreateInfo queryInfo;
+    queryInfo.queryType =
+        vk::QueryType::eAccelerationStructureCompactedSizeKHR;
+    queryInfo.queryCount = count;
+
+    vk::QueryPool queryPool;
+
+    try
+    {
+        queryPool = m_device.createQueryPool( queryInfo );
+    }
+    catch ( vk::SystemError err )
+    {
+        throw std::runtime_error( "failed to create query pool!" );
+    }
+
+    DEBUG_NAME( queryPool, "BLAS Compaction Queries" );
+
+    //Query the compacted sizes, all BLASes in one submission
+    auto buffer = m_pool.beginOneTimeSubmit( "BLAS compaction query" );
+
+    buffer.resetQueryPool( queryPool, 0, count );
+
+    //the builds must be done before their size can be read
+    //AS write -> AS read
+    vk::MemoryBarrier buildBarrier;
+    buildBarrier.srcAccessMask =
+        vk::AccessFlagBits::eAccelerationStructureWriteKHR;
+    buildBarrier.dstAccessMask =
+        vk::AccessFlagBits::eAccelerationStructureReadKHR;
+
+    buffer.pipelineBarrier(
+        vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR,
+        vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, {},
+        buildBarrier, nullptr, nullptr );
 
     // clang-format off
-    AppState::instance().vkCmdBuildAccelerationStructuresKHR(
-        buffer, 
-        1,
-        reinterpret_cast<VkAccelerationStructureBuildGeometryInfoKHR*>(&asInfo ),
-        accelerationBuildStructureRangeInfos.data() 
+    AppState::instance().vkCmdWriteAccelerationStructuresPropertiesKHR(
+        buffer,
+        count,
+        reinterpret_cast<VkAccelerationStructureKHR*>( blases.data() ),
+        VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR,
+        queryPool,
+        0
     );
     // clang-format on
 
     m_pool.endOneTimeSubmit( buffer );
 
-    //get the BLAS hardware address, needed to build TLAS later
-    vk::AccelerationStructureDeviceAddressInfoKHR adressInfo{};
-    adressInfo.accelerationStructure = handle;
+    std::vector<vk::DeviceSize> compactedSizes( count );
 
-    // clang-format off
-    auto blasAddress =
-        AppState::instance().vkGetAccelerationStructureDeviceAddressKHR(
+    auto result = m_device.getQueryPoolResults(
+        queryPool, 0, count, count * sizeof( vk::DeviceSize ),
+        compactedSizes.data(), sizeof( vk::DeviceSize ),
+        vk::QueryResultFlagBits::e64 | vk::QueryResultFlagBits::eWait );
+
+    checkSuccess( result );
+
+    m_device.destroyQueryPool( queryPool );
+
+    //Copy every BLAS into a buffer of its compacted size
+    std::vector<vk::AccelerationStructureKHR> compacted( count );
+
+    buffer = m_pool.beginOneTimeSubmit( "BLAS compaction copy" );
+
+    for ( uint32_t i = 0; i < count; ++i )
+    {
+        auto name = m_storage[blases[i]].name;
+
+        vk::Buffer blas = m_alloc.createDeviceBuffer(
+            name + " Compacted Buffer", compactedSizes[i], nullptr, false,
+            vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR |
+                vk::BufferUsageFlagBits::eShaderDeviceAddress );
+
+        vk::AccelerationStructureCreateInfoKHR createInfo;
+        createInfo.buffer = blas;
+        createInfo.size = compactedSizes[i];
+        createInfo.type = vk::AccelerationStructureTypeKHR::eBottomLevel;
+
+        // clang-format off
+        auto result = AppState::instance().vkCreateAccelerationStructureKHR(
             m_device,
-            reinterpret_cast<VkAccelerationStructureDeviceAddressInfoKHR*>(&adressInfo ) 
+            reinterpret_cast<VkAccelerationStructureCreateInfoKHR*>( &createInfo ),
+            nullptr,
+            reinterpret_cast<VkAccelerationStructureKHR*>( &compacted[i] )
+        );
+        // clang-format on
+
+        checkSuccess( result );
+
+        vk::CopyAccelerationStructureInfoKHR copyInfo;
+        copyInfo.src = blases[i];
+        copyInfo.dst = compacted[i];
+        copyInfo.mode = vk::CopyAccelerationStructureModeKHR::eCompact;
+
+        // clang-format off
+        AppState::instance().vkCmdCopyAccelerationStructureKHR(
+            buffer,
+            reinterpret_cast<VkCopyAccelerationStructureInfoKHR*>( &copyInfo )
+        );
+        // clang-format on
+
+        m_storage[compacted[i]] = { blas, compactedSizes[i], name };
+        DEBUG_NAME( compacted[i], name );
+    }
+
+    m_pool.endOneTimeSubmit( buffer );
+
+    //Swap the originals out, the copies are done
+    vk::DeviceSize totalBefore = 0;
+    vk::DeviceSize totalAfter = 0;
+
+    for ( uint32_t i = 0; i < count; ++i )
+    {
+        auto original = blases[i];
+        auto& storage = m_storage[original];
+        vk::DeviceSize before = storage.size;
+
+        printf( "%s compacted %.2f MB -> %.2f MB ( saved %.2f MB )\n",
+                storage.name.c_str(), before / ( 1024.0 * 1024.0 ),
+                compactedSizes[i] / ( 1024.0 * 1024.0 ),
+                ( before - compactedSizes[i] ) / ( 1024.0 * 1024.0 ) );
+
+        totalBefore += before;
+        totalAfter += compactedSizes[i];
+
+        AppState::instance().vkDestroyAccelerationStructureKHR(
+            m_device, original, nullptr );
+        m_alloc.free( storage.buffer );
+
+        m_storage.erase( original );
+        m_addresses.erase( original );
+        std::erase( m_structures, original );
+
+        //new structure, new address
+        vk::AccelerationStructureDeviceAddressInfoKHR adressInfo{};
+        adressInfo.accelerationStructure = compacted[i];
+
+        // clang-format off
+        m_addresses[compacted[i]] =
+            AppState::instance().vkGetAccelerationStructureDeviceAddressKHR(
+                m_device,
+                reinterpret_cast<VkAccelerationStructureDeviceAddressInfoKHR*>(&adressInfo )
+        );
+        // clang-format on
+
+        m_structures.push_back( compacted[i] );
+        blases[i] = compacted[i];
+    }
+
+    if ( count > 1 )
+    {
+        printf( "BLAS compaction %.2f MB -> %.2f MB\n",
+                totalBefore / ( 1024.0 * 1024.0 ),
+                totalAfter / ( 1024.0 * 1024.0 ) );
+    }
+}
+
+void ASBuilder::getDeviceUUIDs( uint8_t* deviceUUID, uint8_t* driverUUID )
+{
+    auto properties =
+        AppState::instance()
+            .getPhysicalDevice()
+            .getProperties2<vk::PhysicalDeviceProperties2,
+                            vk::PhysicalDeviceIDProperties>();
+
+    auto& ids = properties.get<vk::PhysicalDeviceIDProperties>();
+
+    memcpy( deviceUUID, ids.deviceUUID.data(), VK_UUID_SIZE );
+    memcpy( driverUUID, ids.driverUUID.data(), VK_UUID_SIZE );
+}
+
+vk::Buffer ASBuilder::createSerialBuffer( std::string name,
+                                          vk::DeviceSize size, char*& data,
+                                          uint64_t& address )
+{
+    //the copies need 256 byte aligned addresses, leave room to align the start
+    vk::Buffer buffer = m_alloc.createDeviceBuffer(
+        name, size + SERIAL_ALIGNMENT, nullptr, true,
+        vk::BufferUsageFlagBits::eShaderDeviceAddress );
+
+    uint64_t base = m_alloc.getDeviceAddress( buffer );
+    address = ( base + SERIAL_ALIGNMENT - 1 ) & ~( SERIAL_ALIGNMENT - 1 );
+
+    data = static_cast<char*>( m_alloc.getMapping( buffer ) ) +
+           ( address - base );
+
+    return buffer;
+}
+
+bool ASBuilder::saveBlas( const std::string& path,
+                          const std::vector<vk::AccelerationStructureKHR>& blases,
+                          uint64_t key )
+{
+    if ( blases.empty() )
+        return false;
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    const uint32_t count = static_cast<uint32_t>( blases.size() );
+
+    //one serialization size query per BLAS
+    vk::QueryPoolCreateInfo queryInfo;
+    queryInfo.queryType =
+        vk::QueryType::eAccelerationStructureSerializationSizeKHR;
+    queryInfo.queryCount = count;
+
+    vk::QueryPool queryPool;
+
+    try
+    {
+        queryPool = m_device.createQueryPool( queryInfo );
+    }
+    catch ( vk::SystemError err )
+    {
+        throw std::runtime_error( "failed to create query pool!" );
+    }
+
+    DEBUG_NAME( queryPool, "BLAS Serialization Queries" );
+
+    auto buffer = m_pool.beginOneTimeSubmit( "BLAS serialization query" );
+
+    buffer.resetQueryPool( queryPool, 0, count );
+
+    // clang-format off
+    AppState::instance().vkCmdWriteAccelerationStructuresPropertiesKHR(
+        buffer,
+        count,
+        reinterpret_cast<const VkAccelerationStructureKHR*>( blases.data() ),
+        VK_QUERY_TYPE_ACCELERATION_STRUCTURE_SERIALIZATION_SIZE_KHR,
+        queryPool,
+        0
     );
     // clang-format on
 
-    m_structures.push_back( handle );
-    m_addresses[handle] = blasAddress;
-    DEBUG_NAME( handle, name );
+    m_pool.endOneTimeSubmit( buffer );
 
-    m_alloc.free( blasScratch );
+    std::vector<vk::DeviceSize> serialSizes( count );
 
-    return handle;
+    auto result = m_device.getQueryPoolResults(
+        queryPool, 0, count, count * sizeof( vk::DeviceSize ),
+        serialSizes.data(), sizeof( vk::DeviceSize ),
+        vk::QueryResultFlagBits::e64 | vk::QueryResultFlagBits::eWait );
+
+    checkSuccess( result );
+
+    m_device.destroyQueryPool( queryPool );
+
+    //layout, offsets are relative to the start of the data
+    std::vector<SerialEntry> entries( count );
+    uint64_t dataSize = 0;
+
+    for ( uint32_t i = 0; i < count; ++i )
+    {
+        entries[i].offset = dataSize;
+        entries[i].serializedSize = serialSizes[i];
+        entries[i].structureSize = m_storage[blases[i]].size;
+
+        dataSize += ( serialSizes[i] + SERIAL_ALIGNMENT - 1 ) &
+                    ~( SERIAL_ALIGNMENT - 1 );
+    }
+
+    //Serialize all the BLASes into one host visible buffer
+    char* data;
+    uint64_t address;
+    vk::Buffer serialBuffer =
+        createSerialBuffer( "BLAS Serialization", dataSize, data, address );
+
+    buffer = m_pool.beginOneTimeSubmit( "BLAS serialization" );
+
+    for ( uint32_t i = 0; i < count; ++i )
+    {
+        vk::CopyAccelerationStructureToMemoryInfoKHR copyInfo;
+        copyInfo.src = blases[i];
+        copyInfo.dst.deviceAddress = address + entries[i].offset;
+        copyInfo.mode = vk::CopyAccelerationStructureModeKHR::eSerialize;
+
+        // clang-format off
+        AppState::instance().vkCmdCopyAccelerationStructureToMemoryKHR(
+            buffer,
+            reinterpret_cast<VkCopyAccelerationStructureToMemoryInfoKHR*>( &copyInfo )
+        );
+        // clang-format on
+    }
+
+    //the host reads the result
+    vk::MemoryBarrier hostBarrier;
+    hostBarrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+    hostBarrier.dstAccessMask = vk::AccessFlagBits::eHostRead;
+
+    buffer.pipelineBarrier(
+        vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR,
+        vk::PipelineStageFlagBits::eHost, {}, hostBarrier, nullptr, nullptr );
+
+    m_pool.endOneTimeSubmit( buffer );
+
+    // write to a temporary, then move it in place
+
+    SerialHeader header = {};
+    memcpy( header.magic, SERIAL_MAGIC, sizeof( SERIAL_MAGIC ) );
+    header.version = SERIAL_VERSION;
+    header.key = key;
+    getDeviceUUIDs( header.deviceUUID, header.driverUUID );
+    header.count = count;
+
+    std::string tempPath = path + ".tmp";
+    bool written = false;
+
+    {
+        std::ofstream file( tempPath, std::ios::binary | std::ios::trunc );
+
+        file.write( reinterpret_cast<const char*>( &header ), sizeof( header ) );
+        file.write( reinterpret_cast<const char*>( entries.data() ),
+                    count * sizeof( SerialEntry ) );
+        file.write( data, dataSize );
+
+        written = file.good();
+    }
+
+    m_alloc.free( serialBuffer );
+
+    std::error_code error;
+
+    if ( written )
+        std::filesystem::rename( tempPath, path, error );
+
+    if ( !written || error )
+    {
+        printf( "\tfailed to write %s\n", path.c_str() );
+        std::filesystem::remove( tempPath, error );
+        return false;
+    }
+
+    auto end = std::chrono::high_resolution_clock::now();
+
+    printf( "Saved %u BLASes to %s, %.2f MB in %.1f ms\n", count, path.c_str(),
+            dataSize / ( 1024.0 * 1024.0 ),
+            std::chrono::duration<double, std::milli>( end - start ).count() );
+
+    return true;
+}
+
+bool ASBuilder::loadBlas( const std::string& path, uint64_t key,
+                          const std::vector<BlasInput>& inputs,
+                          std::vector<vk::AccelerationStructureKHR>& blases )
+{
+    auto start = std::chrono::high_resolution_clock::now();
+
+    std::ifstream file( path, std::ios::binary );
+
+    if ( !file )
+        return false;
+
+    //the header must match this model, build settings, device and driver
+    SerialHeader header;
+    file.read( reinterpret_cast<char*>( &header ), sizeof( header ) );
+
+    SerialHeader expected = {};
+    getDeviceUUIDs( expected.deviceUUID, expected.driverUUID );
+
+    if ( !file || memcmp( header.magic, SERIAL_MAGIC, sizeof( SERIAL_MAGIC ) ) ||
+         header.version != SERIAL_VERSION || header.key != key ||
+         memcmp( header.deviceUUID, expected.deviceUUID, VK_UUID_SIZE ) ||
+         memcmp( header.driverUUID, expected.driverUUID, VK_UUID_SIZE ) ||
+         header.count == 0 || header.count != inputs.size() )
+        return false;
+
+    const uint32_t count = static_cast<uint32_t>( header.count );
+
+    std::vector<SerialEntry> entries( count );
+    file.read( reinterpret_cast<char*>( entries.data() ),
+               count * sizeof( SerialEntry ) );
+
+    if ( !file )
+        return false;
+
+    //don't trust the offsets, the file might be corrupt
+    auto dataStart = static_cast<uint64_t>( file.tellg() );
+    file.seekg( 0, std::ios::end );
+    uint64_t dataSize = static_cast<uint64_t>( file.tellg() ) - dataStart;
+    file.seekg( dataStart );
+
+    for ( auto& entry : entries )
+    {
+        if ( entry.offset % SERIAL_ALIGNMENT ||
+             entry.offset > dataSize ||
+             entry.serializedSize > dataSize - entry.offset ||
+             entry.serializedSize < SERIAL_BLAS_HEADER_SIZE ||
+             entry.structureSize == 0 ||
+             entry.structureSize > MAX_SERIAL_STRUCTURE_SIZE )
+            return false;
+    }
+
+    //straight from the file into the buffer the GPU reads
+    char* data;
+    uint64_t address;
+    vk::Buffer serialBuffer =
+        createSerialBuffer( "BLAS Deserialization", dataSize, data, address );
+
+    file.read( data, dataSize );
+
+    if ( !file )
+    {
+        m_alloc.free( serialBuffer );
+        return false;
+    }
+
+    //every serialized BLAS starts with the driver's version data, and the
+    //sizes the driver wrote - the storage must fit what it deserializes to
+    for ( auto& entry : entries )
+    {
+        uint64_t sizes[2];
+        memcpy( sizes, data + entry.offset + 2 * VK_UUID_SIZE,
+                sizeof( sizes ) );
+
+        if ( sizes[0] != entry.serializedSize ||
+             sizes[1] > entry.structureSize )
+        {
+            m_alloc.free( serialBuffer );
+            return false;
+        }
+
+        vk::AccelerationStructureVersionInfoKHR versionInfo;
+        versionInfo.pVersionData =
+            reinterpret_cast<const uint8_t*>( data + entry.offset );
+
+        vk::AccelerationStructureCompatibilityKHR compatibility;
+
+        // clang-format off
+        AppState::instance().vkGetDeviceAccelerationStructureCompatibilityKHR(
+            m_device,
+            reinterpret_cast<VkAccelerationStructureVersionInfoKHR*>( &versionInfo ),
+            reinterpret_cast<VkAccelerationStructureCompatibilityKHR*>( &compatibility )
+        );
+        // clang-format on
+
+        if ( compatibility !=
+             vk::AccelerationStructureCompatibilityKHR::eCompatible )
+        {
+            printf( "\t%s is not compatible with this driver\n",
+                    path.c_str() );
+            m_alloc.free( serialBuffer );
+            return false;
+        }
+    }
+
+    //create them all first, a failed allocation leaves nothing behind
+    std::vector<vk::AccelerationStructureKHR> loaded( count );
+    std::vector<vk::Buffer> storage( count );
+
+    try
+    {
+        for ( uint32_t i = 0; i < count; ++i )
+        {
+            storage[i] = m_alloc.createDeviceBuffer(
+                inputs[i].name + " Buffer", entries[i].structureSize, nullptr,
+                false,
+                vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR |
+                    vk::BufferUsageFlagBits::eShaderDeviceAddress );
+
+            vk::AccelerationStructureCreateInfoKHR createInfo;
+            createInfo.buffer = storage[i];
+            createInfo.size = entries[i].structureSize;
+            createInfo.type = vk::AccelerationStructureTypeKHR::eBottomLevel;
+
+            // clang-format off
+            auto result = AppState::instance().vkCreateAccelerationStructureKHR(
+                m_device,
+                reinterpret_cast<VkAccelerationStructureCreateInfoKHR*>( &createInfo ),
+                nullptr,
+                reinterpret_cast<VkAccelerationStructureKHR*>( &loaded[i] )
+            );
+            // clang-format on
+
+            checkSuccess( result );
+        }
+    }
+
+    catch ( std::exception& err )
+    {
+        printf( "\tfailed to create the BLASes of %s: %s\n", path.c_str(),
+                err.what() );
+
+        for ( uint32_t i = 0; i < count; ++i )
+        {
+            if ( loaded[i] )
+                AppState::instance().vkDestroyAccelerationStructureKHR(
+                    m_device, loaded[i], nullptr );
+
+            if ( storage[i] )
+                m_alloc.free( storage[i] );
+        }
+
+        m_alloc.free( serialBuffer );
+        return false;
+    }
+
+    //Deserialize every BLAS, one submission
+    blases = loaded;
+
+    auto buffer = m_pool.beginOneTimeSubmit( "BLAS deserialization" );
+
+    for ( uint32_t i = 0; i < count; ++i )
+    {
+        vk::CopyMemoryToAccelerationStructureInfoKHR copyInfo;
+        copyInfo.src.deviceAddress = address + entries[i].offset;
+        copyInfo.dst = blases[i];
+        copyInfo.mode = vk::CopyAccelerationStructureModeKHR::eDeserialize;
+
+        // clang-format off
+        AppState::instance().vkCmdCopyMemoryToAccelerationStructureKHR(
+            buffer,
+            reinterpret_cast<VkCopyMemoryToAccelerationStructureInfoKHR*>( &copyInfo )
+        );
+        // clang-format on
+
+        m_structures.push_back( blases[i] );
+        m_storage[blases[i]] = { storage[i], entries[i].structureSize,
+                                 inputs[i].name };
+        DEBUG_NAME( blases[i], inputs[i].name );
+    }
+
+    m_pool.endOneTimeSubmit( buffer );
+
+    m_alloc.free( serialBuffer );
+
+    //get the BLAS hardware addresses, needed to build TLAS later
+    for ( auto handle : blases )
+    {
+        vk::AccelerationStructureDeviceAddressInfoKHR adressInfo{};
+        adressInfo.accelerationStructure = handle;
+
+        // clang-format off
+        m_addresses[handle] =
+            AppState::instance().vkGetAccelerationStructureDeviceAddressKHR(
+                m_device,
+                reinterpret_cast<VkAccelerationStructureDeviceAddressInfoKHR*>(&adressInfo )
+        );
+        // clang-format on
+    }
+
+    auto end = std::chrono::high_resolution_clock::now();
+
+    printf( "Loaded %u BLASes from %s, %.2f MB in %.1f ms\n", count,
+            path.c_str(), dataSize / ( 1024.0 * 1024.0 ),
+            std::chrono::duration<double, std::milli>( end - start ).count() );
+
+    return true;
 }
 
-//Build the TLAS, with one BLAS
+//Build the TLAS, one instance per entry
 vk::AccelerationStructureKHR ASBuilder::buildTlas(
-    std::string name, vk::AccelerationStructureKHR blas )
+    std::string name, const std::vector<Instance>& instances )
 {
-    VkTransformMatrixKHR transformMatrix = { 1.0f, 0.0f, 0.0f, 0.0f,
-                                             0.0f, 1.0f, 0.0f, 0.0f,
-                                             0.0f, 0.0f, 1.0f, 0.0f };
+    assert( !instances.empty() );
 
-    //the BLAS instance that we're putting into the TLAS
-    vk::AccelerationStructureInstanceKHR instance;
-    instance.transform = transformMatrix;
-    instance.instanceCustomIndex = 0;
-    instance.mask = 0xFF;
-    instance.instanceShaderBindingTableRecordOffset = 0;
-    instance.flags = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR;
-    instance.accelerationStructureReference = getAddress( blas );
+    m_instanceCount = static_cast<uint32_t>( instances.size() );
+
+    std::vector<vk::AccelerationStructureInstanceKHR> asInstances;
+
+    for ( auto& instance : instances )
+        asInstances.push_back(
+            toASInstance( instance, getAddress( instance.blas ) ) );
+
+    auto bufferSize =
+        sizeof( vk::AccelerationStructureInstanceKHR ) * asInstances.size();
 
     vk::BufferUsageFlags flags =
         vk::BufferUsageFlagBits::eShaderDeviceAddress |
         vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR;
 
-    m_instanceBuff = m_alloc.createDeviceBuffer(
-        name + " instance buffer",
-        sizeof( vk::AccelerationStructureInstanceKHR ), &instance, true,
-        flags );
+    //one instance buffer per frame in flight, the CPU writes the next
+    //frame's instances while the GPU may still be reading the current ones
+    for ( int i = 0; i < m_framesInFlight; ++i )
+    {
+        m_instanceBuffs.push_back( m_alloc.createDeviceBuffer(
+            name + " instance buffer " + std::to_string( i ), bufferSize,
+            asInstances.data(), true, flags ) );
+    }
 
     vk::DeviceOrHostAddressConstKHR instanceDataDeviceAddress;
     instanceDataDeviceAddress.deviceAddress =
-        m_alloc.getDeviceAddress( m_instanceBuff );
+        m_alloc.getDeviceAddress( m_instanceBuffs[0] );
 
     //geomery
     vk::AccelerationStructureGeometryKHR geometry;
@@ -228,7 +1469,7 @@ vk::AccelerationStructureKHR ASBuilder::buildTlas(
     geometryInfo.geometryCount = 1;
     geometryInfo.pGeometries = &geometry;
 
-    uint32_t primitive_count = 1;
+    uint32_t primitive_count = m_instanceCount;
 
     vk::AccelerationStructureBuildSizesInfoKHR sizeInfo;
 
@@ -269,13 +1510,20 @@ vk::AccelerationStructureKHR ASBuilder::buildTlas(
 
     checkSuccess( result );
 
-    //allocate scratch buffer
-    m_tlasScratch = m_alloc.createDeviceBuffer(
-        name + " Scratch", sizeInfo.buildScratchSize, nullptr, false,
-        vk::BufferUsageFlagBits::eStorageBuffer |
-            vk::BufferUsageFlagBits::eShaderDeviceAddress );
+    //allocate scratch buffers, big enough for both the build and the refits
+    auto scratchSize =
+        std::max( sizeInfo.buildScratchSize, sizeInfo.updateScratchSize );
 
-    auto tlasScratchAddress = m_alloc.getDeviceAddress( m_tlasScratch );
+    for ( int i = 0; i < m_framesInFlight; ++i )
+    {
+        m_tlasScratch.push_back( m_alloc.createDeviceBuffer(
+            name + " Scratch " + std::to_string( i ), scratchSize, nullptr,
+            false,
+            vk::BufferUsageFlagBits::eStorageBuffer |
+                vk::BufferUsageFlagBits::eShaderDeviceAddress ) );
+    }
+
+    auto tlasScratchAddress = m_alloc.getDeviceAddress( m_tlasScratch[0] );
 
     vk::AccelerationStructureBuildGeometryInfoKHR asInfo;
     asInfo.type = vk::AccelerationStructureTypeKHR::eTopLevel;
@@ -288,7 +1536,7 @@ vk::AccelerationStructureKHR ASBuilder::buildTlas(
     asInfo.scratchData.deviceAddress = tlasScratchAddress;
 
     vk::AccelerationStructureBuildRangeInfoKHR asRangeInfo;
-    asRangeInfo.primitiveCount = 1;
+    asRangeInfo.primitiveCount = m_instanceCount;
     asRangeInfo.primitiveOffset = 0;
     asRangeInfo.firstVertex = 0;
     asRangeInfo.transformOffset = 0;
@@ -326,35 +1574,37 @@ vk::AccelerationStructureKHR ASBuilder::buildTlas(
 
     m_structures.push_back( handle );
     m_addresses[handle] = tlasAddress;
+    m_storage[handle] = { tlas, sizeInfo.accelerationStructureSize, name };
     DEBUG_NAME( handle, name );
 
     return handle;
 }
 
-void ASBuilder::updateTlas( vk::AccelerationStructureKHR tlas,
-                            vk::AccelerationStructureKHR blas, glm::mat4 mat )
+void ASBuilder::cmdUpdateTlas( vk::CommandBuffer commandBuffer, int frame,
+                               vk::AccelerationStructureKHR tlas,
+                               const std::vector<Instance>& instances )
 {
-    VkTransformMatrixKHR transformMatrix = {
-        mat[0][0], mat[1][0], mat[2][0], mat[3][0], mat[0][1], mat[1][1],
-        mat[2][1], mat[3][1], mat[0][2], mat[1][2], mat[2][2], mat[3][2] };
+    assert( frame >= 0 && frame < m_framesInFlight );
 
-    //the BLAS instance that we're putting into the TLAS
-    vk::AccelerationStructureInstanceKHR instance;
-    instance.transform = transformMatrix;
-    instance.instanceCustomIndex = 0;
-    instance.mask = 0xFF;
-    instance.instanceShaderBindingTableRecordOffset = 0;
-    instance.flags = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR |
-                     VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR;
-    instance.accelerationStructureReference = getAddress( blas );
+    //a refit can't change the instance count
+    assert( instances.size() == m_instanceCount );
+
+    std::vector<vk::AccelerationStructureInstanceKHR> asInstances;
 
+    for ( auto& instance : instances )
+        asInstances.push_back(
+            toASInstance( instance, getAddress( instance.blas ) ) );
+
+    //the frame's fence was waited on, so nothing on the GPU reads this buffer
+    //host coherent write, made visible by the queue submit
     m_alloc.updateVisibleBuffer(
-        m_instanceBuff, sizeof( vk::AccelerationStructureInstanceKHR ),
-        &instance );
+        m_instanceBuffs[frame],
+        sizeof( vk::AccelerationStructureInstanceKHR ) * asInstances.size(),
+        asInstances.data() );
 
     vk::DeviceOrHostAddressConstKHR instanceDataDeviceAddress;
     instanceDataDeviceAddress.deviceAddress =
-        m_alloc.getDeviceAddress( m_instanceBuff );
+        m_alloc.getDeviceAddress( m_instanceBuffs[frame] );
 
     //geomery
     vk::AccelerationStructureGeometryKHR geometry;
@@ -365,7 +1615,7 @@ void ASBuilder::updateTlas( vk::AccelerationStructureKHR tlas,
     geometry.geometry.instances.arrayOfPointers = false;
     geometry.geometry.instances.data = instanceDataDeviceAddress;
 
-    auto tlasScratchAddress = m_alloc.getDeviceAddress( m_tlasScratch );
+    auto tlasScratchAddress = m_alloc.getDeviceAddress( m_tlasScratch[frame] );
 
     vk::AccelerationStructureBuildGeometryInfoKHR asInfo;
     asInfo.type = vk::AccelerationStructureTypeKHR::eTopLevel;
@@ -379,7 +1629,7 @@ void ASBuilder::updateTlas( vk::AccelerationStructureKHR tlas,
     asInfo.scratchData.deviceAddress = tlasScratchAddress;
 
     vk::AccelerationStructureBuildRangeInfoKHR asRangeInfo;
-    asRangeInfo.primitiveCount = 1;
+    asRangeInfo.primitiveCount = m_instanceCount;
     asRangeInfo.primitiveOffset = 0;
     asRangeInfo.firstVertex = 0;
     asRangeInfo.transformOffset = 0;
@@ -389,19 +1639,246 @@ void ASBuilder::updateTlas( vk::AccelerationStructureKHR tlas,
             reinterpret_cast<VkAccelerationStructureBuildRangeInfoKHR*>(
                 &asRangeInfo ) };
 
+    //the previous frame may still be tracing against this TLAS
+    //trace read -> AS write
+    vk::MemoryBarrier readBarrier;
+    readBarrier.srcAccessMask = vk::AccessFlagBits::eAccelerationStructureReadKHR;
+    readBarrier.dstAccessMask =
+        vk::AccessFlagBits::eAccelerationStructureWriteKHR;
+
+    commandBuffer.pipelineBarrier(
+        vk::PipelineStageFlagBits::eRayTracingShaderKHR,
+        vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, {},
+        readBarrier, nullptr, nullptr );
+
     //Update the TLAS
-    auto buffer = m_pool.beginOneTimeSubmit( "TLAS Update" );
+    // clang-format off
+    AppState::instance().vkCmdBuildAccelerationStructuresKHR(
+        commandBuffer,
+        1,
+        reinterpret_cast<VkAccelerationStructureBuildGeometryInfoKHR*>( &asInfo ),
+        accelerationBuildStructureRangeInfos.data()
+    );
+    // clang-format on
+
+    //the trace must see the refitted TLAS
+    //AS write -> trace read
+    vk::MemoryBarrier buildBarrier;
+    buildBarrier.srcAccessMask =
+        vk::AccessFlagBits::eAccelerationStructureWriteKHR;
+    buildBarrier.dstAccessMask =
+        vk::AccessFlagBits::eAccelerationStructureReadKHR;
+
+    commandBuffer.pipelineBarrier(
+        vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR,
+        vk::PipelineStageFlagBits::eRayTracingShaderKHR, {}, buildBarrier,
+        nullptr, nullptr );
+}
+
+vk::AccelerationStructureKHR ASBuilder::createGpuTlas( std::string name,
+                                                       uint32_t maxInstances )
+{
+    assert( maxInstances > 0 && m_instanceBuffs.empty() );
+    assert( maxInstances <= AppState::instance()
+                                .accelerationStructureProperties
+                                .maxInstanceCount );
+
+    m_maxInstances = maxInstances;
+    m_instanceCount = 0;
+
+    auto bufferSize =
+        sizeof( vk::AccelerationStructureInstanceKHR ) * maxInstances;
+
+    //written by a shader, read by the build
+    vk::BufferUsageFlags flags =
+        vk::BufferUsageFlagBits::eStorageBuffer |
+        vk::BufferUsageFlagBits::eShaderDeviceAddress |
+        vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR;
+
+    for ( int i = 0; i < m_framesInFlight; ++i )
+    {
+        m_instanceBuffs.push_back( m_alloc.createDeviceBuffer(
+            name + " instance buffer " + std::to_string( i ), bufferSize,
+            nullptr, false, flags ) );
+    }
+
+    //the sizes only depend on the count, the instance data isn't read
+    vk::AccelerationStructureGeometryKHR geometry;
+    geometry.geometryType = vk::GeometryTypeKHR::eInstances;
+    geometry.flags = vk::GeometryFlagBitsKHR::eOpaque;
+    geometry.geometry.instances.sType =
+        vk::StructureType::eAccelerationStructureGeometryInstancesDataKHR;
+    geometry.geometry.instances.arrayOfPointers = false;
+
+    vk::AccelerationStructureBuildGeometryInfoKHR geometryInfo;
+    geometryInfo.type = vk::AccelerationStructureTypeKHR::eTopLevel;
+    geometryInfo.flags =
+        vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace |
+        vk::BuildAccelerationStructureFlagBitsKHR::eAllowUpdate;
+    geometryInfo.geometryCount = 1;
+    geometryInfo.pGeometries = &geometry;
+
+    vk::AccelerationStructureBuildSizesInfoKHR sizeInfo;
+
+    // clang-format off
+    AppState::instance().vkGetAccelerationStructureBuildSizesKHR(
+        m_device,
+        VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
+        reinterpret_cast<VkAccelerationStructureBuildGeometryInfoKHR*>( &geometryInfo ),
+        &maxInstances,
+        reinterpret_cast<VkAccelerationStructureBuildSizesInfoKHR*>( &sizeInfo )
+    );
+    // clang-format on
+
+    vk::Buffer tlas = m_alloc.createDeviceBuffer(
+        name + " Buffer", sizeInfo.accelerationStructureSize, nullptr, false,
+        vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR |
+            vk::BufferUsageFlagBits::eShaderDeviceAddress );
+
+    vk::AccelerationStructureCreateInfoKHR createInfo;
+    createInfo.buffer = tlas;
+    createInfo.size = sizeInfo.accelerationStructureSize;
+    createInfo.type = vk::AccelerationStructureTypeKHR::eTopLevel;
+
+    vk::AccelerationStructureKHR handle;
+
+    // clang-format off
+    auto result = AppState::instance().vkCreateAccelerationStructureKHR(
+        m_device,
+        reinterpret_cast<VkAccelerationStructureCreateInfoKHR*>( &createInfo ),
+        nullptr,
+        reinterpret_cast<VkAccelerationStructureKHR*>( &handle )
+    );
+    // clang-format on
+
+    checkSuccess( result );
+
+    //scratch for a build or a refit, per frame in flight
+    auto scratchSize =
+        std::max( sizeInfo.buildScratchSize, sizeInfo.updateScratchSize );
+
+    for ( int i = 0; i < m_framesInFlight; ++i )
+    {
+        m_tlasScratch.push_back( m_alloc.createDeviceBuffer(
+            name + " Scratch " + std::to_string( i ), scratchSize, nullptr,
+            false,
+            vk::BufferUsageFlagBits::eStorageBuffer |
+                vk::BufferUsageFlagBits::eShaderDeviceAddress ) );
+    }
+
+    vk::AccelerationStructureDeviceAddressInfoKHR adressInfo{};
+    adressInfo.accelerationStructure = handle;
+
+    // clang-format off
+    m_addresses[handle] =
+        AppState::instance().vkGetAccelerationStructureDeviceAddressKHR(
+            m_device,
+            reinterpret_cast<VkAccelerationStructureDeviceAddressInfoKHR*>(&adressInfo )
+    );
+    // clang-format on
+
+    m_structures.push_back( handle );
+    m_storage[handle] = { tlas, sizeInfo.accelerationStructureSize, name };
+    DEBUG_NAME( handle, name );
+
+    printf( "%s sized for %u instances, %.2f MB\n", name.c_str(),
+            maxInstances,
+            sizeInfo.accelerationStructureSize / ( 1024.0 * 1024.0 ) );
+
+    return handle;
+}
+
+vk::Buffer ASBuilder::getInstanceBuffer( int frame )
+{
+    assert( frame >= 0 && frame < m_framesInFlight );
+    return m_instanceBuffs[frame];
+}
+
+void ASBuilder::cmdBuildGpuTlas( vk::CommandBuffer commandBuffer, int frame,
+                                 vk::AccelerationStructureKHR tlas,
+                                 uint32_t instanceCount )
+{
+    assert( frame >= 0 && frame < m_framesInFlight );
+    assert( instanceCount > 0 && instanceCount <= m_maxInstances );
+
+    //a refit needs the instance count of the build it starts from, and
+    //degrades the tree like a BLAS refit does
+    bool refit = instanceCount == m_instanceCount && !m_blasesRebuilt &&
+                 m_tlasRefits < m_refitPolicy.maxRefits;
+
+    m_instanceCount = instanceCount;
+    m_tlasRefits = refit ? m_tlasRefits + 1 : 0;
+    m_blasesRebuilt = false;
+
+    vk::DeviceOrHostAddressConstKHR instanceDataDeviceAddress;
+    instanceDataDeviceAddress.deviceAddress =
+        m_alloc.getDeviceAddress( m_instanceBuffs[frame] );
+
+    vk::AccelerationStructureGeometryKHR geometry;
+    geometry.geometryType = vk::GeometryTypeKHR::eInstances;
+    geometry.flags = vk::GeometryFlagBitsKHR::eOpaque;
+    geometry.geometry.instances.sType =
+        vk::StructureType::eAccelerationStructureGeometryInstancesDataKHR;
+    geometry.geometry.instances.arrayOfPointers = false;
+    geometry.geometry.instances.data = instanceDataDeviceAddress;
+
+    vk::AccelerationStructureBuildGeometryInfoKHR asInfo;
+    asInfo.type = vk::AccelerationStructureTypeKHR::eTopLevel;
+    asInfo.flags = vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace |
+                   vk::BuildAccelerationStructureFlagBitsKHR::eAllowUpdate;
+    asInfo.mode = refit ? vk::BuildAccelerationStructureModeKHR::eUpdate
+                        : vk::BuildAccelerationStructureModeKHR::eBuild;
+    asInfo.dstAccelerationStructure = tlas;
+    asInfo.srcAccelerationStructure = refit ? tlas : nullptr;
+    asInfo.geometryCount = 1;
+    asInfo.pGeometries = &geometry;
+    asInfo.scratchData.deviceAddress =
+        m_alloc.getDeviceAddress( m_tlasScratch[frame] );
+
+    vk::AccelerationStructureBuildRangeInfoKHR asRangeInfo;
+    asRangeInfo.primitiveCount = instanceCount;
+    asRangeInfo.primitiveOffset = 0;
+    asRangeInfo.firstVertex = 0;
+    asRangeInfo.transformOffset = 0;
+
+    std::vector<VkAccelerationStructureBuildRangeInfoKHR*>
+        accelerationBuildStructureRangeInfos = {
+            reinterpret_cast<VkAccelerationStructureBuildRangeInfoKHR*>(
+                &asRangeInfo ) };
+
+    //the previous frame may still be tracing against this TLAS
+    //trace read -> AS write
+    vk::MemoryBarrier readBarrier;
+    readBarrier.srcAccessMask = vk::AccessFlagBits::eAccelerationStructureReadKHR;
+    readBarrier.dstAccessMask =
+        vk::AccessFlagBits::eAccelerationStructureWriteKHR;
+
+    commandBuffer.pipelineBarrier(
+        vk::PipelineStageFlagBits::eRayTracingShaderKHR,
+        vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, {},
+        readBarrier, nullptr, nullptr );
 
     // clang-format off
     AppState::instance().vkCmdBuildAccelerationStructuresKHR(
-        buffer,
+        commandBuffer,
         1,
         reinterpret_cast<VkAccelerationStructureBuildGeometryInfoKHR*>( &asInfo ),
         accelerationBuildStructureRangeInfos.data()
     );
     // clang-format on
 
-    m_pool.endOneTimeSubmit( buffer );
+    //the trace must see the new TLAS
+    //AS write -> trace read
+    vk::MemoryBarrier buildBarrier;
+    buildBarrier.srcAccessMask =
+        vk::AccessFlagBits::eAccelerationStructureWriteKHR;
+    buildBarrier.dstAccessMask =
+        vk::AccessFlagBits::eAccelerationStructureReadKHR;
+
+    commandBuffer.pipelineBarrier(
+        vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR,
+        vk::PipelineStageFlagBits::eRayTracingShaderKHR, {}, buildBarrier,
+        nullptr, nullptr );
 }
 
 uint64_t ASBuilder::getAddress( vk::AccelerationStructureKHR structure )
@@ -419,7 +1896,35 @@ void ASBuilder::destroy()
         AppState::instance().vkDestroyAccelerationStructureKHR(
             m_device, handle, nullptr );
 
+    for ( auto& [handle, storage] : m_storage )
+        m_alloc.free( storage.buffer );
+
     m_addresses.clear();
     m_structures.clear();
-    m_alloc.free( m_tlasScratch );
+    m_storage.clear();
+
+    for ( auto scratch : m_tlasScratch )
+        m_alloc.free( scratch );
+
+    for ( auto instances : m_instanceBuffs )
+        m_alloc.free( instances );
+
+    m_tlasScratch.clear();
+    m_instanceBuffs.clear();
+    m_instanceCount = 0;
+    m_maxInstances = 0;
+    m_tlasRefits = 0;
+    m_blasesRebuilt = false;
+
+    for ( auto scratch : m_blasScratch )
+        m_alloc.free( scratch );
+
+    m_blasScratch.clear();
+    m_blasScratchSize = 0;
+    m_dynamic.clear();
+
+    if ( m_timestamps )
+        m_device.destroyQueryPool( m_timestamps );
+
+    m_timestamps = nullptr;
 }
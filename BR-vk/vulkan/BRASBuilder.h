@@ -2,27 +2,159 @@
 
 #include <BRMemoryMgr.h>
 
+#include <glm/glm.hpp>
+#include <set>
+#include <string>
+#include <vector>
+
 namespace BR
 {
 class ASBuilder
 {
    public:
+    //A BLAS over a range of an index buffer
+    struct BlasInput
+    {
+        std::string name;
+        vk::Buffer vertexBuffer;
+        vk::Buffer indexBuffer;
+        uint32_t maxVertex;
+        uint32_t firstIndex;
+        uint32_t indexCount;
+
+        //the same data in host memory, only read by host builds
+        const void* hostVertexData;
+        const void* hostIndexData;
+    };
+
+    //A placement of a BLAS in the TLAS
+    struct Instance
+    {
+        vk::AccelerationStructureKHR blas;
+        glm::mat4 transform;
+        uint32_t customIndex;  // gl_InstanceCustomIndexEXT, 24 bits
+    };
+
+    //Refit/rebuild policy of the dynamic BLASes
+    //A refit moves the bounds but keeps the tree of the last build, so the
+    //tree gets worse the further the geometry moves from that pose. Every
+    //BLAS counts its refits since its last build, the count is the measure
+    //of how degraded it is. Past maxRefits it's due for a rebuild, worst
+    //first, at most rebuildBudget triangles a frame - at least one BLAS
+    //When the measured rebuilds cost no more per triangle than the refits,
+    //every BLAS is due. The GPU TLAS is rebuilt after maxRefits refits too
+    struct RefitPolicy
+    {
+        uint32_t maxRefits = 60;
+        uint64_t rebuildBudget = 1 << 20;
+    };
+
+    //What the refit of a frame did, GPU times from timestamp queries
+    //Reported a few frames late, when the frame's fence was waited on
+    struct RefitStats
+    {
+        uint32_t refits = 0;
+        uint32_t rebuilds = 0;
+        uint64_t refitTriangles = 0;
+        uint64_t rebuildTriangles = 0;
+        double refitMs = 0.0;
+        double rebuildMs = 0.0;
+    };
+
     ASBuilder();
     ~ASBuilder();
 
-    void create( );
+    //allowCompaction builds BLASes that compactBlas() can shrink
+    //hostBuild builds BLASes on the CPU, on all cores, with a deferred
+    //operation. Needs accelerationStructureHostCommands, falls back to GPU
+    //builds without it. The BLASes live in host visible memory until
+    //compacted
+    void create( bool allowCompaction = true, bool hostBuild = false );
     void destroy();
 
-    vk::AccelerationStructureKHR buildBlas( std::string name,
-                                            vk::Buffer vertexBuffer,
-                                            vk::Buffer indexBuffer,
-                                            int maxVertex, int numIndex );
+    //All the BLASes are built in one command buffer, sharing one scratch
+    //buffer. Returns the handles in input order
+    //dynamic BLASes are for geometry that changes every frame, see
+    //cmdRefitBlas(). They're built on the GPU with ePreferFastBuild and
+    //eAllowUpdate, and can't be compacted. The inputs are kept, the
+    //buffers must stay alive as long as the BLASes
+    std::vector<vk::AccelerationStructureKHR> buildBlas(
+        const std::vector<BlasInput>& inputs, bool dynamic = false );
+
+    //Splits a BLAS input into chunks of at most chunkTriangles triangles,
+    //each one a consecutive range of its indices, for a BLAS each
+    //The ranges are spatially coherent when the triangles are sorted along
+    //a curve, as SceneCache cooks them. Smaller chunks rebuild less of an
+    //edited mesh, but the TLAS gets more instances, with overlapping bounds
+    //0 keeps the input whole
+    static std::vector<BlasInput> partition( const BlasInput& input,
+                                             uint32_t chunkTriangles );
+
+    //MemoryMgr alias group of the BLAS build scratch, see
+    //MemoryMgr::createAliasedBuffer. Members must not be in use during
+    //buildBlas() - the scratch clobbers them
+    static constexpr const char* SCRATCH_ALIAS_GROUP = "Build Scratch";
+
+    //Records the refit of dynamic BLASes to the current contents of their
+    //vertex buffers, in place. The ones the RefitPolicy picks are rebuilt
+    //instead, and the ones in forced whatever the policy says - edited
+    //geometry. Uses the scratch buffer of the given frame in flight
+    //The caller makes the vertex writes visible to the AS build stage, and
+    //refits the TLAS afterwards - the BLAS bounds changed
+    void cmdRefitBlas(
+        vk::CommandBuffer commandBuffer, int frame,
+        const std::vector<vk::AccelerationStructureKHR>& blases,
+        const std::set<vk::AccelerationStructureKHR>& forced = {} );
 
-    vk::AccelerationStructureKHR buildTlas( std::string name,
-                                            vk::AccelerationStructureKHR blas );
+    void setRefitPolicy( const RefitPolicy& policy );
+    const RefitStats& getRefitStats();
 
-    void updateTlas( vk::AccelerationStructureKHR tlas,
-                     vk::AccelerationStructureKHR blas, glm::mat4 mat );
+    //Copies the BLASes into buffers of their compacted size, frees the
+    //originals, and replaces the handles in place
+    //One submission for the size queries, one for all the copies
+    void compactBlas( std::vector<vk::AccelerationStructureKHR>& blases );
+
+    //Serialized BLAS cache
+    //key identifies the geometry and build settings, the file also records
+    //the device and driver, and the driver's own compatibility data
+    //loadBlas returns false if the file is missing, stale, corrupt, or
+    //incompatible with this device - rebuild, then saveBlas. It loads one
+    //BLAS per input, named after it, or none at all
+    bool saveBlas( const std::string& path,
+                   const std::vector<vk::AccelerationStructureKHR>& blases,
+                   uint64_t key );
+    bool loadBlas( const std::string& path, uint64_t key,
+                   const std::vector<BlasInput>& inputs,
+                   std::vector<vk::AccelerationStructureKHR>& blases );
+
+    vk::AccelerationStructureKHR buildTlas(
+        std::string name, const std::vector<Instance>& instances );
+
+    //Records a TLAS refit into the frame's command buffer
+    //Uses the instance/scratch buffers of the given frame in flight
+    //Same instance count as the build, transforms and BLASes can change
+    void cmdUpdateTlas( vk::CommandBuffer commandBuffer, int frame,
+                        vk::AccelerationStructureKHR tlas,
+                        const std::vector<Instance>& instances );
+
+    //TLAS over instances written on the GPU, no per-instance host traffic
+    //maxInstances sizes the TLAS, the scratch and the instance buffers, the
+    //builds can use any count up to it. Nothing is built yet
+    vk::AccelerationStructureKHR createGpuTlas( std::string name,
+                                                uint32_t maxInstances );
+
+    //The frame's instance buffer of a GPU TLAS, for the shader writing it
+    //vk::AccelerationStructureInstanceKHR[maxInstances]
+    vk::Buffer getInstanceBuffer( int frame );
+
+    //Records a build of a GPU TLAS from the first instanceCount instances
+    //of the frame's instance buffer - a refit when the count matches the
+    //last build. Rebuilt after RefitPolicy::maxRefits refits, and after a
+    //cmdRefitBlas() that rebuilt BLASes, their bounds may have moved far
+    //The caller makes the instance writes visible to the AS build stage
+    void cmdBuildGpuTlas( vk::CommandBuffer commandBuffer, int frame,
+                          vk::AccelerationStructureKHR tlas,
+                          uint32_t instanceCount );
 
     uint64_t getAddress( vk::AccelerationStructureKHR structure );
 
@@ -30,11 +162,106 @@ class ASBuilder
     vk::Device m_device;
     MemoryMgr& m_alloc;
     CommandPool m_pool;
-    vk::Buffer m_tlasScratch;
-    vk::Buffer m_instanceBuff;
+    int m_framesInFlight;
+    bool m_allowCompaction;
+    bool m_hostBuild;
+
+    //instances of the last TLAS build, and the most a GPU TLAS can have
+    uint32_t m_instanceCount;
+    uint32_t m_maxInstances;
+
+    //GPU TLAS refits since its last build, and whether BLASes were rebuilt
+    //since then
+    uint32_t m_tlasRefits;
+    bool m_blasesRebuilt;
+
+    //one of each per frame in flight, so refits can't race each other
+    std::vector<vk::Buffer> m_tlasScratch;
+    std::vector<vk::Buffer> m_instanceBuffs;
 
     std::vector<vk::AccelerationStructureKHR> m_structures;
     std::map<vk::AccelerationStructureKHR, uint64_t> m_addresses;
+
+    //the buffer behind each structure, freed with it
+    struct Storage
+    {
+        vk::Buffer buffer;
+        vk::DeviceSize size;
+        std::string name;
+    };
+
+    std::map<vk::AccelerationStructureKHR, Storage> m_storage;
+
+    //a BLAS that's refit every frame, and its slice of the refit scratch
+    //the slices fit a build or a refit, whichever needs more
+    struct DynamicBlas
+    {
+        BlasInput input;
+        vk::DeviceSize scratchOffset;
+        uint32_t refits;
+    };
+
+    std::map<vk::AccelerationStructureKHR, DynamicBlas> m_dynamic;
+
+    //one of each per frame in flight, like the TLAS refits
+    std::vector<vk::Buffer> m_blasScratch;
+    vk::DeviceSize m_blasScratchSize;
+
+    //3 timestamps per frame in flight - start, rebuilds done, refits done
+    vk::QueryPool m_timestamps;
+    std::vector<RefitStats> m_frameStats;
+    std::vector<bool> m_timestampsWritten;
+
+    RefitPolicy m_refitPolicy;
+    RefitStats m_refitStats;
+
+    //running averages, ms per million triangles, 0 until measured
+    double m_refitCost;
+    double m_rebuildCost;
+
+    vk::BuildAccelerationStructureFlagsKHR getBlasFlags( bool dynamic );
+
+    //(re)creates the refit scratch buffers to fit every dynamic BLAS
+    void createRefitResources();
+
+    //reads back the timestamps of the last refit of the frame
+    void readRefitStats( int frame );
+
+    //.bras file layout
+    //  SerialHeader | SerialEntry[count] | serialized BLASes, 256 aligned
+    struct SerialHeader
+    {
+        char magic[4];
+        uint32_t version;
+        uint64_t key;
+        uint8_t deviceUUID[VK_UUID_SIZE];
+        uint8_t driverUUID[VK_UUID_SIZE];
+        uint64_t count;
+    };
+
+    struct SerialEntry
+    {
+        uint64_t offset;
+        uint64_t serializedSize;
+        uint64_t structureSize;
+    };
+
+    void getDeviceUUIDs( uint8_t* deviceUUID, uint8_t* driverUUID );
+
+    //host visible buffer for the serialized data, and its mapping and
+    //device address, both rounded up to the copy alignment
+    vk::Buffer createSerialBuffer( std::string name, vk::DeviceSize size,
+                                   char*& data, uint64_t& address );
+
+    //Run the BLAS builds set up by buildBlas(), return how they ran
+    std::string deviceBuild(
+        std::vector<vk::AccelerationStructureBuildGeometryInfoKHR>& asInfos,
+        std::vector<vk::AccelerationStructureBuildRangeInfoKHR>& asRangeInfos,
+        const std::vector<vk::DeviceSize>& scratchSizes );
+    std::string hostBuild(
+        std::vector<vk::AccelerationStructureBuildGeometryInfoKHR>& asInfos,
+        std::vector<vk::AccelerationStructureBuildRangeInfoKHR>& asRangeInfos,
+        const std::vector<vk::DeviceSize>& scratchSizes );
 };
 
 }  // namespace BR
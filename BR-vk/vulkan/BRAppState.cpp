@@ -86,6 +86,42 @@ void AppState::getFunctionPointers()
     vkBuildAccelerationStructuresKHR =
         reinterpret_cast<PFN_vkBuildAccelerationStructuresKHR>(
             vkGetDeviceProcAddr( device, "vkBuildAccelerationStructuresKHR" ) );
+    vkCmdWriteAccelerationStructuresPropertiesKHR =
+        reinterpret_cast<PFN_vkCmdWriteAccelerationStructuresPropertiesKHR>(
+            vkGetDeviceProcAddr(
+                device, "vkCmdWriteAccelerationStructuresPropertiesKHR" ) );
+    vkCmdCopyAccelerationStructureKHR =
+        reinterpret_cast<PFN_vkCmdCopyAccelerationStructureKHR>(
+            vkGetDeviceProcAddr( device,
+                                 "vkCmdCopyAccelerationStructureKHR" ) );
+    vkCmdCopyAccelerationStructureToMemoryKHR =
+        reinterpret_cast<PFN_vkCmdCopyAccelerationStructureToMemoryKHR>(
+            vkGetDeviceProcAddr( device,
+                                 "vkCmdCopyAccelerationStructureToMemoryKHR" ) );
+    vkCmdCopyMemoryToAccelerationStructureKHR =
+        reinterpret_cast<PFN_vkCmdCopyMemoryToAccelerationStructureKHR>(
+            vkGetDeviceProcAddr( device,
+                                 "vkCmdCopyMemoryToAccelerationStructureKHR" ) );
+    vkGetDeviceAccelerationStructureCompatibilityKHR =
+        reinterpret_cast<PFN_vkGetDeviceAccelerationStructureCompatibilityKHR>(
+            vkGetDeviceProcAddr(
+                device, "vkGetDeviceAccelerationStructureCompatibilityKHR" ) );
+    vkCreateDeferredOperationKHR =
+        reinterpret_cast<PFN_vkCreateDeferredOperationKHR>(
+            vkGetDeviceProcAddr( device, "vkCreateDeferredOperationKHR" ) );
+    vkDestroyDeferredOperationKHR =
+        reinterpret_cast<PFN_vkDestroyDeferredOperationKHR>(
+            vkGetDeviceProcAddr( device, "vkDestroyDeferredOperationKHR" ) );
+    vkGetDeferredOperationMaxConcurrencyKHR =
+        reinterpret_cast<PFN_vkGetDeferredOperationMaxConcurrencyKHR>(
+            vkGetDeviceProcAddr( device,
+                                 "vkGetDeferredOperationMaxConcurrencyKHR" ) );
+    vkDeferredOperationJoinKHR =
+        reinterpret_cast<PFN_vkDeferredOperationJoinKHR>(
+            vkGetDeviceProcAddr( device, "vkDeferredOperationJoinKHR" ) );
+    vkGetDeferredOperationResultKHR =
+        reinterpret_cast<PFN_vkGetDeferredOperationResultKHR>(
+            vkGetDeviceProcAddr( device, "vkGetDeferredOperationResultKHR" ) );
     vkCreateAccelerationStructureKHR =
         reinterpret_cast<PFN_vkCreateAccelerationStructureKHR>(
             vkGetDeviceProcAddr( device, "vkCreateAccelerationStructureKHR" ) );
@@ -103,6 +139,9 @@ void AppState::getFunctionPointers()
                 device, "vkGetAccelerationStructureDeviceAddressKHR" ) );
     vkCmdTraceRaysKHR = reinterpret_cast<PFN_vkCmdTraceRaysKHR>(
         vkGetDeviceProcAddr( device, "vkCmdTraceRaysKHR" ) );
+    vkCmdTraceRaysIndirectKHR =
+        reinterpret_cast<PFN_vkCmdTraceRaysIndirectKHR>(
+            vkGetDeviceProcAddr( device, "vkCmdTraceRaysIndirectKHR" ) );
     vkGetRayTracingShaderGroupHandlesKHR =
         reinterpret_cast<PFN_vkGetRayTracingShaderGroupHandlesKHR>(
             vkGetDeviceProcAddr( device,
@@ -119,8 +158,13 @@ void AppState::initRT()
     //get all the properties, these are needed to set up structures
     auto gpu = m_device.m_physicalDevice;
 
+    accelerationStructureProperties.sType =
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_PROPERTIES_KHR;
+    accelerationStructureProperties.pNext = nullptr;
+
     rayTracingPipelineProperties.sType =
         VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_PROPERTIES_KHR;
+    rayTracingPipelineProperties.pNext = &accelerationStructureProperties;
     VkPhysicalDeviceProperties2 deviceProperties2{};
     deviceProperties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
     deviceProperties2.pNext = &rayTracingPipelineProperties;
@@ -171,6 +215,16 @@ int AppState::getFamilyIndex()
     return m_device.m_index;
 }
 
+vk::Queue AppState::getTransferQueue()
+{
+    return m_device.m_transferQueue;
+}
+
+int AppState::getTransferFamilyIndex()
+{
+    return m_device.m_transferIndex;
+}
+
 vk::SurfaceKHR AppState::getSurface()
 {
     return m_surface.m_surface;
@@ -63,6 +63,8 @@ class AppState
     vk::Device getLogicalDevice();
     vk::Queue getGraphicsQueue();
     int getFamilyIndex();
+    vk::Queue getTransferQueue();
+    int getTransferFamilyIndex();
     vk::SurfaceKHR getSurface();
     vk::SwapchainKHR getSwapchain();
     vk::Image getSwapchainImage( int index );
@@ -90,7 +92,23 @@ class AppState
         vkGetAccelerationStructureDeviceAddressKHR;
     PFN_vkCmdBuildAccelerationStructuresKHR vkCmdBuildAccelerationStructuresKHR;
     PFN_vkBuildAccelerationStructuresKHR vkBuildAccelerationStructuresKHR;
+    PFN_vkCmdWriteAccelerationStructuresPropertiesKHR
+        vkCmdWriteAccelerationStructuresPropertiesKHR;
+    PFN_vkCmdCopyAccelerationStructureKHR vkCmdCopyAccelerationStructureKHR;
+    PFN_vkCmdCopyAccelerationStructureToMemoryKHR
+        vkCmdCopyAccelerationStructureToMemoryKHR;
+    PFN_vkCmdCopyMemoryToAccelerationStructureKHR
+        vkCmdCopyMemoryToAccelerationStructureKHR;
+    PFN_vkGetDeviceAccelerationStructureCompatibilityKHR
+        vkGetDeviceAccelerationStructureCompatibilityKHR;
+    PFN_vkCreateDeferredOperationKHR vkCreateDeferredOperationKHR;
+    PFN_vkDestroyDeferredOperationKHR vkDestroyDeferredOperationKHR;
+    PFN_vkGetDeferredOperationMaxConcurrencyKHR
+        vkGetDeferredOperationMaxConcurrencyKHR;
+    PFN_vkDeferredOperationJoinKHR vkDeferredOperationJoinKHR;
+    PFN_vkGetDeferredOperationResultKHR vkGetDeferredOperationResultKHR;
     PFN_vkCmdTraceRaysKHR vkCmdTraceRaysKHR;
+    PFN_vkCmdTraceRaysIndirectKHR vkCmdTraceRaysIndirectKHR;
     PFN_vkGetRayTracingShaderGroupHandlesKHR
         vkGetRayTracingShaderGroupHandlesKHR;
     PFN_vkCreateRayTracingPipelinesKHR vkCreateRayTracingPipelinesKHR;
@@ -98,6 +116,8 @@ class AppState
     //RT Device Properties
     VkPhysicalDeviceRayTracingPipelinePropertiesKHR
         rayTracingPipelineProperties;
+    VkPhysicalDeviceAccelerationStructurePropertiesKHR
+        accelerationStructureProperties;
     VkPhysicalDeviceAccelerationStructureFeaturesKHR
         accelerationStructureFeatures;
 
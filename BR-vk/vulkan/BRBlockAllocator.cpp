@@ -0,0 +1,228 @@
+#include <BRBlockAllocator.h>
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+
+using namespace BR;
+
+BlockAllocator::BlockAllocator( uint64_t size )
+    : m_size( size ), m_used( 0 ), m_flBitmap( 0 )
+{
+    for ( int fl = 0; fl < FL_COUNT; ++fl )
+    {
+        m_slBitmap[fl] = 0;
+
+        for ( int sl = 0; sl < SL_COUNT; ++sl )
+            m_freeLists[fl][sl] = nullptr;
+    }
+
+    //the whole block starts out as one free chunk
+    auto& chunk = m_chunks[0];
+    chunk = { 0, size, true, nullptr, nullptr };
+    insertFree( &chunk );
+}
+
+// size -> (first level, second level) list index
+void BlockAllocator::mapping( uint64_t size, int& fl, int& sl )
+{
+    if ( size < SMALL_SIZE )
+    {
+        //small sizes all go in the first level, in linear steps
+        fl = 0;
+        sl = static_cast<int>( size / ( SMALL_SIZE / SL_COUNT ) );
+    }
+    else
+    {
+        int msb = 63 - std::countl_zero( size );
+        fl = msb - ( SMALL_LOG2 - 1 );
+        sl = static_cast<int>( ( size >> ( msb - SL_LOG2 ) ) ^ SL_COUNT );
+    }
+}
+
+void BlockAllocator::insertFree( Chunk* chunk )
+{
+    int fl, sl;
+    mapping( chunk->size, fl, sl );
+
+    chunk->free = true;
+    chunk->prevFree = nullptr;
+    chunk->nextFree = m_freeLists[fl][sl];
+
+    if ( chunk->nextFree )
+        chunk->nextFree->prevFree = chunk;
+
+    m_freeLists[fl][sl] = chunk;
+    m_flBitmap |= 1ull << fl;
+    m_slBitmap[fl] |= 1u << sl;
+}
+
+void BlockAllocator::removeFree( Chunk* chunk )
+{
+    int fl, sl;
+    mapping( chunk->size, fl, sl );
+
+    if ( chunk->prevFree )
+        chunk->prevFree->nextFree = chunk->nextFree;
+    else
+        m_freeLists[fl][sl] = chunk->nextFree;
+
+    if ( chunk->nextFree )
+        chunk->nextFree->prevFree = chunk->prevFree;
+
+    if ( !m_freeLists[fl][sl] )
+    {
+        m_slBitmap[fl] &= ~( 1u << sl );
+
+        if ( !m_slBitmap[fl] )
+            m_flBitmap &= ~( 1ull << fl );
+    }
+
+    chunk->free = false;
+    chunk->prevFree = nullptr;
+    chunk->nextFree = nullptr;
+}
+
+BlockAllocator::Chunk* BlockAllocator::findFree( uint64_t size )
+{
+    //round the request up to the next list, so any chunk in it is big enough
+    uint64_t search = size;
+
+    if ( size < SMALL_SIZE )
+        search += ( SMALL_SIZE / SL_COUNT ) - 1;
+    else
+        search += ( 1ull << ( 63 - std::countl_zero( size ) - SL_LOG2 ) ) - 1;
+
+    int fl, sl;
+    mapping( search, fl, sl );
+
+    if ( fl >= FL_COUNT )
+        return nullptr;
+
+    //look in the same first level, then in any larger one
+    uint32_t slMap = m_slBitmap[fl] & ( ~0u << sl );
+
+    if ( !slMap )
+    {
+        uint64_t flMap = fl + 1 < 64 ? m_flBitmap & ( ~0ull << ( fl + 1 ) ) : 0;
+
+        if ( !flMap )
+            return nullptr;
+
+        fl = std::countr_zero( flMap );
+        slMap = m_slBitmap[fl];
+    }
+
+    sl = std::countr_zero( slMap );
+
+    return m_freeLists[fl][sl];
+}
+
+bool BlockAllocator::allocate( uint64_t size, uint64_t alignment,
+                               uint64_t& offset )
+{
+    assert( size > 0 );
+    assert( alignment > 0 && ( alignment & ( alignment - 1 ) ) == 0 );
+
+    //worst case, we lose alignment - 1 bytes at the front of the chunk
+    Chunk* chunk = findFree( size + alignment - 1 );
+
+    if ( !chunk )
+        return false;
+
+    removeFree( chunk );
+
+    uint64_t aligned = ( chunk->offset + alignment - 1 ) & ~( alignment - 1 );
+    uint64_t front = aligned - chunk->offset;
+
+    //give the padding in front back as its own free chunk
+    if ( front > 0 )
+    {
+        auto& alignedChunk = m_chunks[aligned];
+        alignedChunk = { aligned, chunk->size - front, false, nullptr,
+                         nullptr };
+
+        chunk->size = front;
+        insertFree( chunk );
+
+        chunk = &alignedChunk;
+    }
+
+    //give the unused tail back
+    if ( chunk->size > size )
+    {
+        auto& tail = m_chunks[aligned + size];
+        tail = { aligned + size, chunk->size - size, true, nullptr, nullptr };
+        insertFree( &tail );
+
+        chunk->size = size;
+    }
+
+    m_used += chunk->size;
+    offset = aligned;
+
+    return true;
+}
+
+void BlockAllocator::free( uint64_t offset )
+{
+    auto it = m_chunks.find( offset );
+    assert( it != m_chunks.end() && !it->second.free );
+
+    m_used -= it->second.size;
+
+    //merge with the next chunk
+    auto next = std::next( it );
+    if ( next != m_chunks.end() && next->second.free )
+    {
+        removeFree( &next->second );
+        it->second.size += next->second.size;
+        m_chunks.erase( next );
+    }
+
+    //merge with the previous chunk
+    if ( it != m_chunks.begin() )
+    {
+        auto prev = std::prev( it );
+        if ( prev->second.free )
+        {
+            removeFree( &prev->second );
+            prev->second.size += it->second.size;
+            m_chunks.erase( it );
+            it = prev;
+        }
+    }
+
+    insertFree( &it->second );
+}
+
+uint64_t BlockAllocator::getSize()
+{
+    return m_size;
+}
+
+uint64_t BlockAllocator::getUsed()
+{
+    return m_used;
+}
+
+uint64_t BlockAllocator::getLargestFree()
+{
+    if ( !m_flBitmap )
+        return 0;
+
+    //the largest chunk is in the highest non-empty list
+    int fl = 63 - std::countl_zero( m_flBitmap );
+    int sl = 31 - std::countl_zero( m_slBitmap[fl] );
+
+    uint64_t largest = 0;
+    for ( Chunk* chunk = m_freeLists[fl][sl]; chunk; chunk = chunk->nextFree )
+        largest = std::max( largest, chunk->size );
+
+    return largest;
+}
+
+bool BlockAllocator::isEmpty()
+{
+    return m_used == 0;
+}
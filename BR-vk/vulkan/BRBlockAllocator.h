@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+
+namespace BR
+{
+/*
+
+Two-Level Segregated Fit (TLSF) allocator for one block of device memory
+
+* Only does the bookkeeping - hands out offsets into a range of [0, size)
+* Free chunks are kept in lists, bucketed by size
+    * First level - power of two ( 2^fl )
+    * Second level - splits each power of two into SL_COUNT linear steps
+* Two bitmaps track which lists are non-empty, so finding a free chunk that
+    fits is a couple of bit scans, O(1)
+* Freed chunks are merged with their physical neighbours right away
+
+*/
+
+class BlockAllocator
+{
+   public:
+    BlockAllocator( uint64_t size );
+    BlockAllocator( const BlockAllocator& ) = delete;
+
+    //returns false if there is no free chunk big enough
+    bool allocate( uint64_t size, uint64_t alignment, uint64_t& offset );
+    void free( uint64_t offset );
+
+    uint64_t getSize();
+    uint64_t getUsed();
+    uint64_t getLargestFree();
+    bool isEmpty();
+
+   private:
+    struct Chunk
+    {
+        uint64_t offset;
+        uint64_t size;
+        bool free;
+        Chunk* prevFree;
+        Chunk* nextFree;
+    };
+
+    static const int SL_LOG2 = 4;
+    static const int SL_COUNT = 1 << SL_LOG2;
+    static const int SMALL_LOG2 = 8;
+    static const uint64_t SMALL_SIZE = 1 << SMALL_LOG2;
+    static const int FL_COUNT = 48;
+
+    void mapping( uint64_t size, int& fl, int& sl );
+    void insertFree( Chunk* chunk );
+    void removeFree( Chunk* chunk );
+    Chunk* findFree( uint64_t size );
+
+    uint64_t m_size;
+    uint64_t m_used;
+
+    uint64_t m_flBitmap;
+    uint32_t m_slBitmap[FL_COUNT];
+    Chunk* m_freeLists[FL_COUNT][SL_COUNT];
+
+    //every chunk in the block, free or used, ordered by offset
+    std::map<uint64_t, Chunk> m_chunks;
+};
+}  // namespace BR
@@ -16,14 +16,22 @@ CommandPool::~CommandPool()
 }
 
 void CommandPool::create( std::string name,
-                          vk::CommandPoolCreateFlagBits flags )
+                          vk::CommandPoolCreateFlagBits flags, bool transfer )
 {
     /*
     * Command pools allow concurrent recording of command buffers
     * One pool per thread -> Multi-thread recording
+    * A pool is tied to one queue family, its buffers can only be submitted
+    *   to queues of that family
     */
-    m_device = AppState::instance().getLogicalDevice();
-    auto familyIndex = AppState::instance().getFamilyIndex();
+    auto& state = AppState::instance();
+
+    m_device = state.getLogicalDevice();
+
+    auto familyIndex =
+        transfer ? state.getTransferFamilyIndex() : state.getFamilyIndex();
+
+    m_queue = transfer ? state.getTransferQueue() : state.getGraphicsQueue();
 
     auto poolInfo = vk::CommandPoolCreateInfo( flags, familyIndex );
 
@@ -96,14 +104,15 @@ void CommandPool::endOneTimeSubmit( vk::CommandBuffer buff )
 
     buff.end();
 
+    //queued uploads must land before this work runs
+    AppState::instance().getMemoryMgr().getUploader().flush();
+
     vk::SubmitInfo submitInfo;
     submitInfo.commandBufferCount = 1;
     submitInfo.pCommandBuffers = &buff;
 
-    auto queue = AppState::instance().getGraphicsQueue();
-
-    queue.submit( submitInfo );
-    queue.waitIdle();
+    m_queue.submit( submitInfo );
+    m_queue.waitIdle();
 
     m_device.freeCommandBuffers( m_commandPool, 1, &buff );
 }
@@ -12,7 +12,9 @@ class CommandPool
     CommandPool();
     ~CommandPool();
 
-    void create( std::string name, vk::CommandPoolCreateFlagBits flags );
+    //transfer = true -> buffers are submitted to the transfer queue
+    void create( std::string name, vk::CommandPoolCreateFlagBits flags,
+                 bool transfer = false );
     vk::CommandBuffer createBuffer( std::string name );
     vk::CommandBuffer beginOneTimeSubmit( std::string name );
     void endOneTimeSubmit( vk::CommandBuffer buff );
@@ -22,5 +24,6 @@ class CommandPool
    private:
     vk::CommandPool m_commandPool;
     vk::Device m_device;
+    vk::Queue m_queue;
 };
 }  // namespace BR
@@ -0,0 +1,54 @@
+#include <BRAppState.h>
+#include <BRComputePipeline.h>
+#include <BRUtil.h>
+
+#include <cassert>
+
+using namespace BR;
+
+void ComputePipeline::build( std::string name, vk::DescriptorSetLayout layout,
+                             uint32_t pushConstantSize )
+{
+    assert( m_shaderStages.size() == 1 );
+
+    vk::PushConstantRange pushConstantRange;
+    pushConstantRange.stageFlags = vk::ShaderStageFlagBits::eCompute;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = pushConstantSize;
+
+    vk::PipelineLayoutCreateInfo pipelineLayoutInfo{};
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &layout;
+    pipelineLayoutInfo.pushConstantRangeCount = pushConstantSize ? 1 : 0;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+    try
+    {
+        m_pipelineLayout = m_device.createPipelineLayout( pipelineLayoutInfo );
+    }
+    catch ( vk::SystemError err )
+    {
+        throw std::runtime_error( "failed to create pipeline layout!" );
+    }
+
+    DEBUG_NAME( m_pipelineLayout, name + " Layout" );
+
+    vk::ComputePipelineCreateInfo pipelineInfo;
+    pipelineInfo.stage = m_shaderStages[0];
+    pipelineInfo.layout = m_pipelineLayout;
+
+    try
+    {
+        m_pipeline =
+            m_device.createComputePipeline( nullptr, pipelineInfo ).value;
+    }
+    catch ( vk::SystemError err )
+    {
+        throw std::runtime_error( "failed to create compute pipeline!" );
+    }
+
+    DEBUG_NAME( m_pipeline, name );
+
+    for ( auto& module : m_shaderModules )
+        m_device.destroyShaderModule( module );
+}
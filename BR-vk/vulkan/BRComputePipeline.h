@@ -0,0 +1,21 @@
+#pragma once
+
+#include <BRDevice.h>
+#include <BRPipeline.h>
+
+#include <vulkan/vulkan_handles.hpp>
+
+namespace BR
+{
+class ComputePipeline : public Pipeline
+{
+   public:
+    ComputePipeline(){};
+    ~ComputePipeline(){};
+
+    //one compute stage, added with addShaderStage() first
+    //pushConstantSize = 0 -> no push constants
+    void build( std::string name, vk::DescriptorSetLayout layout,
+                uint32_t pushConstantSize = 0 );
+};
+}  // namespace BR
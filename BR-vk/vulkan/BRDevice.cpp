@@ -3,6 +3,7 @@
 #include <BRUtil.h>
 
 #include <cassert>
+#include <vector>
 
 using namespace BR;
 
@@ -10,7 +11,9 @@ Device::Device()
     : m_physicalDevice( VK_NULL_HANDLE ),
       m_logicalDevice( VK_NULL_HANDLE ),
       m_graphicsQueue( VK_NULL_HANDLE ),
-      m_index( 0 )
+      m_index( 0 ),
+      m_transferQueue( VK_NULL_HANDLE ),
+      m_transferIndex( 0 )
 {
 }
 
@@ -47,16 +50,42 @@ void Device::create( std::string name,
     // ensure one queue has graphics bit
     int graphicsFamilyIndex = -1;
 
-    int i = 0;
-    for ( const auto& family : queueFamilies )
+    // prefer a transfer-only family ( DMA engine ), then async compute
+    int transferFamilyIndex = -1;
+    int computeFamilyIndex = -1;
+
+    for ( uint32_t i = 0; i < queueFamilies.size(); ++i )
     {
-        if ( family.queueFlags & vk::QueueFlagBits::eGraphics )
-            graphicsFamilyIndex = i++;
+        auto flags = queueFamilies[i].queueFlags;
+        int index = static_cast<int>( i );
+
+        if ( flags & vk::QueueFlagBits::eGraphics )
+        {
+            if ( graphicsFamilyIndex == -1 )
+                graphicsFamilyIndex = index;
+        }
+        else if ( flags & vk::QueueFlagBits::eCompute )
+        {
+            if ( computeFamilyIndex == -1 )
+                computeFamilyIndex = index;
+        }
+        else if ( flags & vk::QueueFlagBits::eTransfer )
+        {
+            if ( transferFamilyIndex == -1 )
+                transferFamilyIndex = index;
+        }
     }
 
     assert( graphicsFamilyIndex != -1 );
 
+    if ( transferFamilyIndex == -1 )
+        transferFamilyIndex = computeFamilyIndex;
+
+    if ( transferFamilyIndex == -1 )
+        transferFamilyIndex = graphicsFamilyIndex;
+
     m_index = graphicsFamilyIndex;
+    m_transferIndex = transferFamilyIndex;
 
     /*
         Queue Families for the RTX 3080:
@@ -81,14 +110,27 @@ void Device::create( std::string name,
     */
 
     //Request for 1 queue from the graphics queue family
+    //and 1 from the transfer family, if it's a different one
+    //Uploads and readbacks go on the transfer queue, overlapping rendering
 
     float priority = 1.0f;
-    auto queueCreateInfo = vk::DeviceQueueCreateInfo(
+    std::vector<vk::DeviceQueueCreateInfo> queueCreateInfos;
+
+    queueCreateInfos.push_back( vk::DeviceQueueCreateInfo(
         vk::DeviceQueueCreateFlags(),
-        static_cast<uint32_t>( graphicsFamilyIndex ), 1, &priority );
+        static_cast<uint32_t>( graphicsFamilyIndex ), 1, &priority ) );
 
-    auto createInfo =
-        vk::DeviceCreateInfo( vk::DeviceCreateFlags(), 1, &queueCreateInfo );
+    if ( transferFamilyIndex != graphicsFamilyIndex )
+    {
+        queueCreateInfos.push_back( vk::DeviceQueueCreateInfo(
+            vk::DeviceQueueCreateFlags(),
+            static_cast<uint32_t>( transferFamilyIndex ), 1, &priority ) );
+    }
+
+    auto createInfo = vk::DeviceCreateInfo(
+        vk::DeviceCreateFlags(),
+        static_cast<uint32_t>( queueCreateInfos.size() ),
+        queueCreateInfos.data() );
 
     // enable vulkan 1.3
     vk::PhysicalDeviceVulkan12Features vkFeatures;
@@ -98,10 +140,19 @@ void Device::create( std::string name,
     // enable RT
     vk::PhysicalDeviceRayTracingPipelineFeaturesKHR rtFeatures;
     rtFeatures.rayTracingPipeline = true;
+    rtFeatures.rayTracingPipelineTraceRaysIndirect = true;
 
     // enable Acceleration Structures
+    // and host builds, when the driver has them
+    auto supported = m_physicalDevice.getFeatures2<
+        vk::PhysicalDeviceFeatures2,
+        vk::PhysicalDeviceAccelerationStructureFeaturesKHR>();
+
     vk::PhysicalDeviceAccelerationStructureFeaturesKHR accelFeatures;
     accelFeatures.accelerationStructure = true;
+    accelFeatures.accelerationStructureHostCommands =
+        supported.get<vk::PhysicalDeviceAccelerationStructureFeaturesKHR>()
+            .accelerationStructureHostCommands;
 
     //Chain the requests
     createInfo.pNext = &vkFeatures;
@@ -128,6 +179,7 @@ void Device::create( std::string name,
     }
 
     m_graphicsQueue = m_logicalDevice->getQueue( graphicsFamilyIndex, 0 );
+    m_transferQueue = m_logicalDevice->getQueue( transferFamilyIndex, 0 );
 
     auto properties = m_physicalDevice.getProperties();
 
@@ -158,6 +210,9 @@ void Device::create( std::string name,
 
         printf( "\tPresentation Support: %d\n\n", presentSupport );
     }
+    printf( "Graphics Queue Family: %d\n", graphicsFamilyIndex );
+    printf( "Transfer Queue Family: %d\n", transferFamilyIndex );
+
     printf( "\nDevice Extensions:\n" );
     for ( auto extension : deviceExtensions )
         printf( "\t%s\n", extension );
@@ -24,5 +24,9 @@ class Device
     vk::UniqueDevice m_logicalDevice;
     vk::Queue m_graphicsQueue;
     int m_index;
+
+    //transfer-only family if there is one, otherwise same as graphics
+    vk::Queue m_transferQueue;
+    int m_transferIndex;
 };
 }  // namespace BR
@@ -2,14 +2,17 @@
 #include <BRMemoryMgr.h>
 #include <BRUtil.h>
 
+#include <algorithm>
 #include <cassert>
 
 using namespace BR;
 
-// This creates one vk::DeviceMemory per vk::Buffer
-// In production, this won't work, because of limit on number of vk::DeviceMemory
-// I may implement suballcation/memory chunks later, or use the AMD VMA library
-// For this educational renderer, the current strategy should work fine
+// Sub-allocates resources from large vk::DeviceMemory blocks
+// Blocks are split up by a TLSF allocator (BRBlockAllocator)
+// Huge resources, or ones the driver prefers, still get their own memory
+
+// Size of one block, smaller heaps use an eighth of the heap
+const vk::DeviceSize BLOCK_SIZE = 256ull * 1024 * 1024;
 
 // Finds suitable memory for the vertex buffer
 uint32_t findMemoryType( uint32_t typeFilter,
@@ -33,106 +36,106 @@ uint32_t findMemoryType( uint32_t typeFilter,
     return -1;
 }
 
+bool hasMemoryType( uint32_t typeFilter, vk::MemoryPropertyFlags properties,
+                    const vk::PhysicalDeviceMemoryProperties& memProperties )
+{
+    for ( uint32_t i = 0; i < memProperties.memoryTypeCount; i++ )
+    {
+        if ( ( typeFilter & ( 1 << i ) ) &&
+             ( memProperties.memoryTypes[i].propertyFlags & properties ) ==
+                 properties )
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
 MemoryMgr::MemoryMgr() : m_device( nullptr )
 {
 }
 
 MemoryMgr::~MemoryMgr()
 {
-    assert( m_alloc.empty() );
+    assert( m_alloc.empty() && m_pools.empty() && m_aliasGroups.empty() );
+}
+
+void MemoryMgr::init()
+{
+    m_device = AppState::instance().getLogicalDevice();
+    m_memProperties =
+        AppState::instance().getPhysicalDevice().getMemoryProperties();
+    m_copyPool.create( "Buffer Copy Pool",
+                       vk::CommandPoolCreateFlagBits::eTransient );
+    m_uploader.create();
 }
 
 vk::Buffer MemoryMgr::createDeviceBuffer( std::string name,
-                                                vk::DeviceSize size,
-                                                void* srcData, bool hostVisible,
-                                                vk::BufferUsageFlags type )
+                                          vk::DeviceSize size,
+                                          const void* srcData,
+                                          bool hostVisible,
+                                          vk::BufferUsageFlags type )
 {
     assert( size > 0 );
 
-    std::pair<vk::Buffer, vk::DeviceMemory> final;
+    vk::Buffer resultBuffer = nullptr;
 
     //Buffer Creation
 
     // host visible/host coherent
     if ( hostVisible )
     {
-        final = createBuffer( size, type,
-                              vk::MemoryPropertyFlagBits::eHostVisible |
-                                  vk::MemoryPropertyFlagBits::eHostCoherent );
+        resultBuffer = createBuffer(
+            name, size, type,
+            vk::MemoryPropertyFlagBits::eHostVisible |
+                vk::MemoryPropertyFlagBits::eHostCoherent );
     }
     // device local, transfer destination
     else if ( !hostVisible && srcData != nullptr )
     {
-        final =
-            createBuffer( size, vk::BufferUsageFlagBits::eTransferDst | type,
+        resultBuffer =
+            createBuffer( name, size, vk::BufferUsageFlagBits::eTransferDst | type,
                           vk::MemoryPropertyFlagBits::eDeviceLocal );
     }
     // device local
     else
     {
-        final = createBuffer( size, type,
-                              vk::MemoryPropertyFlagBits::eDeviceLocal );
+        resultBuffer = createBuffer( name, size, type,
+                                     vk::MemoryPropertyFlagBits::eDeviceLocal );
     }
 
-    auto resultBuffer = final.first;
-    auto resultMem = final.second;
-
-    m_alloc[resultBuffer] = resultMem;
-
-    DEBUG_NAME( resultMem, "mem " + name );
-    DEBUG_NAME( resultBuffer, "buffer " + name );
-
     // Copying Data
     if ( srcData != nullptr )
     {
-        // Regular memcpy
+        // Regular memcpy, the memory is already mapped
         if ( hostVisible )
         {
-            void* dst = m_device.mapMemory( resultMem, 0, size );
-            memcpy( dst, srcData, size );
-            m_device.unmapMemory( resultMem );
+            memcpy( getMapping( resultBuffer ), srcData, size );
         }
-        // Stage and copy
+        // Stage in the upload ring, copied with the next batch
         else
         {
-            auto stage =
-                createBuffer( size, vk::BufferUsageFlagBits::eTransferSrc,
-                              vk::MemoryPropertyFlagBits::eHostVisible |
-                                  vk::MemoryPropertyFlagBits::eHostCoherent );
-
-            auto stageMem = stage.second;
-            auto stageBuffer = stage.first;
-
-            DEBUG_NAME( stageMem, "stageMem " + name );
-            DEBUG_NAME( stageBuffer, "stageBuffer " + name );
-
-            void* data = m_device.mapMemory( stageMem, 0, size );
-            memcpy( data, srcData, (size_t)size );
-            m_device.unmapMemory( stageMem );
-
-            copyBuffer( stageBuffer, resultBuffer, size );
-
-            m_device.destroyBuffer( stageBuffer );
-            m_device.freeMemory( stageMem );
+            m_uploader.upload( resultBuffer, 0, srcData, size );
         }
     }
 
     return resultBuffer;
 }
 
-std::pair<vk::Buffer, vk::DeviceMemory> MemoryMgr::createBuffer(
-    vk::DeviceSize size, vk::BufferUsageFlags usage,
-    vk::MemoryPropertyFlags properties )
+vk::Buffer MemoryMgr::createBuffer( std::string name, vk::DeviceSize size,
+                                    vk::BufferUsageFlags usage,
+                                    vk::MemoryPropertyFlags properties )
 {
     if ( !m_device )
-    {
-        m_device = AppState::instance().getLogicalDevice();
-        m_copyPool.create( "Buffer Copy Pool",
-                           vk::CommandPoolCreateFlagBits::eTransient );
-    }
+        init();
+
+    // device local buffers can be moved by defragment(), which copies them
+    if ( !( properties & vk::MemoryPropertyFlagBits::eHostVisible ) )
+        usage |= vk::BufferUsageFlagBits::eTransferSrc |
+                 vk::BufferUsageFlagBits::eTransferDst;
 
     vk::Buffer buffer = nullptr;
-    vk::DeviceMemory mem = nullptr;
 
     vk::BufferCreateInfo bufferInfo{};
     bufferInfo.size = size;
@@ -148,18 +151,151 @@ std::pair<vk::Buffer, vk::DeviceMemory> MemoryMgr::createBuffer(
         throw std::runtime_error( "failed to create vertex buffer!" );
     }
 
-    vk::MemoryRequirements memRequirements =
-        m_device.getBufferMemoryRequirements( buffer );
+    auto alloc = allocate( name, buffer, properties, false );
+    alloc.bufferInfo = bufferInfo;
+
+    m_device.bindBufferMemory( buffer, alloc.memory, alloc.offset );
+
+    m_alloc[buffer] = alloc;
+
+    DEBUG_NAME( buffer, "buffer " + name );
+
+    // if we want the address, save it
+    if ( ( usage & vk::BufferUsageFlagBits::eShaderDeviceAddress ) ==
+         vk::BufferUsageFlagBits::eShaderDeviceAddress )
+    {
+        auto address = getBufferDeviceAddress( buffer );
+        m_addresses[buffer] = address;
+    }
+
+    return buffer;
+}
+
+MemoryMgr::Allocation MemoryMgr::allocate(
+    std::string name, std::variant<vk::Buffer, vk::Image> object,
+    vk::MemoryPropertyFlags properties, bool optimalImage )
+{
+    vk::MemoryRequirements memRequirements;
+    bool preferDedicated = false;
+
+    if ( std::holds_alternative<vk::Buffer>( object ) )
+    {
+        vk::BufferMemoryRequirementsInfo2 info( std::get<vk::Buffer>( object ) );
+        auto chain = m_device.getBufferMemoryRequirements2<
+            vk::MemoryRequirements2, vk::MemoryDedicatedRequirements>( info );
+
+        memRequirements =
+            chain.get<vk::MemoryRequirements2>().memoryRequirements;
+        auto& dedicated = chain.get<vk::MemoryDedicatedRequirements>();
+        preferDedicated = dedicated.prefersDedicatedAllocation ||
+                          dedicated.requiresDedicatedAllocation;
+    }
+    else
+    {
+        vk::ImageMemoryRequirementsInfo2 info( std::get<vk::Image>( object ) );
+        auto chain = m_device.getImageMemoryRequirements2<
+            vk::MemoryRequirements2, vk::MemoryDedicatedRequirements>( info );
+
+        memRequirements =
+            chain.get<vk::MemoryRequirements2>().memoryRequirements;
+        auto& dedicated = chain.get<vk::MemoryDedicatedRequirements>();
+        preferDedicated = dedicated.prefersDedicatedAllocation ||
+                          dedicated.requiresDedicatedAllocation;
+    }
+
+    // lazily allocated memory is only a wish, not every device or resource
+    // can have it
+    bool lazy =
+        bool( properties & vk::MemoryPropertyFlagBits::eLazilyAllocated );
+
+    if ( lazy && !hasMemoryType( memRequirements.memoryTypeBits, properties,
+                                 m_memProperties ) )
+    {
+        properties = vk::MemoryPropertyFlagBits::eDeviceLocal;
+        lazy = false;
+    }
+
+    uint32_t memoryType =
+        findMemoryType( memRequirements.memoryTypeBits, properties,
+                        AppState::instance().getPhysicalDevice() );
+
+    auto blockSize = getBlockSize( memoryType );
+
+    // big resources would waste most of a block, give them their own memory
+    // lazy memory has no backing to share
+    if ( preferDedicated || lazy || memRequirements.size > blockSize / 2 )
+    {
+        auto alloc =
+            allocateDedicated( name, object, memRequirements, memoryType );
+        alloc.optimalImage = optimalImage;
+        return alloc;
+    }
+
+    auto& pool = m_pools[{ memoryType, optimalImage }];
+
+    MemoryBlock* block = nullptr;
+    uint64_t offset = 0;
+
+    for ( auto& candidate : pool )
+    {
+        if ( candidate->allocator.allocate(
+                 memRequirements.size, memRequirements.alignment, offset ) )
+        {
+            block = candidate.get();
+            break;
+        }
+    }
+
+    // every block is full, make a new one
+    if ( !block )
+    {
+        pool.emplace_back( createBlock( memoryType, blockSize ) );
+        block = pool.back().get();
 
+        bool result = block->allocator.allocate(
+            memRequirements.size, memRequirements.alignment, offset );
+        assert( result );
+    }
+
+    Allocation alloc{};
+    alloc.memory = block->memory;
+    alloc.offset = offset;
+    alloc.size = memRequirements.size;
+    alloc.alignment = memRequirements.alignment;
+    alloc.memoryType = memoryType;
+    alloc.optimalImage = optimalImage;
+    alloc.block = block;
+    alloc.mapped =
+        block->mapped ? static_cast<char*>( block->mapped ) + offset : nullptr;
+    alloc.name = name;
+
+    return alloc;
+}
+
+MemoryMgr::Allocation MemoryMgr::allocateDedicated(
+    std::string name, std::variant<vk::Buffer, vk::Image> object,
+    vk::MemoryRequirements memRequirements, uint32_t memoryType )
+{
+    vk::MemoryDedicatedAllocateInfo dedicatedInfo;
     vk::MemoryAllocateFlagsInfo allocFlags;
-    allocFlags.flags = vk::MemoryAllocateFlagBits::eDeviceAddress;
+
+    if ( std::holds_alternative<vk::Buffer>( object ) )
+    {
+        dedicatedInfo.buffer = std::get<vk::Buffer>( object );
+        allocFlags.flags = vk::MemoryAllocateFlagBits::eDeviceAddress;
+        dedicatedInfo.pNext = &allocFlags;
+    }
+    else
+    {
+        dedicatedInfo.image = std::get<vk::Image>( object );
+    }
 
     vk::MemoryAllocateInfo allocInfo{};
     allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex =
-        findMemoryType( memRequirements.memoryTypeBits, properties,
-                        AppState::instance().getPhysicalDevice() );
-    allocInfo.pNext = &allocFlags;
+    allocInfo.memoryTypeIndex = memoryType;
+    allocInfo.pNext = &dedicatedInfo;
+
+    vk::DeviceMemory mem = nullptr;
 
     try
     {
@@ -167,56 +303,125 @@ std::pair<vk::Buffer, vk::DeviceMemory> MemoryMgr::createBuffer(
     }
     catch ( vk::SystemError err )
     {
-        throw std::runtime_error( "failed to allocate vertex buffer memory!" );
+        throw std::runtime_error( "failed to allocate dedicated memory!" );
     }
 
-    m_device.bindBufferMemory( buffer, mem, 0 );
+    DEBUG_NAME( mem, "mem " + name );
 
-    // if we want the address, save it
-    if ( ( usage & vk::BufferUsageFlagBits::eShaderDeviceAddress ) ==
-         vk::BufferUsageFlagBits::eShaderDeviceAddress )
+    Allocation alloc{};
+    alloc.memory = mem;
+    alloc.offset = 0;
+    alloc.size = memRequirements.size;
+    alloc.alignment = memRequirements.alignment;
+    alloc.memoryType = memoryType;
+    alloc.block = nullptr;
+    alloc.mapped = nullptr;
+    alloc.name = name;
+
+    if ( m_memProperties.memoryTypes[memoryType].propertyFlags &
+         vk::MemoryPropertyFlagBits::eHostVisible )
+        alloc.mapped = m_device.mapMemory( mem, 0, VK_WHOLE_SIZE );
+
+    return alloc;
+}
+
+MemoryMgr::MemoryBlock* MemoryMgr::createBlock( uint32_t memoryType,
+                                                vk::DeviceSize size )
+{
+    // any buffer may end up in this block, so it must support device addresses
+    vk::MemoryAllocateFlagsInfo allocFlags;
+    allocFlags.flags = vk::MemoryAllocateFlagBits::eDeviceAddress;
+
+    vk::MemoryAllocateInfo allocInfo{};
+    allocInfo.allocationSize = size;
+    allocInfo.memoryTypeIndex = memoryType;
+    allocInfo.pNext = &allocFlags;
+
+    vk::DeviceMemory mem = nullptr;
+
+    try
     {
-        auto address = getBufferDeviceAddress( buffer );
-        m_addresses[buffer] = address;
+        mem = m_device.allocateMemory( allocInfo );
     }
+    catch ( vk::SystemError err )
+    {
+        throw std::runtime_error( "failed to allocate memory block!" );
+    }
+
+    DEBUG_NAME( mem, "mem block, type " + std::to_string( memoryType ) );
 
-    return std::make_pair( buffer, mem );
+    // host visible blocks stay mapped for their whole lifetime
+    void* mapped = nullptr;
+    if ( m_memProperties.memoryTypes[memoryType].propertyFlags &
+         vk::MemoryPropertyFlagBits::eHostVisible )
+        mapped = m_device.mapMemory( mem, 0, VK_WHOLE_SIZE );
+
+    return new MemoryBlock( mem, size, mapped );
 }
 
-void MemoryMgr::copyBuffer( vk::Buffer srcBuffer, vk::Buffer dstBuffer,
-                                  vk::DeviceSize size )
+void MemoryMgr::releaseAllocation( Allocation& alloc )
 {
-    auto familyIndex = AppState::instance().getFamilyIndex();
-    auto queue = AppState::instance().getGraphicsQueue();
+    if ( !alloc.aliasGroup.empty() )
+    {
+        auto it = m_aliasGroups.find( alloc.aliasGroup );
+        assert( it != m_aliasGroups.end() );
+
+        it->second.live -= alloc.size;
+
+        // the last member is gone, the memory goes with it
+        if ( --it->second.members == 0 )
+        {
+            m_device.freeMemory( it->second.memory );
+            m_aliasGroups.erase( it );
+        }
+
+        return;
+    }
+
+    if ( !alloc.block )
+    {
+        m_device.freeMemory( alloc.memory );
+        return;
+    }
 
-    auto copyBuffer = m_copyPool.createBuffer( "Buffer copy buffer" );
+    alloc.block->allocator.free( alloc.offset );
 
-    vk::CommandBufferBeginInfo beginInfo;
-    beginInfo.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+    // keep one empty block around per pool, so we don't thrash the driver
+    auto& pool = m_pools[{ alloc.memoryType, alloc.optimalImage }];
 
-    copyBuffer.begin( beginInfo );
-    vk::BufferCopy copyRegion( 0, 0, size );
-    copyBuffer.copyBuffer( srcBuffer, dstBuffer, copyRegion );
-    copyBuffer.end();
+    if ( alloc.block->allocator.isEmpty() && pool.size() > 1 )
+    {
+        auto it = std::find_if( pool.begin(), pool.end(),
+                                [&]( auto& block )
+                                { return block.get() == alloc.block; } );
+        assert( it != pool.end() );
 
-    vk::SubmitInfo submitInfo;
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &copyBuffer;
+        m_device.freeMemory( ( *it )->memory );
+        pool.erase( it );
+    }
+}
 
-    queue.submit( submitInfo );
-    queue.waitIdle();
+vk::DeviceSize MemoryMgr::getBlockSize( uint32_t memoryType )
+{
+    auto heapIndex = m_memProperties.memoryTypes[memoryType].heapIndex;
+    auto heapSize = m_memProperties.memoryHeaps[heapIndex].size;
 
-    m_copyPool.freeBuffer( copyBuffer );
+    return std::min( BLOCK_SIZE, heapSize / 8 );
 }
 
 void MemoryMgr::updateVisibleBuffer( vk::Buffer buff, vk::DeviceSize size,
                                            void* data )
 {
-    auto mem = getMemory( buff );
+    memcpy( getMapping( buff ), data, size );
+}
+
+void* MemoryMgr::getMapping( std::variant<vk::Buffer, vk::Image> buffer )
+{
+    auto it = m_alloc.find( buffer );
 
-    void* dst = m_device.mapMemory( mem, 0, size );
-    memcpy( dst, data, size );
-    m_device.unmapMemory( mem );
+    assert( it != m_alloc.end() && it->second.mapped );
+
+    return it->second.mapped;
 }
 
 vk::DeviceMemory MemoryMgr::getMemory(
@@ -226,7 +431,17 @@ vk::DeviceMemory MemoryMgr::getMemory(
 
     assert( it != m_alloc.end() );
 
-    return it->second;
+    return it->second.memory;
+}
+
+vk::DeviceSize MemoryMgr::getMemoryOffset(
+    std::variant<vk::Buffer, vk::Image> buffer )
+{
+    auto it = m_alloc.find( buffer );
+
+    assert( it != m_alloc.end() );
+
+    return it->second.offset;
 }
 
 vk::Image MemoryMgr::createImage( std::string name, uint32_t width,
@@ -236,14 +451,9 @@ vk::Image MemoryMgr::createImage( std::string name, uint32_t width,
                                         vk::MemoryPropertyFlags memFlags )
 {
     if ( !m_device )
-    {
-        m_device = AppState::instance().getLogicalDevice();
-        m_copyPool.create( "Buffer Copy Pool",
-                           vk::CommandPoolCreateFlagBits::eTransient );
-    }
+        init();
 
     vk::Image image = nullptr;
-    vk::DeviceMemory mem = nullptr;
 
     vk::ImageCreateInfo imageInfo;
     imageInfo.imageType = vk::ImageType::e2D;
@@ -268,31 +478,151 @@ vk::Image MemoryMgr::createImage( std::string name, uint32_t width,
         throw std::runtime_error( "failed to create image!" );
     }
 
-    vk::MemoryRequirements memRequirements =
-        m_device.getImageMemoryRequirements( image );
+    // optimal images go in their own pools, away from linear resources
+    auto alloc = allocate( name, image, memFlags,
+                           tiling == vk::ImageTiling::eOptimal );
 
-    vk::MemoryAllocateInfo allocInfo{};
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex =
-        findMemoryType( memRequirements.memoryTypeBits, memFlags,
-                        AppState::instance().getPhysicalDevice() );
+    m_device.bindImageMemory( image, alloc.memory, alloc.offset );
+
+    m_alloc[image] = alloc;
+
+    DEBUG_NAME( image, name );
+
+    return image;
+}
+
+vk::Image MemoryMgr::createTransientAttachment( std::string name,
+                                                uint32_t width,
+                                                uint32_t height,
+                                                vk::Format format,
+                                                vk::ImageUsageFlags usage )
+{
+    // falls back to device local memory in allocate()
+    return createImage( name, width, height, format, vk::ImageTiling::eOptimal,
+                        usage | vk::ImageUsageFlagBits::eTransientAttachment,
+                        vk::MemoryPropertyFlagBits::eDeviceLocal |
+                            vk::MemoryPropertyFlagBits::eLazilyAllocated );
+}
+
+vk::Buffer MemoryMgr::createAliasedBuffer( std::string name,
+                                           std::string group,
+                                           vk::DeviceSize size,
+                                           vk::BufferUsageFlags usage )
+{
+    if ( !m_device )
+        init();
+
+    assert( size > 0 );
+
+    vk::BufferCreateInfo bufferInfo{};
+    bufferInfo.size = size;
+    bufferInfo.usage = usage;
+    bufferInfo.sharingMode = vk::SharingMode::eExclusive;
+
+    vk::Buffer buffer = nullptr;
 
     try
     {
-        mem = m_device.allocateMemory( allocInfo );
+        buffer = m_device.createBuffer( bufferInfo, nullptr );
     }
     catch ( vk::SystemError err )
     {
-        throw std::runtime_error( "failed to allocate image buffer memory!" );
+        throw std::runtime_error( "failed to create aliased buffer!" );
     }
 
-    m_device.bindImageMemory( image, mem, 0 );
+    auto memRequirements = m_device.getBufferMemoryRequirements( buffer );
 
-    m_alloc[image] = mem;
+    auto it = m_aliasGroups.find( group );
 
-    DEBUG_NAME( image, name );
+    // too big for the group's memory, or the wrong kind
+    if ( it != m_aliasGroups.end() &&
+         ( memRequirements.size > it->second.size ||
+           !( memRequirements.memoryTypeBits &
+              ( 1 << it->second.memoryType ) ) ) )
+    {
+        printf( "\n%s doesn't fit alias group %s, not aliased\n",
+                name.c_str(), group.c_str() );
 
-    return image;
+        m_device.destroyBuffer( buffer );
+
+        return createBuffer( name, size, usage,
+                             vk::MemoryPropertyFlagBits::eDeviceLocal );
+    }
+
+    // the first member sizes the memory
+    if ( it == m_aliasGroups.end() )
+    {
+        uint32_t memoryType =
+            findMemoryType( memRequirements.memoryTypeBits,
+                            vk::MemoryPropertyFlagBits::eDeviceLocal,
+                            AppState::instance().getPhysicalDevice() );
+
+        vk::MemoryAllocateFlagsInfo allocFlags;
+        allocFlags.flags = vk::MemoryAllocateFlagBits::eDeviceAddress;
+
+        vk::MemoryAllocateInfo allocInfo{};
+        allocInfo.allocationSize = memRequirements.size;
+        allocInfo.memoryTypeIndex = memoryType;
+        allocInfo.pNext = &allocFlags;
+
+        vk::DeviceMemory mem = nullptr;
+
+        try
+        {
+            mem = m_device.allocateMemory( allocInfo );
+        }
+        catch ( vk::SystemError err )
+        {
+            throw std::runtime_error( "failed to allocate alias memory!" );
+        }
+
+        DEBUG_NAME( mem, "mem alias group " + group );
+
+        it = m_aliasGroups
+                 .emplace( group, AliasGroup{ mem, memRequirements.size,
+                                              memoryType, 0, 0 } )
+                 .first;
+    }
+
+    auto& aliasGroup = it->second;
+
+    aliasGroup.members++;
+    aliasGroup.live += memRequirements.size;
+
+    auto& stats = m_aliasStats[group];
+    stats.peakSeparate = std::max( stats.peakSeparate, aliasGroup.live );
+    stats.peakShared = std::max( stats.peakShared, aliasGroup.size );
+
+    Allocation alloc{};
+    alloc.memory = aliasGroup.memory;
+    alloc.offset = 0;
+    alloc.size = memRequirements.size;
+    alloc.alignment = memRequirements.alignment;
+    alloc.memoryType = aliasGroup.memoryType;
+    alloc.block = nullptr;
+    alloc.mapped = nullptr;
+    alloc.name = name;
+    alloc.bufferInfo = bufferInfo;
+    alloc.aliasGroup = group;
+
+    m_device.bindBufferMemory( buffer, alloc.memory, alloc.offset );
+
+    m_alloc[buffer] = alloc;
+
+    DEBUG_NAME( buffer, "buffer " + name );
+
+    if ( ( usage & vk::BufferUsageFlagBits::eShaderDeviceAddress ) ==
+         vk::BufferUsageFlagBits::eShaderDeviceAddress )
+        m_addresses[buffer] = getBufferDeviceAddress( buffer );
+
+    return buffer;
+}
+
+vk::DeviceSize MemoryMgr::getAliasCapacity( const std::string& group )
+{
+    auto it = m_aliasGroups.find( group );
+
+    return it != m_aliasGroups.end() ? it->second.size : 0;
 }
 
 vk::ImageView MemoryMgr::createImageView(
@@ -350,7 +680,6 @@ void MemoryMgr::free( std::variant<vk::Buffer, vk::Image> buffer )
     assert( it != m_alloc.end() );
 
     auto obj = it->first;
-    auto mem = it->second;
 
     if ( std::holds_alternative<vk::Buffer>( obj ) )
         m_device.destroyBuffer( std::get<vk::Buffer>( obj ) );
@@ -367,7 +696,7 @@ void MemoryMgr::free( std::variant<vk::Buffer, vk::Image> buffer )
         m_imageViews.erase( image );
     }
 
-    m_device.freeMemory( mem );
+    releaseAllocation( it->second );
 
     m_alloc.erase( it );
 
@@ -380,13 +709,214 @@ void MemoryMgr::free( std::variant<vk::Buffer, vk::Image> buffer )
     }
 }
 
-void MemoryMgr::destroy()
+std::map<vk::Buffer, vk::Buffer> MemoryMgr::defragment()
+{
+    std::map<vk::Buffer, vk::Buffer> moved;
+
+    if ( !m_device )
+        return moved;
+
+    auto cmdBuff = m_copyPool.beginOneTimeSubmit( "Defragment Command Buffer" );
+
+    for ( auto& [key, pool] : m_pools )
+    {
+        // images can't be re-created here, and one block can't be compacted
+        if ( key.second || pool.size() < 2 )
+            continue;
+
+        // evacuate the emptiest block
+        auto victim =
+            std::min_element( pool.begin(), pool.end(),
+                              []( auto& a, auto& b ) {
+                                  return a->allocator.getUsed() <
+                                         b->allocator.getUsed();
+                              } )
+                ->get();
+
+        // mapped pointers handed out by getMapping() would go stale
+        if ( victim->mapped )
+            continue;
+
+        // linear images share the buffers' pools but can't be moved either
+        std::vector<vk::Buffer> buffers;
+        bool movable = true;
+        for ( auto& [obj, alloc] : m_alloc )
+        {
+            if ( alloc.block != victim )
+                continue;
+
+            if ( !std::holds_alternative<vk::Buffer>( obj ) )
+            {
+                movable = false;
+                break;
+            }
+
+            buffers.push_back( std::get<vk::Buffer>( obj ) );
+        }
+
+        if ( !movable )
+            continue;
+
+        // find a new home for every buffer, or leave the block alone
+        std::vector<std::pair<MemoryBlock*, uint64_t> > placements;
+
+        for ( auto buffer : buffers )
+        {
+            auto& alloc = m_alloc[buffer];
+            bool placed = false;
+
+            for ( auto& block : pool )
+            {
+                uint64_t offset;
+
+                if ( block.get() != victim &&
+                     block->allocator.allocate( alloc.size, alloc.alignment,
+                                                offset ) )
+                {
+                    placements.emplace_back( block.get(), offset );
+                    placed = true;
+                    break;
+                }
+            }
+
+            if ( !placed )
+                break;
+        }
+
+        if ( placements.size() != buffers.size() )
+        {
+            for ( auto& placement : placements )
+                placement.first->allocator.free( placement.second );
+            continue;
+        }
+
+        // re-create each buffer in its new place and copy the contents over
+        for ( size_t i = 0; i < buffers.size(); ++i )
+        {
+            auto oldBuffer = buffers[i];
+            auto oldAlloc = m_alloc[oldBuffer];
+            auto [block, offset] = placements[i];
+
+            vk::Buffer newBuffer = m_device.createBuffer( oldAlloc.bufferInfo );
+
+            Allocation newAlloc = oldAlloc;
+            newAlloc.block = block;
+            newAlloc.offset = offset;
+            newAlloc.memory = block->memory;
+
+            m_device.bindBufferMemory( newBuffer, newAlloc.memory,
+                                       newAlloc.offset );
+
+            cmdBuff.copyBuffer(
+                oldBuffer, newBuffer,
+                vk::BufferCopy( 0, 0, oldAlloc.bufferInfo.size ) );
+
+            m_alloc[newBuffer] = newAlloc;
+
+            if ( m_addresses.count( oldBuffer ) )
+                m_addresses[newBuffer] = getBufferDeviceAddress( newBuffer );
+
+            DEBUG_NAME( newBuffer, "buffer " + newAlloc.name );
+
+            moved[oldBuffer] = newBuffer;
+        }
+    }
+
+    m_copyPool.endOneTimeSubmit( cmdBuff );
+
+    // the copies are done, the old buffers can go, which empties their blocks
+    for ( auto& [oldBuffer, newBuffer] : moved )
+        free( oldBuffer );
+
+    printf( "\nDefragmented memory, moved %zu buffers\n", moved.size() );
+
+    return moved;
+}
+
+void MemoryMgr::printStats()
 {
-    for ( auto alloc : m_alloc )
+    size_t blocks = 0;
+    size_t dedicated = 0;
+    vk::DeviceSize dedicatedBytes = 0;
+
+    printf( "\nMemory pools:\n" );
+
+    for ( auto& [key, pool] : m_pools )
+    {
+        vk::DeviceSize used = 0;
+        vk::DeviceSize size = 0;
+
+        for ( auto& block : pool )
+        {
+            used += block->allocator.getUsed();
+            size += block->allocator.getSize();
+        }
+
+        blocks += pool.size();
+
+        printf( "\tType %u%s: %zu blocks, %llu/%llu MB used\n", key.first,
+                key.second ? " (images)" : "", pool.size(),
+                used / ( 1024 * 1024 ), size / ( 1024 * 1024 ) );
+    }
+
+    size_t lazy = 0;
+    vk::DeviceSize lazyBytes = 0;
+
+    for ( auto& [obj, alloc] : m_alloc )
+    {
+        if ( !alloc.block && alloc.aliasGroup.empty() )
+        {
+            dedicated++;
+            dedicatedBytes += alloc.size;
+        }
+
+        if ( m_memProperties.memoryTypes[alloc.memoryType].propertyFlags &
+             vk::MemoryPropertyFlagBits::eLazilyAllocated )
+        {
+            lazy++;
+            lazyBytes += alloc.size;
+        }
+    }
+
+    printf( "\tDedicated: %zu allocations, %llu MB\n", dedicated,
+            dedicatedBytes / ( 1024 * 1024 ) );
+    printf( "\tLazily allocated: %zu attachments, %llu MB not backed\n",
+            lazy, lazyBytes / ( 1024 * 1024 ) );
+
+    // peak of the members on their own vs the shared memory
+    vk::DeviceSize saved = 0;
+
+    for ( auto& [group, stats] : m_aliasStats )
     {
-        auto obj = alloc.first;
-        auto mem = alloc.second;
+        auto groupSaved = stats.peakSeparate > stats.peakShared
+                              ? stats.peakSeparate - stats.peakShared
+                              : 0;
+        saved += groupSaved;
+
+        printf( "\tAlias group %s: peak %.1f MB in %.1f MB, saved %.1f MB\n",
+                group.c_str(), stats.peakSeparate / ( 1024.0 * 1024.0 ),
+                stats.peakShared / ( 1024.0 * 1024.0 ),
+                groupSaved / ( 1024.0 * 1024.0 ) );
+    }
+
+    printf( "\tTransient memory saved: %.1f MB\n",
+            ( saved + lazyBytes ) / ( 1024.0 * 1024.0 ) );
+    printf( "\tvk::DeviceMemory objects: %zu\n",
+            blocks + dedicated + m_aliasGroups.size() );
+}
+
+Uploader& MemoryMgr::getUploader()
+{
+    return m_uploader;
+}
 
+void MemoryMgr::destroy()
+{
+    if ( m_device )
+        m_uploader.destroy();
+
+    for ( auto& [obj, alloc] : m_alloc )
+    {
         if ( std::holds_alternative<vk::Buffer>( obj ) )
             m_device.destroyBuffer( std::get<vk::Buffer>( obj ) );
 
@@ -400,11 +930,23 @@ void MemoryMgr::destroy()
             m_device.destroyImage( image );
         }
 
-        m_device.freeMemory( mem );
+        if ( !alloc.block && alloc.aliasGroup.empty() )
+            m_device.freeMemory( alloc.memory );
     }
 
+    for ( auto& [key, pool] : m_pools )
+    {
+        for ( auto& block : pool )
+            m_device.freeMemory( block->memory );
+    }
+
+    for ( auto& [name, group] : m_aliasGroups )
+        m_device.freeMemory( group.memory );
+
     m_copyPool.destroy();
 
     m_alloc.clear();
+    m_pools.clear();
     m_imageViews.clear();
+    m_aliasGroups.clear();
 }
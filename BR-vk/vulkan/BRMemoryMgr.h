@@ -1,12 +1,15 @@
 #pragma once
 
+#include <BRBlockAllocator.h>
 #include <BRCommandPool.h>
 #include <BRDevice.h>
 #include <BRPipeline.h>
+#include <BRUploader.h>
 #include <BRUtil.h>
 
 #include <any>
 #include <map>
+#include <memory>
 #include <variant>
 #include <vector>
 #include <vulkan/vulkan_handles.hpp>
@@ -19,8 +22,11 @@ class MemoryMgr
 
    public:
 
+    //Device local buffers with srcData are uploaded in batches
+    //The copy is queued, use getUploader() to flush/wait if needed
     vk::Buffer createDeviceBuffer(
-        std::string name, vk::DeviceSize size, void* srcData, bool hostVisible,
+        std::string name, vk::DeviceSize size, const void* srcData,
+        bool hostVisible,
         vk::BufferUsageFlags type = static_cast<vk::BufferUsageFlags>( 0 ) );
 
     //Update a device buffer ( memcpy data in )
@@ -33,15 +39,54 @@ class MemoryMgr
                            vk::ImageUsageFlags usage,
                            vk::MemoryPropertyFlags memFlags );
 
+    //Depth and other attachments that never leave a render pass ( cleared
+    //or don't care on load, don't care on store )
+    //They get lazily allocated memory where the device has it - tilers keep
+    //them in tile memory, with no backing. Plain device local otherwise
+    vk::Image createTransientAttachment( std::string name, uint32_t width,
+                                         uint32_t height, vk::Format format,
+                                         vk::ImageUsageFlags usage );
+
+    //Device local buffer in an alias group - the members share one piece of
+    //memory, made for the first member and freed with the last one
+    //Their lifetimes must not overlap: using a member clobbers the contents
+    //of the others. A member that doesn't fit the memory gets its own
+    vk::Buffer createAliasedBuffer( std::string name, std::string group,
+                                    vk::DeviceSize size,
+                                    vk::BufferUsageFlags usage );
+
+    //bytes of the group's memory, 0 if it has no members
+    vk::DeviceSize getAliasCapacity( const std::string& group );
+
     vk::ImageView createImageView( std::string name, vk::Image image,
                                    vk::Format format,
                                    vk::ImageAspectFlagBits aspectFlagBits );
 
+    //Host pointer to the start of a host visible buffer/image
+    //Memory is persistently mapped, there is no unmap
+    void* getMapping( std::variant<vk::Buffer, vk::Image> buffer );
+
+    //The memory a buffer/image is bound to, and where in it
+    //Resources are sub-allocated, the memory is shared with others - only
+    //touch the resource's own range. Host visible memory is already mapped,
+    //mapping it again is invalid, use getMapping()
     vk::DeviceMemory getMemory( std::variant<vk::Buffer, vk::Image> buffer );
+    vk::DeviceSize getMemoryOffset(
+        std::variant<vk::Buffer, vk::Image> buffer );
     uint64_t getDeviceAddress( VkBuffer buffer );
 
     void free( std::variant<vk::Buffer, vk::Image> buffer );
 
+    //Moves buffers out of the emptiest block of each pool, and frees the block
+    //Returns old -> new handles, the caller must re-point descriptors etc.
+    //Only device local buffers move - mapped memory and blocks holding images
+    //are left alone, so pointers from getMapping() stay valid
+    std::map<vk::Buffer, vk::Buffer> defragment();
+
+    void printStats();
+
+    Uploader& getUploader();
+
     void destroy();
 
    private:
@@ -51,21 +96,95 @@ class MemoryMgr
 
     MemoryMgr( const MemoryMgr& ) = delete;
 
+    /*
+    * One vk::DeviceMemory per resource runs into maxMemoryAllocationCount
+    * Instead, allocate large blocks and sub-allocate from them
+    * Each pool has blocks of one memory type, and holds either linear
+    *   resources (buffers, linear images) or optimal images, never both,
+    *   so bufferImageGranularity never has to be considered
+    * Very large resources, or ones the driver wants, get dedicated memory
+    */
+
+    struct MemoryBlock
+    {
+        MemoryBlock( vk::DeviceMemory memory, vk::DeviceSize size,
+                     void* mapped )
+            : memory( memory ), mapped( mapped ), allocator( size )
+        {
+        }
+        vk::DeviceMemory memory;
+        void* mapped;
+        BlockAllocator allocator;
+    };
+
+    struct Allocation
+    {
+        vk::DeviceMemory memory;
+        vk::DeviceSize offset;
+        vk::DeviceSize size;
+        vk::DeviceSize alignment;
+        uint32_t memoryType;
+        bool optimalImage;
+        MemoryBlock* block;  // nullptr for dedicated allocations
+        void* mapped;        // nullptr if not host visible
+        std::string name;
+        vk::BufferCreateInfo bufferInfo;  // to re-create buffers when moved
+        std::string aliasGroup;           // empty if not aliased
+    };
+
+    struct AliasGroup
+    {
+        vk::DeviceMemory memory;
+        vk::DeviceSize size;
+        uint32_t memoryType;
+        uint32_t members;
+        vk::DeviceSize live;  // memory the members would need on their own
+    };
+
+    //what a group would have needed at its peak, separate and shared
+    //kept after the group's memory is gone, for printStats()
+    struct AliasStats
+    {
+        vk::DeviceSize peakSeparate = 0;
+        vk::DeviceSize peakShared = 0;
+    };
+
+    // memory type, optimal image
+    using PoolKey = std::pair<uint32_t, bool>;
+
     // Creates a buffer on the GPU
-    std::pair<vk::Buffer, vk::DeviceMemory> createBuffer(
-        vk::DeviceSize size, vk::BufferUsageFlags usage,
-        vk::MemoryPropertyFlags properties );
+    vk::Buffer createBuffer( std::string name, vk::DeviceSize size,
+                             vk::BufferUsageFlags usage,
+                             vk::MemoryPropertyFlags properties );
 
-    uint64_t getBufferDeviceAddress( VkBuffer buffer );
+    void init();
+
+    Allocation allocate( std::string name,
+                         std::variant<vk::Buffer, vk::Image> object,
+                         vk::MemoryPropertyFlags properties,
+                         bool optimalImage );
+
+    Allocation allocateDedicated( std::string name,
+                                  std::variant<vk::Buffer, vk::Image> object,
+                                  vk::MemoryRequirements memRequirements,
+                                  uint32_t memoryType );
 
-    void copyBuffer( vk::Buffer srcBuffer, vk::Buffer dstBuffer,
-                     vk::DeviceSize size );
+    MemoryBlock* createBlock( uint32_t memoryType, vk::DeviceSize size );
+    void releaseAllocation( Allocation& alloc );
+    vk::DeviceSize getBlockSize( uint32_t memoryType );
+
+    uint64_t getBufferDeviceAddress( VkBuffer buffer );
 
-    std::map<std::variant<vk::Buffer, vk::Image>, vk::DeviceMemory> m_alloc;
+    std::map<std::variant<vk::Buffer, vk::Image>, Allocation> m_alloc;
+    std::map<PoolKey, std::vector<std::unique_ptr<MemoryBlock> > > m_pools;
     std::map<vk::Buffer, uint64_t> m_addresses;
     std::map<vk::Image, std::vector<vk::ImageView> > m_imageViews;
+    std::map<std::string, AliasGroup> m_aliasGroups;
+    std::map<std::string, AliasStats> m_aliasStats;
 
     vk::Device m_device;
+    vk::PhysicalDeviceMemoryProperties m_memProperties;
     CommandPool m_copyPool;
+    Uploader m_uploader;
 };
 }  // namespace BR
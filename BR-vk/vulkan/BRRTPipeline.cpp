@@ -21,11 +21,19 @@ void RTPipeline::addShaderGroup( vk::RayTracingShaderGroupTypeKHR type,
     m_shaderGroups.push_back( shaderGroup );
 }
 
-void RTPipeline::build( std::string name, vk::DescriptorSetLayout layout )
+void RTPipeline::build( std::string name, vk::DescriptorSetLayout layout,
+                        uint32_t pushConstantSize )
 {
+    vk::PushConstantRange pushConstantRange;
+    pushConstantRange.stageFlags = vk::ShaderStageFlagBits::eRaygenKHR;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = pushConstantSize;
+
     vk::PipelineLayoutCreateInfo pipelineLayoutInfo{};
     pipelineLayoutInfo.setLayoutCount = 1;
     pipelineLayoutInfo.pSetLayouts = &layout;
+    pipelineLayoutInfo.pushConstantRangeCount = pushConstantSize ? 1 : 0;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
 
     try
     {
@@ -20,7 +20,10 @@ class RTPipeline : public Pipeline
     void addShaderGroup( vk::RayTracingShaderGroupTypeKHR type,
                          uint32_t index );
 
-    void build( std::string name, vk::DescriptorSetLayout layout );
+    //pushConstantSize = 0 -> no push constants, else visible to the raygen
+    //shader
+    void build( std::string name, vk::DescriptorSetLayout layout,
+                uint32_t pushConstantSize = 0 );
 
    private:
     std::vector<vk::RayTracingShaderGroupCreateInfoKHR> m_shaderGroups;
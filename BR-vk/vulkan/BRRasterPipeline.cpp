@@ -3,6 +3,7 @@
 #include <BRScene.h>
 #include <BRUtil.h>
 
+#include <algorithm>
 #include <cassert>
 #include <filesystem>
 #include <iostream>
@@ -10,13 +11,14 @@
 using namespace BR;
 
 void RasterPipeline::addVertexInputInfo(
-    vk::VertexInputBindingDescription& binding,
+    std::vector<vk::VertexInputBindingDescription>& bindings,
     std::vector<vk::VertexInputAttributeDescription>& attributes )
 {
-    m_vertexInputInfo.vertexBindingDescriptionCount = 1;
+    m_vertexInputInfo.vertexBindingDescriptionCount =
+        static_cast<uint32_t>( bindings.size() );
     m_vertexInputInfo.vertexAttributeDescriptionCount =
         static_cast<uint32_t>( attributes.size() );
-    m_vertexInputInfo.pVertexBindingDescriptions = &binding;
+    m_vertexInputInfo.pVertexBindingDescriptions = bindings.data();
     m_vertexInputInfo.pVertexAttributeDescriptions = attributes.data();
 }
 
@@ -99,6 +101,17 @@ void RasterPipeline::addDynamicStates( std::vector<vk::DynamicState> states )
     m_dynamicStates = states;
 }
 
+void RasterPipeline::addPushConstants( vk::ShaderStageFlags stages,
+                                       uint32_t size )
+{
+    //ranges are packed one after another
+    uint32_t offset = 0;
+    for ( auto& range : m_pushConstantRanges )
+        offset = std::max( offset, range.offset + range.size );
+
+    m_pushConstantRanges.emplace_back( stages, offset, size );
+}
+
 void RasterPipeline::build( std::string name, RenderPass& renderpass,
                             vk::DescriptorSetLayout layout )
 {
@@ -107,7 +120,9 @@ void RasterPipeline::build( std::string name, RenderPass& renderpass,
     vk::PipelineLayoutCreateInfo pipelineLayoutInfo = {};
     pipelineLayoutInfo.setLayoutCount = 1;
     pipelineLayoutInfo.pSetLayouts = &layout;
-    pipelineLayoutInfo.pushConstantRangeCount = 0;
+    pipelineLayoutInfo.pushConstantRangeCount =
+        static_cast<uint32_t>( m_pushConstantRanges.size() );
+    pipelineLayoutInfo.pPushConstantRanges = m_pushConstantRanges.data();
 
     try
     {
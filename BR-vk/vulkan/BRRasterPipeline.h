@@ -19,7 +19,7 @@ class RasterPipeline : public Pipeline
     ~RasterPipeline(){};
 
     void addVertexInputInfo(
-        vk::VertexInputBindingDescription& binding,
+        std::vector<vk::VertexInputBindingDescription>& bindings,
         std::vector<vk::VertexInputAttributeDescription>& attributes );
     void addInputAssembly( vk::PrimitiveTopology topology, bool restart );
     void addViewport( vk::Extent2D extent );
@@ -28,6 +28,7 @@ class RasterPipeline : public Pipeline
     void addMultisampling( vk::SampleCountFlagBits samples );
     void addColorBlend();
     void addDynamicStates( std::vector<vk::DynamicState> states );
+    void addPushConstants( vk::ShaderStageFlags stages, uint32_t size );
 
     void build( std::string name, RenderPass& renderpass,
                 vk::DescriptorSetLayout layout );
@@ -42,5 +43,6 @@ class RasterPipeline : public Pipeline
     vk::PipelineColorBlendAttachmentState m_colorBlendAttachment;
     vk::PipelineColorBlendStateCreateInfo m_colorBlend;
     std::vector<vk::DynamicState> m_dynamicStates;
+    std::vector<vk::PushConstantRange> m_pushConstantRanges;
 };
 }  // namespace BR
@@ -163,10 +163,19 @@ void Swapchain::takeScreenshot( CommandPool& pool, int frame )
         vk::MemoryPropertyFlagBits::eHostVisible |
             vk::MemoryPropertyFlagBits::eHostCoherent );
 
-    vk::DeviceMemory dstMem = bufferAlloc.getMemory( dstImage );
 
-    auto cmdBuff =
-        pool.beginOneTimeSubmit( "Screenshot Command Buffer" );
+    //the copy runs on the transfer queue
+    //the swapchain image is owned by the graphics family, so it is released
+    //to the transfer family, copied, and handed back before presenting
+    //same family -> the release/acquire submissions are skipped, and the
+    //barriers below are plain layout transitions
+    uint32_t graphicsFamily = AppState::instance().getFamilyIndex();
+    uint32_t transferFamily = AppState::instance().getTransferFamilyIndex();
+    bool ownership = graphicsFamily != transferFamily;
+
+    CommandPool transferPool;
+    transferPool.create( "Screenshot Transfer Pool",
+                         vk::CommandPoolCreateFlagBits::eTransient, true );
 
     //asking for color
     vk::ImageSubresourceRange range;
@@ -176,6 +185,25 @@ void Swapchain::takeScreenshot( CommandPool& pool, int frame )
     range.baseArrayLayer = 0;
     range.layerCount = 1;
 
+    if ( ownership )
+    {
+        auto releaseBuff = pool.beginOneTimeSubmit( "Screenshot Release" );
+
+        // release: memory read -> ( acquire side )
+        // presentation -> transfer source
+        imageBarrier( releaseBuff, srcImage, range,
+                      vk::AccessFlagBits::eMemoryRead,
+                      vk::AccessFlagBits::eNone,
+                      vk::ImageLayout::ePresentSrcKHR,
+                      vk::ImageLayout::eTransferSrcOptimal, graphicsFamily,
+                      transferFamily );
+
+        pool.endOneTimeSubmit( releaseBuff );
+    }
+
+    auto cmdBuff =
+        transferPool.beginOneTimeSubmit( "Screenshot Command Buffer" );
+
     // none -> transfer write
     // undefined -> optimal transfer destination
     imageBarrier( cmdBuff, dstImage, range, vk::AccessFlagBits::eNone,
@@ -188,7 +216,8 @@ void Swapchain::takeScreenshot( CommandPool& pool, int frame )
     imageBarrier( cmdBuff, srcImage, range, vk::AccessFlagBits::eMemoryRead,
                   vk::AccessFlagBits::eTransferRead,
                   vk::ImageLayout::ePresentSrcKHR,
-                  vk::ImageLayout::eTransferSrcOptimal );
+                  vk::ImageLayout::eTransferSrcOptimal, graphicsFamily,
+                  transferFamily );
 
     //copy the color, width*height data
     vk::ImageCopy imageCopy;
@@ -216,18 +245,34 @@ void Swapchain::takeScreenshot( CommandPool& pool, int frame )
     imageBarrier( cmdBuff, srcImage, range, vk::AccessFlagBits::eTransferRead,
                   vk::AccessFlagBits::eMemoryRead,
                   vk::ImageLayout::eTransferSrcOptimal,
-                  vk::ImageLayout::ePresentSrcKHR );
+                  vk::ImageLayout::ePresentSrcKHR, transferFamily,
+                  graphicsFamily );
+
+    transferPool.endOneTimeSubmit( cmdBuff );
+    transferPool.destroy();
+
+    if ( ownership )
+    {
+        auto acquireBuff = pool.beginOneTimeSubmit( "Screenshot Acquire" );
+
+        // acquire: ( release side ) -> memory read
+        // transfer source -> presentation
+        imageBarrier( acquireBuff, srcImage, range, vk::AccessFlagBits::eNone,
+                      vk::AccessFlagBits::eMemoryRead,
+                      vk::ImageLayout::eTransferSrcOptimal,
+                      vk::ImageLayout::ePresentSrcKHR, transferFamily,
+                      graphicsFamily );
 
-    pool.endOneTimeSubmit( cmdBuff );
+        pool.endOneTimeSubmit( acquireBuff );
+    }
 
     //get layout
     vk::ImageSubresource subResource( vk::ImageAspectFlagBits::eColor, 0, 0 );
     auto subResourceLayout =
         m_device.getImageSubresourceLayout( dstImage, subResource );
 
-    //map image to host memory
-    const char* data =
-        (const char*)m_device.mapMemory( dstMem, 0, VK_WHOLE_SIZE );
+    //image memory is persistently mapped by the memory manager
+    const char* data = (const char*)bufferAlloc.getMapping( dstImage );
 
     data += subResourceLayout.offset;
 
@@ -298,7 +343,6 @@ void Swapchain::takeScreenshot( CommandPool& pool, int frame )
 
     assert( error == 0 );
 
-    m_device.unmapMemory( dstMem );
     bufferAlloc.free( dstImage );
 }
 
@@ -0,0 +1,346 @@
+#include <BRAppState.h>
+#include <BRUploader.h>
+#include <BRUtil.h>
+
+#include <algorithm>
+#include <cassert>
+#include <limits>
+
+using namespace BR;
+
+// Size of the staging ring
+const vk::DeviceSize RING_SIZE = 64ull * 1024 * 1024;
+
+// Copies start at this alignment inside the ring
+const vk::DeviceSize RING_ALIGNMENT = 16;
+
+Uploader::Uploader()
+    : m_device( nullptr ),
+      m_transferFamily( 0 ),
+      m_graphicsFamily( 0 ),
+      m_ring( nullptr ),
+      m_uploading( nullptr ),
+      m_ringData( nullptr ),
+      m_ringSize( RING_SIZE ),
+      m_head( 0 ),
+      m_tail( 0 ),
+      m_submitted( 0 ),
+      m_completed( 0 )
+{
+}
+
+Uploader::~Uploader()
+{
+    assert( m_inFlight.empty() && m_pending.empty() );
+}
+
+void Uploader::create()
+{
+    m_device = AppState::instance().getLogicalDevice();
+    m_transferFamily = AppState::instance().getTransferFamilyIndex();
+    m_graphicsFamily = AppState::instance().getFamilyIndex();
+
+    m_pool.create( "Upload Pool",
+                   vk::CommandPoolCreateFlagBits::eResetCommandBuffer, true );
+
+    if ( m_transferFamily != m_graphicsFamily )
+    {
+        m_acquirePool.create(
+            "Upload Acquire Pool",
+            vk::CommandPoolCreateFlagBits::eResetCommandBuffer );
+    }
+
+    auto& alloc = AppState::instance().getMemoryMgr();
+
+    m_ring = alloc.createDeviceBuffer( "Staging Ring", m_ringSize, nullptr,
+                                       true,
+                                       vk::BufferUsageFlagBits::eTransferSrc );
+    m_ringData = static_cast<char*>( alloc.getMapping( m_ring ) );
+}
+
+Uploader::Ticket Uploader::upload( vk::Buffer dst, vk::DeviceSize dstOffset,
+                                   const void* data, vk::DeviceSize size )
+{
+    assert( m_ring );
+
+    //split up anything that can't fit in half the ring
+    const vk::DeviceSize maxChunk = m_ringSize / 2;
+
+    const char* src = static_cast<const char*>( data );
+
+    //allocateRing() may flush the chunks so far, the destination has to stay
+    //with the transfer family for the rest
+    m_uploading = dst;
+
+    for ( vk::DeviceSize done = 0; done < size; )
+    {
+        auto chunk = std::min( size - done, maxChunk );
+        auto srcOffset = allocateRing( chunk );
+
+        memcpy( m_ringData + srcOffset, src + done, chunk );
+
+        m_pending.push_back( { dst, dstOffset + done, srcOffset, chunk } );
+
+        done += chunk;
+    }
+
+    m_uploading = nullptr;
+
+    //the batch these copies will be submitted in
+    return m_submitted + 1;
+}
+
+vk::DeviceSize Uploader::allocateRing( vk::DeviceSize size )
+{
+    size = ( size + RING_ALIGNMENT - 1 ) & ~( RING_ALIGNMENT - 1 );
+
+    while ( true )
+    {
+        auto offset = m_head % m_ringSize;
+
+        //a region can't wrap around, skip to the start of the ring
+        auto padding = offset + size > m_ringSize ? m_ringSize - offset : 0;
+
+        if ( m_head + padding + size - m_tail <= m_ringSize )
+        {
+            m_head += padding + size;
+            return ( offset + padding ) % m_ringSize;
+        }
+
+        //out of space, submit what we have and wait for the oldest batch
+        if ( !m_pending.empty() )
+            flush();
+
+        retireOldest();
+    }
+}
+
+Uploader::Ticket Uploader::flush()
+{
+    if ( m_pending.empty() )
+        return m_submitted;
+
+    Batch batch;
+    batch.ticket = ++m_submitted;
+    batch.ringEnd = m_head;
+    batch.commandBuffer = m_pool.createBuffer(
+        "Upload batch " + std::to_string( batch.ticket ) );
+
+    if ( m_freeFences.empty() )
+    {
+        batch.fence = AppState::instance().getSyncMgr().createFence(
+            "Upload Fence" );
+    }
+    else
+    {
+        batch.fence = m_freeFences.back();
+        m_freeFences.pop_back();
+    }
+
+    auto result = m_device.resetFences( 1, &batch.fence );
+    checkSuccess( result );
+
+    vk::CommandBufferBeginInfo beginInfo;
+    beginInfo.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+
+    batch.commandBuffer.begin( beginInfo );
+
+    //one copy command per destination, with all its regions
+    std::sort( m_pending.begin(), m_pending.end(),
+               []( const Copy& a, const Copy& b ) { return a.dst < b.dst; } );
+
+    std::vector<vk::BufferCopy> regions;
+
+    for ( size_t i = 0; i < m_pending.size(); ++i )
+    {
+        auto& copy = m_pending[i];
+        regions.emplace_back( copy.srcOffset, copy.dstOffset, copy.size );
+
+        if ( i + 1 == m_pending.size() || m_pending[i + 1].dst != copy.dst )
+        {
+            batch.commandBuffer.copyBuffer( m_ring, copy.dst, regions );
+            regions.clear();
+        }
+    }
+
+    bool ownership = m_transferFamily != m_graphicsFamily;
+
+    if ( ownership )
+    {
+        //release the destinations to the graphics family
+        //transfer write -> ( acquire side )
+        std::vector<vk::BufferMemoryBarrier> barriers;
+
+        for ( size_t i = 0; i < m_pending.size(); ++i )
+        {
+            if ( i > 0 && m_pending[i - 1].dst == m_pending[i].dst )
+                continue;
+
+            //more chunks to come, released with the last one
+            if ( m_pending[i].dst == m_uploading )
+                continue;
+
+            vk::BufferMemoryBarrier barrier;
+            barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+            barrier.srcQueueFamilyIndex = m_transferFamily;
+            barrier.dstQueueFamilyIndex = m_graphicsFamily;
+            barrier.buffer = m_pending[i].dst;
+            barrier.offset = 0;
+            barrier.size = VK_WHOLE_SIZE;
+
+            barriers.push_back( barrier );
+        }
+
+        batch.commandBuffer.pipelineBarrier(
+            vk::PipelineStageFlagBits::eTransfer,
+            vk::PipelineStageFlagBits::eBottomOfPipe, {}, nullptr, barriers,
+            nullptr );
+
+        batch.commandBuffer.end();
+
+        //matching acquire on the graphics queue
+        //( release side ) -> memory read/write
+        for ( auto& barrier : barriers )
+        {
+            barrier.srcAccessMask = vk::AccessFlagBits::eNone;
+            barrier.dstAccessMask = vk::AccessFlagBits::eMemoryRead |
+                                    vk::AccessFlagBits::eMemoryWrite;
+        }
+
+        batch.acquireBuffer = m_acquirePool.createBuffer(
+            "Upload acquire " + std::to_string( batch.ticket ) );
+
+        batch.acquireBuffer.begin( beginInfo );
+        batch.acquireBuffer.pipelineBarrier(
+            vk::PipelineStageFlagBits::eTopOfPipe,
+            vk::PipelineStageFlagBits::eAllCommands, {}, nullptr, barriers,
+            nullptr );
+        batch.acquireBuffer.end();
+
+        if ( m_freeSemaphores.empty() )
+        {
+            batch.semaphore = AppState::instance().getSyncMgr().createSemaphore(
+                "Upload Semaphore" );
+        }
+        else
+        {
+            batch.semaphore = m_freeSemaphores.back();
+            m_freeSemaphores.pop_back();
+        }
+
+        //copies on the transfer queue, signal the graphics side when done
+        vk::SubmitInfo copyInfo;
+        copyInfo.commandBufferCount = 1;
+        copyInfo.pCommandBuffers = &batch.commandBuffer;
+        copyInfo.signalSemaphoreCount = 1;
+        copyInfo.pSignalSemaphores = &batch.semaphore;
+
+        AppState::instance().getTransferQueue().submit( copyInfo );
+
+        //everything submitted to graphics after this is ordered after the
+        //acquire, the frames already in flight keep running meanwhile
+        vk::PipelineStageFlags waitStage =
+            vk::PipelineStageFlagBits::eAllCommands;
+
+        vk::SubmitInfo acquireInfo;
+        acquireInfo.waitSemaphoreCount = 1;
+        acquireInfo.pWaitSemaphores = &batch.semaphore;
+        acquireInfo.pWaitDstStageMask = &waitStage;
+        acquireInfo.commandBufferCount = 1;
+        acquireInfo.pCommandBuffers = &batch.acquireBuffer;
+
+        AppState::instance().getGraphicsQueue().submit( acquireInfo,
+                                                        batch.fence );
+    }
+    else
+    {
+        //same family, a memory barrier is enough
+        //transfer write -> memory read/write
+        vk::MemoryBarrier barrier;
+        barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+        barrier.dstAccessMask =
+            vk::AccessFlagBits::eMemoryRead | vk::AccessFlagBits::eMemoryWrite;
+
+        batch.commandBuffer.pipelineBarrier(
+            vk::PipelineStageFlagBits::eTransfer,
+            vk::PipelineStageFlagBits::eAllCommands, {}, barrier, nullptr,
+            nullptr );
+
+        batch.commandBuffer.end();
+
+        vk::SubmitInfo submitInfo;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &batch.commandBuffer;
+
+        AppState::instance().getTransferQueue().submit( submitInfo,
+                                                        batch.fence );
+    }
+
+    m_inFlight.push_back( batch );
+    m_pending.clear();
+
+    return batch.ticket;
+}
+
+void Uploader::retireOldest()
+{
+    assert( !m_inFlight.empty() );
+
+    auto& batch = m_inFlight.front();
+
+    auto result = m_device.waitForFences(
+        1, &batch.fence, VK_TRUE, std::numeric_limits<uint64_t>::max() );
+    checkSuccess( result );
+
+    m_pool.freeBuffer( batch.commandBuffer );
+    m_freeFences.push_back( batch.fence );
+
+    if ( batch.acquireBuffer )
+    {
+        m_acquirePool.freeBuffer( batch.acquireBuffer );
+        m_freeSemaphores.push_back( batch.semaphore );
+    }
+
+    m_tail = batch.ringEnd;
+    m_completed = batch.ticket;
+
+    m_inFlight.pop_front();
+}
+
+void Uploader::retireCompleted()
+{
+    while ( !m_inFlight.empty() &&
+            m_device.getFenceStatus( m_inFlight.front().fence ) ==
+                vk::Result::eSuccess )
+        retireOldest();
+}
+
+void Uploader::wait( Ticket ticket )
+{
+    if ( ticket > m_submitted )
+        flush();
+
+    while ( m_completed < ticket && !m_inFlight.empty() )
+        retireOldest();
+}
+
+bool Uploader::isDone( Ticket ticket )
+{
+    retireCompleted();
+    return m_completed >= ticket;
+}
+
+void Uploader::destroy()
+{
+    //the device is idle by now, no need to wait on the fences
+    m_pool.destroy();
+
+    if ( m_transferFamily != m_graphicsFamily )
+        m_acquirePool.destroy();
+
+    m_pending.clear();
+    m_inFlight.clear();
+    m_freeFences.clear();
+    m_freeSemaphores.clear();
+    m_ring = nullptr;
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <BRCommandPool.h>
+
+#include <deque>
+#include <vector>
+#include <vulkan/vulkan_handles.hpp>
+
+namespace BR
+{
+/*
+
+Batched uploads to device local memory
+
+* One persistently mapped staging buffer, used as a ring
+* upload() memcpys the data into the ring and queues a copy
+* flush() records all the queued copies into one command buffer, and submits
+    it with a fence - one submission instead of one per buffer
+* Every upload gets a ticket ( the batch number ), which can be waited on
+* When the ring is full, the oldest batch is waited on and its space reused
+* Uploads bigger than the ring are split up, their chunks can end up in
+    different batches
+* Copies run on the transfer queue, so they overlap rendering on the graphics
+    queue. When the transfer family is a separate one, the batch releases the
+    destination buffers to the graphics family, and a small command buffer on
+    the graphics queue acquires them ( waits on a semaphore from the copies )
+    * Destinations are expected to be freshly created buffers, that the
+        graphics queue hasn't used yet
+    * A split upload stays with the transfer family until its last chunk,
+        only the batch with the last chunk releases the destination
+
+*/
+
+class Uploader
+{
+   public:
+    using Ticket = uint64_t;
+
+    Uploader();
+    ~Uploader();
+
+    void create();
+    void destroy();
+
+    Ticket upload( vk::Buffer dst, vk::DeviceSize dstOffset, const void* data,
+                   vk::DeviceSize size );
+
+    //submit the queued copies, returns the ticket of the submitted batch
+    Ticket flush();
+
+    //flushes if needed, then blocks until the ticket's batch is done
+    void wait( Ticket ticket );
+    bool isDone( Ticket ticket );
+
+   private:
+    struct Copy
+    {
+        vk::Buffer dst;
+        vk::DeviceSize dstOffset;
+        vk::DeviceSize srcOffset;
+        vk::DeviceSize size;
+    };
+
+    struct Batch
+    {
+        Ticket ticket;
+        vk::CommandBuffer commandBuffer;
+        //queue family ownership acquire, null if the families are the same
+        vk::CommandBuffer acquireBuffer;
+        vk::Semaphore semaphore;
+        vk::Fence fence;
+        uint64_t ringEnd;
+    };
+
+    vk::DeviceSize allocateRing( vk::DeviceSize size );
+    void retireOldest();
+    void retireCompleted();
+
+    vk::Device m_device;
+    CommandPool m_pool;
+    CommandPool m_acquirePool;
+
+    uint32_t m_transferFamily;
+    uint32_t m_graphicsFamily;
+
+    vk::Buffer m_ring;
+    char* m_ringData;
+    vk::DeviceSize m_ringSize;
+
+    //monotonic positions, offset into the ring is position % size
+    uint64_t m_head;
+    uint64_t m_tail;
+
+    std::vector<Copy> m_pending;
+
+    //the destination upload() is splitting, not released by a flush while
+    //it has chunks to go
+    vk::Buffer m_uploading;
+    std::deque<Batch> m_inFlight;
+    std::vector<vk::Fence> m_freeFences;
+    std::vector<vk::Semaphore> m_freeSemaphores;
+
+    Ticket m_submitted;
+    Ticket m_completed;
+};
+}  // namespace BR
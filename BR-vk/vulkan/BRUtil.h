@@ -44,15 +44,17 @@ inline void imageBarrier( vk::CommandBuffer commandBuffer, vk::Image image,
                           vk::ImageSubresourceRange& subresourceRange,
                           vk::AccessFlags srcAccessMask,
                           vk::AccessFlags dstAccessMask,
-                          vk::ImageLayout oldLayout, vk::ImageLayout newLayout )
+                          vk::ImageLayout oldLayout, vk::ImageLayout newLayout,
+                          uint32_t srcQueueFamily = VK_QUEUE_FAMILY_IGNORED,
+                          uint32_t dstQueueFamily = VK_QUEUE_FAMILY_IGNORED )
 {
     vk::ImageMemoryBarrier imageMemoryBarrier;
     imageMemoryBarrier.srcAccessMask = srcAccessMask;
     imageMemoryBarrier.dstAccessMask = dstAccessMask;
     imageMemoryBarrier.oldLayout = oldLayout;
     imageMemoryBarrier.newLayout = newLayout;
-    imageMemoryBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    imageMemoryBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    imageMemoryBarrier.srcQueueFamilyIndex = srcQueueFamily;
+    imageMemoryBarrier.dstQueueFamilyIndex = dstQueueFamily;
     imageMemoryBarrier.image = image;
     imageMemoryBarrier.subresourceRange = subresourceRange;
 